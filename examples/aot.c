@@ -0,0 +1,270 @@
+/*
+MIT License
+
+expr -- A simple expressions parser.
+<https://github.com/torrentg/expr>
+
+Copyright (c) 2024 Gerard Torrent <gerard@generacio.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "expr.h"
+
+/**
+ * Ahead-of-time compiler of rules.
+ * 
+ * Usage:
+ *   aot rules.txt > rules.c        generates the C code
+ *   aot -c rules.txt librules.so   checks the shared object against the interpreter
+ *                                  (requires building with -DWITH_DLOPEN -ldl)
+ * 
+ * Each line of the rules file is 'name = formula' (see rules.txt). 
+ * The generated code includes expr.c and exports the rules table 
+ * loaded by yy_load_rules(). Build it as a shared object:
+ *   cc -O3 -shared -fPIC -Isrc -o librules.so rules.c -lm
+ * 
+ * Check mode resolves the variables using a fixed set of values.
+ */
+
+#define MAX_RULES 1024
+#define MAX_LINE_LEN 4096
+#define MAX_CODE_LEN (256 * 1024)
+#define UNUSED(x) (void)(x)
+
+typedef struct rule_t
+{
+    char *name;             // rule name
+    char *formula;          // formula
+} rule_t;
+
+static rule_t rules[MAX_RULES] = {0};
+static int num_rules = 0;
+
+static char * trim(char *str)
+{
+    char *end = str + strlen(str);
+
+    while (isspace((unsigned char) *str))
+        str++;
+
+    while (end > str && isspace((unsigned char) end[-1]))
+        *--end = 0;
+
+    return str;
+}
+
+static int read_rules(const char *filename)
+{
+    char line[MAX_LINE_LEN] = {0};
+    int num_line = 0;
+    FILE *file = fopen(filename, "r");
+
+    if (!file) {
+        fprintf(stderr, "error: cannot open file '%s'\n", filename);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file))
+    {
+        char *str = trim(line);
+        char *eq = strchr(str, '=');
+
+        num_line++;
+
+        if (*str == 0 || *str == '#')
+            continue;
+
+        if (!eq || num_rules >= MAX_RULES) {
+            fprintf(stderr, "error: invalid rule at line %d\n", num_line);
+            fclose(file);
+            return -1;
+        }
+
+        *eq = 0;
+        rules[num_rules].name = strdup(trim(str));
+        rules[num_rules].formula = strdup(trim(eq + 1));
+        num_rules++;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static int generate(void)
+{
+    static char code[MAX_CODE_LEN];
+    static yy_token_t data[1024];
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    char fname[MAX_LINE_LEN + 8] = {0};
+
+    printf("// Generated by aot, do not edit\n");
+    printf("#include \"expr.c\"\n");
+
+    for (int i = 0; i < num_rules; i++)
+    {
+        const char *formula = rules[i].formula;
+        const char *err = NULL;
+        yy_error_e rc = YY_OK;
+
+        snprintf(fname, sizeof(fname), "rule_%s", rules[i].name);
+
+        if ((rc = yy_compile(formula, formula + strlen(formula), &stack, &err)) != YY_OK) {
+            fprintf(stderr, "error: rule '%s' has a syntax error at position %d\n", rules[i].name, (int)(err - formula));
+            return -1;
+        }
+
+        if ((rc = yy_generate_c(&stack, fname, code, sizeof(code))) != YY_OK) {
+            fprintf(stderr, "error: rule '%s' can not be generated (error=%d)\n", rules[i].name, (int) rc);
+            return -1;
+        }
+
+        printf("\n// %s = %s\n", rules[i].name, formula);
+        printf("%s", code);
+    }
+
+    printf("\n");
+    printf("const yy_rule_t yy_rules[] = {\n");
+
+    for (int i = 0; i < num_rules; i++)
+        printf("    { \"%s\", rule_%s },\n", rules[i].name, rules[i].name);
+
+    printf("};\n");
+    printf("\n");
+    printf("const uint32_t yy_num_rules = %d;\n", num_rules);
+
+    return 0;
+}
+
+static yy_token_t resolve(yy_str_t var, void *data)
+{
+    UNUSED(data);
+
+    if (var.len == 5 && strncmp(var.ptr, "price", 5) == 0)
+        return (yy_token_t){.type = YY_TOKEN_NUMBER, .number_val = 19.5};
+    if (var.len == 3 && strncmp(var.ptr, "qty", 3) == 0)
+        return (yy_token_t){.type = YY_TOKEN_NUMBER, .number_val = 3};
+    if (var.len == 8 && strncmp(var.ptr, "discount", 8) == 0)
+        return (yy_token_t){.type = YY_TOKEN_NUMBER, .number_val = 0.15};
+    if (var.len == 3 && strncmp(var.ptr, "vip", 3) == 0)
+        return (yy_token_t){.type = YY_TOKEN_BOOL, .bool_val = true};
+    if (var.len == 7 && strncmp(var.ptr, "country", 7) == 0)
+        return (yy_token_t){.type = YY_TOKEN_STRING, .str_val = {.ptr = "es", .len = 2}};
+
+    return (yy_token_t){.type = YY_TOKEN_ERROR, .error = YY_ERROR_REF};
+}
+
+static bool equals(yy_token_t x, yy_token_t y)
+{
+    if (x.type != y.type)
+        return false;
+
+    switch (x.type)
+    {
+        case YY_TOKEN_BOOL: return (x.bool_val == y.bool_val);
+        case YY_TOKEN_NUMBER: return (x.number_val == y.number_val || (x.number_val != x.number_val && y.number_val != y.number_val));
+        case YY_TOKEN_DATETIME: return (x.datetime_val == y.datetime_val);
+        case YY_TOKEN_STRING: return (x.str_val.len == y.str_val.len && memcmp(x.str_val.ptr, y.str_val.ptr, x.str_val.len) == 0);
+        case YY_TOKEN_ERROR: return (x.error == y.error);
+        default: return false;
+    }
+}
+
+static void print_token(yy_token_t token)
+{
+    switch (token.type)
+    {
+        case YY_TOKEN_BOOL: printf("%s", (token.bool_val ? "true" : "false")); break;
+        case YY_TOKEN_NUMBER: printf("%g", token.number_val); break;
+        case YY_TOKEN_DATETIME: printf("%llu", (unsigned long long) token.datetime_val); break;
+        case YY_TOKEN_STRING: printf("\"%.*s\"", (int) token.str_val.len, token.str_val.ptr); break;
+        case YY_TOKEN_ERROR: printf("#ERR(%d)", (int) token.error); break;
+        default: printf("?"); break;
+    }
+}
+
+static int check(const char *filename)
+{
+    static yy_token_t data[1024];
+    static yy_token_t data_aux1[1024];
+    static yy_token_t data_aux2[1024];
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_stack_t aux1 = {data_aux1, sizeof(data_aux1)/sizeof(data_aux1[0]), 0};
+    yy_stack_t aux2 = {data_aux2, sizeof(data_aux2)/sizeof(data_aux2[0]), 0};
+    yy_rules_t loaded = {0};
+    int num_errors = 0;
+
+    if (yy_load_rules(filename, &loaded) != YY_OK) {
+        fprintf(stderr, "error: cannot load rules from '%s'\n", filename);
+        return -1;
+    }
+
+    for (int i = 0; i < num_rules; i++)
+    {
+        const char *formula = rules[i].formula;
+        const yy_rule_t *rule = yy_find_rule(&loaded, rules[i].name);
+
+        if (!rule || yy_compile(formula, formula + strlen(formula), &stack, NULL) != YY_OK) {
+            printf("%s = missing\n", rules[i].name);
+            num_errors++;
+            continue;
+        }
+
+        yy_token_t expected = yy_eval_stack(&stack, &aux1, resolve, NULL);
+        yy_token_t result = rule->eval(&aux2, resolve, NULL);
+
+        printf("%s = ", rules[i].name);
+        print_token(result);
+        printf(" [%s]\n", (equals(result, expected) ? "OK" : "DISTINCT"));
+
+        num_errors += !equals(result, expected);
+    }
+
+    yy_unload_rules(&loaded);
+
+    return (num_errors ? -1 : 0);
+}
+
+int main(int argc, char *argv[])
+{
+    bool check_mode = (argc == 4 && strcmp(argv[1], "-c") == 0);
+    int rc = 0;
+
+    if (argc != 2 && !check_mode) {
+        fprintf(stderr, "usage: %s rules.txt > rules.c\n", argv[0]);
+        fprintf(stderr, "       %s -c rules.txt librules.so\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (read_rules(argv[check_mode ? 2 : 1]) != 0)
+        return EXIT_FAILURE;
+
+    rc = (check_mode ? check(argv[3]) : generate());
+
+    for (int i = 0; i < num_rules; i++) {
+        free(rules[i].name);
+        free(rules[i].formula);
+    }
+
+    return (rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -29,6 +29,7 @@ SOFTWARE.
 #include <time.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <ctype.h>
 #include <stddef.h>
 #include <assert.h>
@@ -58,6 +59,73 @@ SOFTWARE.
     #define unlikely(x)   x
 #endif
 
+#if defined(__AVX__)
+    #include <immintrin.h>
+    #define VEC_LEN              4
+    typedef __m256d              yy_vec_t;
+    #define vec_load(p)          _mm256_loadu_pd(p)
+    #define vec_store(p, a)      _mm256_storeu_pd(p, a)
+    #define vec_set1(x)          _mm256_set1_pd(x)
+    #define vec_add(a, b)        _mm256_add_pd(a, b)
+    #define vec_sub(a, b)        _mm256_sub_pd(a, b)
+    #define vec_mul(a, b)        _mm256_mul_pd(a, b)
+    #define vec_div(a, b)        _mm256_div_pd(a, b)
+    #define vec_sqrt(a)          _mm256_sqrt_pd(a)
+    #define vec_and(a, b)        _mm256_and_pd(a, b)
+    #define vec_or(a, b)         _mm256_or_pd(a, b)
+    #define vec_xor(a, b)        _mm256_xor_pd(a, b)
+    #define vec_andnot(a, b)     _mm256_andnot_pd(a, b)
+    #define vec_lt(a, b)         _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+    #define vec_le(a, b)         _mm256_cmp_pd(a, b, _CMP_LE_OQ)
+    #define vec_eq(a, b)         _mm256_cmp_pd(a, b, _CMP_EQ_OQ)
+    #define vec_ne(a, b)         _mm256_cmp_pd(a, b, _CMP_NEQ_UQ)
+    #define vec_unord(a, b)      _mm256_cmp_pd(a, b, _CMP_UNORD_Q)
+    #define vec_select(m, a, b)  _mm256_blendv_pd(b, a, m)
+    #define vec_movemask(m)      _mm256_movemask_pd(m)
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+    #define VEC_LEN              2
+    typedef __m128d              yy_vec_t;
+    #define vec_load(p)          _mm_loadu_pd(p)
+    #define vec_store(p, a)      _mm_storeu_pd(p, a)
+    #define vec_set1(x)          _mm_set1_pd(x)
+    #define vec_add(a, b)        _mm_add_pd(a, b)
+    #define vec_sub(a, b)        _mm_sub_pd(a, b)
+    #define vec_mul(a, b)        _mm_mul_pd(a, b)
+    #define vec_div(a, b)        _mm_div_pd(a, b)
+    #define vec_sqrt(a)          _mm_sqrt_pd(a)
+    #define vec_and(a, b)        _mm_and_pd(a, b)
+    #define vec_or(a, b)         _mm_or_pd(a, b)
+    #define vec_xor(a, b)        _mm_xor_pd(a, b)
+    #define vec_andnot(a, b)     _mm_andnot_pd(a, b)
+    #define vec_lt(a, b)         _mm_cmplt_pd(a, b)
+    #define vec_le(a, b)         _mm_cmple_pd(a, b)
+    #define vec_eq(a, b)         _mm_cmpeq_pd(a, b)
+    #define vec_ne(a, b)         _mm_cmpneq_pd(a, b)
+    #define vec_unord(a, b)      _mm_cmpunord_pd(a, b)
+    #define vec_select(m, a, b)  _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b))
+    #define vec_movemask(m)      _mm_movemask_pd(m)
+#endif
+
+// Native code generation (see yy_compile_jit), define NO_JIT to disable it
+#if defined(__x86_64__) && (defined(__linux__) || defined(__FreeBSD__)) && !defined(NO_JIT)
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #define USE_JIT
+#endif
+
+// Loadable rules (see yy_load_rules), define WITH_DLOPEN (and link with -ldl) to enable it
+#if (defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__)) && defined(WITH_DLOPEN)
+    #include <dlfcn.h>
+    #define USE_DLOPEN
+#endif
+
+// Cache locking (see yy_eval_cached), define WITH_THREADS (and link with -pthread) to enable it
+#if (defined(__unix__) || defined(__APPLE__)) && defined(WITH_THREADS)
+    #include <pthread.h>
+    #define USE_THREADS
+#endif
+
 #if defined __has_attribute
     #if __has_attribute(__fallthrough__)
         # define fallthrough   __attribute__((__fallthrough__))
@@ -78,6 +146,7 @@ SOFTWARE.
 #define MIN(a, b)       (((a)<(b))?(a):(b))
 #define MAX(a, b)       (((a)>(b))?(a):(b))
 #define CLAMP(x, a, b)  (((x)<(a))?(a):(((b)<(x))?(b):(x)))
+#define UNUSED(x)       (void)(x)
 
 #ifndef M_E
     #define M_E     2.7182818284590452354
@@ -89,6 +158,9 @@ SOFTWARE.
 
 #define MAX_RECURSION_TYPE         100
 #define MAX_RECURSION_GENERIC        9
+#define MAX_ANALYSIS_DEPTH         256
+#define MAX_SHARE_TOKENS          1024
+#define MAX_POWI_EXP                 8
 
 #define make_string(ptr_, len_)    (yy_str_t){.ptr = (ptr_), .len = (uint32_t)(len_)}
 #define token_error(err_)          (yy_token_t){ .error = (err_)                    , .type = YY_TOKEN_ERROR    }
@@ -97,6 +169,8 @@ SOFTWARE.
 #define token_datetime(val_)       (yy_token_t){ .datetime_val = (val_)             , .type = YY_TOKEN_DATETIME }
 #define token_string(ptr_, len_)   (yy_token_t){ .str_val = make_string(ptr_, len_) , .type = YY_TOKEN_STRING   }
 #define token_variable(ptr_, len_) (yy_token_t){ .str_val = make_string(ptr_, len_) , .type = YY_TOKEN_VARIABLE }
+#define token_jump(opcode_, off_)  (yy_token_t){ .jump = { .offset = (off_), .opcode = (opcode_) }, .type = YY_TOKEN_JUMP }
+#define token_temp(idx_)           (yy_token_t){ .temp = (idx_)                     , .type = YY_TOKEN_TEMP     }
 
 typedef enum yy_symbol_e
 {
@@ -172,6 +246,98 @@ typedef enum yy_symbol_e
     YY_SYMBOL_END,                  //!< No more symbols (maintain at the end of list)
 } yy_symbol_e;
 
+/**
+ * Opcodes used by the evaluator.
+ * 
+ * Values and errors share the yy_token_e value. Functions having an 
+ * specific opcode are evaluated inline, the remaining ones are called 
+ * using the function pointer (YY_OPCODE_CALL).
+ * 
+ * Typed opcodes (ex. YY_OPCODE_LT_STR) are assigned after compilation 
+ * when the argument types are known (see specialize_stack()). They check 
+ * the argument types once and call the function on mismatch (ex. a 
+ * variable with an unexpected value or an error).
+ * 
+ * Jump opcodes are carried by YY_TOKEN_JUMP tokens, assigned after 
+ * compilation to skip the untaken operands of ifelse, && and || 
+ * (see add_jumps()). Frame and store opcodes are carried by the same 
+ * token type (see share_subexprs()). Fused opcodes (superinstructions) 
+ * are carried by a jump token preceding a binary operator with two 
+ * loaded operands (see fuse_stack()).
+ */
+typedef enum yy_opcode_e
+{
+    YY_OPCODE_NULL = YY_TOKEN_NULL,         //!< Unassigned token.
+    YY_OPCODE_BOOL = YY_TOKEN_BOOL,         //!< Push bool value.
+    YY_OPCODE_NUMBER = YY_TOKEN_NUMBER,     //!< Push number value.
+    YY_OPCODE_DATETIME = YY_TOKEN_DATETIME, //!< Push datetime value.
+    YY_OPCODE_STRING = YY_TOKEN_STRING,     //!< Push string value.
+    YY_OPCODE_VARIABLE = YY_TOKEN_VARIABLE, //!< Push resolved variable.
+    YY_OPCODE_CALL = YY_TOKEN_FUNCTION,     //!< Function call.
+    YY_OPCODE_ERROR = YY_TOKEN_ERROR,       //!< Push error.
+    YY_OPCODE_SLOT = YY_TOKEN_SLOT,         //!< Push slot value.
+    YY_OPCODE_TEMP = YY_TOKEN_TEMP,         //!< Push temporary value.
+    YY_OPCODE_AND_OP,                       //!< &&
+    YY_OPCODE_OR_OP,                        //!< ||
+    YY_OPCODE_EQUALS_OP,                    //!< ==
+    YY_OPCODE_DISTINCT_OP,                  //!< !=
+    YY_OPCODE_LESS_OP,                      //!< <
+    YY_OPCODE_LESS_EQUALS_OP,               //!< <=
+    YY_OPCODE_GREAT_OP,                     //!< >
+    YY_OPCODE_GREAT_EQUALS_OP,              //!< >=
+    YY_OPCODE_PLUS_OP,                      //!< + (prefix)
+    YY_OPCODE_MINUS_OP,                     //!< - (prefix)
+    YY_OPCODE_ADDITION_OP,                  //!< + (infix)
+    YY_OPCODE_SUBTRACTION_OP,               //!< - (infix)
+    YY_OPCODE_PRODUCT_OP,                   //!< *
+    YY_OPCODE_DIVIDE_OP,                    //!< /
+    YY_OPCODE_NOT,                          //!< not
+    YY_OPCODE_LT_NUM,                       //!< < (numbers)
+    YY_OPCODE_LT_DATETIME,                  //!< < (datetimes)
+    YY_OPCODE_LT_STR,                       //!< < (strings)
+    YY_OPCODE_LE_NUM,                       //!< <= (numbers)
+    YY_OPCODE_LE_DATETIME,                  //!< <= (datetimes)
+    YY_OPCODE_LE_STR,                       //!< <= (strings)
+    YY_OPCODE_GT_NUM,                       //!< > (numbers)
+    YY_OPCODE_GT_DATETIME,                  //!< > (datetimes)
+    YY_OPCODE_GT_STR,                       //!< > (strings)
+    YY_OPCODE_GE_NUM,                       //!< >= (numbers)
+    YY_OPCODE_GE_DATETIME,                  //!< >= (datetimes)
+    YY_OPCODE_GE_STR,                       //!< >= (strings)
+    YY_OPCODE_EQ_NUM,                       //!< == (numbers)
+    YY_OPCODE_EQ_DATETIME,                  //!< == (datetimes)
+    YY_OPCODE_EQ_STR,                       //!< == (strings)
+    YY_OPCODE_EQ_BOOL,                      //!< == (bools)
+    YY_OPCODE_NE_NUM,                       //!< != (numbers)
+    YY_OPCODE_NE_DATETIME,                  //!< != (datetimes)
+    YY_OPCODE_NE_STR,                       //!< != (strings)
+    YY_OPCODE_NE_BOOL,                      //!< != (bools)
+    YY_OPCODE_MIN_NUM,                      //!< min (numbers)
+    YY_OPCODE_MIN_DATETIME,                 //!< min (datetimes)
+    YY_OPCODE_MAX_NUM,                      //!< max (numbers)
+    YY_OPCODE_MAX_DATETIME,                 //!< max (datetimes)
+    YY_OPCODE_CLAMP_NUM,                    //!< clamp (numbers)
+    YY_OPCODE_CLAMP_DATETIME,               //!< clamp (datetimes)
+    YY_OPCODE_IFELSE,                       //!< ifelse (branch value already selected by jumps)
+    YY_OPCODE_JUMP,                         //!< Unconditional jump
+    YY_OPCODE_JUMP_IFELSE,                  //!< Pop condition, jump to else-branch if false
+    YY_OPCODE_JUMP_AND,                     //!< Jump after && if first operand is false
+    YY_OPCODE_JUMP_OR,                      //!< Jump after || if first operand is true
+    YY_OPCODE_FRAME,                        //!< Reserve temporaries (first token)
+    YY_OPCODE_STORE,                        //!< Copy top value to a temporary
+    YY_OPCODE_FUSED_ADD,                    //!< Load 2 values and add them
+    YY_OPCODE_FUSED_SUB,                    //!< Load 2 values and subtract them
+    YY_OPCODE_FUSED_MUL,                    //!< Load 2 values and multiply them
+    YY_OPCODE_FUSED_DIV,                    //!< Load 2 values and divide them
+    YY_OPCODE_FUSED_LT,                     //!< Load 2 values and compare them (<)
+    YY_OPCODE_FUSED_LE,                     //!< Load 2 values and compare them (<=)
+    YY_OPCODE_FUSED_GT,                     //!< Load 2 values and compare them (>)
+    YY_OPCODE_FUSED_GE,                     //!< Load 2 values and compare them (>=)
+    YY_OPCODE_FUSED_EQ,                     //!< Load 2 values and compare them (==)
+    YY_OPCODE_FUSED_NE,                     //!< Load 2 values and compare them (!=)
+    YY_OPCODE_END,                          //!< No more opcodes (maintain at the end of list)
+} yy_opcode_e;
+
 typedef struct yy_symbol_t
 {
     yy_str_t lexeme;                //!< String representing the symbol.
@@ -228,6 +394,7 @@ static const int days_in_month[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30,
 
 // Forward declarations
 static bool is_temp_ptr(yy_eval_ctx_t *ctx, const char *ptr);
+static int str_cmp(const yy_str_t str1, const yy_str_t str2);
 static void free_str(yy_eval_ctx_t *ctx, yy_str_t *str);
 static yy_token_e parse_expr_generic(yy_parser_t *parser, bool check_bool, bool do_finalize);
 static void parse_expr_datetime(yy_parser_t *parser);
@@ -266,6 +433,9 @@ static yy_token_t func_log(yy_token_t x);
 static yy_token_t func_sqrt(yy_token_t x);
 static yy_token_t func_random(yy_token_t x, yy_token_t y, yy_eval_ctx_t *ctx);
 static yy_token_t func_pow(yy_token_t x, yy_token_t y);
+static yy_token_t func_powi(yy_token_t x, yy_token_t n);
+static double pow_int(double x, int n);
+static yy_token_t func_fma(yy_token_t x, yy_token_t y, yy_token_t z);
 static yy_token_t func_minus(yy_token_t x);
 static yy_token_t func_ident(yy_token_t x);
 static yy_token_t func_addition(yy_token_t x, yy_token_t y);
@@ -345,7 +515,7 @@ const yy_identifier_t yy_identifiers[] =
 
 #define NUM_IDENTIFIERS (sizeof(yy_identifiers)/sizeof(yy_identifiers[0]) - 1)
 
-#define make_func(func_, args_, ...) (yy_func_t){ .ptr = (void (*)(void)) func_, .num_args = args_, __VA_ARGS__ }
+#define make_func(func_, args_, opcode_, ...) (yy_func_t){ .ptr = (void (*)(void)) func_, .num_args = args_, .opcode = opcode_, __VA_ARGS__ }
 
 static const yy_token_t symbol_to_token[] =
 {
@@ -366,60 +536,60 @@ static const yy_token_t symbol_to_token[] =
     // [YY_SYMBOL_PAREN_RIGHT]  = { .type = YY_TOKEN_NULL     },
     // [YY_SYMBOL_COMMA]        = { .type = YY_TOKEN_NULL     },
 
-    [YY_SYMBOL_POWER_OP]        = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_pow        , 2, .precedence = 2) },
-    [YY_SYMBOL_MINUS_OP]        = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_minus      , 1, .precedence = 3, .right_to_left = true) },
-    [YY_SYMBOL_PLUS_OP]         = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_ident      , 1, .precedence = 3, .right_to_left = true) },
-    [YY_SYMBOL_PRODUCT_OP]      = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_mult       , 2, .precedence = 4) },
-    [YY_SYMBOL_DIVIDE_OP]       = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_div        , 2, .precedence = 4) },
-    [YY_SYMBOL_MODULO_OP]       = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_mod        , 2, .precedence = 4) },
-    [YY_SYMBOL_ADDITION_OP]     = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_addition   , 2, .precedence = 5) },
-    [YY_SYMBOL_SUBTRACTION_OP]  = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_subtraction, 2, .precedence = 5) },
-    [YY_SYMBOL_LESS_OP]         = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_lt         , 2, .precedence = 6) },
-    [YY_SYMBOL_LESS_EQUALS_OP]  = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_le         , 2, .precedence = 6) },
-    [YY_SYMBOL_GREAT_OP]        = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_gt         , 2, .precedence = 6) },
-    [YY_SYMBOL_GREAT_EQUALS_OP] = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_ge         , 2, .precedence = 6) },
-    [YY_SYMBOL_EQUALS_OP]       = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_eq         , 2, .precedence = 7) },
-    [YY_SYMBOL_DISTINCT_OP]     = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_ne         , 2, .precedence = 7) },
-    [YY_SYMBOL_AND_OP]          = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_and        , 2, .precedence = 8) },
-    [YY_SYMBOL_OR_OP]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_or         , 2, .precedence = 9) },
-    [YY_SYMBOL_NOT]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_not        , 1) },
-    [YY_SYMBOL_ISINF]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_isinf      , 1) },
-    [YY_SYMBOL_ISNAN]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_isnan      , 1) },
-    [YY_SYMBOL_ISERROR]         = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_iserror    , 1) },
-    [YY_SYMBOL_ABS]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_abs        , 1) },
-    [YY_SYMBOL_MODULO]          = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_mod        , 2) },
-    [YY_SYMBOL_POWER]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_pow        , 2) },
-    [YY_SYMBOL_SQRT]            = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_sqrt       , 1) },
-    [YY_SYMBOL_SIN]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_sin        , 1) },
-    [YY_SYMBOL_COS]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_cos        , 1) },
-    [YY_SYMBOL_TAN]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_tan        , 1) },
-    [YY_SYMBOL_EXP]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_exp        , 1) },
-    [YY_SYMBOL_LOG]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_log        , 1) },
-    [YY_SYMBOL_TRUNC]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_trunc      , 1) },
-    [YY_SYMBOL_CEIL]            = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_ceil       , 1) },
-    [YY_SYMBOL_FLOOR]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_floor      , 1) },
-    [YY_SYMBOL_CLAMP]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_clamp      , 3) },
-    [YY_SYMBOL_RANDOM]          = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_random     , 2, .is_not_pure = true) },
-    [YY_SYMBOL_NOW]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_now        , 0, .is_not_pure = true) },
-    [YY_SYMBOL_DATEPART]        = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_datepart   , 2) },
-    [YY_SYMBOL_DATEDIFF]        = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_datediff   , 3) },
-    [YY_SYMBOL_DATEADD]         = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_dateadd    , 3) },
-    [YY_SYMBOL_DATESET]         = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_dateset    , 3) },
-    [YY_SYMBOL_DATETRUNC]       = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_datetrunc  , 2) },
-    [YY_SYMBOL_LENGTH]          = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_length     , 1) },
-    [YY_SYMBOL_FIND]            = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_find       , 3) },
-    [YY_SYMBOL_STR]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_str        , 1, .is_not_pure = true) },
-    [YY_SYMBOL_LOWER]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_lower      , 1, .is_not_pure = true) },
-    [YY_SYMBOL_UPPER]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_upper      , 1, .is_not_pure = true) },
-    [YY_SYMBOL_TRIM]            = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_trim       , 1, .is_not_pure = true) },
-    [YY_SYMBOL_CONCAT_OP]       = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_concat     , 2, .precedence = 5, .is_not_pure = true) },
-    [YY_SYMBOL_SUBSTR]          = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_substr     , 3, .is_not_pure = true) },
-    [YY_SYMBOL_REPLACE]         = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_replace    , 3, .is_not_pure = true) },
-    [YY_SYMBOL_UNESCAPE]        = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_unescape   , 1, .is_not_pure = true) },
-    [YY_SYMBOL_MIN]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_min        , 2) },
-    [YY_SYMBOL_MAX]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_max        , 2) },
-    [YY_SYMBOL_IFELSE]          = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_ifelse     , 3) },
-    [YY_SYMBOL_VARIABLE_FUNC]   = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_variable   , 1) },
+    [YY_SYMBOL_POWER_OP]        = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_pow        , 2, YY_OPCODE_CALL           , .precedence = 2) },
+    [YY_SYMBOL_MINUS_OP]        = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_minus      , 1, YY_OPCODE_MINUS_OP       , .precedence = 3, .right_to_left = true) },
+    [YY_SYMBOL_PLUS_OP]         = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_ident      , 1, YY_OPCODE_PLUS_OP        , .precedence = 3, .right_to_left = true) },
+    [YY_SYMBOL_PRODUCT_OP]      = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_mult       , 2, YY_OPCODE_PRODUCT_OP     , .precedence = 4) },
+    [YY_SYMBOL_DIVIDE_OP]       = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_div        , 2, YY_OPCODE_DIVIDE_OP      , .precedence = 4) },
+    [YY_SYMBOL_MODULO_OP]       = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_mod        , 2, YY_OPCODE_CALL           , .precedence = 4) },
+    [YY_SYMBOL_ADDITION_OP]     = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_addition   , 2, YY_OPCODE_ADDITION_OP    , .precedence = 5) },
+    [YY_SYMBOL_SUBTRACTION_OP]  = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_subtraction, 2, YY_OPCODE_SUBTRACTION_OP , .precedence = 5) },
+    [YY_SYMBOL_LESS_OP]         = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_lt         , 2, YY_OPCODE_LESS_OP        , .precedence = 6) },
+    [YY_SYMBOL_LESS_EQUALS_OP]  = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_le         , 2, YY_OPCODE_LESS_EQUALS_OP , .precedence = 6) },
+    [YY_SYMBOL_GREAT_OP]        = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_gt         , 2, YY_OPCODE_GREAT_OP       , .precedence = 6) },
+    [YY_SYMBOL_GREAT_EQUALS_OP] = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_ge         , 2, YY_OPCODE_GREAT_EQUALS_OP, .precedence = 6) },
+    [YY_SYMBOL_EQUALS_OP]       = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_eq         , 2, YY_OPCODE_EQUALS_OP      , .precedence = 7) },
+    [YY_SYMBOL_DISTINCT_OP]     = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_ne         , 2, YY_OPCODE_DISTINCT_OP    , .precedence = 7) },
+    [YY_SYMBOL_AND_OP]          = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_and        , 2, YY_OPCODE_AND_OP         , .precedence = 8) },
+    [YY_SYMBOL_OR_OP]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_or         , 2, YY_OPCODE_OR_OP          , .precedence = 9) },
+    [YY_SYMBOL_NOT]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_not        , 1, YY_OPCODE_NOT) },
+    [YY_SYMBOL_ISINF]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_isinf      , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_ISNAN]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_isnan      , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_ISERROR]         = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_iserror    , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_ABS]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_abs        , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_MODULO]          = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_mod        , 2, YY_OPCODE_CALL) },
+    [YY_SYMBOL_POWER]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_pow        , 2, YY_OPCODE_CALL) },
+    [YY_SYMBOL_SQRT]            = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_sqrt       , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_SIN]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_sin        , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_COS]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_cos        , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_TAN]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_tan        , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_EXP]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_exp        , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_LOG]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_log        , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_TRUNC]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_trunc      , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_CEIL]            = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_ceil       , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_FLOOR]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_floor      , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_CLAMP]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_clamp      , 3, YY_OPCODE_CALL) },
+    [YY_SYMBOL_RANDOM]          = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_random     , 2, YY_OPCODE_CALL           , .is_not_pure = true, .needs_ctx = true) },
+    [YY_SYMBOL_NOW]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_now        , 0, YY_OPCODE_CALL           , .is_not_pure = true, .needs_ctx = true) },
+    [YY_SYMBOL_DATEPART]        = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_datepart   , 2, YY_OPCODE_CALL) },
+    [YY_SYMBOL_DATEDIFF]        = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_datediff   , 3, YY_OPCODE_CALL) },
+    [YY_SYMBOL_DATEADD]         = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_dateadd    , 3, YY_OPCODE_CALL) },
+    [YY_SYMBOL_DATESET]         = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_dateset    , 3, YY_OPCODE_CALL) },
+    [YY_SYMBOL_DATETRUNC]       = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_datetrunc  , 2, YY_OPCODE_CALL) },
+    [YY_SYMBOL_LENGTH]          = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_length     , 1, YY_OPCODE_CALL) },
+    [YY_SYMBOL_FIND]            = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_find       , 3, YY_OPCODE_CALL) },
+    [YY_SYMBOL_STR]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_str        , 1, YY_OPCODE_CALL           , .needs_ctx = true) },
+    [YY_SYMBOL_LOWER]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_lower      , 1, YY_OPCODE_CALL           , .needs_ctx = true) },
+    [YY_SYMBOL_UPPER]           = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_upper      , 1, YY_OPCODE_CALL           , .needs_ctx = true) },
+    [YY_SYMBOL_TRIM]            = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_trim       , 1, YY_OPCODE_CALL           , .needs_ctx = true) },
+    [YY_SYMBOL_CONCAT_OP]       = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_concat     , 2, YY_OPCODE_CALL           , .precedence = 5, .needs_ctx = true) },
+    [YY_SYMBOL_SUBSTR]          = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_substr     , 3, YY_OPCODE_CALL           , .needs_ctx = true) },
+    [YY_SYMBOL_REPLACE]         = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_replace    , 3, YY_OPCODE_CALL           , .needs_ctx = true) },
+    [YY_SYMBOL_UNESCAPE]        = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_unescape   , 1, YY_OPCODE_CALL           , .needs_ctx = true) },
+    [YY_SYMBOL_MIN]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_min        , 2, YY_OPCODE_CALL) },
+    [YY_SYMBOL_MAX]             = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_max        , 2, YY_OPCODE_CALL) },
+    [YY_SYMBOL_IFELSE]          = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_ifelse     , 3, YY_OPCODE_CALL) },
+    [YY_SYMBOL_VARIABLE_FUNC]   = { .type = YY_TOKEN_FUNCTION, .function = make_func(func_variable   , 1, YY_OPCODE_CALL) },
     [YY_SYMBOL_END]             = { .type = YY_TOKEN_NULL }
 };
 
@@ -456,6 +626,32 @@ bool is_blocking_error(yy_error_e err)
     }
 }
 
+/**
+ * Minimum of two numbers, ignoring NaN (like fmin). Returns x when
+ * both are equal (ex: min(-0, +0) = -0, min(+0, -0) = +0).
+ * 
+ * fmin() of +0 and -0 depends on whether the compiler inlines it (libm
+ * returns y), so all evaluators use this function to get the same result.
+ */
+INLINE
+static double min_num(double x, double y)
+{
+    if (isnan(x))
+        return y;
+
+    return (y < x ? y : x);
+}
+
+// Maximum of two numbers, ignoring NaN, returns x when equal (see min_num)
+INLINE
+static double max_num(double x, double y)
+{
+    if (isnan(x))
+        return y;
+
+    return (y > x ? y : x);
+}
+
 /**
  * Search the identifier matching the given string
  * using the binary search algo on the yy_identifiers list.
@@ -1190,6 +1386,68 @@ static yy_token_t * get(yy_stack_t *stack, uint32_t idx)
     return (&stack->data[stack->len - 1 - idx]);
 }
 
+/**
+ * Calls a function.
+ * 
+ * @param[in] func Function to call.
+ * @param[in] args Function arguments (num_args values).
+ * @param[in] ctx Eval context (used by functions requiring it).
+ * 
+ * @return Function result.
+ */
+INLINE
+static yy_token_t call_func(yy_func_t func, const yy_token_t *args, yy_eval_ctx_t *ctx)
+{
+    if (!func.ptr) 
+        return token_error(YY_ERROR_EVAL);
+
+    switch (func.num_args + (func.needs_ctx ? 4 : 0))
+    {
+        case 0: return ((yy_func_0) func.ptr)();
+        case 1: return ((yy_func_1) func.ptr)(args[0]);
+        case 2: return ((yy_func_2) func.ptr)(args[0], args[1]);
+        case 3: return ((yy_func_3) func.ptr)(args[0], args[1], args[2]);
+        case 4: return ((yy_func_0_x) func.ptr)(ctx);
+        case 5: return ((yy_func_1_x) func.ptr)(args[0], ctx);
+        case 6: return ((yy_func_2_x) func.ptr)(args[0], args[1], ctx);
+        case 7: return ((yy_func_3_x) func.ptr)(args[0], args[1], args[2], ctx);
+        default: return token_error(YY_ERROR_EVAL);
+    }
+}
+
+/**
+ * Deallocates the temporary memory used by the arguments of a call.
+ * 
+ * Arguments are freed from the last one (the most recent allocation).
+ * The result is preserved, and relocated if required.
+ * 
+ * @param[in] ctx Eval context to use.
+ * @param[in,out] args Function arguments.
+ * @param[in] num_args Number of arguments.
+ * @param[in,out] result Function result.
+ */
+static void free_args(yy_eval_ctx_t *ctx, yy_token_t *args, uint32_t num_args, yy_token_t *result)
+{
+    for (uint32_t j = num_args; j-- > 0; )
+    {
+        yy_token_t *arg = &args[j];
+
+        if (arg->type != YY_TOKEN_STRING || !is_temp_ptr(ctx, arg->str_val.ptr))
+            continue;
+
+        if (result->type == YY_TOKEN_STRING && is_temp_ptr(ctx, result->str_val.ptr))
+        {
+            if (result->str_val.ptr == arg->str_val.ptr)
+                continue;
+
+            if (result->str_val.ptr < arg->str_val.ptr)
+                result->str_val.ptr += arg->str_val.len;
+        }
+
+        free_str(ctx, &arg->str_val);
+    }
+}
+
 /**
  * Try to simplify tokens on the top of the RPN stack.
  * 
@@ -1197,9 +1455,9 @@ static yy_token_t * get(yy_stack_t *stack, uint32_t idx)
  *   - Remove plus operator (ex: +1 -> 1)
  *   - Eval top function if its arguments are fixed values (ex: 1+1 -> 2)
  * 
- * Unsupported simplifications:
- *   - For commutative operators, move fixed values to top (ex: 1+$a+3 -> $a+1+3 -> $a+4)
- *   - Non-pure functions acting as pure on fixed strings (ex. func_trim())
+ * Functions requiring the eval context (ex. func_trim()) and fixed 
+ * values of operator chains are folded once the stack is complete 
+ * (see fold_stack() and reassociate_stack()).
  * 
  * @param[in] stack Stack to simplify.
  * 
@@ -1211,7 +1469,7 @@ static bool simplify_stack(yy_parser_t *parser)
     yy_stack_t *stack = parser->stack;
     yy_token_t *token0 = top_stack(parser);
 
-    if (!token0 || token0->type != YY_TOKEN_FUNCTION || token0->function.is_not_pure)
+    if (!token0 || token0->type != YY_TOKEN_FUNCTION || token0->function.is_not_pure || token0->function.needs_ctx)
         return false;
 
     assert((int)stack->len >= token0->function.num_args + 1);
@@ -1473,1037 +1731,8421 @@ static void expect(yy_parser_t *parser, yy_symbol_e type)
     consume(parser);
 }
 
+typedef struct yy_typed_func_t
+{
+    void (*ptr)(void);              //!< Function.
+    yy_token_e type;                //!< Arguments type.
+    yy_opcode_e opcode;             //!< Typed opcode.
+} yy_typed_func_t;
+
+#define make_typed(func_, type_, opcode_) { (void (*)(void)) func_, type_, opcode_ }
+
+static const yy_typed_func_t typed_funcs[] =
+{
+    make_typed(func_lt,    YY_TOKEN_NUMBER,   YY_OPCODE_LT_NUM),
+    make_typed(func_lt,    YY_TOKEN_DATETIME, YY_OPCODE_LT_DATETIME),
+    make_typed(func_lt,    YY_TOKEN_STRING,   YY_OPCODE_LT_STR),
+    make_typed(func_le,    YY_TOKEN_NUMBER,   YY_OPCODE_LE_NUM),
+    make_typed(func_le,    YY_TOKEN_DATETIME, YY_OPCODE_LE_DATETIME),
+    make_typed(func_le,    YY_TOKEN_STRING,   YY_OPCODE_LE_STR),
+    make_typed(func_gt,    YY_TOKEN_NUMBER,   YY_OPCODE_GT_NUM),
+    make_typed(func_gt,    YY_TOKEN_DATETIME, YY_OPCODE_GT_DATETIME),
+    make_typed(func_gt,    YY_TOKEN_STRING,   YY_OPCODE_GT_STR),
+    make_typed(func_ge,    YY_TOKEN_NUMBER,   YY_OPCODE_GE_NUM),
+    make_typed(func_ge,    YY_TOKEN_DATETIME, YY_OPCODE_GE_DATETIME),
+    make_typed(func_ge,    YY_TOKEN_STRING,   YY_OPCODE_GE_STR),
+    make_typed(func_eq,    YY_TOKEN_NUMBER,   YY_OPCODE_EQ_NUM),
+    make_typed(func_eq,    YY_TOKEN_DATETIME, YY_OPCODE_EQ_DATETIME),
+    make_typed(func_eq,    YY_TOKEN_STRING,   YY_OPCODE_EQ_STR),
+    make_typed(func_eq,    YY_TOKEN_BOOL,     YY_OPCODE_EQ_BOOL),
+    make_typed(func_ne,    YY_TOKEN_NUMBER,   YY_OPCODE_NE_NUM),
+    make_typed(func_ne,    YY_TOKEN_DATETIME, YY_OPCODE_NE_DATETIME),
+    make_typed(func_ne,    YY_TOKEN_STRING,   YY_OPCODE_NE_STR),
+    make_typed(func_ne,    YY_TOKEN_BOOL,     YY_OPCODE_NE_BOOL),
+    make_typed(func_min,   YY_TOKEN_NUMBER,   YY_OPCODE_MIN_NUM),
+    make_typed(func_min,   YY_TOKEN_DATETIME, YY_OPCODE_MIN_DATETIME),
+    make_typed(func_max,   YY_TOKEN_NUMBER,   YY_OPCODE_MAX_NUM),
+    make_typed(func_max,   YY_TOKEN_DATETIME, YY_OPCODE_MAX_DATETIME),
+    make_typed(func_clamp, YY_TOKEN_NUMBER,   YY_OPCODE_CLAMP_NUM),
+    make_typed(func_clamp, YY_TOKEN_DATETIME, YY_OPCODE_CLAMP_DATETIME),
+};
+
 /**
- * Finalize parsing.
+ * Returns the type returned by a function (errors aside).
  * 
- * @param[in] parser Parser to update.
+ * @param[in] func Function.
+ * @param[in] args Arguments types (YY_TOKEN_NULL means unknown).
+ * 
+ * @return The result type, 
+ *         YY_TOKEN_NULL if unknown.
  */
-static void finalize(yy_parser_t *parser)
+static yy_token_e get_func_type(const yy_func_t *func, const yy_token_e *args)
 {
-    if (parser->error != YY_OK)
-        return;
+    #define IS_FUNC(func_) (func->ptr == (void (*)(void)) (func_))
 
-    if (parser->curr_symbol.type == YY_SYMBOL_END)
-        consume(parser);
-    else
-        parser->error = YY_ERROR_SYNTAX;
-}
+    if (IS_FUNC(func_lt) || IS_FUNC(func_le) || IS_FUNC(func_gt) || IS_FUNC(func_ge) || IS_FUNC(func_eq) || IS_FUNC(func_ne) ||
+        IS_FUNC(func_and) || IS_FUNC(func_or) || IS_FUNC(func_not) || IS_FUNC(func_isinf) || IS_FUNC(func_isnan) || IS_FUNC(func_iserror))
+        return YY_TOKEN_BOOL;
 
-static void init_parser(yy_parser_t *parser, const char *begin, const char *end, yy_stack_t *stack)
-{
-    assert(parser);
+    if (IS_FUNC(func_min) || IS_FUNC(func_max) || IS_FUNC(func_clamp))
+        return (args[0] != YY_TOKEN_NULL ? args[0] : args[1]);
 
-    stack->len = 0;
+    if (IS_FUNC(func_ifelse))
+        return (args[1] != YY_TOKEN_NULL ? args[1] : args[2]);
 
-    parser->begin = begin;
-    parser->end = end;
-    parser->curr = begin;
-    parser->stack = stack;
-    parser->operators_len = 0;
-    parser->curr_symbol = (yy_symbol_t){0};
-    parser->prev_symbol = (yy_symbol_t){0};
-    parser->error = (stack && stack->reserved ? YY_OK : YY_ERROR_MEM);
-    parser->recursion_type = 0;
-    parser->recursion_generic = 0;
+    if (IS_FUNC(func_now) || IS_FUNC(func_dateadd) || IS_FUNC(func_dateset) || IS_FUNC(func_datetrunc))
+        return YY_TOKEN_DATETIME;
 
-    consume(parser);
+    if (IS_FUNC(func_variable))
+        return YY_TOKEN_NULL;
+
+    if (func->needs_ctx && !IS_FUNC(func_random))
+        return YY_TOKEN_STRING;
+
+    return YY_TOKEN_NUMBER;
+
+    #undef IS_FUNC
 }
 
 /**
- * Parse a numeric term.
+ * Assigns typed opcodes to functions whose argument types are known.
  * 
- * @see Grammar described in docs.
+ * Variables and errors have an unknown type. A function having an argument 
+ * with a known type T is specialized to type T (if it has a T-variant). 
+ * This preserves the result because any other argument type gives an 
+ * error, and typed opcodes call the function when types doesn't match.
  * 
- * @param[in] parser Parser to update.
+ * @param[in] stack Compiled stack.
  */
-static void parse_term_number(yy_parser_t *parser)
+static void specialize_stack(yy_stack_t *stack)
 {
-    assert(parser);
-
-    if (parser->error != YY_OK)
-        return;
+    yy_token_e types[MAX_ANALYSIS_DEPTH];
+    uint32_t depth = 0;
 
-    switch (parser->curr_symbol.type)
+    for (uint32_t i = 0; i < stack->len; i++)
     {
-        case YY_SYMBOL_CONST_E:
-        case YY_SYMBOL_CONST_PI:
-        case YY_SYMBOL_CONST_INF:
-        case YY_SYMBOL_CONST_NAN:
-        case YY_SYMBOL_NUMBER_VAL:
-        case YY_SYMBOL_VARIABLE:
-            consume(parser);
-            break;
-        case YY_SYMBOL_VARIABLE_FUNC:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_ABS:
-        case YY_SYMBOL_SQRT:
-        case YY_SYMBOL_SIN:
-        case YY_SYMBOL_COS:
-        case YY_SYMBOL_TAN:
-        case YY_SYMBOL_EXP:
-        case YY_SYMBOL_LOG:
-        case YY_SYMBOL_CEIL:
-        case YY_SYMBOL_FLOOR:
-        case YY_SYMBOL_TRUNC:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_MAX:
-        case YY_SYMBOL_MIN:
-        case YY_SYMBOL_MODULO:
-        case YY_SYMBOL_POWER:
-        case YY_SYMBOL_RANDOM:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_CLAMP:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_PAREN_LEFT:
-            consume(parser);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_ADDITION_OP:
-            if (is_numeric_operator(parser->prev_symbol.type)) {
-                parser->error = YY_ERROR_SYNTAX;
+        yy_token_t *token = &stack->data[i];
+
+        if (token->type == YY_TOKEN_JUMP)
+            continue;
+
+        if (token->type != YY_TOKEN_FUNCTION)
+        {
+            if (depth >= MAX_ANALYSIS_DEPTH)
+                return;
+
+            types[depth++] = (is_token_fixed_value(token->type) ? token->type : YY_TOKEN_NULL);
+            continue;
+        }
+
+        yy_func_t *func = &token->function;
+
+        if (depth < func->num_args)
+            return;
+
+        depth -= func->num_args;
+
+        yy_token_e type = YY_TOKEN_NULL;
+
+        for (uint32_t j = 0; j < func->num_args; j++)
+        {
+            if (types[depth + j] == YY_TOKEN_NULL)
+                continue;
+
+            if (type != YY_TOKEN_NULL && type != types[depth + j]) {
+                type = YY_TOKEN_ERROR;  // mixed types
                 break;
             }
-            parser->curr_symbol.type = YY_SYMBOL_PLUS_OP;
-            consume(parser);
-            parse_expr_number(parser);
-            break;
-        case YY_SYMBOL_SUBTRACTION_OP:
-            if (is_numeric_operator(parser->prev_symbol.type)) {
-                parser->error = YY_ERROR_SYNTAX;
+
+            type = types[depth + j];
+        }
+
+        for (size_t j = 0; j < sizeof(typed_funcs)/sizeof(typed_funcs[0]) && type != YY_TOKEN_NULL; j++)
+        {
+            if (typed_funcs[j].ptr == func->ptr && typed_funcs[j].type == type) {
+                func->opcode = typed_funcs[j].opcode;
                 break;
             }
-            parser->curr_symbol.type = YY_SYMBOL_MINUS_OP;
-            consume(parser);
-            parse_expr_number(parser);
-            break;
-        case YY_SYMBOL_LENGTH:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_FIND:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_IFELSE:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_bool(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_DATEPART:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_datetime(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_datepart(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_DATEDIFF:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_datetime(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_datetime(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_datepart(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        default:
-            parser->error = YY_ERROR_SYNTAX;
+        }
+
+        types[depth] = get_func_type(func, &types[depth]);
+        depth++;
     }
 }
 
 /**
- * Parse a numeric expression until an unrecognized symbol is found.
+ * Inserts a token in the stack.
  * 
- * @param[in] Parser object.
+ * @param[in,out] stack Stack to update (with room for one token).
+ * @param[in] pos Position of the new token.
+ * @param[in] token Token to insert.
  */
-static void parse_expr_number(yy_parser_t *parser)
-{ 
-    assert(parser);
+static void insert_token(yy_stack_t *stack, uint32_t pos, yy_token_t token)
+{
+    assert(stack->len < stack->reserved && pos <= stack->len);
 
-    if (++(parser->recursion_type) > MAX_RECURSION_TYPE)
-        parser->error = YY_ERROR_EXCD;
+    memmove(&stack->data[pos + 1], &stack->data[pos], (stack->len - pos) * sizeof(yy_token_t));
+    stack->data[pos] = token;
+    stack->len++;
+}
 
-EXPR_NUMBER_START:
+/**
+ * Returns the position of the first token of a subtree.
+ * 
+ * @param[in] stack Compiled stack.
+ * @param[in] pos Position of the subtree root (not a control token).
+ * 
+ * @return Position of the first token,
+ *         UINT32_MAX on error (corrupted stack).
+ */
+static uint32_t get_subtree_start(const yy_stack_t *stack, uint32_t pos)
+{
+    uint32_t num_values = 1;
 
-    parse_term_number(parser);
+    for (uint32_t i = pos + 1; i-- > 0; )
+    {
+        const yy_token_t *token = &stack->data[i];
 
-    if (parser->error != YY_OK)
-        goto EXPR_NUMBER_END;
+        if (token->type == YY_TOKEN_JUMP)
+            continue;
 
-    switch (parser->curr_symbol.type)
+        if (token->type == YY_TOKEN_FUNCTION)
+            num_values += token->function.num_args;
+
+        if (--num_values == 0)
+            return i;
+    }
+
+    return UINT32_MAX;
+}
+
+static bool is_same_token(const yy_token_t *token1, const yy_token_t *token2)
+{
+    if (token1->type != token2->type)
+        return false;
+
+    switch (token1->type)
     {
-        case YY_SYMBOL_ADDITION_OP: 
-        case YY_SYMBOL_SUBTRACTION_OP: 
-        case YY_SYMBOL_PRODUCT_OP: 
-        case YY_SYMBOL_DIVIDE_OP: 
-        case YY_SYMBOL_MODULO_OP: 
-        case YY_SYMBOL_POWER_OP: 
-            consume(parser);
-            goto EXPR_NUMBER_START;
-        default:
-            break;
+        case YY_TOKEN_BOOL: 
+            return (token1->bool_val == token2->bool_val);
+        case YY_TOKEN_NUMBER: 
+            return (memcmp(&token1->number_val, &token2->number_val, sizeof(double)) == 0);
+        case YY_TOKEN_DATETIME: 
+            return (token1->datetime_val == token2->datetime_val);
+        case YY_TOKEN_STRING:
+        case YY_TOKEN_VARIABLE:
+            return (token1->str_val.len == token2->str_val.len && 
+                    (token1->str_val.len == 0 || memcmp(token1->str_val.ptr, token2->str_val.ptr, token1->str_val.len) == 0));
+        case YY_TOKEN_FUNCTION: 
+            return (token1->function.ptr == token2->function.ptr && token1->function.num_args == token2->function.num_args);
+        case YY_TOKEN_ERROR: 
+            return (token1->error == token2->error);
+        case YY_TOKEN_SLOT: 
+            return (token1->slot == token2->slot);
+        default: 
+            return false;
     }
+}
 
-EXPR_NUMBER_END:
+// control tokens are ignored
+static bool is_same_subtree(const yy_stack_t *stack, uint32_t pos1, uint32_t end1, uint32_t pos2, uint32_t end2)
+{
+    while (true)
+    {
+        while (pos1 <= end1 && stack->data[pos1].type == YY_TOKEN_JUMP)
+            pos1++;
 
-    assert(parser->recursion_type != 0);
-    parser->recursion_type--;
+        while (pos2 <= end2 && stack->data[pos2].type == YY_TOKEN_JUMP)
+            pos2++;
+
+        if (pos1 > end1 || pos2 > end2)
+            return (pos1 > end1 && pos2 > end2);
+
+        if (!is_same_token(&stack->data[pos1], &stack->data[pos2]))
+            return false;
+
+        pos1++;
+        pos2++;
+    }
 }
 
 /**
- * Parse a string term.
+ * Checks if a subtree can be shared.
  * 
- * @see Grammar described in docs.
- * 
- * @param[in] parser Parser to update.
+ * Subtrees having impure functions (random, now, or creating temporary 
+ * strings), control tokens or temporaries are discarded. Small subtrees 
+ * are not worth sharing.
  */
-static void parse_term_string(yy_parser_t *parser)
+static bool is_shareable(const yy_stack_t *stack, uint32_t start, uint32_t end)
 {
-    assert(parser);
-
-    if (parser->error != YY_OK)
-        return;
+    if (end - start < 2)
+        return false;
 
-    switch (parser->curr_symbol.type)
+    for (uint32_t i = start; i <= end; i++)
     {
-        case YY_SYMBOL_STRING_VAL:
-        case YY_SYMBOL_ESCAPED_STRING_VAL:
-        case YY_SYMBOL_VARIABLE:
-            consume(parser);
-            break;
-        case YY_SYMBOL_VARIABLE_FUNC:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_TRIM:
-        case YY_SYMBOL_LOWER:
-        case YY_SYMBOL_UPPER:
-        case YY_SYMBOL_UNESCAPE:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_STR:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_generic(parser, true, false);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_MIN:
-        case YY_SYMBOL_MAX:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_SUBSTR:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_REPLACE:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_IFELSE:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_bool(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_PAREN_LEFT:
-            consume(parser);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        default:
-            parser->error = YY_ERROR_SYNTAX;
+        const yy_token_t *token = &stack->data[i];
+
+        if (token->type == YY_TOKEN_JUMP || token->type == YY_TOKEN_TEMP)
+            return false;
+
+        if (token->type == YY_TOKEN_FUNCTION && (token->function.is_not_pure || token->function.needs_ctx))
+            return false;
     }
+
+    return true;
 }
 
 /**
- * Parse a string expression until an unrecognized symbol is found.
- * 
- * @param[in] Parser object.
+ * Checks if the token at pos2 is evaluated only when the token at pos1 
+ * (pos1 < pos2) was evaluated. This is, each conditional operand (ifelse 
+ * branches, second operand of && and ||) containing pos1 contains pos2.
  */
-static void parse_expr_string(yy_parser_t *parser)
-{ 
-    assert(parser);
+static bool is_dominated(const yy_stack_t *stack, uint32_t pos1, uint32_t pos2)
+{
+    for (uint32_t i = pos1 + 1; i < stack->len; i++)
+    {
+        const yy_func_t *func = &stack->data[i].function;
 
-    if (++(parser->recursion_type) > MAX_RECURSION_TYPE)
-        parser->error = YY_ERROR_EXCD;
+        if (stack->data[i].type != YY_TOKEN_FUNCTION)
+            continue;
 
-EXPR_STRING_START:
+        if (!(func->ptr == (void (*)(void)) func_ifelse && func->num_args == 3) && 
+            !(func->ptr == (void (*)(void)) func_and && func->num_args == 2) && 
+            !(func->ptr == (void (*)(void)) func_or && func->num_args == 2))
+            continue;
 
-    parse_term_string(parser);
+        // operands are traversed from the last one (the first one is unconditional)
+        uint32_t end = i - 1;
 
-    if (parser->error != YY_OK)
-        goto EXPR_STRING_END;
+        for (uint32_t k = func->num_args - 1; k > 0; k--)
+        {
+            uint32_t root = end;
 
-    switch (parser->curr_symbol.type)
-    {
-        case YY_SYMBOL_ADDITION_OP: 
-            parser->curr_symbol.type = YY_SYMBOL_CONCAT_OP;
-            consume(parser);
-            goto EXPR_STRING_START;
-        default:
-            break;
-    }
+            while (root > 0 && stack->data[root].type == YY_TOKEN_JUMP)
+                root--;
 
-EXPR_STRING_END:
+            uint32_t start = get_subtree_start(stack, root);
 
-    assert(parser->recursion_type != 0);
-    parser->recursion_type--;
-}
+            if (start == UINT32_MAX || start == 0)
+                return false;
 
-static void parse_expr_by_type(yy_parser_t *parser, yy_token_e type)
-{
-    if (parser->error != YY_OK)
-        return;
+            if (start <= pos1 && pos1 <= end && !(start <= pos2 && pos2 <= end))
+                return false;
 
-    switch (type)
-    {
-        case YY_TOKEN_BOOL: parse_expr_bool(parser); break;
-        case YY_TOKEN_NUMBER: parse_expr_number(parser); break;
-        case YY_TOKEN_DATETIME: parse_expr_datetime(parser); break;
-        case YY_TOKEN_STRING: parse_expr_string(parser); break;
-        default: assert(false); parser->error = YY_ERROR_SYNTAX; break;
+            end = start - 1;
+        }
     }
-}
-
-static yy_parser_t save_state(yy_parser_t *parser)
-{
-    yy_parser_t ret = *parser;
-    ret.end = (const char *) (intptr_t) parser->stack->len;
-    return ret;
-}
 
-static void restore_state(yy_parser_t *parser, const yy_parser_t *prev_state)
-{
-    size_t len = sizeof(yy_parser_t) - offsetof(yy_parser_t, curr);
-    memcpy(&parser->curr, &prev_state->curr, len);
-    parser->stack->len = (uint32_t) (intptr_t) prev_state->end;
+    return true;
 }
 
 /**
- * Parse an expression until an unrecognized symbol is found.
+ * Shares repeated subexpressions (common subexpression elimination).
  * 
- * In case of error, returns the most serious error found and the error position 
- * corresponds to the parser that advanced the furthest.
+ * Repeated pure subtrees are replaced by a temporary value stored by 
+ * the first occurrence:
  * 
- * @param[in] parser Parser to update.
- * @param[in] check_bool Checks bool type (to avoid a non-ending loop parsing a bool).
- * @param[in] do_finalize Flag to finalize.
+ *   A ... A   ->   FRAME(n) A STORE(k) ... TEMP(k)
  * 
- * @return YY_TOKEN_BOOL - Parsed bool expression,
- *         YY_TOKEN_NUMBER - Parsed number expression,
- *         YY_TOKEN_DATETIME - Parsed datetime expression,
- *         YY_TOKEN_STRING - Parsed string expression,
- *         YY_TOKEN_ERROR - Error parsing expression (see parser.error).
+ * The frame token reserves the temporaries at the bottom of the aux stack.
+ * The first occurrence must be evaluated whenever the repeated one is 
+ * (see is_dominated()). Subtrees are processed from the end, so largest 
+ * subtrees are shared first. Big stacks are not processed (quadratic cost).
+ * 
+ * @param[in,out] stack Compiled stack (without jumps).
  */
-static yy_token_e parse_expr_generic(yy_parser_t *parser, bool check_bool, bool do_finalize)
+static void share_subexprs(yy_stack_t *stack)
 {
-    static const yy_token_e types[] = {YY_TOKEN_BOOL, YY_TOKEN_NUMBER, YY_TOKEN_DATETIME, YY_TOKEN_STRING};
+    uint32_t num_temps = 0;
+    uint32_t i = stack->len;
 
-    if (++(parser->recursion_generic) > MAX_RECURSION_GENERIC)
-        parser->error = YY_ERROR_EXCD;
+    if (stack->len > MAX_SHARE_TOKENS)
+        return;
 
-    yy_token_e ret = YY_TOKEN_ERROR;
-    yy_parser_t prev_state = save_state(parser);
-    const char *curr = parser->curr;
-    yy_error_e error = YY_OK;
+    while (i-- > 0)
+    {
+        const yy_token_t *token = &stack->data[i];
 
-    if (parser->error != YY_OK)
-        goto EXPR_GENERIC_END;
+        if (token->type != YY_TOKEN_FUNCTION || token->function.num_args == 0)
+            continue;
 
-    for (size_t i = (check_bool ? 0 : 1); i < (sizeof(types)/sizeof(types[0])); i++)
-    {
-        parse_expr_by_type(parser, types[i]);
+        uint32_t start = get_subtree_start(stack, i);
 
-        if (do_finalize)
-            finalize(parser);
+        if (start == UINT32_MAX)
+            return;
 
-        if (parser->error == YY_OK) {
-            ret = types[i];
-            goto EXPR_GENERIC_END;
-        }
+        if (!is_shareable(stack, start, i))
+            continue;
 
-        if (error < parser->error || (error == parser->error && curr < parser->curr)) {
-            error = parser->error;
-            curr = parser->curr;
+        // first occurrence
+        uint32_t prev = UINT32_MAX;
+
+        for (uint32_t j = 0; j < start && prev == UINT32_MAX; j++)
+        {
+            if (!is_same_token(&stack->data[j], token))
+                continue;
+
+            uint32_t prev_start = get_subtree_start(stack, j);
+
+            if (prev_start != UINT32_MAX && is_same_subtree(stack, prev_start, j, start, i) && is_dominated(stack, j, i))
+                prev = j;
         }
 
-        restore_state(parser, &prev_state);
+        if (prev == UINT32_MAX)
+            continue;
+
+        bool has_store = (stack->data[prev + 1].type == YY_TOKEN_JUMP && stack->data[prev + 1].jump.opcode == YY_OPCODE_STORE);
+        uint32_t temp = (has_store ? stack->data[prev + 1].jump.offset : num_temps++);
+
+        stack->data[start] = token_temp(temp);
+        memmove(&stack->data[start + 1], &stack->data[i + 1], (stack->len - i - 1) * sizeof(yy_token_t));
+        stack->len -= (i - start);
+        i = start;
+
+        if (!has_store) {
+            insert_token(stack, prev + 1, token_jump(YY_OPCODE_STORE, temp));
+            i++;
+        }
     }
 
-    parser->error = error;
-    parser->curr = curr;
-    ret = YY_TOKEN_ERROR;
+    if (num_temps > 0)
+        insert_token(stack, 0, token_jump(YY_OPCODE_FRAME, num_temps));
+}
 
-EXPR_GENERIC_END:
+static void remove_tokens(yy_stack_t *stack, uint32_t pos, uint32_t num)
+{
+    assert(pos + num <= stack->len);
 
-    assert(parser->recursion_generic != 0);
-    parser->recursion_generic--;
+    memmove(&stack->data[pos], &stack->data[pos + num], (stack->len - pos - num) * sizeof(yy_token_t));
+    stack->len -= num;
+}
 
-    return ret;
+INLINE
+static bool is_func_2(const yy_token_t *token, yy_token_t (*ptr)(yy_token_t, yy_token_t))
+{
+    return (token->type == YY_TOKEN_FUNCTION && token->function.num_args == 2 && token->function.ptr == (void (*)(void)) ptr);
+}
+
+INLINE
+static bool is_token_bool(const yy_token_t *token, bool val)
+{
+    return (token->type == YY_TOKEN_BOOL && token->bool_val == val);
+}
+
+// subtree having root at pos returns a bool (or an error)
+static bool is_bool_subtree(const yy_stack_t *stack, uint32_t pos)
+{
+    const yy_token_t *token = &stack->data[pos];
+    yy_token_e args[3] = {YY_TOKEN_NULL, YY_TOKEN_NULL, YY_TOKEN_NULL};
+
+    if (token->type == YY_TOKEN_BOOL)
+        return true;
+
+    return (token->type == YY_TOKEN_FUNCTION && get_func_type(&token->function, args) == YY_TOKEN_BOOL);
 }
 
 /**
- * Parse a bool term.
+ * Folds the functions having fixed arguments not simplified while 
+ * parsing (functions requiring the eval context, ex: upper("abc")).
  * 
- * @see Grammar described in docs.
+ * Calls creating strings (ex: upper("abc"), unescaped literals) are only
+ * folded when requested (YY_OPTIMIZE_FOLD_STRINGS). Their results are 
+ * placed in a pool at the end of the stack memory, and the stack 
+ * reserved length is reduced to protect them.
+ * Non-deterministic functions (random, now) are not folded.
  * 
- * @param[in] parser Parser to update.
+ * @param[in,out] stack Plain stack (without control tokens).
+ * @param[in] flags Optimization flags (see yy_optimize_e).
  */
-static void parse_term_bool(yy_parser_t *parser)
+static void fold_stack(yy_stack_t *stack, uint32_t flags)
 {
-    assert(parser);
+    yy_eval_ctx_t ctx = {.stack = stack, .tmp_str = (char *) &stack->data[stack->reserved]};
+    bool use_pool = (flags & YY_OPTIMIZE_FOLD_STRINGS);
 
-    if (parser->error != YY_OK)
-        return;
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        yy_func_t func = stack->data[i].function;
 
-    yy_error_e error = YY_OK;
-    const char *curr = NULL;
-    yy_parser_t prev_state = save_state(parser);
+        if (stack->data[i].type != YY_TOKEN_FUNCTION || func.is_not_pure || i < func.num_args)
+            continue;
 
-    yy_token_e type = parse_expr_generic(parser, false, false);
+        yy_token_t *args = &stack->data[i - func.num_args];
+        bool is_fixed = true;
 
-    if (type == YY_TOKEN_ERROR && parser->error != YY_ERROR_SYNTAX) // MEM or EXCD
-        return;
+        for (uint32_t j = 0; j < func.num_args; j++)
+            is_fixed = is_fixed && is_token_fixed_value(args[j].type);
 
-    if (type != YY_TOKEN_ERROR)
-    {
-        switch (parser->curr_symbol.type)
-        {
-            case YY_SYMBOL_LESS_OP:
-            case YY_SYMBOL_LESS_EQUALS_OP:
-            case YY_SYMBOL_GREAT_OP:
-            case YY_SYMBOL_GREAT_EQUALS_OP:
-            case YY_SYMBOL_EQUALS_OP:
-            case YY_SYMBOL_DISTINCT_OP:
-                consume(parser);
-                parse_expr_by_type(parser, type);
-                return;
-            default:
-                break;
-        }
-    }
+        if (!is_fixed)
+            continue;
 
-    // save error
-    error = parser->error;
-    curr = parser->curr;
+        char *tmp_str = ctx.tmp_str;
+        yy_token_t result = call_func(func, args, &ctx);
 
-    restore_state(parser, &prev_state);
+        if (result.type == YY_TOKEN_ERROR && result.error == YY_ERROR_MEM)
+            continue;   // pool exhausted, evaluated at runtime
 
-    switch (parser->curr_symbol.type)
-    {
-        case YY_SYMBOL_TRUE:
-        case YY_SYMBOL_FALSE:
-        case YY_SYMBOL_VARIABLE:
-            consume(parser);
-            break;
-        case YY_SYMBOL_VARIABLE_FUNC:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_NOT:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_bool(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_ISINF:
-        case YY_SYMBOL_ISNAN:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_number(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_ISERROR:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_generic(parser, true, false);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_IFELSE:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_bool(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_bool(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_bool(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_PAREN_LEFT:
-            consume(parser);
-            parse_expr_bool(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        default:
-            parser->error = YY_ERROR_SYNTAX;
-    }
+        // created string is discarded, evaluated at runtime
+        if (!use_pool && result.type == YY_TOKEN_STRING && is_temp_ptr(&ctx, result.str_val.ptr)) {
+            ctx.tmp_str = tmp_str;
+            continue;
+        }
 
-    if (parser->error && (error > parser->error || (error == parser->error && curr > parser->curr))) {
-        parser->error = error;
-        parser->curr = curr;
+        free_args(&ctx, args, func.num_args, &result);
+
+        args[0] = result;
+        remove_tokens(stack, i - func.num_args + 1, func.num_args);
+        i -= func.num_args;
     }
+
+    if (use_pool)
+        stack->reserved = (uint32_t) ((ctx.tmp_str - (char *) stack->data) / sizeof(yy_token_t));
 }
 
 /**
- * Parse a boolean expression until an unrecognized symbol is found.
+ * Moves the fixed values of an operators chain to the top, and folds them.
  * 
- * @param[in] Parser object.
+ * Operands are normalized (fixed value placed at top):
+ *   (X op C1) op C2          ->  X op K
+ *   (X op C1) op (Y op C2)   ->  (X op Y) op K
+ *   (X op C1) op Y           ->  (X op Y) op C1
+ *   C1 op (Y op C2)          ->  Y op K
+ *   C1 op Y                  ->  Y op C1
+ *   X op (Y op C2)           ->  (X op Y) op C2
+ * 
+ * where K = C1 op C2. Operator must be associative and commutative.
+ * min() and max() chains having a zero fixed value are not changed
+ * (the sign of a zero result would depend on the new order).
+ * Node never grows.
+ * 
+ * @param[in,out] stack Stack to update.
+ * @param[in] start Position of the first token of the left operand.
+ * @param[in] pos_y Position of the first token of the right operand.
+ * @param[in] pos Position of the operator.
+ * 
+ * @return Position of the node root after the rewrite.
  */
-static void parse_expr_bool(yy_parser_t *parser)
-{ 
-    assert(parser);
+static uint32_t reassociate_chain(yy_stack_t *stack, uint32_t start, uint32_t pos_y, uint32_t pos)
+{
+    yy_token_t *data = stack->data;
+    yy_token_t op = data[pos];
+    yy_token_t c1 = {0};
+    yy_token_t c2 = {0};
+    uint32_t end_x = pos_y;     // left operand without fixed value is [start, end_x)
+    uint32_t end_y = pos;       // right operand without fixed value is [pos_y, end_y)
+
+    if (pos_y == start + 1 && is_token_fixed_value(data[start].type)) {
+        c1 = data[start];
+        end_x = start;
+    }
+    else if (is_func_2(&data[pos_y - 1], (yy_func_2) op.function.ptr) && is_token_fixed_value(data[pos_y - 2].type)) {
+        c1 = data[pos_y - 2];
+        end_x = pos_y - 2;
+    }
 
-    if (++(parser->recursion_type) > MAX_RECURSION_TYPE)
-        parser->error = YY_ERROR_EXCD;
+    if (pos == pos_y + 1 && is_token_fixed_value(data[pos_y].type)) {
+        c2 = data[pos_y];
+        end_y = pos_y;
+    }
+    else if (is_func_2(&data[pos - 1], (yy_func_2) op.function.ptr) && is_token_fixed_value(data[pos - 2].type)) {
+        c2 = data[pos - 2];
+        end_y = pos - 2;
+    }
 
-EXPR_BOOL_START:
+    bool has_c1 = (c1.type != YY_TOKEN_NULL);
+    bool has_c2 = (c2.type != YY_TOKEN_NULL);
 
-    parse_term_bool(parser);
+    if (!has_c1 && (!has_c2 || end_y == pos_y))
+        return pos;
 
-    if (parser->error != YY_OK)
-        goto EXPR_BOOL_END;
+    // min() and max() of +0 and -0 depend on the operands order (ex: max(-0, $x) with $x = +0)
+    if (!is_func_2(&op, func_addition) && !is_func_2(&op, func_mult) &&
+        ((c1.type == YY_TOKEN_NUMBER && c1.number_val == 0) || (c2.type == YY_TOKEN_NUMBER && c2.number_val == 0)))
+        return pos;
 
-    switch (parser->curr_symbol.type)
-    {
-        case YY_SYMBOL_AND_OP: 
-        case YY_SYMBOL_OR_OP: 
-        case YY_SYMBOL_EQUALS_OP: 
-        case YY_SYMBOL_DISTINCT_OP: 
-            consume(parser);
-            goto EXPR_BOOL_START;
-        default:
-            break;
-    }
+    yy_token_t k = (has_c1 && has_c2 ? ((yy_func_2) op.function.ptr)(c1, c2) : (has_c1 ? c1 : c2));
+    uint32_t len = end_x;
 
-EXPR_BOOL_END:
+    memmove(&data[len], &data[pos_y], (end_y - pos_y) * sizeof(yy_token_t));
+    len += end_y - pos_y;
 
-    assert(parser->recursion_type != 0);
-    parser->recursion_type--;
+    if (end_x > start && end_y > pos_y)
+        data[len++] = op;
+
+    data[len++] = k;
+
+    if (len > start + 1)
+        data[len++] = op;
+
+    remove_tokens(stack, len, pos + 1 - len);
+
+    return len - 1;
 }
 
 /**
- * Parse a datepart identifier.
+ * Removes the neutral and absorbing fixed values of && and ||.
  * 
- * @param[in] Parser object.
+ *   true && Y            ->  Y                (Y returns a bool)
+ *   X && true            ->  X                (X returns a bool)
+ *   false && Y           ->  false
+ *   (X && true) && Y     ->  X && Y
+ *   (true && X) && Y     ->  X && Y
+ * 
+ * Similar rules apply to ||, and to any combination of both operators 
+ * (the left operand is checked to be a bool by the parent operator).
+ * Fixed values are not moved because the evaluation order matters 
+ * (short-circuit and errors).
+ * 
+ * @param[in,out] stack Stack to update.
+ * @param[in] start Position of the first token of the left operand.
+ * @param[in] pos_y Position of the first token of the right operand.
+ * @param[in] pos Position of the operator.
+ * 
+ * @return Position of the node root after the rewrite.
  */
-static void parse_datepart(yy_parser_t *parser)
+static uint32_t reassociate_logic(yy_stack_t *stack, uint32_t start, uint32_t pos_y, uint32_t pos)
 {
-    assert(parser);
+    yy_token_t *data = stack->data;
+    yy_func_2 func = (yy_func_2) data[pos].function.ptr;
+    bool neutral = (func == func_and);
 
-    int part = -1;
+    while (is_func_2(&data[pos_y - 1], func_and) || is_func_2(&data[pos_y - 1], func_or))
+    {
+        uint32_t root = pos_y - 1;
+        bool val = is_func_2(&data[root], func_and);
 
-    if (parser->error != YY_OK)
-        return;
+        if (is_token_bool(&data[root - 1], val)) {
+            remove_tokens(stack, root - 1, 2);
+        }
+        else if (is_token_bool(&data[start], val) && get_subtree_start(stack, root - 1) == start + 1) {
+            remove_tokens(stack, root, 1);
+            remove_tokens(stack, start, 1);
+        }
+        else {
+            break;
+        }
 
-    if (parser->curr_symbol.type != YY_SYMBOL_STRING_VAL) {
-        parser->error = YY_ERROR_SYNTAX;
-        return;
+        pos_y -= 2;
+        pos -= 2;
     }
 
-    if ((part = get_datepart(&parser->curr_symbol.str_val)) < 0) {
-        parser->error = YY_ERROR_SYNTAX;
-        return;
+    if (pos_y == start + 1 && is_token_fixed_value(data[start].type))
+    {
+        if (!is_token_bool(&data[start], neutral)) {
+            data[start] = func(data[start], token_error(YY_ERROR_VALUE));
+            remove_tokens(stack, start + 1, pos - start);
+            return start;
+        }
+
+        if (!is_bool_subtree(stack, pos - 1))
+            return pos;
+
+        remove_tokens(stack, pos, 1);
+        remove_tokens(stack, start, 1);
+        return pos - 2;
     }
 
-    parser->curr_symbol.type = YY_SYMBOL_NUMBER_VAL;
-    parser->curr_symbol.number_val = (double) part;
+    if (pos == pos_y + 1 && is_token_bool(&data[pos_y], neutral) && is_bool_subtree(stack, pos_y - 1)) {
+        remove_tokens(stack, pos_y, 2);
+        return pos_y - 1;
+    }
 
-    consume(parser);
+    return pos;
 }
 
 /**
- * Parse a datetime value.
+ * Reassociates chains of operators to fold their fixed values.
  * 
- * A datetime value is a double-quoted string containing a datetime.
+ * min() and max() are reassociated always. Sums and products 
+ * only when YY_OPTIMIZE_REASSOCIATE is set, because floating point 
+ * rounding depends on the evaluation order (ex: $x + 1 + 2 + 3 -> $x + 6).
+ * Logical operators (&& and ||) drop their neutral fixed values.
  * 
- * @param[in] Parser object.
+ * Applies to plain stacks (without control tokens).
+ * 
+ * @param[in,out] stack Stack to update.
+ * @param[in] flags Optimization flags (see yy_optimize_e).
  */
-static void parse_datetime_val(yy_parser_t *parser)
+static void reassociate_stack(yy_stack_t *stack, uint32_t flags)
 {
-    assert(parser);
+    uint32_t starts[MAX_ANALYSIS_DEPTH];    // first token of each pending value
+    uint32_t depth = 0;
 
-    if (parser->error != YY_OK)
-        return;
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
 
-    if (parser->curr_symbol.type != YY_SYMBOL_STRING_VAL) {
-        parser->error = YY_ERROR_SYNTAX;
-        return;
+        if (token->type == YY_TOKEN_JUMP || token->type == YY_TOKEN_TEMP)
+            return;
+
+        if (token->type != YY_TOKEN_FUNCTION || token->function.num_args == 0)
+        {
+            if (depth >= MAX_ANALYSIS_DEPTH)
+                return;
+
+            starts[depth++] = i;
+            continue;
+        }
+
+        if (depth < token->function.num_args)
+            return;
+
+        depth -= token->function.num_args;
+
+        if (is_func_2(token, func_min) || is_func_2(token, func_max) || 
+            ((flags & YY_OPTIMIZE_REASSOCIATE) && (is_func_2(token, func_addition) || is_func_2(token, func_mult))))
+            i = reassociate_chain(stack, starts[depth], starts[depth + 1], i);
+        else if (is_func_2(token, func_and) || is_func_2(token, func_or))
+            i = reassociate_logic(stack, starts[depth], starts[depth + 1], i);
+
+        depth++;    // starts[depth] is the first token of the function arguments
     }
+}
 
-    const char *begin = parser->curr_symbol.str_val.ptr;
-    const char *end = begin + parser->curr_symbol.str_val.len;
+INLINE
+static bool is_func_1(const yy_token_t *token, yy_token_t (*ptr)(yy_token_t))
+{
+    return (token->type == YY_TOKEN_FUNCTION && token->function.num_args == 1 && token->function.ptr == (void (*)(void)) ptr);
+}
 
-    yy_token_t token = yy_parse_datetime(begin, end);
+INLINE
+static bool is_token_number(const yy_token_t *token, double val)
+{
+    return (token->type == YY_TOKEN_NUMBER && token->number_val == val && 
+            signbit(token->number_val) == signbit(val));
+}
 
-    if (token.type != YY_TOKEN_DATETIME) {
-        parser->error = YY_ERROR_SYNTAX;
-        return;
+// subtree having root at pos returns a number (or YY_ERROR_VALUE)
+static bool is_number_subtree(const yy_stack_t *stack, uint32_t pos)
+{
+    static void (* const funcs[])(void) = {
+        (void (*)(void)) func_addition, (void (*)(void)) func_subtraction, (void (*)(void)) func_mult,
+        (void (*)(void)) func_div,      (void (*)(void)) func_mod,         (void (*)(void)) func_pow,
+        (void (*)(void)) func_powi,     (void (*)(void)) func_fma,         (void (*)(void)) func_minus,
+        (void (*)(void)) func_ident,    (void (*)(void)) func_abs,         (void (*)(void)) func_sqrt,
+        (void (*)(void)) func_exp,      (void (*)(void)) func_log,         (void (*)(void)) func_sin,
+        (void (*)(void)) func_cos,      (void (*)(void)) func_tan,         (void (*)(void)) func_trunc,
+        (void (*)(void)) func_ceil,     (void (*)(void)) func_floor,
+    };
+
+    const yy_token_t *token = &stack->data[pos];
+
+    if (token->type == YY_TOKEN_NUMBER)
+        return true;
+
+    for (size_t i = 0; i < sizeof(funcs)/sizeof(funcs[0]) && token->type == YY_TOKEN_FUNCTION; i++)
+        if (token->function.ptr == funcs[i])
+            return true;
+
+    return false;
+}
+
+// 1/val is exact (val is a power of 2)
+static bool has_exact_inverse(double val)
+{
+    int exp = 0;
+
+    if (!isfinite(val) || val == 0.0 || fabs(frexp(val, &exp)) != 0.5)
+        return false;
+
+    double inv = 1.0 / val;
+
+    return (isfinite(inv) && inv != 0.0 && fabs(frexp(inv, &exp)) == 0.5);
+}
+
+// swaps [first, middle) and [middle, last)
+static void rotate_tokens(yy_token_t *data, uint32_t first, uint32_t middle, uint32_t last)
+{
+    uint32_t ranges[3][2] = {{first, middle}, {middle, last}, {first, last}};
+
+    for (int k = 0; k < 3; k++)
+    {
+        for (uint32_t i = ranges[k][0], j = ranges[k][1]; i + 1 < j; i++, j--) {
+            yy_token_t tmp = data[i];
+            data[i] = data[j - 1];
+            data[j - 1] = tmp;
+        }
     }
+}
 
-    parser->curr_symbol.type = YY_SYMBOL_DATETIME_VAL;
-    parser->curr_symbol.datetime_val = token.datetime_val;
+/**
+ * Replaces a binary node by a unary plus applied to one of its operands.
+ * Unary plus is omitted when the operand returns a number.
+ * 
+ * @return Position of the node root after the rewrite.
+ */
+static uint32_t make_ident(yy_stack_t *stack, uint32_t start, uint32_t pos_y, uint32_t pos, bool keep_left)
+{
+    uint32_t root = 0;
 
-    consume(parser);
+    if (keep_left) {
+        remove_tokens(stack, pos_y, pos + 1 - pos_y);
+        root = pos_y - 1;
+    }
+    else {
+        remove_tokens(stack, pos, 1);
+        remove_tokens(stack, start, pos_y - start);
+        root = pos - 1 - (pos_y - start);
+    }
+
+    if (is_number_subtree(stack, root))
+        return root;
+
+    insert_token(stack, root + 1, symbol_to_token[YY_SYMBOL_PLUS_OP]);
+    return root + 1;
 }
 
 /**
- * Parse a datetime term.
+ * Rewrites an arithmetic node into a cheaper form.
  * 
- * @param[in] Parser object.
+ * Exact rewrites (IEEE results and errors are preserved):
+ *   --X          ->  +X
+ *   +X           ->  X              (X returns a number)
+ *   X * 1        ->  +X             (also 1 * X)
+ *   X / 1        ->  +X
+ *   X / C        ->  X * (1/C)      (C is a power of 2)
+ *   X - 0        ->  +X
+ *   X + -0       ->  +X             (also -0 + X)
+ *   X + -Y       ->  X - Y
+ *   X - -Y       ->  X + Y
+ *   X ^ 1        ->  +X
+ * 
+ * Unary plus is kept when the operand type is unknown because it 
+ * returns YY_ERROR_VALUE on non-numbers, as the replaced operator.
+ * 
+ * Rewrites changing rounding or signed zeros (YY_OPTIMIZE_ALGEBRAIC):
+ *   X + 0        ->  +X             (also 0 + X and X - -0)
+ *   X ^ 2        ->  X * X          (X is shared, see share_subexprs())
+ *   X ^ N        ->  powi(X, N)     (N integer, 2 <= |N| <= MAX_POWI_EXP)
+ * 
+ * Fused multiply-add (YY_OPTIMIZE_FMA):
+ *   X * Y + Z    ->  fma(X, Y, Z)   (also Z + X * Y)
+ *   X * Y - Z    ->  fma(X, Y, -Z)
+ * 
+ * @param[in,out] stack Stack to update.
+ * @param[in] flags Optimization flags (see yy_optimize_e).
+ * @param[in] start Position of the first token of the (first) operand.
+ * @param[in] pos_y Position of the first token of the right operand (binary operators).
+ * @param[in] pos Position of the operator.
+ * 
+ * @return Position of the node root after the rewrite.
  */
-static void parse_term_datetime(yy_parser_t *parser)
-{ 
-    assert(parser);
+static uint32_t simplify_node(yy_stack_t *stack, uint32_t flags, uint32_t start, uint32_t pos_y, uint32_t pos)
+{
+    yy_token_t *data = stack->data;
+    bool algebraic = (flags & YY_OPTIMIZE_ALGEBRAIC);
 
-    if (parser->error != YY_OK)
-        return;
+    if (is_func_1(&data[pos], func_minus) && is_func_1(&data[pos - 1], func_minus)) {
+        remove_tokens(stack, pos - 1, 1);
+        data[--pos] = symbol_to_token[YY_SYMBOL_PLUS_OP];
+    }
 
-    switch (parser->curr_symbol.type)
+    if (is_func_1(&data[pos], func_ident))
     {
-        case YY_SYMBOL_STRING_VAL:
-            parse_datetime_val(parser);
-            break;
-        case YY_SYMBOL_VARIABLE:
-            consume(parser);
-            break;
-        case YY_SYMBOL_VARIABLE_FUNC:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_string(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_NOW: 
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
-            break;
-        case YY_SYMBOL_DATEADD: 
-        case YY_SYMBOL_DATESET: 
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_datetime(parser);
-            expect(parser, YY_SYMBOL_COMMA);
+        if (!is_number_subtree(stack, pos - 1))
+            return pos;
+
+        remove_tokens(stack, pos, 1);
+        return pos - 1;
+    }
+
+    if (data[pos].type != YY_TOKEN_FUNCTION || data[pos].function.num_args != 2)
+        return pos;
+
+    const yy_token_t *x = (pos_y == start + 1 ? &data[start] : NULL);     // fixed left operand
+    const yy_token_t *y = (pos == pos_y + 1 ? &data[pos_y] : NULL);       // fixed right operand
+
+    if (is_func_2(&data[pos], func_mult))
+    {
+        if (y && is_token_number(y, 1.0))
+            return make_ident(stack, start, pos_y, pos, true);
+
+        if (x && is_token_number(x, 1.0))
+            return make_ident(stack, start, pos_y, pos, false);
+    }
+    else if (is_func_2(&data[pos], func_div))
+    {
+        if (y && is_token_number(y, 1.0))
+            return make_ident(stack, start, pos_y, pos, true);
+
+        if (y && y->type == YY_TOKEN_NUMBER && has_exact_inverse(y->number_val)) {
+            data[pos_y] = token_number(1.0 / y->number_val);
+            data[pos] = symbol_to_token[YY_SYMBOL_PRODUCT_OP];
+            return pos;
+        }
+    }
+    else if (is_func_2(&data[pos], func_addition) || is_func_2(&data[pos], func_subtraction))
+    {
+        bool is_add = is_func_2(&data[pos], func_addition);
+
+        if (y && (is_token_number(y, is_add ? -0.0 : 0.0) || (algebraic && is_token_number(y, is_add ? 0.0 : -0.0))))
+            return make_ident(stack, start, pos_y, pos, true);
+
+        if (is_add && x && (is_token_number(x, -0.0) || (algebraic && is_token_number(x, 0.0))))
+            return make_ident(stack, start, pos_y, pos, false);
+
+        if (is_func_1(&data[pos - 1], func_minus)) {
+            remove_tokens(stack, pos - 1, 1);
+            data[--pos] = symbol_to_token[is_add ? YY_SYMBOL_SUBTRACTION_OP : YY_SYMBOL_ADDITION_OP];
+            return pos;
+        }
+
+        if (!(flags & YY_OPTIMIZE_FMA))
+            return pos;
+
+        if (is_add && !is_func_2(&data[pos_y - 1], func_mult) && is_func_2(&data[pos - 1], func_mult)) {
+            rotate_tokens(data, start, pos_y, pos);
+            pos_y = start + (pos - pos_y);
+        }
+
+        if (!is_func_2(&data[pos_y - 1], func_mult))
+            return pos;
+
+        yy_token_t fma_token = {.type = YY_TOKEN_FUNCTION, .function = make_func(func_fma, 3, YY_OPCODE_CALL)};
+
+        memmove(&data[pos_y - 1], &data[pos_y], (pos - pos_y) * sizeof(yy_token_t));
+
+        if (is_add) {
+            data[pos - 1] = fma_token;
+            remove_tokens(stack, pos, 1);
+            return pos - 1;
+        }
+
+        data[pos - 1] = symbol_to_token[YY_SYMBOL_MINUS_OP];
+        data[pos] = fma_token;
+        return pos;
+    }
+    else if (is_func_2(&data[pos], func_pow) && y && y->type == YY_TOKEN_NUMBER)
+    {
+        double n = y->number_val;
+
+        if (n == 1.0)
+            return make_ident(stack, start, pos_y, pos, true);
+
+        if (!algebraic || n != trunc(n) || fabs(n) > MAX_POWI_EXP || fabs(n) < 2.0)
+            return pos;
+
+        uint32_t len = pos_y - start;
+        bool is_leaf = (len == 1 && data[start].type == YY_TOKEN_SLOT);
+
+        if (n == 2.0 && (is_leaf || is_shareable(stack, start, pos_y - 1)) && stack->len + len - 1 <= stack->reserved)
+        {
+            memmove(&data[pos + len], &data[pos + 1], (stack->len - pos - 1) * sizeof(yy_token_t));
+            memcpy(&data[pos_y], &data[start], len * sizeof(yy_token_t));
+            stack->len += len - 1;
+            pos = pos_y + len;
+            data[pos] = symbol_to_token[YY_SYMBOL_PRODUCT_OP];
+            return pos;
+        }
+
+        data[pos] = (yy_token_t){.type = YY_TOKEN_FUNCTION, .function = make_func(func_powi, 2, YY_OPCODE_CALL)};
+    }
+
+    return pos;
+}
+
+/**
+ * Rewrites arithmetic nodes into cheaper forms (see simplify_node()).
+ * 
+ * Applies to plain stacks (without control tokens).
+ * 
+ * @param[in,out] stack Stack to update.
+ * @param[in] flags Optimization flags (see yy_optimize_e).
+ */
+static void simplify_algebra(yy_stack_t *stack, uint32_t flags)
+{
+    uint32_t starts[MAX_ANALYSIS_DEPTH];    // first token of each pending value
+    uint32_t depth = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+
+        if (token->type == YY_TOKEN_JUMP || token->type == YY_TOKEN_TEMP)
+            return;
+
+        if (token->type != YY_TOKEN_FUNCTION || token->function.num_args == 0)
+        {
+            if (depth >= MAX_ANALYSIS_DEPTH)
+                return;
+
+            starts[depth++] = i;
+            continue;
+        }
+
+        if (depth < token->function.num_args)
+            return;
+
+        depth -= token->function.num_args;
+
+        if (token->function.num_args <= 2)
+            i = simplify_node(stack, flags, starts[depth], starts[depth + token->function.num_args - 1], i);
+
+        depth++;    // starts[depth] is the first token of the function arguments
+    }
+}
+
+/**
+ * Removes the untaken branches of the ifelse having a fixed condition.
+ * 
+ *   ifelse(true, X, Y)   ->  X
+ *   ifelse(false, X, Y)  ->  Y
+ *   ifelse(C, X, Y)      ->  YY_ERROR_VALUE     (C is not a bool)
+ * 
+ * ifelse() converts any error to YY_ERROR_VALUE. When the taken branch 
+ * can return another error (variables), the ifelse is kept and the 
+ * untaken branch is replaced by a YY_ERROR_VALUE token that is never 
+ * evaluated. Dead operands of && and || are removed by reassociate_logic().
+ * 
+ * Applies to plain stacks (without control tokens).
+ * 
+ * @param[in,out] stack Stack to update.
+ * 
+ * @return true if the stack was modified, false otherwise.
+ */
+static bool prune_branches(yy_stack_t *stack)
+{
+    uint32_t starts[MAX_ANALYSIS_DEPTH];    // first token of each pending value
+    uint32_t depth = 0;
+    bool ret = false;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        yy_token_t *data = stack->data;
+
+        if (data[i].type == YY_TOKEN_JUMP || data[i].type == YY_TOKEN_TEMP)
+            return ret;
+
+        if (data[i].type != YY_TOKEN_FUNCTION || data[i].function.num_args == 0)
+        {
+            if (depth >= MAX_ANALYSIS_DEPTH)
+                return ret;
+
+            starts[depth++] = i;
+            continue;
+        }
+
+        if (depth < data[i].function.num_args)
+            return ret;
+
+        depth -= data[i].function.num_args;
+
+        uint32_t pos_c = starts[depth];
+        uint32_t pos_x = (data[i].function.num_args == 3 ? starts[depth + 1] : 0);
+        uint32_t pos_y = (data[i].function.num_args == 3 ? starts[depth + 2] : 0);
+
+        if (data[i].function.ptr != (void (*)(void)) func_ifelse || data[i].function.num_args != 3 || 
+            pos_x != pos_c + 1 || !is_token_fixed_value(data[pos_c].type))
+        {
+            depth++;
+            continue;
+        }
+
+        if (data[pos_c].type != YY_TOKEN_BOOL)
+        {
+            data[pos_c] = token_error(YY_ERROR_VALUE);
+            remove_tokens(stack, pos_c + 1, i - pos_c);
+            i = pos_c;
+            ret = true;
+            depth++;
+            continue;
+        }
+
+        uint32_t start = (data[pos_c].bool_val ? pos_x : pos_y);    // taken branch
+        uint32_t end = (data[pos_c].bool_val ? pos_y : i);
+        const yy_token_t *root = &data[end - 1];
+        bool is_safe = (is_token_fixed_value(root->type) || 
+                        (root->type == YY_TOKEN_ERROR && root->error == YY_ERROR_VALUE) || 
+                        (root->type == YY_TOKEN_FUNCTION && root->function.ptr != (void (*)(void)) func_variable));
+
+        if (is_safe)
+        {
+            memmove(&data[pos_c], &data[start], (end - start) * sizeof(yy_token_t));
+            remove_tokens(stack, pos_c + (end - start), i + 1 - pos_c - (end - start));
+            i = pos_c + (end - start) - 1;
+            ret = true;
+        }
+        else
+        {
+            uint32_t dead = (data[pos_c].bool_val ? pos_y : pos_x);
+            uint32_t len = (data[pos_c].bool_val ? i - pos_y : pos_y - pos_x);
+
+            if (len > 1 || data[dead].type != YY_TOKEN_ERROR)
+            {
+                data[dead] = token_error(YY_ERROR_VALUE);
+                remove_tokens(stack, dead + 1, len - 1);
+                i -= len - 1;
+                ret = true;
+            }
+        }
+
+        depth++;    // starts[depth] is the first token of the function arguments
+    }
+
+    return ret;
+}
+
+/**
+ * Undoes the shared subexpressions and the jumps.
+ * 
+ * Temporaries are replaced by a copy of the stored subtree, so 
+ * the stack can be rewritten and compiled again.
+ * 
+ * @param[in,out] stack Compiled stack.
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_MEM if the expanded stack does not fit,
+ *         YY_ERROR_EVAL if the stack is corrupted.
+ */
+static yy_error_e normalize_stack(yy_stack_t *stack)
+{
+    yy_token_t *data = stack->data;
+    uint32_t len = stack->len;
+
+    // check room before touching the stack
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (uint32_t i = 0; i < stack->len; i++)
+        {
+            if (data[i].type != YY_TOKEN_TEMP)
+                continue;
+
+            uint32_t store = 0;
+
+            while (store < i && !(data[store].type == YY_TOKEN_JUMP && data[store].jump.opcode == YY_OPCODE_STORE && data[store].jump.offset == data[i].temp))
+                store++;
+
+            if (store == 0 || store == i || data[store - 1].type == YY_TOKEN_JUMP)
+                return YY_ERROR_EVAL;
+
+            uint32_t start = get_subtree_start(stack, store - 1);
+            uint32_t num = 0;
+
+            if (start == UINT32_MAX)
+                return YY_ERROR_EVAL;
+
+            for (uint32_t j = start; j < store; j++)
+                num += (data[j].type != YY_TOKEN_JUMP);
+
+            if (pass == 0) {
+                len += num - 1;
+                continue;
+            }
+
+            memmove(&data[i + num], &data[i + 1], (stack->len - i - 1) * sizeof(yy_token_t));
+            stack->len += num - 1;
+
+            for (uint32_t j = start, k = i; j < store; j++)
+                if (data[j].type != YY_TOKEN_JUMP)
+                    data[k++] = data[j];
+
+            i += num - 1;
+        }
+
+        if (len > stack->reserved)
+            return YY_ERROR_MEM;
+    }
+
+    len = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        if (data[i].type == YY_TOKEN_JUMP)
+            continue;
+
+        if (data[i].type == YY_TOKEN_FUNCTION && data[i].function.opcode == YY_OPCODE_IFELSE)
+            data[i].function.opcode = YY_OPCODE_CALL;
+
+        data[len++] = data[i];
+    }
+
+    stack->len = len;
+
+    return YY_OK;
+}
+
+/**
+ * Adds jumps to skip the untaken operands of ifelse, && and ||.
+ * 
+ *   ifelse(c, x, y)  ->  c JUMP_IFELSE(y) x JUMP(ifelse) y IFELSE
+ *   x && y           ->  x JUMP_AND(end) y AND_OP
+ *   x || y           ->  x JUMP_OR(end) y OR_OP
+ * 
+ * Function tokens remain untouched (excepting the ifelse opcode), 
+ * so evaluators ignoring jumps still compute the same result. 
+ * Operands consisting of a single constant are not worth a jump.
+ * Jumps are not added when the stack is full.
+ * 
+ * @param[in,out] stack Compiled stack.
+ */
+static void add_jumps(yy_stack_t *stack)
+{
+    uint32_t starts[MAX_ANALYSIS_DEPTH];    // first token of each pending value
+    uint32_t depth = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        if (stack->data[i].type == YY_TOKEN_JUMP)
+            continue;
+
+        if (stack->data[i].type != YY_TOKEN_FUNCTION || stack->data[i].function.num_args == 0)
+        {
+            if (depth >= MAX_ANALYSIS_DEPTH)
+                return;
+
+            starts[depth++] = i;
+            continue;
+        }
+
+        yy_func_t *func = &stack->data[i].function;
+
+        if (depth < func->num_args)
+            return;
+
+        depth -= func->num_args;
+
+        if (func->ptr == (void (*)(void)) func_ifelse && func->num_args == 3)
+        {
+            uint32_t pos_x = starts[depth + 1];
+            uint32_t pos_y = starts[depth + 2];
+            bool is_trivial = (pos_y == pos_x + 1 && i == pos_y + 1 && 
+                               is_token_fixed_value(stack->data[pos_x].type) && 
+                               is_token_fixed_value(stack->data[pos_y].type));
+
+            if (!is_trivial && stack->len + 2 <= stack->reserved)
+            {
+                insert_token(stack, pos_y, token_jump(YY_OPCODE_JUMP, i + 1 - pos_y));
+                insert_token(stack, pos_x, token_jump(YY_OPCODE_JUMP_IFELSE, pos_y + 2 - pos_x));
+                i += 2;
+                stack->data[i].function.opcode = YY_OPCODE_IFELSE;
+            }
+        }
+        else if ((func->ptr == (void (*)(void)) func_and || func->ptr == (void (*)(void)) func_or) && func->num_args == 2)
+        {
+            uint32_t pos_y = starts[depth + 1];
+            bool is_trivial = (i == pos_y + 1 && is_token_fixed_value(stack->data[pos_y].type));
+            uint8_t opcode = (func->ptr == (void (*)(void)) func_and ? YY_OPCODE_JUMP_AND : YY_OPCODE_JUMP_OR);
+
+            if (!is_trivial && stack->len < stack->reserved)
+            {
+                insert_token(stack, pos_y, token_jump(opcode, i + 2 - pos_y));
+                i++;
+            }
+        }
+
+        depth++;    // starts[depth] is the first token of the function arguments
+    }
+}
+
+/**
+ * Returns the fused opcode of a binary operator.
+ * 
+ * @param[in] token Token to check.
+ * 
+ * @return The fused opcode,
+ *         YY_OPCODE_NULL if operator can't be fused.
+ */
+static uint8_t get_fused_opcode(const yy_token_t *token)
+{
+    if (token->type != YY_TOKEN_FUNCTION || token->function.num_args != 2)
+        return YY_OPCODE_NULL;
+
+    switch (token->function.opcode)
+    {
+        case YY_OPCODE_ADDITION_OP:     return YY_OPCODE_FUSED_ADD;
+        case YY_OPCODE_SUBTRACTION_OP:  return YY_OPCODE_FUSED_SUB;
+        case YY_OPCODE_PRODUCT_OP:      return YY_OPCODE_FUSED_MUL;
+        case YY_OPCODE_DIVIDE_OP:       return YY_OPCODE_FUSED_DIV;
+        case YY_OPCODE_LESS_OP:
+        case YY_OPCODE_LT_NUM:          return YY_OPCODE_FUSED_LT;
+        case YY_OPCODE_LESS_EQUALS_OP:
+        case YY_OPCODE_LE_NUM:          return YY_OPCODE_FUSED_LE;
+        case YY_OPCODE_GREAT_OP:
+        case YY_OPCODE_GT_NUM:          return YY_OPCODE_FUSED_GT;
+        case YY_OPCODE_GREAT_EQUALS_OP:
+        case YY_OPCODE_GE_NUM:          return YY_OPCODE_FUSED_GE;
+        case YY_OPCODE_EQUALS_OP:
+        case YY_OPCODE_EQ_NUM:          return YY_OPCODE_FUSED_EQ;
+        case YY_OPCODE_DISTINCT_OP:
+        case YY_OPCODE_NE_NUM:          return YY_OPCODE_FUSED_NE;
+        default:                        return YY_OPCODE_NULL;
+    }
+}
+
+static bool is_fusable_value(const yy_token_t *token)
+{
+    return (token->type == YY_TOKEN_VARIABLE || token->type == YY_TOKEN_SLOT || 
+            token->type == YY_TOKEN_TEMP || token->type == YY_TOKEN_NUMBER);
+}
+
+static bool is_fused_token(const yy_token_t *token)
+{
+    return (token->type == YY_TOKEN_JUMP && token->jump.opcode >= YY_OPCODE_FUSED_ADD && token->jump.opcode <= YY_OPCODE_FUSED_NE);
+}
+
+/**
+ * Adds superinstructions to the most frequent sequences.
+ * 
+ *   $x 5 LT_NUM    ->  FUSED_LT $x 5 LT_NUM
+ *   $x $y *        ->  FUSED_MUL $x $y *
+ * 
+ * The fused token loads both operands and computes the numeric result 
+ * in a single dispatch, without pushing the operands to the stack. On 
+ * non-numeric operands it pushes them and continues at the operator token. 
+ * Sequences were selected mining the performance dataset (see test/mining.c).
+ * 
+ * The operands are leafs, so no jump lands inside the sequence. Jumps 
+ * crossing the fused token are enlarged, jumps landing on the sequence 
+ * land on the fused token. Sequences are not fused when the stack is full.
+ * 
+ * @param[in,out] stack Compiled stack.
+ */
+static void fuse_stack(yy_stack_t *stack)
+{
+    for (uint32_t i = 0; i + 2 < stack->len && stack->len < stack->reserved; i++)
+    {
+        yy_token_t *data = stack->data;
+        uint8_t opcode = get_fused_opcode(&data[i + 2]);
+
+        if (opcode == YY_OPCODE_NULL || !is_fusable_value(&data[i]) || !is_fusable_value(&data[i + 1]))
+            continue;
+
+        // constants were folded before
+        if (data[i].type == YY_TOKEN_NUMBER && data[i + 1].type == YY_TOKEN_NUMBER)
+            continue;
+
+        for (uint32_t j = 0; j < i; j++)
+        {
+            if (data[j].type != YY_TOKEN_JUMP || data[j].jump.opcode < YY_OPCODE_JUMP || data[j].jump.opcode > YY_OPCODE_JUMP_OR)
+                continue;
+
+            if (j + data[j].jump.offset > i)
+                data[j].jump.offset++;
+        }
+
+        insert_token(stack, i, token_jump(opcode, 3));
+        i += 3;
+    }
+}
+
+/**
+ * Applies the compile passes to a plain stack.
+ * 
+ * @param[in,out] stack Stack to optimize.
+ * @param[in] flags Optimization flags (see yy_optimize_e).
+ */
+static void optimize_stack(yy_stack_t *stack, uint32_t flags)
+{
+    fold_stack(stack, flags);
+    reassociate_stack(stack, flags);
+
+    if (prune_branches(stack)) {
+        fold_stack(stack, flags);
+        reassociate_stack(stack, flags);
+    }
+
+    simplify_algebra(stack, flags);
+    specialize_stack(stack);
+    share_subexprs(stack);
+    add_jumps(stack);
+    fuse_stack(stack);
+}
+
+/**
+ * Finalize parsing.
+ * 
+ * @param[in] parser Parser to update.
+ */
+static void finalize(yy_parser_t *parser)
+{
+    if (parser->error != YY_OK)
+        return;
+
+    if (parser->curr_symbol.type == YY_SYMBOL_END)
+        consume(parser);
+    else
+        parser->error = YY_ERROR_SYNTAX;
+
+    if (parser->error == YY_OK)
+        optimize_stack(parser->stack, 0);
+}
+
+static void init_parser(yy_parser_t *parser, const char *begin, const char *end, yy_stack_t *stack)
+{
+    assert(parser);
+
+    stack->len = 0;
+
+    parser->begin = begin;
+    parser->end = end;
+    parser->curr = begin;
+    parser->stack = stack;
+    parser->operators_len = 0;
+    parser->curr_symbol = (yy_symbol_t){0};
+    parser->prev_symbol = (yy_symbol_t){0};
+    parser->error = (stack && stack->reserved ? YY_OK : YY_ERROR_MEM);
+    parser->recursion_type = 0;
+    parser->recursion_generic = 0;
+
+    consume(parser);
+}
+
+/**
+ * Parse a numeric term.
+ * 
+ * @see Grammar described in docs.
+ * 
+ * @param[in] parser Parser to update.
+ */
+static void parse_term_number(yy_parser_t *parser)
+{
+    assert(parser);
+
+    if (parser->error != YY_OK)
+        return;
+
+    switch (parser->curr_symbol.type)
+    {
+        case YY_SYMBOL_CONST_E:
+        case YY_SYMBOL_CONST_PI:
+        case YY_SYMBOL_CONST_INF:
+        case YY_SYMBOL_CONST_NAN:
+        case YY_SYMBOL_NUMBER_VAL:
+        case YY_SYMBOL_VARIABLE:
+            consume(parser);
+            break;
+        case YY_SYMBOL_VARIABLE_FUNC:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_ABS:
+        case YY_SYMBOL_SQRT:
+        case YY_SYMBOL_SIN:
+        case YY_SYMBOL_COS:
+        case YY_SYMBOL_TAN:
+        case YY_SYMBOL_EXP:
+        case YY_SYMBOL_LOG:
+        case YY_SYMBOL_CEIL:
+        case YY_SYMBOL_FLOOR:
+        case YY_SYMBOL_TRUNC:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_MAX:
+        case YY_SYMBOL_MIN:
+        case YY_SYMBOL_MODULO:
+        case YY_SYMBOL_POWER:
+        case YY_SYMBOL_RANDOM:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_CLAMP:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_PAREN_LEFT:
+            consume(parser);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_ADDITION_OP:
+            if (is_numeric_operator(parser->prev_symbol.type)) {
+                parser->error = YY_ERROR_SYNTAX;
+                break;
+            }
+            parser->curr_symbol.type = YY_SYMBOL_PLUS_OP;
+            consume(parser);
+            parse_expr_number(parser);
+            break;
+        case YY_SYMBOL_SUBTRACTION_OP:
+            if (is_numeric_operator(parser->prev_symbol.type)) {
+                parser->error = YY_ERROR_SYNTAX;
+                break;
+            }
+            parser->curr_symbol.type = YY_SYMBOL_MINUS_OP;
+            consume(parser);
+            parse_expr_number(parser);
+            break;
+        case YY_SYMBOL_LENGTH:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_FIND:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_IFELSE:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_bool(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_DATEPART:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_datetime(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_datepart(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_DATEDIFF:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_datetime(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_datetime(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_datepart(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        default:
+            parser->error = YY_ERROR_SYNTAX;
+    }
+}
+
+/**
+ * Parse a numeric expression until an unrecognized symbol is found.
+ * 
+ * @param[in] Parser object.
+ */
+static void parse_expr_number(yy_parser_t *parser)
+{ 
+    assert(parser);
+
+    if (++(parser->recursion_type) > MAX_RECURSION_TYPE)
+        parser->error = YY_ERROR_EXCD;
+
+EXPR_NUMBER_START:
+
+    parse_term_number(parser);
+
+    if (parser->error != YY_OK)
+        goto EXPR_NUMBER_END;
+
+    switch (parser->curr_symbol.type)
+    {
+        case YY_SYMBOL_ADDITION_OP: 
+        case YY_SYMBOL_SUBTRACTION_OP: 
+        case YY_SYMBOL_PRODUCT_OP: 
+        case YY_SYMBOL_DIVIDE_OP: 
+        case YY_SYMBOL_MODULO_OP: 
+        case YY_SYMBOL_POWER_OP: 
+            consume(parser);
+            goto EXPR_NUMBER_START;
+        default:
+            break;
+    }
+
+EXPR_NUMBER_END:
+
+    assert(parser->recursion_type != 0);
+    parser->recursion_type--;
+}
+
+/**
+ * Parse a string term.
+ * 
+ * @see Grammar described in docs.
+ * 
+ * @param[in] parser Parser to update.
+ */
+static void parse_term_string(yy_parser_t *parser)
+{
+    assert(parser);
+
+    if (parser->error != YY_OK)
+        return;
+
+    switch (parser->curr_symbol.type)
+    {
+        case YY_SYMBOL_STRING_VAL:
+        case YY_SYMBOL_ESCAPED_STRING_VAL:
+        case YY_SYMBOL_VARIABLE:
+            consume(parser);
+            break;
+        case YY_SYMBOL_VARIABLE_FUNC:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_TRIM:
+        case YY_SYMBOL_LOWER:
+        case YY_SYMBOL_UPPER:
+        case YY_SYMBOL_UNESCAPE:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_STR:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_generic(parser, true, false);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_MIN:
+        case YY_SYMBOL_MAX:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_SUBSTR:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_REPLACE:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_IFELSE:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_bool(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_PAREN_LEFT:
+            consume(parser);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        default:
+            parser->error = YY_ERROR_SYNTAX;
+    }
+}
+
+/**
+ * Parse a string expression until an unrecognized symbol is found.
+ * 
+ * @param[in] Parser object.
+ */
+static void parse_expr_string(yy_parser_t *parser)
+{ 
+    assert(parser);
+
+    if (++(parser->recursion_type) > MAX_RECURSION_TYPE)
+        parser->error = YY_ERROR_EXCD;
+
+EXPR_STRING_START:
+
+    parse_term_string(parser);
+
+    if (parser->error != YY_OK)
+        goto EXPR_STRING_END;
+
+    switch (parser->curr_symbol.type)
+    {
+        case YY_SYMBOL_ADDITION_OP: 
+            parser->curr_symbol.type = YY_SYMBOL_CONCAT_OP;
+            consume(parser);
+            goto EXPR_STRING_START;
+        default:
+            break;
+    }
+
+EXPR_STRING_END:
+
+    assert(parser->recursion_type != 0);
+    parser->recursion_type--;
+}
+
+static void parse_expr_by_type(yy_parser_t *parser, yy_token_e type)
+{
+    if (parser->error != YY_OK)
+        return;
+
+    switch (type)
+    {
+        case YY_TOKEN_BOOL: parse_expr_bool(parser); break;
+        case YY_TOKEN_NUMBER: parse_expr_number(parser); break;
+        case YY_TOKEN_DATETIME: parse_expr_datetime(parser); break;
+        case YY_TOKEN_STRING: parse_expr_string(parser); break;
+        default: assert(false); parser->error = YY_ERROR_SYNTAX; break;
+    }
+}
+
+static yy_parser_t save_state(yy_parser_t *parser)
+{
+    yy_parser_t ret = *parser;
+    ret.end = (const char *) (intptr_t) parser->stack->len;
+    return ret;
+}
+
+static void restore_state(yy_parser_t *parser, const yy_parser_t *prev_state)
+{
+    size_t len = sizeof(yy_parser_t) - offsetof(yy_parser_t, curr);
+    memcpy(&parser->curr, &prev_state->curr, len);
+    parser->stack->len = (uint32_t) (intptr_t) prev_state->end;
+}
+
+/**
+ * Parse an expression until an unrecognized symbol is found.
+ * 
+ * In case of error, returns the most serious error found and the error position 
+ * corresponds to the parser that advanced the furthest.
+ * 
+ * @param[in] parser Parser to update.
+ * @param[in] check_bool Checks bool type (to avoid a non-ending loop parsing a bool).
+ * @param[in] do_finalize Flag to finalize.
+ * 
+ * @return YY_TOKEN_BOOL - Parsed bool expression,
+ *         YY_TOKEN_NUMBER - Parsed number expression,
+ *         YY_TOKEN_DATETIME - Parsed datetime expression,
+ *         YY_TOKEN_STRING - Parsed string expression,
+ *         YY_TOKEN_ERROR - Error parsing expression (see parser.error).
+ */
+static yy_token_e parse_expr_generic(yy_parser_t *parser, bool check_bool, bool do_finalize)
+{
+    static const yy_token_e types[] = {YY_TOKEN_BOOL, YY_TOKEN_NUMBER, YY_TOKEN_DATETIME, YY_TOKEN_STRING};
+
+    if (++(parser->recursion_generic) > MAX_RECURSION_GENERIC)
+        parser->error = YY_ERROR_EXCD;
+
+    yy_token_e ret = YY_TOKEN_ERROR;
+    yy_parser_t prev_state = save_state(parser);
+    const char *curr = parser->curr;
+    yy_error_e error = YY_OK;
+
+    if (parser->error != YY_OK)
+        goto EXPR_GENERIC_END;
+
+    for (size_t i = (check_bool ? 0 : 1); i < (sizeof(types)/sizeof(types[0])); i++)
+    {
+        parse_expr_by_type(parser, types[i]);
+
+        if (do_finalize)
+            finalize(parser);
+
+        if (parser->error == YY_OK) {
+            ret = types[i];
+            goto EXPR_GENERIC_END;
+        }
+
+        if (error < parser->error || (error == parser->error && curr < parser->curr)) {
+            error = parser->error;
+            curr = parser->curr;
+        }
+
+        restore_state(parser, &prev_state);
+    }
+
+    parser->error = error;
+    parser->curr = curr;
+    ret = YY_TOKEN_ERROR;
+
+EXPR_GENERIC_END:
+
+    assert(parser->recursion_generic != 0);
+    parser->recursion_generic--;
+
+    return ret;
+}
+
+/**
+ * Parse a bool term.
+ * 
+ * @see Grammar described in docs.
+ * 
+ * @param[in] parser Parser to update.
+ */
+static void parse_term_bool(yy_parser_t *parser)
+{
+    assert(parser);
+
+    if (parser->error != YY_OK)
+        return;
+
+    yy_error_e error = YY_OK;
+    const char *curr = NULL;
+    yy_parser_t prev_state = save_state(parser);
+
+    yy_token_e type = parse_expr_generic(parser, false, false);
+
+    if (type == YY_TOKEN_ERROR && parser->error != YY_ERROR_SYNTAX) // MEM or EXCD
+        return;
+
+    if (type != YY_TOKEN_ERROR)
+    {
+        switch (parser->curr_symbol.type)
+        {
+            case YY_SYMBOL_LESS_OP:
+            case YY_SYMBOL_LESS_EQUALS_OP:
+            case YY_SYMBOL_GREAT_OP:
+            case YY_SYMBOL_GREAT_EQUALS_OP:
+            case YY_SYMBOL_EQUALS_OP:
+            case YY_SYMBOL_DISTINCT_OP:
+                consume(parser);
+                parse_expr_by_type(parser, type);
+                return;
+            default:
+                break;
+        }
+    }
+
+    // save error
+    error = parser->error;
+    curr = parser->curr;
+
+    restore_state(parser, &prev_state);
+
+    switch (parser->curr_symbol.type)
+    {
+        case YY_SYMBOL_TRUE:
+        case YY_SYMBOL_FALSE:
+        case YY_SYMBOL_VARIABLE:
+            consume(parser);
+            break;
+        case YY_SYMBOL_VARIABLE_FUNC:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_NOT:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_bool(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_ISINF:
+        case YY_SYMBOL_ISNAN:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_number(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_ISERROR:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_generic(parser, true, false);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_IFELSE:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_bool(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_bool(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_bool(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_PAREN_LEFT:
+            consume(parser);
+            parse_expr_bool(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        default:
+            parser->error = YY_ERROR_SYNTAX;
+    }
+
+    if (parser->error && (error > parser->error || (error == parser->error && curr > parser->curr))) {
+        parser->error = error;
+        parser->curr = curr;
+    }
+}
+
+/**
+ * Parse a boolean expression until an unrecognized symbol is found.
+ * 
+ * @param[in] Parser object.
+ */
+static void parse_expr_bool(yy_parser_t *parser)
+{ 
+    assert(parser);
+
+    if (++(parser->recursion_type) > MAX_RECURSION_TYPE)
+        parser->error = YY_ERROR_EXCD;
+
+EXPR_BOOL_START:
+
+    parse_term_bool(parser);
+
+    if (parser->error != YY_OK)
+        goto EXPR_BOOL_END;
+
+    switch (parser->curr_symbol.type)
+    {
+        case YY_SYMBOL_AND_OP: 
+        case YY_SYMBOL_OR_OP: 
+        case YY_SYMBOL_EQUALS_OP: 
+        case YY_SYMBOL_DISTINCT_OP: 
+            consume(parser);
+            goto EXPR_BOOL_START;
+        default:
+            break;
+    }
+
+EXPR_BOOL_END:
+
+    assert(parser->recursion_type != 0);
+    parser->recursion_type--;
+}
+
+/**
+ * Parse a datepart identifier.
+ * 
+ * @param[in] Parser object.
+ */
+static void parse_datepart(yy_parser_t *parser)
+{
+    assert(parser);
+
+    int part = -1;
+
+    if (parser->error != YY_OK)
+        return;
+
+    if (parser->curr_symbol.type != YY_SYMBOL_STRING_VAL) {
+        parser->error = YY_ERROR_SYNTAX;
+        return;
+    }
+
+    if ((part = get_datepart(&parser->curr_symbol.str_val)) < 0) {
+        parser->error = YY_ERROR_SYNTAX;
+        return;
+    }
+
+    parser->curr_symbol.type = YY_SYMBOL_NUMBER_VAL;
+    parser->curr_symbol.number_val = (double) part;
+
+    consume(parser);
+}
+
+/**
+ * Parse a datetime value.
+ * 
+ * A datetime value is a double-quoted string containing a datetime.
+ * 
+ * @param[in] Parser object.
+ */
+static void parse_datetime_val(yy_parser_t *parser)
+{
+    assert(parser);
+
+    if (parser->error != YY_OK)
+        return;
+
+    if (parser->curr_symbol.type != YY_SYMBOL_STRING_VAL) {
+        parser->error = YY_ERROR_SYNTAX;
+        return;
+    }
+
+    const char *begin = parser->curr_symbol.str_val.ptr;
+    const char *end = begin + parser->curr_symbol.str_val.len;
+
+    yy_token_t token = yy_parse_datetime(begin, end);
+
+    if (token.type != YY_TOKEN_DATETIME) {
+        parser->error = YY_ERROR_SYNTAX;
+        return;
+    }
+
+    parser->curr_symbol.type = YY_SYMBOL_DATETIME_VAL;
+    parser->curr_symbol.datetime_val = token.datetime_val;
+
+    consume(parser);
+}
+
+/**
+ * Parse a datetime term.
+ * 
+ * @param[in] Parser object.
+ */
+static void parse_term_datetime(yy_parser_t *parser)
+{ 
+    assert(parser);
+
+    if (parser->error != YY_OK)
+        return;
+
+    switch (parser->curr_symbol.type)
+    {
+        case YY_SYMBOL_STRING_VAL:
+            parse_datetime_val(parser);
+            break;
+        case YY_SYMBOL_VARIABLE:
+            consume(parser);
+            break;
+        case YY_SYMBOL_VARIABLE_FUNC:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_string(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_NOW: 
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_DATEADD: 
+        case YY_SYMBOL_DATESET: 
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_datetime(parser);
+            expect(parser, YY_SYMBOL_COMMA);
             parse_expr_number(parser);
             expect(parser, YY_SYMBOL_COMMA);
-            parse_datepart(parser);
+            parse_datepart(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_DATETRUNC: 
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_datetime(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_datepart(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_MIN: 
+        case YY_SYMBOL_MAX: 
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_datetime(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_datetime(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_CLAMP:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_datetime(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_datetime(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_datetime(parser);
+            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+            break;
+        case YY_SYMBOL_IFELSE:
+            consume(parser);
+            expect(parser, YY_SYMBOL_PAREN_LEFT);
+            parse_expr_bool(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_datetime(parser);
+            expect(parser, YY_SYMBOL_COMMA);
+            parse_expr_datetime(parser);
             expect(parser, YY_SYMBOL_PAREN_RIGHT);
             break;
-        case YY_SYMBOL_DATETRUNC: 
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_datetime(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_datepart(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+        default:
+            parser->error = YY_ERROR_SYNTAX;
+    }
+}
+
+/**
+ * Parse a datetime expression until an unrecognized symbol is found.
+ * 
+ * @param[in] Parser object.
+ */
+INLINE
+static void parse_expr_datetime(yy_parser_t *parser)
+{
+    if (++(parser->recursion_type) > MAX_RECURSION_TYPE)
+        parser->error = YY_ERROR_EXCD;
+
+    parse_term_datetime(parser);
+
+    assert(parser->recursion_type != 0);
+    parser->recursion_type--;
+}
+
+yy_error_e yy_compile_number(const char *begin, const char *end, yy_stack_t *stack, const char **err)
+{
+    if (!begin || !end || begin > end || !stack || !stack->data)
+        return YY_ERROR;
+
+    yy_parser_t parser;
+
+    init_parser(&parser, begin, end, stack);
+    parse_expr_number(&parser);
+    finalize(&parser);
+
+    if (err && parser.error != YY_OK)
+        *err = parser.curr;
+
+    return parser.error;
+}
+
+yy_error_e yy_compile_datetime(const char *begin, const char *end, yy_stack_t *stack, const char **err)
+{
+    if (!begin || !end || begin > end || !stack || !stack->data)
+        return YY_ERROR;
+
+    yy_parser_t parser;
+
+    init_parser(&parser, begin, end, stack);
+    parse_expr_datetime(&parser);
+    finalize(&parser);
+
+    if (err && parser.error != YY_OK)
+        *err = parser.curr;
+
+    return parser.error;
+}
+
+yy_error_e yy_compile_string(const char *begin, const char *end, yy_stack_t *stack, const char **err)
+{
+    if (!begin || !end || begin > end || !stack || !stack->data)
+        return YY_ERROR;
+
+    yy_parser_t parser;
+
+    init_parser(&parser, begin, end, stack);
+    parse_expr_string(&parser);
+    finalize(&parser);
+
+    if (err && parser.error != YY_OK)
+        *err = parser.curr;
+
+    return parser.error;
+}
+
+yy_error_e yy_compile_bool(const char *begin, const char *end, yy_stack_t *stack, const char **err)
+{
+    if (!begin || !end || begin > end || !stack || !stack->data)
+        return YY_ERROR;
+
+    yy_parser_t parser;
+
+    init_parser(&parser, begin, end, stack);
+    parse_expr_bool(&parser);
+    finalize(&parser);
+
+    if (err && parser.error != YY_OK)
+        *err = parser.curr;
+
+    return parser.error;
+}
+
+yy_error_e yy_compile(const char *begin, const char *end, yy_stack_t *stack, const char **err)
+{
+    if (!begin || !end || begin > end || !stack || !stack->data)
+        return YY_ERROR;
+
+    yy_parser_t parser;
+
+    init_parser(&parser, begin, end, stack);
+    parse_expr_generic(&parser, true, true);
+
+    if (err && parser.error != YY_OK)
+        *err = parser.curr;
+
+    return parser.error;
+}
+
+yy_error_e yy_optimize_stack(yy_stack_t *stack, uint32_t flags)
+{
+    if (!stack || !stack->data || !stack->len)
+        return YY_ERROR;
+
+    yy_error_e rc = normalize_stack(stack);
+
+    if (rc != YY_OK)
+        return rc;
+
+    optimize_stack(stack, flags);
+
+    return YY_OK;
+}
+
+yy_error_e yy_partial_eval_stack(const yy_stack_t *stack, yy_stack_t *output, yy_token_t (*resolve)(yy_str_t var, void *data), void *data, uint32_t flags)
+{
+    if (!stack || !stack->data || !stack->len || !output || !output->data || !resolve)
+        return YY_ERROR;
+
+    if (output->reserved < stack->len)
+        return YY_ERROR_MEM;
+
+    if (output->data != stack->data)
+        memcpy(output->data, stack->data, stack->len * sizeof(yy_token_t));
+
+    output->len = stack->len;
+
+    yy_error_e rc = normalize_stack(output);
+
+    if (rc != YY_OK)
+        return rc;
+
+    for (uint32_t i = 0; i < output->len; i++)
+    {
+        if (output->data[i].type != YY_TOKEN_VARIABLE)
+            continue;
+
+        yy_token_t value = resolve(output->data[i].variable, data);
+
+        // unknown variables are resolved at eval time
+        if (value.type == YY_TOKEN_ERROR && (value.error == YY_ERROR_REF || is_blocking_error(value.error)))
+            continue;
+
+        if (is_token_fixed_value(value.type) || value.type == YY_TOKEN_ERROR)
+            output->data[i] = value;
+    }
+
+    optimize_stack(output, flags);
+
+    return YY_OK;
+}
+
+// --- Range analysis (interval arithmetic)
+
+#define range_any()     (yy_range_t){ .type = YY_TOKEN_NULL , .min = -INFINITY, .max = INFINITY , .maybe_nan = true , .maybe_error = true }
+#define range_error()   (yy_range_t){ .type = YY_TOKEN_ERROR, .min = INFINITY , .max = -INFINITY, .maybe_nan = false, .maybe_error = true }
+
+// empty interval (min > max) means that the only non-error value is NaN
+static yy_range_t range_number(double min, double max, bool maybe_nan, bool maybe_error)
+{
+    if (!(min <= max) && !maybe_nan)
+        return range_error();
+
+    return (yy_range_t){ .type = YY_TOKEN_NUMBER, .min = min, .max = max, .maybe_nan = maybe_nan, .maybe_error = maybe_error };
+}
+
+static yy_range_t range_bool(bool can_be_false, bool can_be_true, bool maybe_error)
+{
+    if (!can_be_false && !can_be_true)
+        return range_error();
+
+    return (yy_range_t){ .type = YY_TOKEN_BOOL, .min = (can_be_false ? 0 : 1), .max = (can_be_true ? 1 : 0), .maybe_nan = false, .maybe_error = maybe_error };
+}
+
+// unbounded values of the given type
+static yy_range_t range_type(yy_token_e type, bool maybe_error)
+{
+    switch (type)
+    {
+        case YY_TOKEN_NULL: return range_any();
+        case YY_TOKEN_ERROR: return range_error();
+        case YY_TOKEN_BOOL: return range_bool(true, true, maybe_error);
+        case YY_TOKEN_NUMBER: return range_number(-INFINITY, INFINITY, true, maybe_error);
+        default: return (yy_range_t){ .type = type, .min = -INFINITY, .max = INFINITY, .maybe_nan = false, .maybe_error = maybe_error };
+    }
+}
+
+static yy_range_t range_union(const yy_range_t *x, const yy_range_t *y)
+{
+    yy_range_t ret = *x;
+
+    if (x->type == YY_TOKEN_ERROR || y->type == YY_TOKEN_ERROR) {
+        ret = (x->type == YY_TOKEN_ERROR ? *y : *x);
+        ret.maybe_error = true;
+        return ret;
+    }
+
+    if (x->type != y->type)
+        return range_any();
+
+    ret.min = MIN(x->min, y->min);
+    ret.max = MAX(x->max, y->max);
+    ret.maybe_nan = x->maybe_nan || y->maybe_nan;
+    ret.maybe_error = x->maybe_error || y->maybe_error;
+
+    return ret;
+}
+
+// rounding errors of libm functions
+static yy_range_t range_widen(yy_range_t range)
+{
+    range.min = nextafter(range.min, -INFINITY);
+    range.max = nextafter(range.max, INFINITY);
+    return range;
+}
+
+INLINE
+static bool is_range_empty(const yy_range_t *range)
+{
+    return !(range->min <= range->max);
+}
+
+// arguments of numeric functions (unknown values are numbers or errors)
+static bool to_number(yy_range_t *range)
+{
+    if (range->type == YY_TOKEN_NULL)
+        *range = range_number(-INFINITY, INFINITY, true, true);
+
+    return (range->type == YY_TOKEN_NUMBER);
+}
+
+// arguments of boolean functions (unknown values are bools or errors)
+static bool to_bool(yy_range_t *range)
+{
+    if (range->type == YY_TOKEN_NULL)
+        *range = range_bool(true, true, true);
+
+    return (range->type == YY_TOKEN_BOOL);
+}
+
+static const yy_domain_t * find_domain(const yy_domain_t *domains, uint32_t num_domains, const yy_token_t *token)
+{
+    if (token->type == YY_TOKEN_SLOT)
+        return (token->slot < num_domains ? &domains[token->slot] : NULL);
+
+    for (uint32_t i = 0; i < num_domains; i++)
+        if (domains[i].name.len == token->variable.len && strncmp(domains[i].name.ptr, token->variable.ptr, token->variable.len) == 0)
+            return &domains[i];
+
+    return NULL;
+}
+
+/**
+ * Computes the range of a value token.
+ * 
+ * @param[in] token Value token (fixed value, variable, slot or error).
+ * @param[in] domains Variable domains.
+ * @param[in] num_domains Number of domains.
+ * @param[out] range Range of the token.
+ * 
+ * @return true on success, false if token is not a value.
+ */
+static bool range_value(const yy_token_t *token, const yy_domain_t *domains, uint32_t num_domains, yy_range_t *range)
+{
+    const yy_domain_t *domain = NULL;
+
+    switch (token->type)
+    {
+        case YY_TOKEN_BOOL:
+            *range = range_bool(!token->bool_val, token->bool_val, false);
+            return true;
+        case YY_TOKEN_NUMBER:
+            if (isnan(token->number_val))
+                *range = range_number(INFINITY, -INFINITY, true, false);
+            else
+                *range = range_number(token->number_val, token->number_val, false, false);
+            return true;
+        case YY_TOKEN_DATETIME:
+        case YY_TOKEN_STRING:
+            *range = range_type(token->type, false);
+            return true;
+        case YY_TOKEN_ERROR:
+            *range = range_error();
+            return true;
+        case YY_TOKEN_VARIABLE:
+        case YY_TOKEN_SLOT:
+            domain = find_domain(domains, num_domains, token);
+            *range = (domain ? domain->range : range_any());
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Computes the range of a binary function over a set of points.
+ * The function must be monotone on each argument between points.
+ */
+static yy_range_t range_corners(yy_func_2 func, const double *xs, uint32_t nx, const double *ys, uint32_t ny, bool maybe_error)
+{
+    double min = INFINITY;
+    double max = -INFINITY;
+
+    for (uint32_t i = 0; i < nx; i++)
+    {
+        for (uint32_t j = 0; j < ny; j++)
+        {
+            double val = func(token_number(xs[i]), token_number(ys[j])).number_val;
+
+            if (isnan(val))
+                return range_number(-INFINITY, INFINITY, true, maybe_error);
+
+            min = MIN(min, val);
+            max = MAX(max, val);
+        }
+    }
+
+    return range_number(min, max, false, maybe_error);
+}
+
+// x and y are non-empty numbers
+static yy_range_t range_arith(yy_func_2 func, const yy_range_t *x, const yy_range_t *y)
+{
+    bool maybe_error = x->maybe_error || y->maybe_error;
+    double xs[] = {x->min, x->max};
+    double ys[] = {y->min, y->max};
+
+    // 0/0, 0*inf
+    if ((func == func_div && y->min <= 0 && 0 <= y->max) || 
+        (func == func_mult && x->min <= 0 && 0 <= x->max && (isinf(y->min) || isinf(y->max))) || 
+        (func == func_mult && y->min <= 0 && 0 <= y->max && (isinf(x->min) || isinf(x->max))))
+        return range_number(-INFINITY, INFINITY, true, maybe_error);
+
+    yy_range_t ret = range_corners(func, xs, 2, ys, 2, maybe_error);
+
+    ret.maybe_nan = ret.maybe_nan || x->maybe_nan || y->maybe_nan;
+
+    return ret;
+}
+
+// x and y are numbers
+static yy_range_t range_pow(yy_func_2 func, const yy_range_t *x, const yy_range_t *y)
+{
+    bool maybe_error = x->maybe_error || y->maybe_error;
+    bool is_int = (y->min == y->max && y->min == trunc(y->min));
+
+    // pow(NaN, 0) = 1
+    if (x->maybe_nan || y->maybe_nan || is_range_empty(x) || is_range_empty(y))
+        return range_number(-INFINITY, INFINITY, true, maybe_error);
+
+    // monotone on each argument
+    if (x->min > 0 || (x->min == 0 && y->min >= 0)) {
+        double xs[] = {x->min, x->max};
+        double ys[] = {y->min, y->max};
+        return range_widen(range_corners(func, xs, 2, ys, 2, maybe_error));
+    }
+
+    // integer exponent, monotone on each side of zero
+    if (is_int) {
+        double xs[] = {x->min, MIN(x->max, -0.0), MAX(x->min, 0.0), x->max};
+        uint32_t from = (x->max < 0 ? 0 : x->min >= 0 ? 2 : 0);
+        uint32_t num = (x->max < 0 || x->min >= 0 ? 2 : 4);
+        double ys[] = {y->min};
+        return range_widen(range_corners(func, xs + from, num, ys, 1, maybe_error));
+    }
+
+    return range_number(-INFINITY, INFINITY, true, maybe_error);
+}
+
+/**
+ * Computes the range of a function returning a number (or a bool 
+ * checking a number) whose arguments are numbers.
+ * 
+ * @param[in] func Function.
+ * @param[in,out] args Ranges of the arguments.
+ * 
+ * @return The range of the result.
+ */
+static yy_range_t range_numeric(const yy_func_t *func, yy_range_t *args)
+{
+    #define IS_FUNC(func_) (func->ptr == (void (*)(void)) (func_))
+
+    const yy_range_t *x = &args[0];
+    bool maybe_error = false;
+    bool maybe_nan = false;
+
+    for (uint32_t j = 0; j < func->num_args; j++)
+    {
+        if (!to_number(&args[j]))
+            return range_error();
+
+        maybe_error = maybe_error || args[j].maybe_error;
+        maybe_nan = maybe_nan || args[j].maybe_nan;
+    }
+
+    if (IS_FUNC(func_isnan))
+        return range_bool(!is_range_empty(x), x->maybe_nan, maybe_error);
+
+    if (IS_FUNC(func_isinf))
+        return range_bool(x->maybe_nan || (!is_range_empty(x) && !(x->min == x->max && isinf(x->min))), 
+                          !is_range_empty(x) && (isinf(x->min) || isinf(x->max)), maybe_error);
+
+    if (IS_FUNC(func_pow) || IS_FUNC(func_powi))
+        return range_pow((yy_func_2) func->ptr, x, &args[1]);
+
+    // remaining functions return NaN when an argument is NaN
+    for (uint32_t j = 0; j < func->num_args; j++)
+        if (is_range_empty(&args[j]))
+            return range_number(INFINITY, -INFINITY, true, maybe_error);
+
+    yy_range_t ret = range_number(-INFINITY, INFINITY, true, maybe_error);
+
+    if (IS_FUNC(func_ident))
+        ret = *x;
+    else if (IS_FUNC(func_minus))
+        ret = range_number(-x->max, -x->min, false, maybe_error);
+    else if (IS_FUNC(func_abs))
+        ret = (x->min >= 0 ? range_number(x->min, x->max, false, maybe_error) : 
+               x->max <= 0 ? range_number(-x->max, -x->min, false, maybe_error) : 
+               range_number(0, MAX(-x->min, x->max), false, maybe_error));
+    else if (IS_FUNC(func_ceil))
+        ret = range_number(ceil(x->min), ceil(x->max), false, maybe_error);
+    else if (IS_FUNC(func_floor))
+        ret = range_number(floor(x->min), floor(x->max), false, maybe_error);
+    else if (IS_FUNC(func_trunc))
+        ret = range_number(trunc(x->min), trunc(x->max), false, maybe_error);
+    else if (IS_FUNC(func_sqrt))
+        ret = range_number(sqrt(MAX(x->min, 0)), (x->max < 0 ? -INFINITY : sqrt(x->max)), x->min < 0, maybe_error);
+    else if (IS_FUNC(func_exp))
+        ret = range_widen(range_number(exp(x->min), exp(x->max), false, maybe_error));
+    else if (IS_FUNC(func_log))
+        ret = range_widen(range_number(log(MAX(x->min, 0)), (x->max < 0 ? -INFINITY : log(x->max)), x->min < 0, maybe_error));
+    else if (IS_FUNC(func_sin) || IS_FUNC(func_cos))
+        ret = range_number(-1, 1, isinf(x->min) || isinf(x->max), maybe_error);
+    else if (IS_FUNC(func_tan))
+        ret = range_number(-INFINITY, INFINITY, isinf(x->min) || isinf(x->max), maybe_error);
+    else if (IS_FUNC(func_addition) || IS_FUNC(func_subtraction) || IS_FUNC(func_mult) || IS_FUNC(func_div))
+        ret = range_arith((yy_func_2) func->ptr, x, &args[1]);
+    else if (IS_FUNC(func_mod))
+    {
+        // sign of x, and |fmod(x,y)| < |y|
+        const yy_range_t *y = &args[1];
+        double m = MAX(fabs(y->min), fabs(y->max));
+        bool is_nan = (isinf(x->min) || isinf(x->max) || (y->min <= 0 && 0 <= y->max));
+
+        ret = range_number((x->min >= 0 ? 0 : MAX(x->min, -m)), (x->max <= 0 ? 0 : MIN(x->max, m)), is_nan, maybe_error);
+    }
+    else if (IS_FUNC(func_fma))
+    {
+        // x * y is rounded once (product bounds are widened)
+        yy_range_t prod = range_widen(range_arith(func_mult, x, &args[1]));
+
+        if (!prod.maybe_nan)
+            ret = range_arith(func_addition, &prod, &args[2]);
+    }
+
+    ret.maybe_nan = ret.maybe_nan || maybe_nan;
+
+    return ret;
+
+    #undef IS_FUNC
+}
+
+// lt, le, gt, ge, eq, ne
+static yy_range_t range_compare(const yy_func_t *func, const yy_range_t *x, const yy_range_t *y)
+{
+    #define IS_FUNC(func_) (func->ptr == (void (*)(void)) (func_))
+
+    bool maybe_error = x->maybe_error || y->maybe_error;
+    bool is_eq = (IS_FUNC(func_eq) || IS_FUNC(func_ne));
+
+    if (x->type == YY_TOKEN_ERROR || y->type == YY_TOKEN_ERROR)
+        return range_error();
+
+    if (x->type == YY_TOKEN_NULL || y->type == YY_TOKEN_NULL)
+        return range_bool(true, true, true);
+
+    if (x->type != y->type || (x->type == YY_TOKEN_BOOL && !is_eq))
+        return range_error();
+
+    if (x->type != YY_TOKEN_NUMBER && x->type != YY_TOKEN_BOOL)
+        return range_bool(true, true, maybe_error);
+
+    // x > y is y < x
+    const yy_range_t *a = (IS_FUNC(func_gt) || IS_FUNC(func_ge) ? y : x);
+    const yy_range_t *b = (IS_FUNC(func_gt) || IS_FUNC(func_ge) ? x : y);
+    bool maybe_nan = (a->maybe_nan || b->maybe_nan);
+    bool is_empty = (is_range_empty(a) || is_range_empty(b));
+
+    if (IS_FUNC(func_lt) || IS_FUNC(func_gt))
+        return range_bool(maybe_nan || a->max >= b->min, !is_empty && a->min < b->max, maybe_error);
+
+    if (IS_FUNC(func_le) || IS_FUNC(func_ge))
+        return range_bool(maybe_nan || a->max > b->min, !is_empty && a->min <= b->max, maybe_error);
+
+    bool can_be_equal = (!is_empty && a->min <= b->max && b->min <= a->max);
+    bool can_be_distinct = (maybe_nan || !(a->min == a->max && b->min == b->max && a->min == b->min));
+
+    if (IS_FUNC(func_eq))
+        return range_bool(can_be_distinct, can_be_equal, maybe_error);
+    else
+        return range_bool(can_be_equal, can_be_distinct, maybe_error);
+
+    #undef IS_FUNC
+}
+
+// not, and, or, ifelse
+static yy_range_t range_logic(const yy_func_t *func, yy_range_t *args)
+{
+    #define IS_FUNC(func_) (func->ptr == (void (*)(void)) (func_))
+
+    yy_range_t *x = &args[0];
+
+    if (!to_bool(x))
+        return range_error();
+
+    bool x_false = (x->min == 0);
+    bool x_true = (x->max == 1);
+
+    if (IS_FUNC(func_not))
+        return range_bool(x_true, x_false, x->maybe_error);
+
+    if (IS_FUNC(func_ifelse))
+    {
+        yy_range_t ret = (x_true ? args[1] : args[2]);
+
+        if (x_true && x_false)
+            ret = range_union(&args[1], &args[2]);
+
+        ret.maybe_error = ret.maybe_error || x->maybe_error;
+        return ret;
+    }
+
+    // y is evaluated when x does not decide the result
+    yy_range_t *y = &args[1];
+    bool is_bool = to_bool(y);
+    bool y_false = (is_bool && y->min == 0);
+    bool y_true = (is_bool && y->max == 1);
+    bool y_error = (!is_bool || y->maybe_error);
+
+    if (IS_FUNC(func_and))
+        return range_bool(x_false || y_false, x_true && y_true, x->maybe_error || (x_true && y_error));
+    else
+        return range_bool(x_false && y_false, x_true || y_true, x->maybe_error || (x_false && y_error));
+
+    #undef IS_FUNC
+}
+
+// min, max, clamp
+static yy_range_t range_minmax(const yy_func_t *func, yy_range_t *args)
+{
+    #define IS_FUNC(func_) (func->ptr == (void (*)(void)) (func_))
+
+    yy_token_e type = YY_TOKEN_NULL;
+    bool maybe_error = false;
+
+    for (uint32_t j = 0; j < func->num_args; j++)
+    {
+        if (args[j].type == YY_TOKEN_ERROR || (type != YY_TOKEN_NULL && args[j].type != YY_TOKEN_NULL && args[j].type != type))
+            return range_error();
+
+        type = (args[j].type != YY_TOKEN_NULL ? args[j].type : type);
+        maybe_error = maybe_error || args[j].maybe_error || args[j].type == YY_TOKEN_NULL;
+    }
+
+    if (type == YY_TOKEN_BOOL || (type == YY_TOKEN_STRING && IS_FUNC(func_clamp)))
+        return range_error();
+
+    // no datetime bounds, so clamp() vmin > vmax (error) can't be discarded
+    if (type != YY_TOKEN_NUMBER)
+        return range_type(type, maybe_error || IS_FUNC(func_clamp));
+
+    for (uint32_t j = 0; j < func->num_args; j++)
+        to_number(&args[j]);
+
+    const yy_range_t *x = &args[0];
+    const yy_range_t *y = &args[1];
+
+    if (IS_FUNC(func_clamp))
+    {
+        const yy_range_t *vmin = &args[1];
+        const yy_range_t *vmax = &args[2];
+
+        // bounds are unknown, so vmin > vmax (error) can't be discarded
+        if (vmin->maybe_nan || vmax->maybe_nan || is_range_empty(vmin) || is_range_empty(vmax))
+            return range_number(-INFINITY, INFINITY, true, true);
+
+        // monotone on each argument when vmin <= vmax (otherwise error)
+        return range_number(MIN(MAX(x->min, vmin->min), vmax->min), MIN(MAX(x->max, vmin->max), vmax->max), 
+                            x->maybe_nan, maybe_error || vmin->max > vmax->min);
+    }
+
+    // fmin(NaN, y) = y
+    double min = (IS_FUNC(func_min) ? MIN(x->min, y->min) : MAX(x->min, y->min));
+    double max = (IS_FUNC(func_min) ? MIN(x->max, y->max) : MAX(x->max, y->max));
+
+    if (x->maybe_nan) {
+        min = MIN(min, y->min);
+        max = MAX(max, y->max);
+    }
+
+    if (y->maybe_nan) {
+        min = MIN(min, x->min);
+        max = MAX(max, x->max);
+    }
+
+    return range_number(min, max, x->maybe_nan && y->maybe_nan, maybe_error);
+
+    #undef IS_FUNC
+}
+
+/**
+ * Computes the range of a function result.
+ * 
+ * @param[in] func Function.
+ * @param[in,out] args Ranges of the arguments (num_args values).
+ * 
+ * @return The range of the result.
+ */
+static yy_range_t range_func(const yy_func_t *func, yy_range_t *args)
+{
+    #define IS_FUNC(func_) (func->ptr == (void (*)(void)) (func_))
+
+    // blocking errors are not caught
+    if (IS_FUNC(func_iserror))
+        return range_bool(args[0].type != YY_TOKEN_ERROR, args[0].maybe_error, args[0].maybe_error);
+
+    if (IS_FUNC(func_not) || IS_FUNC(func_and) || IS_FUNC(func_or) || IS_FUNC(func_ifelse))
+        return range_logic(func, args);
+
+    if (IS_FUNC(func_lt) || IS_FUNC(func_le) || IS_FUNC(func_gt) || IS_FUNC(func_ge) || IS_FUNC(func_eq) || IS_FUNC(func_ne))
+        return range_compare(func, &args[0], &args[1]);
+
+    if (IS_FUNC(func_min) || IS_FUNC(func_max) || IS_FUNC(func_clamp))
+        return range_minmax(func, args);
+
+    if (IS_FUNC(func_ident) || IS_FUNC(func_minus) || IS_FUNC(func_abs) || IS_FUNC(func_ceil) || IS_FUNC(func_floor) || 
+        IS_FUNC(func_trunc) || IS_FUNC(func_sqrt) || IS_FUNC(func_exp) || IS_FUNC(func_log) || IS_FUNC(func_sin) || 
+        IS_FUNC(func_cos) || IS_FUNC(func_tan) || IS_FUNC(func_isinf) || IS_FUNC(func_isnan) || IS_FUNC(func_addition) || 
+        IS_FUNC(func_subtraction) || IS_FUNC(func_mult) || IS_FUNC(func_div) || IS_FUNC(func_mod) || IS_FUNC(func_pow) || 
+        IS_FUNC(func_powi) || IS_FUNC(func_fma))
+        return range_numeric(func, args);
+
+    // other functions, only the result type is known
+    yy_token_e types[3] = {YY_TOKEN_NULL, YY_TOKEN_NULL, YY_TOKEN_NULL};
+
+    for (uint32_t j = 0; j < func->num_args && j < 3; j++)
+        types[j] = (args[j].type == YY_TOKEN_ERROR ? YY_TOKEN_NULL : args[j].type);
+
+    return range_type(get_func_type(func, types), true);
+
+    #undef IS_FUNC
+}
+
+/**
+ * Replaces the subexpressions having a fixed value in the given 
+ * domains by this value.
+ * 
+ * Applies to plain stacks (without control tokens).
+ * 
+ * @param[in,out] stack Stack to update.
+ * @param[in] domains Variable domains.
+ * @param[in] num_domains Number of domains.
+ */
+static void narrow_stack(yy_stack_t *stack, const yy_domain_t *domains, uint32_t num_domains)
+{
+    yy_range_t values[MAX_ANALYSIS_DEPTH];
+    uint32_t starts[MAX_ANALYSIS_DEPTH];    // first token of each pending value
+    uint32_t depth = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        yy_token_t *data = stack->data;
+        uint32_t start = i;
+        yy_range_t range;
+
+        if (data[i].type == YY_TOKEN_FUNCTION)
+        {
+            if (depth < data[i].function.num_args)
+                return;
+
+            depth -= data[i].function.num_args;
+            start = (data[i].function.num_args ? starts[depth] : i);
+            range = range_func(&data[i].function, &values[depth]);
+        }
+        else if (!range_value(&data[i], domains, num_domains, &range))
+            return;
+
+        if (depth >= MAX_ANALYSIS_DEPTH)
+            return;
+
+        bool is_fixed = (!range.maybe_error && range.min == range.max && 
+                         (range.type == YY_TOKEN_BOOL || (range.type == YY_TOKEN_NUMBER && !range.maybe_nan && range.min != 0)));
+
+        if (is_fixed && !is_token_fixed_value(data[i].type))
+        {
+            data[start] = (range.type == YY_TOKEN_BOOL ? token_bool(range.min == 1) : token_number(range.min));
+            remove_tokens(stack, start + 1, i - start);
+            i = start;
+        }
+
+        values[depth] = range;
+        starts[depth] = start;
+        depth++;
+    }
+}
+
+yy_error_e yy_eval_stack_range(const yy_stack_t *stack, const yy_domain_t *domains, uint32_t num_domains, yy_range_t *result)
+{
+    if (!stack || !stack->data || !stack->len || (num_domains && !domains) || !result)
+        return YY_ERROR;
+
+    yy_range_t values[MAX_ANALYSIS_DEPTH];
+    yy_range_t temps[MAX_ANALYSIS_DEPTH];
+    uint32_t depth = 0;
+    uint32_t num_temps = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+
+        if (token->type == YY_TOKEN_JUMP)
+        {
+            if (token->jump.opcode == YY_OPCODE_FRAME)
+            {
+                if (i != 0)
+                    return YY_ERROR_EVAL;
+
+                if (token->jump.offset > MAX_ANALYSIS_DEPTH)
+                    return YY_ERROR_EXCD;
+
+                num_temps = token->jump.offset;
+            }
+            else if (token->jump.opcode == YY_OPCODE_STORE)
+            {
+                if (depth == 0 || token->jump.offset >= num_temps)
+                    return YY_ERROR_EVAL;
+
+                temps[token->jump.offset] = values[depth - 1];
+            }
+
+            // jumps are ignored (untaken operands don't change the result)
+            continue;
+        }
+
+        if (token->type == YY_TOKEN_FUNCTION)
+        {
+            if (depth < token->function.num_args)
+                return YY_ERROR_EVAL;
+
+            depth -= token->function.num_args;
+        }
+
+        if (depth >= MAX_ANALYSIS_DEPTH)
+            return YY_ERROR_EXCD;
+
+        if (token->type == YY_TOKEN_FUNCTION)
+            values[depth] = range_func(&token->function, &values[depth]);
+        else if (token->type == YY_TOKEN_TEMP && token->temp < num_temps)
+            values[depth] = temps[token->temp];
+        else if (!range_value(token, domains, num_domains, &values[depth]))
+            return YY_ERROR_EVAL;
+
+        depth++;
+    }
+
+    if (depth != 1)
+        return YY_ERROR_EVAL;
+
+    *result = values[0];
+
+    return YY_OK;
+}
+
+yy_error_e yy_narrow_stack(yy_stack_t *stack, const yy_domain_t *domains, uint32_t num_domains, uint32_t flags)
+{
+    if (!stack || !stack->data || !stack->len || (num_domains && !domains))
+        return YY_ERROR;
+
+    yy_error_e rc = normalize_stack(stack);
+
+    if (rc != YY_OK)
+        return rc;
+
+    narrow_stack(stack, domains, num_domains);
+    optimize_stack(stack, flags);
+
+    return YY_OK;
+}
+
+INLINE
+static uint8_t get_opcode(const yy_token_t *token)
+{
+    uint8_t opcode = (token->type == YY_TOKEN_FUNCTION ? token->function.opcode : 
+                      token->type == YY_TOKEN_JUMP ? token->jump.opcode : (uint8_t) token->type);
+
+    return (likely(opcode < YY_OPCODE_END) ? opcode : YY_OPCODE_NULL);
+}
+
+/*
+ * Dispatch macros used by the evaluator.
+ * 
+ * Using computed goto (GCC extension) each opcode jumps directly to the 
+ * next one (direct threading). Otherwise a switch inside a loop is used.
+ * Define NO_COMPUTED_GOTO to force the switch.
+ */
+#if (defined(__GNUC__) || defined(__clang__) || defined(__INTEL_LLVM_COMPILER)) && !defined(NO_COMPUTED_GOTO)
+    #define USE_COMPUTED_GOTO
+#endif
+
+#ifdef USE_COMPUTED_GOTO
+    #define VM_DISPATCH()   goto *labels[get_opcode(&stack->data[i])];
+    #define VM_CASE(op_)    LABEL_##op_
+    #define VM_NEXT()       do { if (++i == stack->len) goto VM_END; goto *labels[get_opcode(&stack->data[i])]; } while (0)
+    #define VM_JUMP(n_)     do { i += (n_); if (i == stack->len) goto VM_END; goto *labels[get_opcode(&stack->data[i])]; } while (0)
+#else
+    #define VM_DISPATCH()   for (; i < stack->len; i++) switch (get_opcode(&stack->data[i]))
+    #define VM_CASE(op_)    case op_
+    #define VM_NEXT()       continue
+    #define VM_JUMP(n_)     { i += (n_) - 1; continue; }
+#endif
+
+// Inlined binary function (x = first arg, y = second arg)
+#define VM_BINARY(op_, check_, result_) \
+    VM_CASE(op_): \
+    { \
+        if (unlikely(aux->len < 2)) \
+            goto VM_CALL; \
+        x = &aux->data[aux->len - 2]; \
+        y = x + 1; \
+        if (unlikely(!(check_))) \
+            goto VM_CALL; \
+        *x = (result_); \
+        aux->len--; \
+        VM_NEXT(); \
+    }
+
+// Superinstruction (loads 2 values, fallback to the operator token on non-numbers)
+#define VM_FUSED(op_, result_) \
+    VM_CASE(op_): \
+    { \
+        if (unlikely(aux->reserved < aux->len + 2)) \
+            return token_error(YY_ERROR_MEM); \
+        if (unlikely(stack->len - i < 4)) \
+            return token_error(YY_ERROR_EVAL); \
+        x = &aux->data[aux->len]; \
+        y = x + 1; \
+        if (unlikely(!load_value(&stack->data[i + 1], aux, base, vars, x))) \
+            return *x; \
+        if (unlikely(!load_value(&stack->data[i + 2], aux, base, vars, y))) \
+            return *y; \
+        if (likely(IS_NUM(x) && IS_NUM(y))) { \
+            *x = (result_); \
+            aux->len++; \
+            VM_JUMP(4); \
+        } \
+        aux->len += 2; \
+        VM_JUMP(3); \
+    }
+
+// Next token, unless the pushed value is an error to skip (fast-fail mode)
+#define VM_NEXT_CHECKED() { \
+        if (unlikely(aux->data[aux->len - 1].type == YY_TOKEN_ERROR && vars->skips)) \
+            goto VM_FAIL; \
+        VM_NEXT(); \
+    }
+
+#define IS_NUM(t_)          ((t_)->type == YY_TOKEN_NUMBER)
+#define IS_DATETIME(t_)     ((t_)->type == YY_TOKEN_DATETIME)
+#define IS_BOOL(t_)         ((t_)->type == YY_TOKEN_BOOL)
+#define IS_FIXED_STR(t_)    ((t_)->type == YY_TOKEN_STRING && (t_)->str_val.ptr && !is_temp_ptr(&ctx, (t_)->str_val.ptr))
+
+typedef struct yy_vars_t
+{
+    yy_token_t (*resolve)(yy_str_t var, void *data);  //!< Variables resolver (can be NULL).
+    void *data;                     //!< Data passed to resolve.
+    const yy_token_t *slots;        //!< Bound variables values (can be NULL).
+    uint32_t num_slots;             //!< Number of slots.
+    yy_stack_t *memo;               //!< Resolved variables as pairs (variable, value), NULL = disabled.
+    uint32_t *counts;               //!< Short-circuit counters (see yy_profile_t), NULL = disabled.
+    const yy_skip_t *skips;         //!< Fast-fail skips (see yy_compute_skips), NULL = disabled.
+} yy_vars_t;
+
+/**
+ * Search a variable in the memoized values.
+ * 
+ * @param[in] memo Pairs (variable, value).
+ * @param[in] var Variable name.
+ * 
+ * @return The memoized value,
+ *         NULL if not found.
+ */
+static const yy_token_t * find_memo(const yy_stack_t *memo, yy_str_t var)
+{
+    for (uint32_t i = 0; i + 1 < memo->len; i += 2)
+    {
+        const yy_str_t *name = &memo->data[i].variable;
+
+        if (name->len == var.len && memcmp(name->ptr, var.ptr, var.len) == 0)
+            return &memo->data[i + 1];
+    }
+
+    return NULL;
+}
+
+/**
+ * Loads the value of an operand of a fused token (see fuse_stack()) 
+ * or a register-based instruction (see yy_compile_program()).
+ * 
+ * @param[in] token Token to load (value, error, variable, slot or temporary).
+ * @param[in] aux Evaluation stack (temporaries are located at the bottom).
+ * @param[in] base Number of temporaries.
+ * @param[in] vars Variables.
+ * @param[out] value Loaded value (or the error stopping the evaluation).
+ * 
+ * @return true on success,
+ *         false if evaluation must stop.
+ */
+INLINE
+static bool load_value(const yy_token_t *token, const yy_stack_t *aux, uint32_t base, const yy_vars_t *vars, yy_token_t *value)
+{
+    switch (token->type)
+    {
+        case YY_TOKEN_BOOL:
+        case YY_TOKEN_NUMBER:
+        case YY_TOKEN_DATETIME:
+        case YY_TOKEN_STRING:
+            *value = *token;
+            return true;
+
+        case YY_TOKEN_ERROR:
+            *value = (is_blocking_error(token->error) ? token_error(YY_ERROR_EVAL) : *token);
+            return !is_blocking_error(token->error);
+
+        case YY_TOKEN_SLOT:
+            if (unlikely(token->slot >= vars->num_slots || !vars->slots)) {
+                *value = token_error(YY_ERROR_REF);
+                return true;
+            }
+            *value = vars->slots[token->slot];
+            return (value->type != YY_TOKEN_ERROR || !is_blocking_error(value->error));
+
+        case YY_TOKEN_TEMP:
+            if (unlikely(token->temp >= base || aux->data[token->temp].type == YY_TOKEN_NULL)) {
+                *value = token_error(YY_ERROR_EVAL);
+                return false;
+            }
+            *value = aux->data[token->temp];
+            return true;
+
+        case YY_TOKEN_VARIABLE:
+        {
+            if (!vars->resolve) {
+                *value = token_error(YY_ERROR_REF);
+                return false;
+            }
+
+            const yy_token_t *memoized = (vars->memo ? find_memo(vars->memo, token->variable) : NULL);
+
+            if (memoized) {
+                *value = *memoized;
+                return true;
+            }
+
+            *value = vars->resolve(token->variable, vars->data);
+            if (value->type == YY_TOKEN_ERROR && is_blocking_error(value->error))
+                return false;
+
+            if (vars->memo && vars->memo->len + 2 <= vars->memo->reserved) {
+                vars->memo->data[vars->memo->len++] = *token;
+                vars->memo->data[vars->memo->len++] = *value;
+            }
+
+            return true;
+        }
+
+        default:
+            *value = token_error(YY_ERROR_EVAL);
+            return false;
+    }
+}
+
+/**
+ * Evaluates a stack.
+ * 
+ * Variables are resolved using the resolve function (once per 
+ * evaluation if memo is set), slots (bound variables) are read 
+ * from the slots array.
+ */
+static yy_token_t eval_stack(const yy_stack_t *stack, yy_stack_t *aux, const yy_vars_t *vars)
+{
+    if (!stack || !aux || !stack->data || !stack->len || !aux->data)
+        return token_error(YY_ERROR);
+
+#ifdef USE_COMPUTED_GOTO
+    static const void *labels[] = {
+        [YY_OPCODE_NULL]            = &&LABEL_YY_OPCODE_NULL,
+        [YY_OPCODE_BOOL]            = &&LABEL_YY_OPCODE_BOOL,
+        [YY_OPCODE_NUMBER]          = &&LABEL_YY_OPCODE_NUMBER,
+        [YY_OPCODE_DATETIME]        = &&LABEL_YY_OPCODE_DATETIME,
+        [YY_OPCODE_STRING]          = &&LABEL_YY_OPCODE_STRING,
+        [YY_OPCODE_VARIABLE]        = &&LABEL_YY_OPCODE_VARIABLE,
+        [YY_OPCODE_CALL]            = &&LABEL_YY_OPCODE_CALL,
+        [YY_OPCODE_ERROR]           = &&LABEL_YY_OPCODE_ERROR,
+        [YY_OPCODE_SLOT]            = &&LABEL_YY_OPCODE_SLOT,
+        [YY_OPCODE_TEMP]            = &&LABEL_YY_OPCODE_TEMP,
+        [YY_OPCODE_AND_OP]          = &&LABEL_YY_OPCODE_AND_OP,
+        [YY_OPCODE_OR_OP]           = &&LABEL_YY_OPCODE_OR_OP,
+        [YY_OPCODE_EQUALS_OP]       = &&LABEL_YY_OPCODE_EQUALS_OP,
+        [YY_OPCODE_DISTINCT_OP]     = &&LABEL_YY_OPCODE_DISTINCT_OP,
+        [YY_OPCODE_LESS_OP]         = &&LABEL_YY_OPCODE_LESS_OP,
+        [YY_OPCODE_LESS_EQUALS_OP]  = &&LABEL_YY_OPCODE_LESS_EQUALS_OP,
+        [YY_OPCODE_GREAT_OP]        = &&LABEL_YY_OPCODE_GREAT_OP,
+        [YY_OPCODE_GREAT_EQUALS_OP] = &&LABEL_YY_OPCODE_GREAT_EQUALS_OP,
+        [YY_OPCODE_PLUS_OP]         = &&LABEL_YY_OPCODE_PLUS_OP,
+        [YY_OPCODE_MINUS_OP]        = &&LABEL_YY_OPCODE_MINUS_OP,
+        [YY_OPCODE_ADDITION_OP]     = &&LABEL_YY_OPCODE_ADDITION_OP,
+        [YY_OPCODE_SUBTRACTION_OP]  = &&LABEL_YY_OPCODE_SUBTRACTION_OP,
+        [YY_OPCODE_PRODUCT_OP]      = &&LABEL_YY_OPCODE_PRODUCT_OP,
+        [YY_OPCODE_DIVIDE_OP]       = &&LABEL_YY_OPCODE_DIVIDE_OP,
+        [YY_OPCODE_NOT]             = &&LABEL_YY_OPCODE_NOT,
+        [YY_OPCODE_LT_NUM]          = &&LABEL_YY_OPCODE_LT_NUM,
+        [YY_OPCODE_LT_DATETIME]     = &&LABEL_YY_OPCODE_LT_DATETIME,
+        [YY_OPCODE_LT_STR]          = &&LABEL_YY_OPCODE_LT_STR,
+        [YY_OPCODE_LE_NUM]          = &&LABEL_YY_OPCODE_LE_NUM,
+        [YY_OPCODE_LE_DATETIME]     = &&LABEL_YY_OPCODE_LE_DATETIME,
+        [YY_OPCODE_LE_STR]          = &&LABEL_YY_OPCODE_LE_STR,
+        [YY_OPCODE_GT_NUM]          = &&LABEL_YY_OPCODE_GT_NUM,
+        [YY_OPCODE_GT_DATETIME]     = &&LABEL_YY_OPCODE_GT_DATETIME,
+        [YY_OPCODE_GT_STR]          = &&LABEL_YY_OPCODE_GT_STR,
+        [YY_OPCODE_GE_NUM]          = &&LABEL_YY_OPCODE_GE_NUM,
+        [YY_OPCODE_GE_DATETIME]     = &&LABEL_YY_OPCODE_GE_DATETIME,
+        [YY_OPCODE_GE_STR]          = &&LABEL_YY_OPCODE_GE_STR,
+        [YY_OPCODE_EQ_NUM]          = &&LABEL_YY_OPCODE_EQ_NUM,
+        [YY_OPCODE_EQ_DATETIME]     = &&LABEL_YY_OPCODE_EQ_DATETIME,
+        [YY_OPCODE_EQ_STR]          = &&LABEL_YY_OPCODE_EQ_STR,
+        [YY_OPCODE_EQ_BOOL]         = &&LABEL_YY_OPCODE_EQ_BOOL,
+        [YY_OPCODE_NE_NUM]          = &&LABEL_YY_OPCODE_NE_NUM,
+        [YY_OPCODE_NE_DATETIME]     = &&LABEL_YY_OPCODE_NE_DATETIME,
+        [YY_OPCODE_NE_STR]          = &&LABEL_YY_OPCODE_NE_STR,
+        [YY_OPCODE_NE_BOOL]         = &&LABEL_YY_OPCODE_NE_BOOL,
+        [YY_OPCODE_MIN_NUM]         = &&LABEL_YY_OPCODE_MIN_NUM,
+        [YY_OPCODE_MIN_DATETIME]    = &&LABEL_YY_OPCODE_MIN_DATETIME,
+        [YY_OPCODE_MAX_NUM]         = &&LABEL_YY_OPCODE_MAX_NUM,
+        [YY_OPCODE_MAX_DATETIME]    = &&LABEL_YY_OPCODE_MAX_DATETIME,
+        [YY_OPCODE_CLAMP_NUM]       = &&LABEL_YY_OPCODE_CLAMP_NUM,
+        [YY_OPCODE_CLAMP_DATETIME]  = &&LABEL_YY_OPCODE_CLAMP_DATETIME,
+        [YY_OPCODE_IFELSE]          = &&LABEL_YY_OPCODE_IFELSE,
+        [YY_OPCODE_JUMP]            = &&LABEL_YY_OPCODE_JUMP,
+        [YY_OPCODE_JUMP_IFELSE]     = &&LABEL_YY_OPCODE_JUMP_IFELSE,
+        [YY_OPCODE_JUMP_AND]        = &&LABEL_YY_OPCODE_JUMP_AND,
+        [YY_OPCODE_JUMP_OR]         = &&LABEL_YY_OPCODE_JUMP_OR,
+        [YY_OPCODE_FRAME]           = &&LABEL_YY_OPCODE_FRAME,
+        [YY_OPCODE_STORE]           = &&LABEL_YY_OPCODE_STORE,
+        [YY_OPCODE_FUSED_ADD]       = &&LABEL_YY_OPCODE_FUSED_ADD,
+        [YY_OPCODE_FUSED_SUB]       = &&LABEL_YY_OPCODE_FUSED_SUB,
+        [YY_OPCODE_FUSED_MUL]       = &&LABEL_YY_OPCODE_FUSED_MUL,
+        [YY_OPCODE_FUSED_DIV]       = &&LABEL_YY_OPCODE_FUSED_DIV,
+        [YY_OPCODE_FUSED_LT]        = &&LABEL_YY_OPCODE_FUSED_LT,
+        [YY_OPCODE_FUSED_LE]        = &&LABEL_YY_OPCODE_FUSED_LE,
+        [YY_OPCODE_FUSED_GT]        = &&LABEL_YY_OPCODE_FUSED_GT,
+        [YY_OPCODE_FUSED_GE]        = &&LABEL_YY_OPCODE_FUSED_GE,
+        [YY_OPCODE_FUSED_EQ]        = &&LABEL_YY_OPCODE_FUSED_EQ,
+        [YY_OPCODE_FUSED_NE]        = &&LABEL_YY_OPCODE_FUSED_NE,
+    };
+#endif
+
+    yy_eval_ctx_t ctx = {.stack = aux, .tmp_str = (char *) &aux->data[aux->reserved]};
+    yy_token_t tmp = {0};
+    yy_token_t *x = NULL;
+    yy_token_t *y = NULL;
+    uint32_t jump = 0;
+    uint32_t base = 0;      // number of temporaries (bottom of aux)
+    uint32_t i = 0;
+
+    aux->len = 0;
+
+    VM_DISPATCH()
+    {
+        VM_CASE(YY_OPCODE_BOOL):
+        VM_CASE(YY_OPCODE_NUMBER):
+        VM_CASE(YY_OPCODE_DATETIME):
+        VM_CASE(YY_OPCODE_STRING):
+        {
+            if (unlikely(aux->reserved <= aux->len))
+                return token_error(YY_ERROR_MEM);
+
+            aux->data[aux->len++] = stack->data[i];
+            VM_NEXT();
+        }
+
+        VM_CASE(YY_OPCODE_ERROR):
+        {
+            if (is_blocking_error(stack->data[i].error))
+                return token_error(YY_ERROR_EVAL);
+
+            if (aux->reserved <= aux->len)
+                return token_error(YY_ERROR_MEM);
+
+            aux->data[aux->len++] = stack->data[i];
+            VM_NEXT_CHECKED();
+        }
+
+        VM_CASE(YY_OPCODE_VARIABLE):
+        {
+            if (unlikely(aux->reserved <= aux->len))
+                return token_error(YY_ERROR_MEM);
+
+            if (!vars->resolve)
+                return token_error(YY_ERROR_REF);
+
+            const yy_token_t *memoized = (vars->memo ? find_memo(vars->memo, stack->data[i].variable) : NULL);
+
+            if (memoized) {
+                aux->data[aux->len++] = *memoized;
+                VM_NEXT_CHECKED();
+            }
+
+            tmp = vars->resolve(stack->data[i].variable, vars->data);
+            if (tmp.type == YY_TOKEN_ERROR && is_blocking_error(tmp.error))
+                return tmp;
+
+            if (vars->memo && vars->memo->len + 2 <= vars->memo->reserved) {
+                vars->memo->data[vars->memo->len++] = stack->data[i];
+                vars->memo->data[vars->memo->len++] = tmp;
+            }
+
+            aux->data[aux->len++] = tmp;
+            VM_NEXT_CHECKED();
+        }
+
+        VM_CASE(YY_OPCODE_SLOT):
+        {
+            if (unlikely(aux->reserved <= aux->len))
+                return token_error(YY_ERROR_MEM);
+
+            if (unlikely(stack->data[i].slot >= vars->num_slots || !vars->slots)) {
+                aux->data[aux->len++] = token_error(YY_ERROR_REF);
+                VM_NEXT_CHECKED();
+            }
+
+            tmp = vars->slots[stack->data[i].slot];
+            if (tmp.type == YY_TOKEN_ERROR && is_blocking_error(tmp.error))
+                return tmp;
+
+            aux->data[aux->len++] = tmp;
+            VM_NEXT_CHECKED();
+        }
+
+        // shared subexpressions (see share_subexprs())
+
+        VM_CASE(YY_OPCODE_FRAME):
+        {
+            base = stack->data[i].jump.offset;
+
+            if (unlikely(i != 0 || base >= aux->reserved))
+                return token_error(YY_ERROR_EVAL);
+
+            memset(aux->data, 0x00, base * sizeof(yy_token_t));
+            aux->len = base;
+            VM_NEXT();
+        }
+
+        VM_CASE(YY_OPCODE_STORE):
+        {
+            jump = stack->data[i].jump.offset;
+
+            if (unlikely(jump >= base || aux->len <= base))
+                return token_error(YY_ERROR_EVAL);
+
+            aux->data[jump] = aux->data[aux->len - 1];
+            VM_NEXT();
+        }
+
+        VM_CASE(YY_OPCODE_TEMP):
+        {
+            if (unlikely(aux->reserved <= aux->len))
+                return token_error(YY_ERROR_MEM);
+
+            jump = stack->data[i].temp;
+
+            if (unlikely(jump >= base || aux->data[jump].type == YY_TOKEN_NULL))
+                return token_error(YY_ERROR_EVAL);
+
+            aux->data[aux->len++] = aux->data[jump];
+            VM_NEXT_CHECKED();
+        }
+
+        // inlined operators (fallback to function call on unexpected types)
+
+        VM_BINARY(YY_OPCODE_ADDITION_OP, IS_NUM(x) && IS_NUM(y), token_number(x->number_val + y->number_val))
+        VM_BINARY(YY_OPCODE_SUBTRACTION_OP, IS_NUM(x) && IS_NUM(y), token_number(x->number_val - y->number_val))
+        VM_BINARY(YY_OPCODE_PRODUCT_OP, IS_NUM(x) && IS_NUM(y), token_number(x->number_val * y->number_val))
+        VM_BINARY(YY_OPCODE_DIVIDE_OP, IS_NUM(x) && IS_NUM(y), token_number(x->number_val / y->number_val))
+
+        VM_CASE(YY_OPCODE_AND_OP):
+        VM_CASE(YY_OPCODE_OR_OP):
+        {
+            if (unlikely(aux->len < 2))
+                goto VM_CALL;
+
+            x = &aux->data[aux->len - 2];
+            y = x + 1;
+
+            // second operand decides the result (false on &&, true on ||)
+            if (unlikely(vars->counts)) {
+                vars->counts[2 * i]++;
+                vars->counts[2 * i + 1] += (y->type != YY_TOKEN_BOOL || y->bool_val == (stack->data[i].function.opcode == YY_OPCODE_OR_OP));
+            }
+
+            if (unlikely(!IS_BOOL(x) || !IS_BOOL(y)))
+                goto VM_CALL;
+
+            x->bool_val = (stack->data[i].function.opcode == YY_OPCODE_AND_OP ? x->bool_val && y->bool_val : x->bool_val || y->bool_val);
+            aux->len--;
+            VM_NEXT();
+        }
+
+        // typed operators (argument types known at compile time)
+
+        VM_BINARY(YY_OPCODE_LT_NUM, IS_NUM(x) && IS_NUM(y), token_bool(x->number_val < y->number_val))
+        VM_BINARY(YY_OPCODE_LE_NUM, IS_NUM(x) && IS_NUM(y), token_bool(x->number_val <= y->number_val))
+        VM_BINARY(YY_OPCODE_GT_NUM, IS_NUM(x) && IS_NUM(y), token_bool(x->number_val > y->number_val))
+        VM_BINARY(YY_OPCODE_GE_NUM, IS_NUM(x) && IS_NUM(y), token_bool(x->number_val >= y->number_val))
+        VM_BINARY(YY_OPCODE_EQ_NUM, IS_NUM(x) && IS_NUM(y), token_bool(x->number_val == y->number_val))
+        VM_BINARY(YY_OPCODE_NE_NUM, IS_NUM(x) && IS_NUM(y), token_bool(x->number_val != y->number_val))
+        VM_BINARY(YY_OPCODE_MIN_NUM, IS_NUM(x) && IS_NUM(y), token_number(min_num(x->number_val, y->number_val)))
+        VM_BINARY(YY_OPCODE_MAX_NUM, IS_NUM(x) && IS_NUM(y), token_number(max_num(x->number_val, y->number_val)))
+
+        VM_BINARY(YY_OPCODE_LT_DATETIME, IS_DATETIME(x) && IS_DATETIME(y), token_bool(x->datetime_val < y->datetime_val))
+        VM_BINARY(YY_OPCODE_LE_DATETIME, IS_DATETIME(x) && IS_DATETIME(y), token_bool(x->datetime_val <= y->datetime_val))
+        VM_BINARY(YY_OPCODE_GT_DATETIME, IS_DATETIME(x) && IS_DATETIME(y), token_bool(x->datetime_val > y->datetime_val))
+        VM_BINARY(YY_OPCODE_GE_DATETIME, IS_DATETIME(x) && IS_DATETIME(y), token_bool(x->datetime_val >= y->datetime_val))
+        VM_BINARY(YY_OPCODE_EQ_DATETIME, IS_DATETIME(x) && IS_DATETIME(y), token_bool(x->datetime_val == y->datetime_val))
+        VM_BINARY(YY_OPCODE_NE_DATETIME, IS_DATETIME(x) && IS_DATETIME(y), token_bool(x->datetime_val != y->datetime_val))
+        VM_BINARY(YY_OPCODE_MIN_DATETIME, IS_DATETIME(x) && IS_DATETIME(y), token_datetime(MIN(x->datetime_val, y->datetime_val)))
+        VM_BINARY(YY_OPCODE_MAX_DATETIME, IS_DATETIME(x) && IS_DATETIME(y), token_datetime(MAX(x->datetime_val, y->datetime_val)))
+
+        // temporary strings are deallocated by the function call
+        VM_BINARY(YY_OPCODE_LT_STR, IS_FIXED_STR(x) && IS_FIXED_STR(y), token_bool(str_cmp(x->str_val, y->str_val) < 0))
+        VM_BINARY(YY_OPCODE_LE_STR, IS_FIXED_STR(x) && IS_FIXED_STR(y), token_bool(str_cmp(x->str_val, y->str_val) <= 0))
+        VM_BINARY(YY_OPCODE_GT_STR, IS_FIXED_STR(x) && IS_FIXED_STR(y), token_bool(str_cmp(x->str_val, y->str_val) > 0))
+        VM_BINARY(YY_OPCODE_GE_STR, IS_FIXED_STR(x) && IS_FIXED_STR(y), token_bool(str_cmp(x->str_val, y->str_val) >= 0))
+        VM_BINARY(YY_OPCODE_EQ_STR, IS_FIXED_STR(x) && IS_FIXED_STR(y), token_bool(str_cmp(x->str_val, y->str_val) == 0))
+        VM_BINARY(YY_OPCODE_NE_STR, IS_FIXED_STR(x) && IS_FIXED_STR(y), token_bool(str_cmp(x->str_val, y->str_val) != 0))
+
+        VM_BINARY(YY_OPCODE_EQ_BOOL, IS_BOOL(x) && IS_BOOL(y), token_bool(x->bool_val == y->bool_val))
+        VM_BINARY(YY_OPCODE_NE_BOOL, IS_BOOL(x) && IS_BOOL(y), token_bool(x->bool_val != y->bool_val))
+
+        VM_CASE(YY_OPCODE_CLAMP_NUM):
+        {
+            if (unlikely(aux->len < 3))
+                goto VM_CALL;
+
+            x = &aux->data[aux->len - 3];
+            y = x + 1;
+
+            if (unlikely(!IS_NUM(x) || !IS_NUM(y) || !IS_NUM(y + 1) || y[0].number_val > y[1].number_val))
+                goto VM_CALL;
+
+            x->number_val = CLAMP(x->number_val, y[0].number_val, y[1].number_val);
+            aux->len -= 2;
+            VM_NEXT();
+        }
+
+        VM_CASE(YY_OPCODE_CLAMP_DATETIME):
+        {
+            if (unlikely(aux->len < 3))
+                goto VM_CALL;
+
+            x = &aux->data[aux->len - 3];
+            y = x + 1;
+
+            if (unlikely(!IS_DATETIME(x) || !IS_DATETIME(y) || !IS_DATETIME(y + 1) || y[0].datetime_val > y[1].datetime_val))
+                goto VM_CALL;
+
+            x->datetime_val = CLAMP(x->datetime_val, y[0].datetime_val, y[1].datetime_val);
+            aux->len -= 2;
+            VM_NEXT();
+        }
+
+        // superinstructions (see fuse_stack())
+
+        VM_FUSED(YY_OPCODE_FUSED_ADD, token_number(x->number_val + y->number_val))
+        VM_FUSED(YY_OPCODE_FUSED_SUB, token_number(x->number_val - y->number_val))
+        VM_FUSED(YY_OPCODE_FUSED_MUL, token_number(x->number_val * y->number_val))
+        VM_FUSED(YY_OPCODE_FUSED_DIV, token_number(x->number_val / y->number_val))
+        VM_FUSED(YY_OPCODE_FUSED_LT, token_bool(x->number_val < y->number_val))
+        VM_FUSED(YY_OPCODE_FUSED_LE, token_bool(x->number_val <= y->number_val))
+        VM_FUSED(YY_OPCODE_FUSED_GT, token_bool(x->number_val > y->number_val))
+        VM_FUSED(YY_OPCODE_FUSED_GE, token_bool(x->number_val >= y->number_val))
+        VM_FUSED(YY_OPCODE_FUSED_EQ, token_bool(x->number_val == y->number_val))
+        VM_FUSED(YY_OPCODE_FUSED_NE, token_bool(x->number_val != y->number_val))
+
+        // short-circuit (untaken operands are skipped)
+
+        VM_CASE(YY_OPCODE_JUMP):
+        {
+            jump = stack->data[i].jump.offset;
+
+            if (unlikely(!jump || stack->len - i < jump))
+                return token_error(YY_ERROR_EVAL);
+
+            VM_JUMP(jump);
+        }
+
+        VM_CASE(YY_OPCODE_JUMP_IFELSE):
+        {
+            jump = stack->data[i].jump.offset;
+
+            if (unlikely(aux->len < 1 || !jump || stack->len - i < jump))
+                return token_error(YY_ERROR_EVAL);
+
+            x = &aux->data[aux->len - 1];
+
+            if (likely(x->type == YY_TOKEN_BOOL))
+            {
+                aux->len--;
+
+                if (x->bool_val)
+                    VM_NEXT();
+
+                VM_JUMP(jump);
+            }
+
+            // non-bool condition, goes to the ifelse token (target of the jump preceding the else-branch)
+            y = &stack->data[i + jump - 1];
+
+            if (unlikely(y->type != YY_TOKEN_JUMP || !y->jump.offset || stack->len - i < jump - 1 + y->jump.offset))
+                return token_error(YY_ERROR_EVAL);
+
+            if (x->type == YY_TOKEN_STRING)
+                free_str(&ctx, &x->str_val);
+
+            *x = token_error(YY_ERROR_VALUE);
+            VM_JUMP(jump - 1 + y->jump.offset);
+        }
+
+        VM_CASE(YY_OPCODE_JUMP_AND):
+        VM_CASE(YY_OPCODE_JUMP_OR):
+        {
+            jump = stack->data[i].jump.offset;
+
+            if (unlikely(aux->len < 1 || !jump || stack->len - i < jump))
+                return token_error(YY_ERROR_EVAL);
+
+            x = &aux->data[aux->len - 1];
+
+            // first operand decides the result (false on &&, true on ||)
+            if (unlikely(vars->counts)) {
+                vars->counts[2 * i]++;
+                vars->counts[2 * i + 1] += (x->type != YY_TOKEN_BOOL || x->bool_val == (stack->data[i].jump.opcode == YY_OPCODE_JUMP_OR));
+            }
+
+            if (likely(x->type == YY_TOKEN_BOOL))
+            {
+                if (x->bool_val == (stack->data[i].jump.opcode == YY_OPCODE_JUMP_OR))
+                    VM_JUMP(jump);
+
+                VM_NEXT();
+            }
+
+            if (x->type == YY_TOKEN_STRING)
+                free_str(&ctx, &x->str_val);
+
+            *x = token_error(YY_ERROR_VALUE);
+            VM_JUMP(jump);
+        }
+
+        VM_CASE(YY_OPCODE_IFELSE):
+        {
+            if (unlikely(aux->len < 1))
+                return token_error(YY_ERROR_EVAL);
+
+            x = &aux->data[aux->len - 1];
+
+            if (x->type != YY_TOKEN_NUMBER && x->type != YY_TOKEN_DATETIME && x->type != YY_TOKEN_STRING && x->type != YY_TOKEN_BOOL)
+                *x = token_error(YY_ERROR_VALUE);
+
+            VM_NEXT();
+        }
+
+        // untyped operators
+
+        VM_CASE(YY_OPCODE_LESS_OP):
+        VM_CASE(YY_OPCODE_LESS_EQUALS_OP):
+        VM_CASE(YY_OPCODE_GREAT_OP):
+        VM_CASE(YY_OPCODE_GREAT_EQUALS_OP):
+        VM_CASE(YY_OPCODE_EQUALS_OP):
+        VM_CASE(YY_OPCODE_DISTINCT_OP):
+        {
+            if (unlikely(aux->len < 2))
+                goto VM_CALL;
+
+            x = &aux->data[aux->len - 2];
+            y = x + 1;
+
+            if (x->type != y->type)
+                goto VM_CALL;
+
+            int cmp = 0;
+
+            if (x->type == YY_TOKEN_NUMBER)
+            {
+                double a = x->number_val;
+                double b = y->number_val;
+
+                switch (stack->data[i].function.opcode)
+                {
+                    case YY_OPCODE_LESS_OP:         *x = token_bool(a <  b); break;
+                    case YY_OPCODE_LESS_EQUALS_OP:  *x = token_bool(a <= b); break;
+                    case YY_OPCODE_GREAT_OP:        *x = token_bool(a >  b); break;
+                    case YY_OPCODE_GREAT_EQUALS_OP: *x = token_bool(a >= b); break;
+                    case YY_OPCODE_EQUALS_OP:       *x = token_bool(a == b); break;
+                    default:                        *x = token_bool(a != b); break;
+                }
+
+                aux->len--;
+                VM_NEXT();
+            }
+
+            if (x->type == YY_TOKEN_DATETIME)
+                cmp = (x->datetime_val < y->datetime_val ? -1 : (x->datetime_val > y->datetime_val ? 1 : 0));
+            else if (x->type == YY_TOKEN_BOOL && (stack->data[i].function.opcode == YY_OPCODE_EQUALS_OP || stack->data[i].function.opcode == YY_OPCODE_DISTINCT_OP))
+                cmp = (x->bool_val != y->bool_val);
+            else
+                goto VM_CALL;
+
+            switch (stack->data[i].function.opcode)
+            {
+                case YY_OPCODE_LESS_OP:         *x = token_bool(cmp <  0); break;
+                case YY_OPCODE_LESS_EQUALS_OP:  *x = token_bool(cmp <= 0); break;
+                case YY_OPCODE_GREAT_OP:        *x = token_bool(cmp >  0); break;
+                case YY_OPCODE_GREAT_EQUALS_OP: *x = token_bool(cmp >= 0); break;
+                case YY_OPCODE_EQUALS_OP:       *x = token_bool(cmp == 0); break;
+                default:                        *x = token_bool(cmp != 0); break;
+            }
+
+            aux->len--;
+            VM_NEXT();
+        }
+
+        VM_CASE(YY_OPCODE_NOT):
+        {
+            if (unlikely(aux->len < 1))
+                goto VM_CALL;
+
+            x = &aux->data[aux->len - 1];
+
+            if (unlikely(x->type != YY_TOKEN_BOOL))
+                goto VM_CALL;
+
+            x->bool_val = !x->bool_val;
+            VM_NEXT();
+        }
+
+        VM_CASE(YY_OPCODE_PLUS_OP):
+        VM_CASE(YY_OPCODE_MINUS_OP):
+        {
+            if (unlikely(aux->len < 1))
+                goto VM_CALL;
+
+            x = &aux->data[aux->len - 1];
+
+            if (unlikely(x->type != YY_TOKEN_NUMBER))
+                goto VM_CALL;
+
+            if (stack->data[i].function.opcode == YY_OPCODE_MINUS_OP)
+                x->number_val = -x->number_val;
+
+            VM_NEXT();
+        }
+
+        VM_CASE(YY_OPCODE_CALL):
+VM_CALL:
+        {
+            if (unlikely(aux->len < stack->data[i].function.num_args))
+                return token_error(YY_ERROR_EVAL);
+
+            tmp = call_func(stack->data[i].function, &aux->data[aux->len - stack->data[i].function.num_args], &ctx);
+            if (tmp.type == YY_TOKEN_ERROR && is_blocking_error(tmp.error))
+                return tmp;
+
+            free_args(&ctx, &aux->data[aux->len - stack->data[i].function.num_args], stack->data[i].function.num_args, &tmp);
+
+            if (stack->data[i].function.num_args)
+                aux->len -= stack->data[i].function.num_args;
+            else if (aux->reserved <= aux->len)
+                return token_error(YY_ERROR_MEM);
+
+            aux->data[aux->len++] = tmp;
+            VM_NEXT_CHECKED();
+        }
+
+        // error skipping the enclosing functions (see yy_compute_skips())
+VM_FAIL:
+        {
+            const yy_skip_t *skip = &vars->skips[i];
+
+            if (!skip->offset)
+                VM_NEXT();
+
+            if (unlikely(aux->len <= base + skip->num_values || stack->len - i < skip->offset))
+                return token_error(YY_ERROR_EVAL);
+
+            for (uint32_t k = 1; k <= skip->num_values + 1; k++)
+                if (aux->data[aux->len - k].type == YY_TOKEN_STRING)
+                    free_str(&ctx, &aux->data[aux->len - k].str_val);
+
+            aux->len -= skip->num_values;
+            aux->data[aux->len - 1] = token_error(YY_ERROR_VALUE);
+            VM_JUMP(skip->offset);
+        }
+
+        VM_CASE(YY_OPCODE_NULL):
+#ifndef USE_COMPUTED_GOTO
+        default:
+#endif
+            return token_error(YY_ERROR_EVAL);
+    }
+
+#ifdef USE_COMPUTED_GOTO
+VM_END:
+#endif
+
+    if (aux->len != base + 1)
+        return token_error(YY_ERROR_EVAL);
+
+    assert (aux->data[base].type != YY_TOKEN_STRING || 
+            !is_temp_ptr(&ctx, aux->data[base].str_val.ptr) || 
+            (aux->data[base].str_val.ptr == ctx.tmp_str && ctx.tmp_str + aux->data[base].str_val.len == (char *) &aux->data[aux->reserved]));
+
+    return aux->data[base];
+}
+
+yy_token_t yy_eval_stack(const yy_stack_t *stack, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+{
+    yy_vars_t vars = {.resolve = resolve, .data = data};
+
+    return eval_stack(stack, aux, &vars);
+}
+
+yy_token_t yy_eval_stack_memo(const yy_stack_t *stack, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+{
+    if (!stack || !aux || !stack->data || !aux->data)
+        return token_error(YY_ERROR);
+
+    uint32_t num_vars = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+        num_vars += (stack->data[i].type == YY_TOKEN_VARIABLE);
+
+    if (num_vars < 2)
+        return yy_eval_stack(stack, aux, resolve, data);
+
+    // memoized values are placed at the head of aux (using up to half of it)
+    yy_stack_t memo = {.data = aux->data, .reserved = MIN(2 * num_vars, (aux->reserved / 4) * 2), .len = 0};
+    yy_stack_t values = {.data = aux->data + memo.reserved, .reserved = aux->reserved - memo.reserved, .len = 0};
+    yy_vars_t vars = {.resolve = resolve, .data = data, .memo = &memo};
+
+    yy_token_t ret = eval_stack(stack, &values, &vars);
+
+    aux->len = memo.reserved + values.len;
+
+    return ret;
+}
+
+yy_token_t yy_eval_stack_slots(const yy_stack_t *stack, yy_stack_t *aux, const yy_token_t *slots, uint32_t num_slots)
+{
+    yy_vars_t vars = {.slots = slots, .num_slots = num_slots};
+
+    return eval_stack(stack, aux, &vars);
+}
+
+/**
+ * Estimated cost of evaluating a token.
+ * 
+ * Variables are resolved by a callback, and functions not inlined 
+ * by the evaluator are called by pointer (and can create strings).
+ */
+static uint32_t get_token_cost(const yy_token_t *token)
+{
+    switch (token->type)
+    {
+        case YY_TOKEN_JUMP:
+            return 0;
+        case YY_TOKEN_VARIABLE:
+            return 4;
+        case YY_TOKEN_FUNCTION:
+            if (token->function.opcode != YY_OPCODE_CALL)
+                return 1;
+            return (token->function.needs_ctx ? 8 : 4);
+        default:
+            return 1;
+    }
+}
+
+typedef struct yy_operand_t
+{
+    uint32_t start;                 //!< Position of the first token.
+    uint32_t len;                   //!< Number of tokens.
+    uint32_t num_evals;             //!< Number of evaluations.
+    uint32_t num_decided;           //!< Number of evaluations deciding the result.
+    double rank;                    //!< Cost divided by the probability of deciding the result.
+} yy_operand_t;
+
+/**
+ * Sorts the operands of a chain of && (or ||) by rank.
+ * 
+ *   x0 JUMP(x1) x1 OP JUMP(x2) x2 OP ...
+ * 
+ * The probability that an operand decides the result is estimated from 
+ * the counters of the token after it (the jump following the first operand, 
+ * the operator following the rest). Chains having a missing jump or a stored 
+ * subexpression (see share_subexprs()) are not reordered.
+ * 
+ * @param[in,out] stack Compiled stack.
+ * @param[in] root Position of the last operator of the chain.
+ * @param[in] counts Short-circuit counters (see yy_profile_t).
+ */
+static void reorder_chain(yy_stack_t *stack, uint32_t root, const uint32_t *counts)
+{
+    yy_token_t *data = stack->data;
+    yy_token_t op = data[root];
+    yy_func_2 func = (yy_func_2) op.function.ptr;
+    uint8_t opcode = (func == func_and ? YY_OPCODE_JUMP_AND : YY_OPCODE_JUMP_OR);
+    yy_operand_t operands[MAX_ANALYSIS_DEPTH];
+    uint32_t order[MAX_ANALYSIS_DEPTH];
+    uint32_t num = 0;
+    uint32_t pos = root;
+
+    // operands from the last one
+    while (is_func_2(&data[pos], func))
+    {
+        if (num + 2 > MAX_ANALYSIS_DEPTH || data[pos - 1].type == YY_TOKEN_JUMP)
+            return;
+
+        uint32_t start = get_subtree_start(stack, pos - 1);
+
+        if (start != UINT32_MAX && start > 0 && is_fused_token(&data[start - 1]))
+            start--;
+
+        if (start == UINT32_MAX || start < 2 || data[start - 1].type != YY_TOKEN_JUMP || data[start - 1].jump.opcode != opcode)
+            return;
+
+        operands[num++] = (yy_operand_t){ .start = start, .len = pos - start, .num_evals = counts[2 * pos], .num_decided = counts[2 * pos + 1] };
+        pos = start - 2;
+    }
+
+    if (data[pos].type == YY_TOKEN_JUMP || num == 0)
+        return;
+
+    uint32_t start = get_subtree_start(stack, pos);
+
+    if (start == UINT32_MAX)
+        return;
+
+    if (start > 0 && is_fused_token(&data[start - 1]))
+        start--;
+
+    operands[num++] = (yy_operand_t){ .start = start, .len = pos + 1 - start, .num_evals = counts[2 * pos + 2], .num_decided = counts[2 * pos + 3] };
+
+    // chain order
+    for (uint32_t k = 0; k < num / 2; k++) {
+        yy_operand_t tmp = operands[k];
+        operands[k] = operands[num - 1 - k];
+        operands[num - 1 - k] = tmp;
+    }
+
+    for (uint32_t k = 0; k < num; k++)
+    {
+        uint32_t cost = 0;
+
+        for (uint32_t j = operands[k].start; j < operands[k].start + operands[k].len; j++)
+        {
+            if (data[j].type == YY_TOKEN_JUMP && (data[j].jump.opcode == YY_OPCODE_STORE || data[j].jump.opcode == YY_OPCODE_FRAME))
+                return;
+
+            cost += get_token_cost(&data[j]);
+        }
+
+        // probability estimated using the rule of succession (unknown = 1/2)
+        double prob = (operands[k].num_decided + 1.0) / (operands[k].num_evals + 2.0);
+
+        operands[k].rank = cost / prob;
+    }
+
+    // stable insertion sort
+    bool is_sorted = true;
+
+    for (uint32_t k = 0; k < num; k++)
+    {
+        uint32_t j = k;
+
+        while (j > 0 && operands[order[j - 1]].rank > operands[k].rank) {
+            order[j] = order[j - 1];
+            j--;
+        }
+
+        order[j] = k;
+        is_sorted = is_sorted && (j == k);
+    }
+
+    if (is_sorted)
+        return;
+
+    // removes the connectors (operands are placed at the beginning)
+    uint32_t first = operands[0].start;
+    uint32_t w = first;
+
+    for (uint32_t k = 0; k < num; k++) {
+        memmove(&data[w], &data[operands[k].start], operands[k].len * sizeof(yy_token_t));
+        operands[k].start = w;
+        w += operands[k].len;
+    }
+
+    // sorts the operands
+    w = first;
+
+    for (uint32_t k = 0; k < num; k++)
+    {
+        yy_operand_t *operand = &operands[order[k]];
+
+        if (operand->start != w)
+        {
+            rotate_tokens(data, w, operand->start, operand->start + operand->len);
+
+            for (uint32_t j = 0; j < num; j++)
+                if (w <= operands[j].start && operands[j].start < operand->start)
+                    operands[j].start += operand->len;
+
+            operand->start = w;
+        }
+
+        w += operand->len;
+    }
+
+    // adds the connectors (from the end)
+    w = root + 1;
+
+    for (uint32_t k = num; k-- > 1; )
+    {
+        const yy_operand_t *operand = &operands[order[k]];
+
+        data[--w] = op;
+        w -= operand->len;
+        memmove(&data[w], &data[operand->start], operand->len * sizeof(yy_token_t));
+        data[--w] = token_jump(opcode, operand->len + 2);
+    }
+
+    assert(w == first + operands[order[0]].len);
+}
+
+/**
+ * Reorders the operands of the chains of && and || (see reorder_chain()).
+ * Nested chains are processed first.
+ * 
+ * @param[in,out] stack Compiled stack.
+ * @param[in] counts Short-circuit counters (see yy_profile_t).
+ */
+static void reorder_stack(yy_stack_t *stack, const uint32_t *counts)
+{
+    uint32_t starts[MAX_ANALYSIS_DEPTH];    // first token of each pending value
+    uint32_t roots[MAX_ANALYSIS_DEPTH];     // last operator of each chain
+    uint32_t num_roots = 0;
+    uint32_t depth = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+
+        if (token->type == YY_TOKEN_JUMP)
+            continue;
+
+        if (token->type != YY_TOKEN_FUNCTION || token->function.num_args == 0)
+        {
+            if (depth >= MAX_ANALYSIS_DEPTH)
+                return;
+
+            starts[depth++] = i;
+            continue;
+        }
+
+        if (depth < token->function.num_args)
+            return;
+
+        depth -= token->function.num_args;
+
+        if ((is_func_2(token, func_and) || is_func_2(token, func_or)) && num_roots < MAX_ANALYSIS_DEPTH)
+        {
+            uint32_t pos_x = starts[depth + 1] - 1;     // root of the first operand
+
+            while (stack->data[pos_x].type == YY_TOKEN_JUMP && pos_x > 0)
+                pos_x--;
+
+            // first operand is not a chain root if it has the same operator
+            for (uint32_t k = 0; k < num_roots; k++) {
+                if (roots[k] == pos_x && stack->data[pos_x].function.ptr == token->function.ptr) {
+                    memmove(&roots[k], &roots[k + 1], (num_roots - k - 1) * sizeof(uint32_t));
+                    num_roots--;
+                    break;
+                }
+            }
+
+            roots[num_roots++] = i;
+        }
+
+        depth++;    // starts[depth] is the first token of the function arguments
+    }
+
+    for (uint32_t k = 0; k < num_roots; k++)
+        reorder_chain(stack, roots[k], counts);
+}
+
+yy_token_t yy_eval_stack_adaptive(yy_stack_t *stack, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data, yy_profile_t *profile)
+{
+    if (!stack || !profile || !profile->counts || profile->reserved / 2 < stack->len)
+        return token_error(YY_ERROR);
+
+    yy_vars_t vars = {.resolve = resolve, .data = data, .counts = profile->counts};
+
+    yy_token_t ret = eval_stack(stack, aux, &vars);
+
+    if (profile->period && ++profile->num_evals >= profile->period)
+    {
+        reorder_stack(stack, profile->counts);
+        memset(profile->counts, 0x00, 2 * stack->len * sizeof(uint32_t));
+        profile->num_evals = 0;
+    }
+
+    return ret;
+}
+
+/**
+ * Checks if a function returns YY_ERROR_VALUE when an argument is an error.
+ */
+static bool is_error_strict(const yy_func_t *func)
+{
+    #define IS_FUNC(func_) (func->ptr == (void (*)(void)) (func_))
+
+    // iserror and str observe errors, &&, || and ifelse can ignore them
+    return !(IS_FUNC(func_iserror) || IS_FUNC(func_str) || IS_FUNC(func_and) || IS_FUNC(func_or) || IS_FUNC(func_ifelse));
+
+    #undef IS_FUNC
+}
+
+/**
+ * Checks if a token can't be skipped.
+ * 
+ * Stores and frames are used by later tokens. Functions using the eval
+ * context (ex: str, upper) can return a blocking error (YY_ERROR, 
+ * YY_ERROR_MEM) that skipping would report as YY_ERROR_VALUE.
+ */
+static bool is_skip_barrier(const yy_token_t *token)
+{
+    if (token->type == YY_TOKEN_JUMP)
+        return (token->jump.opcode == YY_OPCODE_STORE || token->jump.opcode == YY_OPCODE_FRAME);
+
+    return (token->type == YY_TOKEN_FUNCTION && token->function.needs_ctx);
+}
+
+/**
+ * Returns the position of the function consuming the value of a token.
+ * 
+ * @param[in] stack Compiled stack.
+ * @param[in] pos Position of the token (not a control token).
+ * 
+ * @return Position of the parent function,
+ *         UINT32_MAX if the token is the root (or the stack is corrupted).
+ */
+static uint32_t get_parent(const yy_stack_t *stack, uint32_t pos)
+{
+    uint32_t num_values = 1;
+
+    for (uint32_t i = pos + 1; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+
+        if (token->type == YY_TOKEN_JUMP)
+            continue;
+
+        if (token->type == YY_TOKEN_FUNCTION) {
+            if (token->function.num_args >= num_values)
+                return i;
+            num_values -= token->function.num_args;
+        }
+
+        num_values++;
+    }
+
+    return UINT32_MAX;
+}
+
+yy_error_e yy_compute_skips(const yy_stack_t *stack, yy_skip_t *skips, uint32_t len)
+{
+    if (!stack || !stack->data || !skips)
+        return YY_ERROR;
+
+    if (len < stack->len)
+        return YY_ERROR_MEM;
+
+    memset(skips, 0x00, stack->len * sizeof(yy_skip_t));
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        if (stack->data[i].type == YY_TOKEN_JUMP)
+            continue;
+
+        uint32_t pos = i;
+
+        // climbs while the error is only propagated
+        while (true)
+        {
+            uint32_t parent = get_parent(stack, pos);
+            bool has_barrier = false;
+
+            if (parent == UINT32_MAX || !is_error_strict(&stack->data[parent].function))
+                break;
+
+            for (uint32_t j = pos + 1; j < parent && !has_barrier; j++)
+                has_barrier = is_skip_barrier(&stack->data[j]);
+
+            if (has_barrier)
+                break;
+
+            pos = parent;
+        }
+
+        if (pos == i)
+            continue;
+
+        // values of the skipped subtree present when the error is pushed
+        uint32_t start = get_subtree_start(stack, pos);
+        uint32_t num_values = 0;
+
+        if (start == UINT32_MAX || start > i)
+            return YY_ERROR_EVAL;
+
+        for (uint32_t j = start; j <= i; j++)
+        {
+            const yy_token_t *token = &stack->data[j];
+
+            if (token->type == YY_TOKEN_JUMP)
+                continue;
+
+            if (token->type == YY_TOKEN_FUNCTION) {
+                if (num_values < token->function.num_args)
+                    return YY_ERROR_EVAL;
+                num_values -= token->function.num_args;
+            }
+
+            num_values++;
+        }
+
+        skips[i].offset = pos + 1 - i;
+        skips[i].num_values = num_values - 1;
+    }
+
+    return YY_OK;
+}
+
+yy_token_t yy_eval_stack_fast_fail(const yy_stack_t *stack, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data, const yy_skip_t *skips)
+{
+    if (!skips)
+        return token_error(YY_ERROR);
+
+    yy_vars_t vars = {.resolve = resolve, .data = data, .skips = skips};
+
+    return eval_stack(stack, aux, &vars);
+}
+
+#define MAX_REGISTERS 256
+#define MAX_PENDING_JUMPS (2 * MAX_REGISTERS)
+
+typedef struct yy_regs_compiler_t
+{
+    const yy_stack_t *stack;        //!< Compiled stack.
+    yy_program_t *program;          //!< Program being compiled.
+    uint32_t values[MAX_REGISTERS]; //!< Pending values (register or token position).
+    bool is_token[MAX_REGISTERS];   //!< Pending value is a token position.
+    uint32_t depth;                 //!< Number of pending values.
+    uint32_t base;                  //!< Number of temporaries (registers 0..base-1).
+    uint32_t pending[MAX_PENDING_JUMPS][3]; //!< Unresolved jumps (instruction, operand index, target token).
+    uint32_t num_pending;           //!< Number of unresolved jumps.
+    yy_error_e error;               //!< Compilation error.
+} yy_regs_compiler_t;
+
+static yy_instr_t * emit_instr(yy_regs_compiler_t *cc, uint8_t opcode, uint32_t dst)
+{
+    yy_program_t *program = cc->program;
+
+    if (cc->error != YY_OK)
+        return NULL;
+
+    if (program->len >= program->reserved) {
+        cc->error = YY_ERROR_MEM;
+        return NULL;
+    }
+
+    if (dst >= MAX_REGISTERS) {
+        cc->error = YY_ERROR_EXCD;
+        return NULL;
+    }
+
+    yy_instr_t *instr = &program->code[program->len++];
+
+    *instr = (yy_instr_t){ .opcode = opcode, .dst = (uint8_t) dst };
+
+    if (dst + 1 > program->num_regs)
+        program->num_regs = dst + 1;
+
+    return instr;
+}
+
+static void add_operand(yy_regs_compiler_t *cc, yy_instr_t *instr, uint32_t idx)
+{
+    instr->args[instr->num_args] = cc->values[idx];
+    instr->is_token |= (uint8_t)(cc->is_token[idx] << instr->num_args);
+    instr->num_args++;
+}
+
+/**
+ * Moves a pending value to the register of its depth.
+ */
+static void load_register(yy_regs_compiler_t *cc, uint32_t idx)
+{
+    uint32_t reg = cc->base + idx;
+
+    if (!cc->is_token[idx] && cc->values[idx] == reg)
+        return;
+
+    yy_instr_t *instr = emit_instr(cc, YY_OPCODE_STORE, reg);
+
+    if (!instr)
+        return;
+
+    add_operand(cc, instr, idx);
+    cc->values[idx] = reg;
+    cc->is_token[idx] = false;
+}
+
+/**
+ * Loads the pending variables below a given depth.
+ * 
+ * Variables are resolved (and errors raised) in the same 
+ * order than the stack evaluator.
+ */
+static void load_variables(yy_regs_compiler_t *cc, uint32_t depth)
+{
+    for (uint32_t k = 0; k < depth; k++)
+        if (cc->is_token[k] && !is_token_fixed_value(cc->stack->data[cc->values[k]].type))
+            load_register(cc, k);
+}
+
+static void add_pending_jump(yy_regs_compiler_t *cc, uint32_t arg, uint32_t target)
+{
+    if (cc->error != YY_OK)
+        return;
+
+    if (cc->num_pending >= MAX_PENDING_JUMPS || target > cc->stack->len) {
+        cc->error = (cc->num_pending >= MAX_PENDING_JUMPS ? YY_ERROR_EXCD : YY_ERROR_EVAL);
+        return;
+    }
+
+    cc->pending[cc->num_pending][0] = cc->program->len - 1;
+    cc->pending[cc->num_pending][1] = arg;
+    cc->pending[cc->num_pending][2] = target;
+    cc->num_pending++;
+}
+
+/**
+ * Resolves the jumps landing on a token (next instruction).
+ */
+static void resolve_jumps(yy_regs_compiler_t *cc, uint32_t target)
+{
+    for (uint32_t k = 0; k < cc->num_pending; )
+    {
+        if (cc->pending[k][2] != target) {
+            k++;
+            continue;
+        }
+
+        yy_instr_t *instr = &cc->program->code[cc->pending[k][0]];
+
+        if (cc->pending[k][1] == 0)
+            instr->pos = cc->program->len;
+        else
+            instr->args[1] = cc->program->len;
+
+        memcpy(cc->pending[k], cc->pending[--cc->num_pending], sizeof(cc->pending[k]));
+    }
+}
+
+/**
+ * Compiles a jump token (see add_jumps() and share_subexprs()).
+ */
+static void compile_jump(yy_regs_compiler_t *cc, uint32_t i)
+{
+    const yy_token_t *token = &cc->stack->data[i];
+    uint32_t target = i + token->jump.offset;
+    yy_instr_t *instr = NULL;
+
+    if (token->jump.opcode == YY_OPCODE_FRAME)
+    {
+        if (i != 0 || token->jump.offset > MAX_REGISTERS) {
+            cc->error = (i != 0 ? YY_ERROR_EVAL : YY_ERROR_EXCD);
+            return;
+        }
+
+        cc->base = token->jump.offset;
+        return;
+    }
+
+    // superinstructions are not required (operands are read directly)
+    if (is_fused_token(token))
+        return;
+
+    if (cc->depth == 0) {
+        cc->error = YY_ERROR_EVAL;
+        return;
+    }
+
+    uint32_t top = cc->depth - 1;
+
+    switch (token->jump.opcode)
+    {
+        case YY_OPCODE_STORE:
+            if (token->jump.offset >= cc->base) {
+                cc->error = YY_ERROR_EVAL;
+                return;
+            }
+            load_variables(cc, cc->depth);
+            instr = emit_instr(cc, YY_OPCODE_STORE, token->jump.offset);
+            if (instr)
+                add_operand(cc, instr, top);
+            return;
+
+        case YY_OPCODE_JUMP_IFELSE:
+            // non-bool condition goes to the ifelse token (target of the jump preceding the else-branch)
+            if (target == 0 || target > cc->stack->len || cc->stack->data[target - 1].type != YY_TOKEN_JUMP) {
+                cc->error = YY_ERROR_EVAL;
+                return;
+            }
+            load_variables(cc, top);
+            instr = emit_instr(cc, YY_OPCODE_JUMP_IFELSE, cc->base + top);
+            if (instr)
+                add_operand(cc, instr, top);
+            add_pending_jump(cc, 0, target);
+            add_pending_jump(cc, 1, target - 1 + cc->stack->data[target - 1].jump.offset);
+            cc->depth--;
+            return;
+
+        case YY_OPCODE_JUMP:
+        case YY_OPCODE_JUMP_AND:
+        case YY_OPCODE_JUMP_OR:
+            load_variables(cc, cc->depth);
+            load_register(cc, top);
+            emit_instr(cc, token->jump.opcode, cc->base + top);
+            add_pending_jump(cc, 0, target);
+            if (token->jump.opcode == YY_OPCODE_JUMP)
+                cc->depth--;    // else-branch starts at the same depth
+            return;
+
+        default:
+            cc->error = YY_ERROR_EVAL;
+            return;
+    }
+}
+
+yy_error_e yy_compile_program(const yy_stack_t *stack, yy_program_t *program)
+{
+    if (!stack || !stack->data || !stack->len || !program || !program->code)
+        return YY_ERROR;
+
+    yy_regs_compiler_t compiler = { .stack = stack, .program = program };
+    yy_regs_compiler_t *cc = &compiler;
+
+    program->len = 0;
+    program->num_regs = 0;
+    program->tokens = stack->data;
+
+    for (uint32_t i = 0; i < stack->len && cc->error == YY_OK; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+        bool is_ifelse = (token->type == YY_TOKEN_FUNCTION && token->function.opcode == YY_OPCODE_IFELSE);
+
+        if (!is_ifelse)
+            resolve_jumps(cc, i);
+
+        switch (token->type)
+        {
+            case YY_TOKEN_JUMP:
+                compile_jump(cc, i);
+                continue;
+
+            case YY_TOKEN_TEMP:
+                if (token->temp >= cc->base || cc->depth + cc->base >= MAX_REGISTERS) {
+                    cc->error = (token->temp >= cc->base ? YY_ERROR_EVAL : YY_ERROR_EXCD);
+                    break;
+                }
+                cc->values[cc->depth] = token->temp;
+                cc->is_token[cc->depth++] = false;
+                continue;
+
+            case YY_TOKEN_FUNCTION:
+                break;
+
+            default:
+                if (cc->depth + cc->base >= MAX_REGISTERS) {
+                    cc->error = YY_ERROR_EXCD;
+                    break;
+                }
+                cc->values[cc->depth] = i;
+                cc->is_token[cc->depth++] = true;
+                continue;
+        }
+
+        if (cc->error != YY_OK)
+            break;
+
+        // branch value already selected by jumps (only the last one remains)
+        if (is_ifelse)
+        {
+            if (cc->depth == 0) {
+                cc->error = YY_ERROR_EVAL;
+                break;
+            }
+
+            load_variables(cc, cc->depth);
+            load_register(cc, cc->depth - 1);
+            resolve_jumps(cc, i);
+
+            yy_instr_t *instr = emit_instr(cc, YY_OPCODE_IFELSE, cc->base + cc->depth - 1);
+
+            if (instr)
+                add_operand(cc, instr, cc->depth - 1);
+
+            continue;
+        }
+
+        uint32_t num_args = token->function.num_args;
+
+        if (cc->depth < num_args || num_args > 3 || cc->depth - num_args + cc->base >= MAX_REGISTERS) {
+            cc->error = (cc->depth < num_args || num_args > 3 ? YY_ERROR_EVAL : YY_ERROR_EXCD);
+            break;
+        }
+
+        uint32_t first = cc->depth - num_args;
+
+        load_variables(cc, first);
+
+        yy_instr_t *instr = emit_instr(cc, token->function.opcode, cc->base + first);
+
+        if (!instr)
+            break;
+
+        for (uint32_t k = first; k < cc->depth; k++)
+            add_operand(cc, instr, k);
+
+        instr->pos = i;
+
+        cc->values[first] = cc->base + first;
+        cc->is_token[first] = false;
+        cc->depth = first + 1;
+    }
+
+    if (cc->error == YY_OK)
+    {
+        resolve_jumps(cc, stack->len);
+
+        if (cc->depth != 1 || cc->num_pending)
+            cc->error = YY_ERROR_EVAL;
+        else
+            load_register(cc, 0);
+    }
+
+    program->result = cc->base;
+
+    return cc->error;
+}
+
+yy_token_t yy_eval_program(const yy_program_t *program, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+{
+    if (!program || !program->code || !program->tokens || !aux || !aux->data || program->result >= program->num_regs)
+        return token_error(YY_ERROR);
+
+    if (aux->reserved < program->num_regs)
+        return token_error(YY_ERROR_MEM);
+
+    yy_vars_t vars = {.resolve = resolve, .data = data};
+    yy_eval_ctx_t ctx = {.stack = aux, .tmp_str = (char *) &aux->data[aux->reserved]};
+    yy_token_t *regs = aux->data;
+    yy_token_t args[3] = {0};
+    const yy_token_t *x = &args[0];
+    const yy_token_t *y = &args[1];
+    uint32_t pc = 0;
+
+    memset(regs, 0x00, program->num_regs * sizeof(yy_token_t));
+    aux->len = program->num_regs;
+
+    while (pc < program->len)
+    {
+        const yy_instr_t *instr = &program->code[pc];
+
+        if (unlikely(instr->num_args > 3 || instr->dst >= program->num_regs))
+            return token_error(YY_ERROR_EVAL);
+
+        // operands are loaded in order (variables are resolved like the stack evaluator)
+        for (uint32_t k = 0; k < instr->num_args; k++)
+        {
+            if (instr->is_token & (1 << k))
+            {
+                if (!load_value(&program->tokens[instr->args[k]], aux, 0, &vars, &args[k]))
+                    return args[k];
+            }
+            else
+            {
+                if (unlikely(instr->args[k] >= program->num_regs))
+                    return token_error(YY_ERROR_EVAL);
+
+                args[k] = regs[instr->args[k]];
+            }
+        }
+
+        switch (instr->opcode)
+        {
+            case YY_OPCODE_STORE:
+                regs[instr->dst] = *x;
+                pc++;
+                continue;
+
+            case YY_OPCODE_JUMP:
+                pc = instr->pos;
+                continue;
+
+            case YY_OPCODE_JUMP_IFELSE:
+                if (likely(x->type == YY_TOKEN_BOOL)) {
+                    pc = (x->bool_val ? pc + 1 : instr->pos);
+                    continue;
+                }
+                if (args[0].type == YY_TOKEN_STRING)
+                    free_str(&ctx, &args[0].str_val);
+                regs[instr->dst] = token_error(YY_ERROR_VALUE);
+                pc = instr->args[1];
+                continue;
+
+            case YY_OPCODE_JUMP_AND:
+            case YY_OPCODE_JUMP_OR:
+            {
+                yy_token_t *value = &regs[instr->dst];
+
+                if (likely(value->type == YY_TOKEN_BOOL)) {
+                    pc = (value->bool_val == (instr->opcode == YY_OPCODE_JUMP_OR) ? instr->pos : pc + 1);
+                    continue;
+                }
+
+                if (value->type == YY_TOKEN_STRING)
+                    free_str(&ctx, &value->str_val);
+
+                *value = token_error(YY_ERROR_VALUE);
+                pc = instr->pos;
+                continue;
+            }
+
+            case YY_OPCODE_IFELSE:
+                if (x->type != YY_TOKEN_NUMBER && x->type != YY_TOKEN_DATETIME && x->type != YY_TOKEN_STRING && x->type != YY_TOKEN_BOOL)
+                    regs[instr->dst] = token_error(YY_ERROR_VALUE);
+                pc++;
+                continue;
+
+            default:
+                break;
+        }
+
+        // inlined operators (fallback to function call on unexpected types)
+        if (instr->num_args == 2 && IS_NUM(x) && IS_NUM(y))
+        {
+            double a = x->number_val;
+            double b = y->number_val;
+            bool done = true;
+
+            switch (instr->opcode)
+            {
+                case YY_OPCODE_ADDITION_OP:     regs[instr->dst] = token_number(a + b); break;
+                case YY_OPCODE_SUBTRACTION_OP:  regs[instr->dst] = token_number(a - b); break;
+                case YY_OPCODE_PRODUCT_OP:      regs[instr->dst] = token_number(a * b); break;
+                case YY_OPCODE_DIVIDE_OP:       regs[instr->dst] = token_number(a / b); break;
+                case YY_OPCODE_LESS_OP:
+                case YY_OPCODE_LT_NUM:          regs[instr->dst] = token_bool(a < b); break;
+                case YY_OPCODE_LESS_EQUALS_OP:
+                case YY_OPCODE_LE_NUM:          regs[instr->dst] = token_bool(a <= b); break;
+                case YY_OPCODE_GREAT_OP:
+                case YY_OPCODE_GT_NUM:          regs[instr->dst] = token_bool(a > b); break;
+                case YY_OPCODE_GREAT_EQUALS_OP:
+                case YY_OPCODE_GE_NUM:          regs[instr->dst] = token_bool(a >= b); break;
+                case YY_OPCODE_EQUALS_OP:
+                case YY_OPCODE_EQ_NUM:          regs[instr->dst] = token_bool(a == b); break;
+                case YY_OPCODE_DISTINCT_OP:
+                case YY_OPCODE_NE_NUM:          regs[instr->dst] = token_bool(a != b); break;
+                case YY_OPCODE_MIN_NUM:         regs[instr->dst] = token_number(min_num(a, b)); break;
+                case YY_OPCODE_MAX_NUM:         regs[instr->dst] = token_number(max_num(a, b)); break;
+                default:                        done = false; break;
+            }
+
+            if (done) {
+                pc++;
+                continue;
+            }
+        }
+        else if (instr->num_args == 2 && IS_BOOL(x) && IS_BOOL(y) && (instr->opcode == YY_OPCODE_AND_OP || instr->opcode == YY_OPCODE_OR_OP))
+        {
+            regs[instr->dst] = token_bool(instr->opcode == YY_OPCODE_AND_OP ? x->bool_val && y->bool_val : x->bool_val || y->bool_val);
+            pc++;
+            continue;
+        }
+
+        // function call
+        const yy_token_t *func = &program->tokens[instr->pos];
+
+        if (unlikely(func->type != YY_TOKEN_FUNCTION || func->function.num_args != instr->num_args))
+            return token_error(YY_ERROR_EVAL);
+
+        yy_token_t result = call_func(func->function, args, &ctx);
+        if (result.type == YY_TOKEN_ERROR && is_blocking_error(result.error))
+            return result;
+
+        free_args(&ctx, args, instr->num_args, &result);
+
+        regs[instr->dst] = result;
+        pc++;
+    }
+
+    if (pc != program->len)
+        return token_error(YY_ERROR_EVAL);
+
+    return regs[program->result];
+}
+
+/*
+ * Compact token format (NaN-boxing).
+ * 
+ * Numbers are doubles (NaN is stored as a positive quiet NaN). The 
+ * remaining values are stored in the payload (48 bits) of a negative 
+ * quiet NaN, whose upper 16 bits identify the type:
+ * 
+ *   0xFFF9  bool (0 or 1)
+ *   0xFFFA  datetime (millis)
+ *   0xFFFB  error
+ *   0xFFFC  string (token position, or runtime string index if bit 47 is set)
+ *   0xFFFD  variable (token position)
+ *   0xFFFE  function (symbol << 8 | opcode)
+ *   0xFFFF  control (kind << 40 | opcode << 32 | value), kind = jump, temp or slot
+ */
+#define BOX_TAG_BOOL        0xFFF9
+#define BOX_TAG_DATETIME    0xFFFA
+#define BOX_TAG_ERROR       0xFFFB
+#define BOX_TAG_STRING      0xFFFC
+#define BOX_TAG_VARIABLE    0xFFFD
+#define BOX_TAG_FUNCTION    0xFFFE
+#define BOX_TAG_CONTROL     0xFFFF
+
+#define BOX_CONTROL_JUMP    0
+#define BOX_CONTROL_TEMP    1
+#define BOX_CONTROL_SLOT    2
+
+#define BOX_PAYLOAD_MASK    0x0000FFFFFFFFFFFFULL
+#define BOX_RUNTIME_STR     0x0000800000000000ULL
+#define BOX_NAN             0x7FF8000000000000ULL
+#define BOX_EMPTY           0xFFFFFFFFFFFFFFFFULL   // unassigned temporary (never a value)
+#define MAX_BOXED_STRINGS   32
+
+#define box_make(tag_, payload_)    (((uint64_t)(tag_) << 48) | ((uint64_t)(payload_) & BOX_PAYLOAD_MASK))
+#define box_tag(box_)               ((uint32_t)((box_) >> 48))
+#define box_payload(box_)           ((box_) & BOX_PAYLOAD_MASK)
+#define box_is_number(box_)         (box_tag(box_) < BOX_TAG_BOOL)
+#define box_is_bool(box_)           (box_tag(box_) == BOX_TAG_BOOL)
+#define box_bool(val_)              box_make(BOX_TAG_BOOL, (val_) ? 1 : 0)
+#define box_error(err_)             box_make(BOX_TAG_ERROR, (err_))
+#define box_control(kind_, opcode_, value_) box_make(BOX_TAG_CONTROL, ((uint64_t)(kind_) << 40) | ((uint64_t)(opcode_) << 32) | (uint32_t)(value_))
+
+typedef struct yy_box_ctx_t
+{
+    const yy_token_t *tokens;       //!< Original tokens (strings and variables).
+    yy_str_t strs[MAX_BOXED_STRINGS]; //!< Strings created at runtime (ex. resolved variables).
+    uint32_t num_strs;              //!< Number of runtime strings.
+} yy_box_ctx_t;
+
+INLINE
+static yy_box_t box_number(double val)
+{
+    yy_box_t ret = BOX_NAN;
+
+    if (!isnan(val))
+        memcpy(&ret, &val, sizeof(ret));
+
+    return ret;
+}
+
+INLINE
+static double unbox_number(yy_box_t box)
+{
+    double ret = 0.0;
+
+    memcpy(&ret, &box, sizeof(ret));
+    return ret;
+}
+
+/**
+ * Finds the symbol of a function (same pointer and number of arguments).
+ * 
+ * @return Symbol index, or YY_SYMBOL_END if not found.
+ */
+static uint32_t find_symbol(const yy_func_t *func)
+{
+    uint32_t symbol = 0;
+
+    while (symbol < YY_SYMBOL_END && !(symbol_to_token[symbol].type == YY_TOKEN_FUNCTION && 
+           symbol_to_token[symbol].function.ptr == func->ptr && 
+           symbol_to_token[symbol].function.num_args == func->num_args))
+        symbol++;
+
+    return symbol;
+}
+
+/**
+ * Converts a value to the boxed format.
+ * 
+ * @param[in] token Value to box.
+ * @param[in,out] ctx Context (runtime strings are appended).
+ * @param[out] box Boxed value.
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_VALUE if value can't be boxed (ex. datetime too large),
+ *         YY_ERROR_MEM if there are too many runtime strings.
+ */
+static yy_error_e box_value(const yy_token_t *token, yy_box_ctx_t *ctx, yy_box_t *box)
+{
+    switch (token->type)
+    {
+        case YY_TOKEN_NUMBER:
+            *box = box_number(token->number_val);
+            return YY_OK;
+        case YY_TOKEN_BOOL:
+            *box = box_bool(token->bool_val);
+            return YY_OK;
+        case YY_TOKEN_DATETIME:
+            if (token->datetime_val > BOX_PAYLOAD_MASK)
+                return YY_ERROR_VALUE;
+            *box = box_make(BOX_TAG_DATETIME, token->datetime_val);
+            return YY_OK;
+        case YY_TOKEN_ERROR:
+            *box = box_error(token->error);
+            return YY_OK;
+        case YY_TOKEN_STRING:
+            if (ctx->num_strs >= MAX_BOXED_STRINGS)
+                return YY_ERROR_MEM;
+            ctx->strs[ctx->num_strs] = token->str_val;
+            *box = box_make(BOX_TAG_STRING, BOX_RUNTIME_STR | ctx->num_strs++);
+            return YY_OK;
+        default:
+            return YY_ERROR_VALUE;
+    }
+}
+
+static yy_token_t unbox_value(yy_box_t box, const yy_box_ctx_t *ctx)
+{
+    if (box_is_number(box))
+        return token_number(unbox_number(box));
+
+    uint64_t payload = box_payload(box);
+
+    switch (box_tag(box))
+    {
+        case BOX_TAG_BOOL:
+            return token_bool(payload != 0);
+        case BOX_TAG_DATETIME:
+            return token_datetime(payload);
+        case BOX_TAG_ERROR:
+            return token_error((yy_error_e) payload);
+        case BOX_TAG_STRING:
+            if (payload & BOX_RUNTIME_STR)
+                return (yy_token_t){ .str_val = ctx->strs[payload & ~BOX_RUNTIME_STR], .type = YY_TOKEN_STRING };
+            return ctx->tokens[payload];
+        default:
+            return token_error(YY_ERROR_EVAL);
+    }
+}
+
+yy_error_e yy_box_stack(const yy_stack_t *stack, yy_boxed_t *boxed)
+{
+    if (!stack || !stack->data || !boxed || !boxed->data)
+        return YY_ERROR;
+
+    if (boxed->reserved < stack->len)
+        return YY_ERROR_MEM;
+
+    // checked before touching the output
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+
+        if (token->type == YY_TOKEN_DATETIME && token->datetime_val > BOX_PAYLOAD_MASK)
+            return YY_ERROR_VALUE;
+
+        if (token->type == YY_TOKEN_FUNCTION && token->function.needs_ctx)
+            return YY_ERROR_VALUE;
+    }
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+        yy_box_t *box = &boxed->data[i];
+
+        switch (token->type)
+        {
+            case YY_TOKEN_NUMBER:
+                *box = box_number(token->number_val);
+                break;
+            case YY_TOKEN_BOOL:
+                *box = box_bool(token->bool_val);
+                break;
+            case YY_TOKEN_DATETIME:
+                *box = box_make(BOX_TAG_DATETIME, token->datetime_val);
+                break;
+            case YY_TOKEN_ERROR:
+                *box = box_error(token->error);
+                break;
+            case YY_TOKEN_STRING:
+                *box = box_make(BOX_TAG_STRING, i);
+                break;
+            case YY_TOKEN_VARIABLE:
+                *box = box_make(BOX_TAG_VARIABLE, i);
+                break;
+            case YY_TOKEN_JUMP:
+                *box = box_control(BOX_CONTROL_JUMP, token->jump.opcode, token->jump.offset);
+                break;
+            case YY_TOKEN_TEMP:
+                *box = box_control(BOX_CONTROL_TEMP, 0, token->temp);
+                break;
+            case YY_TOKEN_SLOT:
+                *box = box_control(BOX_CONTROL_SLOT, 0, token->slot);
+                break;
+            case YY_TOKEN_FUNCTION:
+            {
+                uint32_t symbol = find_symbol(&token->function);
+
+                if (symbol == YY_SYMBOL_END)
+                    return YY_ERROR_VALUE;
+
+                *box = box_make(BOX_TAG_FUNCTION, (symbol << 8) | token->function.opcode);
+                break;
+            }
+            default:
+                return YY_ERROR_VALUE;
+        }
+    }
+
+    boxed->len = stack->len;
+    boxed->tokens = stack->data;
+
+    return YY_OK;
+}
+
+yy_token_t yy_eval_boxed(const yy_boxed_t *boxed, yy_boxed_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+{
+    if (!boxed || !boxed->data || !boxed->tokens || !boxed->len || !aux || !aux->data)
+        return token_error(YY_ERROR);
+
+    yy_box_ctx_t ctx = {.tokens = boxed->tokens};
+    const yy_box_t *code = boxed->data;
+    yy_box_t *values = aux->data;
+    yy_token_t args[3] = {0};
+    yy_token_t tmp = {0};
+    yy_error_e rc = YY_OK;
+    uint32_t base = 0;      // number of temporaries (bottom of aux)
+    uint32_t len = 0;
+
+    for (uint32_t i = 0; i < boxed->len; i++)
+    {
+        yy_box_t box = code[i];
+        uint64_t payload = box_payload(box);
+
+        switch (box_is_number(box) ? 0 : box_tag(box))
+        {
+            case 0:
+            case BOX_TAG_BOOL:
+            case BOX_TAG_DATETIME:
+            case BOX_TAG_STRING:
+                if (unlikely(aux->reserved <= len))
+                    return token_error(YY_ERROR_MEM);
+                values[len++] = box;
+                continue;
+
+            case BOX_TAG_ERROR:
+                if (is_blocking_error((yy_error_e) payload))
+                    return token_error(YY_ERROR_EVAL);
+                if (aux->reserved <= len)
+                    return token_error(YY_ERROR_MEM);
+                values[len++] = box;
+                continue;
+
+            case BOX_TAG_VARIABLE:
+                if (unlikely(aux->reserved <= len))
+                    return token_error(YY_ERROR_MEM);
+                if (!resolve)
+                    return token_error(YY_ERROR_REF);
+                tmp = resolve(ctx.tokens[payload].variable, data);
+                if (tmp.type == YY_TOKEN_ERROR && is_blocking_error(tmp.error))
+                    return tmp;
+                rc = box_value(&tmp, &ctx, &values[len]);
+                if (rc == YY_ERROR_MEM)
+                    return token_error(rc);
+                if (rc != YY_OK)
+                    values[len] = box_error(YY_ERROR_VALUE);
+                len++;
+                continue;
+
+            case BOX_TAG_CONTROL:
+                break;
+
+            case BOX_TAG_FUNCTION:
+                goto BOXED_FUNCTION;
+
+            default:
+                return token_error(YY_ERROR_EVAL);
+        }
+
+        // control tokens (see eval_stack())
+        uint32_t value = (uint32_t) payload;
+        uint8_t opcode = (uint8_t)(payload >> 32);
+        yy_box_t *x = NULL;
+
+        switch ((payload >> 40) & 0xFF)
+        {
+            case BOX_CONTROL_SLOT:
+                if (unlikely(aux->reserved <= len))
+                    return token_error(YY_ERROR_MEM);
+                values[len++] = box_error(YY_ERROR_REF);
+                continue;
+
+            case BOX_CONTROL_TEMP:
+                if (unlikely(aux->reserved <= len))
+                    return token_error(YY_ERROR_MEM);
+                if (unlikely(value >= base || values[value] == BOX_EMPTY))
+                    return token_error(YY_ERROR_EVAL);
+                values[len++] = values[value];
+                continue;
+
+            case BOX_CONTROL_JUMP:
+                break;
+
+            default:
+                return token_error(YY_ERROR_EVAL);
+        }
+
+        switch (opcode)
+        {
+            case YY_OPCODE_FRAME:
+                if (unlikely(i != 0 || value >= aux->reserved))
+                    return token_error(YY_ERROR_EVAL);
+                base = len = value;
+                for (uint32_t k = 0; k < base; k++)
+                    values[k] = BOX_EMPTY;
+                continue;
+
+            case YY_OPCODE_STORE:
+                if (unlikely(value >= base || len <= base))
+                    return token_error(YY_ERROR_EVAL);
+                values[value] = values[len - 1];
+                continue;
+
+            case YY_OPCODE_JUMP:
+                if (unlikely(!value || boxed->len - i < value))
+                    return token_error(YY_ERROR_EVAL);
+                i += value - 1;
+                continue;
+
+            case YY_OPCODE_JUMP_IFELSE:
+                if (unlikely(len < 1 || !value || boxed->len - i < value))
+                    return token_error(YY_ERROR_EVAL);
+                x = &values[len - 1];
+                if (likely(box_is_bool(*x))) {
+                    len--;
+                    if (!box_payload(*x))
+                        i += value - 1;
+                    continue;
+                }
+                // non-bool condition, goes to the ifelse token (target of the jump preceding the else-branch)
+                box = code[i + value - 1];
+                if (unlikely(box_tag(box) != BOX_TAG_CONTROL || ((box_payload(box) >> 40) & 0xFF) != BOX_CONTROL_JUMP || 
+                             !(uint32_t) box || boxed->len - i < value - 1 + (uint32_t) box))
+                    return token_error(YY_ERROR_EVAL);
+                *x = box_error(YY_ERROR_VALUE);
+                i += value - 1 + (uint32_t) box - 1;
+                continue;
+
+            case YY_OPCODE_JUMP_AND:
+            case YY_OPCODE_JUMP_OR:
+                if (unlikely(len < 1 || !value || boxed->len - i < value))
+                    return token_error(YY_ERROR_EVAL);
+                x = &values[len - 1];
+                if (likely(box_is_bool(*x))) {
+                    if ((box_payload(*x) != 0) == (opcode == YY_OPCODE_JUMP_OR))
+                        i += value - 1;
+                    continue;
+                }
+                *x = box_error(YY_ERROR_VALUE);
+                i += value - 1;
+                continue;
+
+            default:
+                // superinstructions are evaluated as plain tokens
+                if (opcode >= YY_OPCODE_FUSED_ADD && opcode <= YY_OPCODE_FUSED_NE)
+                    continue;
+                return token_error(YY_ERROR_EVAL);
+        }
+
+BOXED_FUNCTION:
+        {
+            uint32_t symbol = (uint32_t)(payload >> 8);
+
+            if (unlikely(symbol >= YY_SYMBOL_END || symbol_to_token[symbol].type != YY_TOKEN_FUNCTION))
+                return token_error(YY_ERROR_EVAL);
+
+            yy_func_t func = symbol_to_token[symbol].function;
+            yy_box_t *x = &values[len - (func.num_args ? func.num_args : 1)];
+            yy_box_t *y = x + 1;
+
+            func.opcode = (uint8_t) payload;
+
+            if (func.opcode == YY_OPCODE_IFELSE)
+            {
+                // branch value already selected by jumps
+                if (unlikely(len < 1))
+                    return token_error(YY_ERROR_EVAL);
+
+                x = &values[len - 1];
+
+                if (!box_is_number(*x) && box_tag(*x) != BOX_TAG_BOOL && box_tag(*x) != BOX_TAG_DATETIME && box_tag(*x) != BOX_TAG_STRING)
+                    *x = box_error(YY_ERROR_VALUE);
+
+                continue;
+            }
+
+            if (unlikely(len < func.num_args))
+                return token_error(YY_ERROR_EVAL);
+
+            // inlined operators (fallback to function call on unexpected types)
+            if (func.num_args == 2 && box_is_number(*x) && box_is_number(*y))
+            {
+                double a = unbox_number(*x);
+                double b = unbox_number(*y);
+                bool done = true;
+
+                switch (func.opcode)
+                {
+                    case YY_OPCODE_ADDITION_OP:     *x = box_number(a + b); break;
+                    case YY_OPCODE_SUBTRACTION_OP:  *x = box_number(a - b); break;
+                    case YY_OPCODE_PRODUCT_OP:      *x = box_number(a * b); break;
+                    case YY_OPCODE_DIVIDE_OP:       *x = box_number(a / b); break;
+                    case YY_OPCODE_LESS_OP:
+                    case YY_OPCODE_LT_NUM:          *x = box_bool(a < b); break;
+                    case YY_OPCODE_LESS_EQUALS_OP:
+                    case YY_OPCODE_LE_NUM:          *x = box_bool(a <= b); break;
+                    case YY_OPCODE_GREAT_OP:
+                    case YY_OPCODE_GT_NUM:          *x = box_bool(a > b); break;
+                    case YY_OPCODE_GREAT_EQUALS_OP:
+                    case YY_OPCODE_GE_NUM:          *x = box_bool(a >= b); break;
+                    case YY_OPCODE_EQUALS_OP:
+                    case YY_OPCODE_EQ_NUM:          *x = box_bool(a == b); break;
+                    case YY_OPCODE_DISTINCT_OP:
+                    case YY_OPCODE_NE_NUM:          *x = box_bool(a != b); break;
+                    default:                        done = false; break;
+                }
+
+                if (done) {
+                    len--;
+                    continue;
+                }
+            }
+            else if (func.num_args == 2 && box_is_bool(*x) && box_is_bool(*y) && (func.opcode == YY_OPCODE_AND_OP || func.opcode == YY_OPCODE_OR_OP))
+            {
+                *x = box_bool(func.opcode == YY_OPCODE_AND_OP ? (*x & *y & 1) : ((*x | *y) & 1));
+                len--;
+                continue;
+            }
+
+            // function call (functions requiring the eval context are not boxed)
+            if (unlikely(func.needs_ctx || (func.num_args == 0 && aux->reserved <= len)))
+                return token_error(func.needs_ctx ? YY_ERROR_EVAL : YY_ERROR_MEM);
+
+            for (uint32_t k = 0; k < func.num_args; k++)
+                args[k] = unbox_value(values[len - func.num_args + k], &ctx);
+
+            tmp = call_func(func, args, NULL);
+            if (tmp.type == YY_TOKEN_ERROR && is_blocking_error(tmp.error))
+                return tmp;
+
+            len -= func.num_args;
+            rc = box_value(&tmp, &ctx, &values[len]);
+            if (rc == YY_ERROR_MEM)
+                return token_error(rc);
+            if (rc != YY_OK)
+                values[len] = box_error(YY_ERROR_VALUE);
+            len++;
+        }
+    }
+
+    aux->len = len;
+
+    if (len != base + 1)
+        return token_error(YY_ERROR_EVAL);
+
+    return unbox_value(values[base], &ctx);
+}
+
+/*
+ * Canonical form.
+ *
+ * Texts differing in spacing, redundant parentheses or aliases (True/true,
+ * pow($x, 2)/$x^2) already compile to the same stack. The canonical form
+ * also sorts the operands of the commutative functions, so that $y * $x
+ * and $x * $y give the same stack (and fingerprint).
+ *
+ * && and || are not commutative here (the first operand is checked before
+ * short-circuiting, ex: $v && false is an error but false && $v is false),
+ * neither min() and max() (min(-0, +0) and min(+0, -0) differ).
+ * Sorting changes the order in which variables are resolved.
+ */
+
+static bool is_commutative(const yy_token_t *token)
+{
+    return (is_func_2(token, func_addition) || is_func_2(token, func_mult) ||
+            is_func_2(token, func_eq) || is_func_2(token, func_ne));
+}
+
+#define CMP(a_, b_)     (((a_) > (b_)) - ((a_) < (b_)))
+
+// total order not depending on addresses (stable across processes)
+static int compare_tokens(const yy_token_t *token1, const yy_token_t *token2)
+{
+    if (token1->type != token2->type)
+        return CMP(token1->type, token2->type);
+
+    switch (token1->type)
+    {
+        case YY_TOKEN_BOOL:
+            return CMP(token1->bool_val, token2->bool_val);
+        case YY_TOKEN_NUMBER: {
+            uint64_t bits1, bits2;
+            memcpy(&bits1, &token1->number_val, sizeof(bits1));
+            memcpy(&bits2, &token2->number_val, sizeof(bits2));
+            return CMP(bits1, bits2);
+        }
+        case YY_TOKEN_DATETIME:
+            return CMP(token1->datetime_val, token2->datetime_val);
+        case YY_TOKEN_STRING:
+        case YY_TOKEN_VARIABLE: {
+            uint32_t len = MIN(token1->str_val.len, token2->str_val.len);
+            int ret = (len ? memcmp(token1->str_val.ptr, token2->str_val.ptr, len) : 0);
+            return (ret != 0 ? ret : CMP(token1->str_val.len, token2->str_val.len));
+        }
+        case YY_TOKEN_FUNCTION: {
+            uint32_t symbol1 = find_symbol(&token1->function);
+            uint32_t symbol2 = find_symbol(&token2->function);
+            return (symbol1 != symbol2 ? CMP(symbol1, symbol2) : CMP(token1->function.num_args, token2->function.num_args));
+        }
+        case YY_TOKEN_ERROR:
+            return CMP(token1->error, token2->error);
+        case YY_TOKEN_SLOT:
+            return CMP(token1->slot, token2->slot);
+        case YY_TOKEN_TEMP:
+            return CMP(token1->temp, token2->temp);
+        default:
+            return 0;
+    }
+}
+
+// compares the subtrees [first1, end1) and [first2, end2) of a plain stack
+static int compare_subtrees(const yy_stack_t *stack, uint32_t first1, uint32_t end1, uint32_t first2, uint32_t end2)
+{
+    for (; first1 < end1 && first2 < end2; first1++, first2++)
+    {
+        int ret = compare_tokens(&stack->data[first1], &stack->data[first2]);
+
+        if (ret != 0)
+            return ret;
+    }
+
+    return CMP(end1 - first1, end2 - first2);
+}
+
+/**
+ * Sorts the operands of the commutative functions (lowest first).
+ * 
+ * Stack is traversed from the beginning, so operands are already sorted
+ * when their function is processed.
+ * 
+ * @param[in,out] stack Plain stack (without control tokens).
+ * 
+ * @return true on success, false if the stack is corrupted.
+ */
+static bool sort_operands(yy_stack_t *stack)
+{
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        if (!is_commutative(&stack->data[i]))
+            continue;
+
+        uint32_t start_y = (i > 1 ? get_subtree_start(stack, i - 1) : UINT32_MAX);
+
+        if (start_y == UINT32_MAX || start_y == 0)
+            return false;
+
+        uint32_t start_x = get_subtree_start(stack, start_y - 1);
+
+        if (start_x == UINT32_MAX)
+            return false;
+
+        if (compare_subtrees(stack, start_x, start_y, start_y, i) > 0)
+            rotate_tokens(stack->data, start_x, start_y, i);
+    }
+
+    return true;
+}
+
+// FNV-1a 128-bit (prime = 2^88 + 0x13B)
+static void hash_bytes(yy_fingerprint_t *hash, const void *data, uint32_t len)
+{
+    const uint8_t *bytes = (const uint8_t *) data;
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        hash->lo ^= bytes[i];
+
+        uint64_t lo = (hash->lo & 0xFFFFFFFF) * 0x13B;
+        uint64_t mid = (hash->lo >> 32) * 0x13B + (lo >> 32);
+
+        hash->hi = hash->hi * 0x13B + (mid >> 32) + (hash->lo << 24);
+        hash->lo = (mid << 32) | (lo & 0xFFFFFFFF);
+    }
+}
+
+// integers are hashed in little-endian order (same result on all platforms)
+static void hash_uint(yy_fingerprint_t *hash, uint64_t val, uint32_t num_bytes)
+{
+    uint8_t bytes[8];
+
+    for (uint32_t i = 0; i < num_bytes; i++)
+        bytes[i] = (uint8_t)(val >> (8 * i));
+
+    hash_bytes(hash, bytes, num_bytes);
+}
+
+yy_error_e yy_canonicalize_stack(const yy_stack_t *stack, yy_stack_t *output)
+{
+    if (!stack || !stack->data || !stack->len || !output || !output->data)
+        return YY_ERROR;
+
+    if (output->reserved < stack->len)
+        return YY_ERROR_MEM;
+
+    if (output->data != stack->data)
+        memcpy(output->data, stack->data, stack->len * sizeof(yy_token_t));
+
+    output->len = stack->len;
+
+    yy_error_e rc = normalize_stack(output);
+
+    if (rc != YY_OK)
+        return rc;
+
+    if (!sort_operands(output))
+        return YY_ERROR_EVAL;
+
+    optimize_stack(output, 0);
+
+    return YY_OK;
+}
+
+yy_error_e yy_fingerprint_stack(const yy_stack_t *stack, yy_fingerprint_t *fingerprint)
+{
+    if (!stack || !stack->data || !fingerprint)
+        return YY_ERROR;
+
+    yy_fingerprint_t hash = {.hi = 0x6C62272E07BB0142ULL, .lo = 0x62B821756295C58DULL};
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+        uint64_t bits = 0;
+
+        hash_uint(&hash, token->type, 1);
+
+        switch (token->type)
+        {
+            case YY_TOKEN_BOOL:
+                hash_uint(&hash, token->bool_val, 1);
+                break;
+            case YY_TOKEN_NUMBER:
+                memcpy(&bits, &token->number_val, sizeof(bits));
+                hash_uint(&hash, bits, 8);
+                break;
+            case YY_TOKEN_DATETIME:
+                hash_uint(&hash, token->datetime_val, 8);
+                break;
+            case YY_TOKEN_STRING:
+            case YY_TOKEN_VARIABLE:
+                hash_uint(&hash, token->str_val.len, 4);
+                hash_bytes(&hash, token->str_val.ptr, token->str_val.len);
+                break;
+            case YY_TOKEN_FUNCTION:
+                hash_uint(&hash, find_symbol(&token->function), 4);
+                hash_uint(&hash, token->function.num_args, 1);
+                break;
+            case YY_TOKEN_ERROR:
+                hash_uint(&hash, token->error, 4);
+                break;
+            case YY_TOKEN_SLOT:
+                hash_uint(&hash, token->slot, 4);
+                break;
+            case YY_TOKEN_TEMP:
+                hash_uint(&hash, token->temp, 4);
+                break;
+            case YY_TOKEN_JUMP:
+                hash_uint(&hash, token->jump.opcode, 1);
+                hash_uint(&hash, token->jump.offset, 4);
+                break;
+            default:
+                return YY_ERROR_EVAL;
+        }
+    }
+
+    *fingerprint = hash;
+
+    return YY_OK;
+}
+
+/*
+ * Dense bytecode.
+ * 
+ * Each token is encoded as an opcode byte (see yy_opcode_e) followed by 
+ * its operand:
+ * 
+ *   bool, error             1 byte (value)
+ *   number, datetime        varint (constant index)
+ *   string, variable        varint (offset in the strings pool)
+ *   slot, temp              varint (index)
+ *   frame, store            varint (number of temporaries, temporary index)
+ *   jumps                   varint (bytes to skip after the instruction)
+ *   functions               1 byte (symbol, see symbol_to_token)
+ * 
+ * The jump of an ifelse condition targets the unconditional jump 
+ * preceding the else-branch (taken if the condition is not a bool). 
+ * Fused opcodes are not encoded (operators are evaluated inline).
+ */
+
+#define MAX_VARINT_BYTES    5
+
+INLINE
+static bool is_function_opcode(uint8_t opcode)
+{
+    return (opcode == YY_OPCODE_CALL || (opcode >= YY_OPCODE_AND_OP && opcode <= YY_OPCODE_IFELSE));
+}
+
+INLINE
+static bool is_fused_opcode(uint8_t opcode)
+{
+    return (opcode >= YY_OPCODE_FUSED_ADD && opcode <= YY_OPCODE_FUSED_NE);
+}
+
+static uint32_t write_varint(uint8_t *buf, uint32_t val)
+{
+    uint32_t len = 0;
+
+    while (val >= 0x80) {
+        buf[len++] = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+
+    buf[len++] = (uint8_t) val;
+    return len;
+}
+
+INLINE
+static bool read_varint(const uint8_t *code, uint32_t len, uint32_t *pos, uint32_t *val)
+{
+    uint32_t ret = 0;
+
+    for (uint32_t shift = 0; shift < 7 * MAX_VARINT_BYTES && *pos < len; shift += 7)
+    {
+        uint8_t byte = code[(*pos)++];
+
+        ret |= (uint32_t)(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80)) {
+            *val = ret;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Returns the length of the instruction at the given position (0 if invalid).
+ */
+static uint32_t get_instr_len(const uint8_t *code, uint32_t len, uint32_t pos)
+{
+    uint32_t start = pos;
+    uint32_t val = 0;
+
+    if (pos >= len)
+        return 0;
+
+    uint8_t opcode = code[pos++];
+
+    if (opcode == YY_OPCODE_BOOL || opcode == YY_OPCODE_ERROR || is_function_opcode(opcode))
+        return (pos < len ? 2 : 0);
+
+    if (!read_varint(code, len, &pos, &val))
+        return 0;
+
+    return pos - start;
+}
+
+static yy_error_e add_const(yy_bytecode_t *bytecode, uint64_t val, uint32_t *idx)
+{
+    for (uint32_t i = 0; i < bytecode->num_consts; i++) {
+        if (bytecode->consts[i] == val) {
+            *idx = i;
+            return YY_OK;
+        }
+    }
+
+    if (bytecode->num_consts >= bytecode->consts_reserved)
+        return YY_ERROR_MEM;
+
+    *idx = bytecode->num_consts;
+    bytecode->consts[bytecode->num_consts++] = val;
+
+    return YY_OK;
+}
+
+static yy_error_e add_str(yy_bytecode_t *bytecode, yy_str_t str, uint32_t *offset)
+{
+    uint32_t pos = 0;
+    uint32_t len = 0;
+
+    while (pos < bytecode->strs_len)
+    {
+        uint32_t start = pos;
+
+        if (!read_varint((const uint8_t *) bytecode->strs, bytecode->strs_len, &pos, &len) || bytecode->strs_len - pos < len)
+            return YY_ERROR_EVAL;
+
+        if (len == str.len && (!len || memcmp(bytecode->strs + pos, str.ptr, len) == 0)) {
+            *offset = start;
+            return YY_OK;
+        }
+
+        pos += len;
+    }
+
+    uint8_t buf[MAX_VARINT_BYTES] = {0};
+    uint32_t num_bytes = write_varint(buf, str.len);
+
+    if (bytecode->strs_reserved - bytecode->strs_len < num_bytes + str.len)
+        return YY_ERROR_MEM;
+
+    *offset = bytecode->strs_len;
+    memcpy(bytecode->strs + bytecode->strs_len, buf, num_bytes);
+    if (str.len)
+        memcpy(bytecode->strs + bytecode->strs_len + num_bytes, str.ptr, str.len);
+    bytecode->strs_len += num_bytes + str.len;
+
+    return YY_OK;
+}
+
+static bool get_pool_str(const yy_bytecode_t *bytecode, uint32_t offset, yy_str_t *str)
+{
+    uint32_t len = 0;
+
+    if (!read_varint((const uint8_t *) bytecode->strs, bytecode->strs_len, &offset, &len) || bytecode->strs_len - offset < len)
+        return false;
+
+    *str = (yy_str_t){ .ptr = bytecode->strs + offset, .len = len };
+    return true;
+}
+
+yy_error_e yy_encode_stack(const yy_stack_t *stack, yy_bytecode_t *bytecode)
+{
+    if (!stack || !stack->data || !stack->len || !bytecode || !bytecode->code || !bytecode->consts || !bytecode->strs)
+        return YY_ERROR;
+
+    yy_error_e rc = YY_OK;
+    uint8_t *code = bytecode->code;
+    uint32_t end = bytecode->code_reserved;
+    uint32_t pos = end;
+
+    bytecode->code_len = 0;
+    bytecode->num_consts = 0;
+    bytecode->strs_len = 0;
+
+    // encoded backwards (jump lengths are known once the jumped code is encoded)
+    for (uint32_t i = stack->len; i-- > 0; )
+    {
+        const yy_token_t *token = &stack->data[i];
+        uint8_t buf[2 + MAX_VARINT_BYTES] = {0};
+        uint32_t len = 1;
+        uint32_t val = 0;
+
+        buf[0] = (uint8_t) token->type;
+
+        switch (token->type)
+        {
+            case YY_TOKEN_BOOL:
+                buf[len++] = (token->bool_val ? 1 : 0);
+                break;
+            case YY_TOKEN_ERROR:
+                buf[len++] = (uint8_t) token->error;
+                break;
+            case YY_TOKEN_NUMBER:
+            {
+                uint64_t bits = 0;
+                memcpy(&bits, &token->number_val, sizeof(bits));
+                if ((rc = add_const(bytecode, bits, &val)) != YY_OK)
+                    return rc;
+                len += write_varint(buf + len, val);
+                break;
+            }
+            case YY_TOKEN_DATETIME:
+                if ((rc = add_const(bytecode, token->datetime_val, &val)) != YY_OK)
+                    return rc;
+                len += write_varint(buf + len, val);
+                break;
+            case YY_TOKEN_STRING:
+            case YY_TOKEN_VARIABLE:
+                if ((rc = add_str(bytecode, (token->type == YY_TOKEN_STRING ? token->str_val : token->variable), &val)) != YY_OK)
+                    return rc;
+                len += write_varint(buf + len, val);
+                break;
+            case YY_TOKEN_SLOT:
+                len += write_varint(buf + len, token->slot);
+                break;
+            case YY_TOKEN_TEMP:
+                len += write_varint(buf + len, token->temp);
+                break;
+            case YY_TOKEN_FUNCTION:
+                val = find_symbol(&token->function);
+                if (val == YY_SYMBOL_END || !is_function_opcode(token->function.opcode))
+                    return YY_ERROR_EVAL;
+                buf[0] = token->function.opcode;
+                buf[len++] = (uint8_t) val;
+                break;
+            case YY_TOKEN_JUMP:
+            {
+                if (is_fused_opcode(token->jump.opcode))
+                    continue;
+
+                buf[0] = token->jump.opcode;
+                val = token->jump.offset;
+
+                if (token->jump.opcode == YY_OPCODE_FRAME || token->jump.opcode == YY_OPCODE_STORE) {
+                    len += write_varint(buf + len, val);
+                    break;
+                }
+
+                if (token->jump.opcode < YY_OPCODE_JUMP || token->jump.opcode > YY_OPCODE_JUMP_OR || !val || stack->len - i < val)
+                    return YY_ERROR_EVAL;
+
+                // ifelse condition targets the jump preceding the else-branch
+                uint32_t target = i + val - (token->jump.opcode == YY_OPCODE_JUMP_IFELSE ? 1 : 0);
+                uint32_t dist = 0;
+
+                for (uint32_t j = i + 1; j < target; j++)
+                {
+                    if (stack->data[j].type == YY_TOKEN_JUMP && is_fused_opcode(stack->data[j].jump.opcode))
+                        continue;
+
+                    uint32_t num_bytes = get_instr_len(code, end, pos + dist);
+
+                    if (!num_bytes)
+                        return YY_ERROR_EVAL;
+
+                    dist += num_bytes;
+                }
+
+                len += write_varint(buf + len, dist);
+                break;
+            }
+            default:
+                return YY_ERROR_EVAL;
+        }
+
+        if (pos < len)
+            return YY_ERROR_MEM;
+
+        pos -= len;
+        memcpy(code + pos, buf, len);
+    }
+
+    bytecode->code_len = end - pos;
+    memmove(code, code + pos, bytecode->code_len);
+
+    return YY_OK;
+}
+
+yy_token_t yy_eval_bytecode(const yy_bytecode_t *bytecode, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+{
+    if (!bytecode || !bytecode->code || !bytecode->code_len || !aux || !aux->data)
+        return token_error(YY_ERROR);
+
+    yy_vars_t vars = {.resolve = resolve, .data = data};
+    yy_eval_ctx_t ctx = {.stack = aux, .tmp_str = (char *) &aux->data[aux->reserved]};
+    const uint8_t *code = bytecode->code;
+    uint32_t code_len = bytecode->code_len;
+    yy_token_t tmp = {0};
+    yy_token_t *x = NULL;
+    yy_token_t *y = NULL;
+    yy_str_t str = {0};
+    uint32_t base = 0;
+    uint32_t pc = 0;
+    uint32_t val = 0;
+
+    aux->len = 0;
+
+    while (pc < code_len)
+    {
+        uint32_t start = pc;
+        uint8_t opcode = code[pc++];
+
+        if (unlikely(pc >= code_len))
+            return token_error(YY_ERROR_EVAL);
+
+        // functions (opcode + symbol)
+        if (is_function_opcode(opcode))
+        {
+            uint8_t symbol = code[pc++];
+
+            if (unlikely(symbol >= YY_SYMBOL_END || symbol_to_token[symbol].type != YY_TOKEN_FUNCTION))
+                return token_error(YY_ERROR_EVAL);
+
+            yy_func_t func = symbol_to_token[symbol].function;
+
+            func.opcode = opcode;
+
+            if (opcode == YY_OPCODE_IFELSE)
+            {
+                // branch value already selected by jumps
+                if (unlikely(aux->len < 1))
+                    return token_error(YY_ERROR_EVAL);
+
+                x = &aux->data[aux->len - 1];
+
+                if (x->type != YY_TOKEN_NUMBER && x->type != YY_TOKEN_DATETIME && x->type != YY_TOKEN_STRING && x->type != YY_TOKEN_BOOL)
+                    *x = token_error(YY_ERROR_VALUE);
+
+                continue;
+            }
+
+            if (unlikely(aux->len < func.num_args))
+                return token_error(YY_ERROR_EVAL);
+
+            // inlined operators (fallback to function call on unexpected types)
+            if (func.num_args == 2)
+            {
+                x = &aux->data[aux->len - 2];
+                y = &aux->data[aux->len - 1];
+
+                if (IS_NUM(x) && IS_NUM(y))
+                {
+                    double a = x->number_val;
+                    double b = y->number_val;
+                    bool done = true;
+
+                    switch (opcode)
+                    {
+                        case YY_OPCODE_ADDITION_OP:     *x = token_number(a + b); break;
+                        case YY_OPCODE_SUBTRACTION_OP:  *x = token_number(a - b); break;
+                        case YY_OPCODE_PRODUCT_OP:      *x = token_number(a * b); break;
+                        case YY_OPCODE_DIVIDE_OP:       *x = token_number(a / b); break;
+                        case YY_OPCODE_LESS_OP:
+                        case YY_OPCODE_LT_NUM:          *x = token_bool(a < b); break;
+                        case YY_OPCODE_LESS_EQUALS_OP:
+                        case YY_OPCODE_LE_NUM:          *x = token_bool(a <= b); break;
+                        case YY_OPCODE_GREAT_OP:
+                        case YY_OPCODE_GT_NUM:          *x = token_bool(a > b); break;
+                        case YY_OPCODE_GREAT_EQUALS_OP:
+                        case YY_OPCODE_GE_NUM:          *x = token_bool(a >= b); break;
+                        case YY_OPCODE_EQUALS_OP:
+                        case YY_OPCODE_EQ_NUM:          *x = token_bool(a == b); break;
+                        case YY_OPCODE_DISTINCT_OP:
+                        case YY_OPCODE_NE_NUM:          *x = token_bool(a != b); break;
+                        case YY_OPCODE_MIN_NUM:         *x = token_number(min_num(a, b)); break;
+                        case YY_OPCODE_MAX_NUM:         *x = token_number(max_num(a, b)); break;
+                        default:                        done = false; break;
+                    }
+
+                    if (done) {
+                        aux->len--;
+                        continue;
+                    }
+                }
+                else if (IS_BOOL(x) && IS_BOOL(y) && (opcode == YY_OPCODE_AND_OP || opcode == YY_OPCODE_OR_OP))
+                {
+                    *x = token_bool(opcode == YY_OPCODE_AND_OP ? x->bool_val && y->bool_val : x->bool_val || y->bool_val);
+                    aux->len--;
+                    continue;
+                }
+            }
+
+            tmp = call_func(func, &aux->data[aux->len - func.num_args], &ctx);
+            if (tmp.type == YY_TOKEN_ERROR && is_blocking_error(tmp.error))
+                return tmp;
+
+            free_args(&ctx, &aux->data[aux->len - func.num_args], func.num_args, &tmp);
+
+            if (func.num_args)
+                aux->len -= func.num_args;
+            else if (aux->reserved <= aux->len)
+                return token_error(YY_ERROR_MEM);
+
+            aux->data[aux->len++] = tmp;
+            continue;
+        }
+
+        // values (opcode + byte)
+        if (opcode == YY_OPCODE_BOOL || opcode == YY_OPCODE_ERROR)
+        {
+            uint8_t byte = code[pc++];
+
+            if (unlikely(aux->reserved <= aux->len))
+                return token_error(YY_ERROR_MEM);
+
+            if (opcode == YY_OPCODE_ERROR && is_blocking_error((yy_error_e) byte))
+                return token_error(YY_ERROR_EVAL);
+
+            aux->data[aux->len++] = (opcode == YY_OPCODE_BOOL ? token_bool(byte != 0) : token_error((yy_error_e) byte));
+            continue;
+        }
+
+        // remaining opcodes (opcode + varint)
+        if (unlikely(!read_varint(code, code_len, &pc, &val)))
+            return token_error(YY_ERROR_EVAL);
+
+        switch (opcode)
+        {
+            case YY_OPCODE_NUMBER:
+            case YY_OPCODE_DATETIME:
+            case YY_OPCODE_STRING:
+            case YY_OPCODE_VARIABLE:
+            case YY_OPCODE_SLOT:
+            case YY_OPCODE_TEMP:
+            {
+                if (unlikely(aux->reserved <= aux->len))
+                    return token_error(YY_ERROR_MEM);
+
+                x = &aux->data[aux->len];
+
+                if (opcode == YY_OPCODE_NUMBER || opcode == YY_OPCODE_DATETIME)
+                {
+                    if (unlikely(val >= bytecode->num_consts || !bytecode->consts))
+                        return token_error(YY_ERROR_EVAL);
+
+                    if (opcode == YY_OPCODE_NUMBER) {
+                        double num = 0.0;
+                        memcpy(&num, &bytecode->consts[val], sizeof(num));
+                        *x = token_number(num);
+                    }
+                    else
+                        *x = token_datetime(bytecode->consts[val]);
+                }
+                else if (opcode == YY_OPCODE_STRING || opcode == YY_OPCODE_VARIABLE)
+                {
+                    if (unlikely(!bytecode->strs || !get_pool_str(bytecode, val, &str)))
+                        return token_error(YY_ERROR_EVAL);
+
+                    if (opcode == YY_OPCODE_STRING)
+                        *x = (yy_token_t){ .str_val = str, .type = YY_TOKEN_STRING };
+                    else if (!load_value(&(yy_token_t){ .variable = str, .type = YY_TOKEN_VARIABLE }, aux, base, &vars, x))
+                        return *x;
+                }
+                else if (opcode == YY_OPCODE_SLOT)
+                    *x = token_error(YY_ERROR_REF);
+                else if (!load_value(&token_temp(val), aux, base, &vars, x))
+                    return *x;
+
+                aux->len++;
+                continue;
+            }
+
+            // shared subexpressions (see share_subexprs())
+
+            case YY_OPCODE_FRAME:
+                if (unlikely(start != 0 || val >= aux->reserved))
+                    return token_error(YY_ERROR_EVAL);
+                memset(aux->data, 0x00, val * sizeof(yy_token_t));
+                aux->len = base = val;
+                continue;
+
+            case YY_OPCODE_STORE:
+                if (unlikely(val >= base || aux->len <= base))
+                    return token_error(YY_ERROR_EVAL);
+                aux->data[val] = aux->data[aux->len - 1];
+                continue;
+
+            // short-circuit (untaken operands are skipped)
+
+            case YY_OPCODE_JUMP:
+                if (unlikely(code_len - pc < val))
+                    return token_error(YY_ERROR_EVAL);
+                pc += val;
+                continue;
+
+            case YY_OPCODE_JUMP_IFELSE:
+            {
+                if (unlikely(aux->len < 1 || code_len - pc <= val || code[pc + val] != YY_OPCODE_JUMP))
+                    return token_error(YY_ERROR_EVAL);
+
+                x = &aux->data[aux->len - 1];
+                pc += val;
+
+                if (likely(x->type == YY_TOKEN_BOOL))
+                {
+                    aux->len--;
+
+                    if (x->bool_val)
+                        pc = start + get_instr_len(code, code_len, start);
+                    else
+                        pc += get_instr_len(code, code_len, pc);
+
+                    continue;
+                }
+
+                // non-bool condition, runs the jump preceding the else-branch
+                if (x->type == YY_TOKEN_STRING)
+                    free_str(&ctx, &x->str_val);
+
+                *x = token_error(YY_ERROR_VALUE);
+                continue;
+            }
+
+            case YY_OPCODE_JUMP_AND:
+            case YY_OPCODE_JUMP_OR:
+                if (unlikely(aux->len < 1 || code_len - pc < val))
+                    return token_error(YY_ERROR_EVAL);
+
+                x = &aux->data[aux->len - 1];
+
+                if (likely(x->type == YY_TOKEN_BOOL)) {
+                    if (x->bool_val == (opcode == YY_OPCODE_JUMP_OR))
+                        pc += val;
+                    continue;
+                }
+
+                if (x->type == YY_TOKEN_STRING)
+                    free_str(&ctx, &x->str_val);
+
+                *x = token_error(YY_ERROR_VALUE);
+                pc += val;
+                continue;
+
+            default:
+                return token_error(YY_ERROR_EVAL);
+        }
+    }
+
+    if (aux->len != base + 1)
+        return token_error(YY_ERROR_EVAL);
+
+    return aux->data[base];
+}
+
+/*
+ * Serialized images.
+ * 
+ * An image is a contiguous block of bytes evaluated in place (relocatable, 
+ * no pointers). All integers are in native byte order:
+ * 
+ *   header (yy_image_header_t)
+ *   index (uint32_t offset of each expression record, 0 = not added)
+ *   records, each one 8-byte aligned:
+ *     record header (yy_image_record_t)
+ *     constants pool (uint64_t)
+ *     code (see yy_encode_stack)
+ *     strings pool
+ * 
+ * Opcodes and functions are identified by their enum values, so the 
+ * header records the number of opcodes and symbols of the writer.
+ */
+
+#define IMAGE_MAGIC         "YYEX"
+#define IMAGE_VERSION       1
+#define IMAGE_BYTE_ORDER    0x0102
+#define IMAGE_ALIGN(n_)     (((n_) + 7U) & ~7U)
+
+typedef struct yy_image_header_t
+{
+    char magic[4];                  //!< Format identifier (IMAGE_MAGIC).
+    uint16_t version;               //!< Format version (IMAGE_VERSION).
+    uint16_t byte_order;            //!< IMAGE_BYTE_ORDER in the writer byte order.
+    uint16_t num_opcodes;           //!< Number of opcodes of the writer.
+    uint16_t num_symbols;           //!< Number of symbols of the writer.
+    uint32_t num_exprs;             //!< Number of index entries.
+    uint32_t num_added;             //!< Number of added expressions.
+    uint32_t len;                   //!< Image size (bytes).
+} yy_image_header_t;
+
+typedef struct yy_image_record_t
+{
+    uint32_t code_len;              //!< Number of code bytes.
+    uint32_t num_consts;            //!< Number of constants.
+    uint32_t strs_len;              //!< Number of string bytes.
+    uint32_t padding;               //!< Unused (0).
+} yy_image_record_t;
+
+// Reads the header of an image (returns false if it isn't a valid image)
+static bool get_image_header(const void *data, uint32_t len, yy_image_header_t *header)
+{
+    if (!data || ((uintptr_t) data % 8) != 0 || len < sizeof(yy_image_header_t))
+        return false;
+
+    memcpy(header, data, sizeof(yy_image_header_t));
+
+    return (memcmp(header->magic, IMAGE_MAGIC, 4) == 0 && 
+            header->version == IMAGE_VERSION && 
+            header->byte_order == IMAGE_BYTE_ORDER && 
+            header->num_opcodes == YY_OPCODE_END && 
+            header->num_symbols == YY_SYMBOL_END && 
+            header->num_added <= header->num_exprs && 
+            header->num_exprs <= (UINT32_MAX - sizeof(yy_image_header_t)) / sizeof(uint32_t) && 
+            IMAGE_ALIGN(sizeof(yy_image_header_t) + header->num_exprs * (uint64_t) sizeof(uint32_t)) <= header->len && 
+            header->len <= len);
+}
+
+yy_error_e yy_image_create(yy_image_t *image, uint32_t num_exprs)
+{
+    if (!image || !image->data || ((uintptr_t) image->data % 8) != 0)
+        return YY_ERROR;
+
+    if (num_exprs > (UINT32_MAX - sizeof(yy_image_header_t)) / sizeof(uint32_t))
+        return YY_ERROR_MEM;
+
+    uint64_t len = IMAGE_ALIGN(sizeof(yy_image_header_t) + num_exprs * (uint64_t) sizeof(uint32_t));
+    yy_image_header_t header = {
+        .version = IMAGE_VERSION,
+        .byte_order = IMAGE_BYTE_ORDER,
+        .num_opcodes = YY_OPCODE_END,
+        .num_symbols = YY_SYMBOL_END,
+        .num_exprs = num_exprs,
+        .num_added = 0,
+        .len = (uint32_t) len
+    };
+
+    if (image->reserved < len)
+        return YY_ERROR_MEM;
+
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    memset(image->data, 0x00, (size_t) len);
+    memcpy(image->data, &header, sizeof(header));
+    image->len = (uint32_t) len;
+
+    return YY_OK;
+}
+
+yy_error_e yy_image_append(yy_image_t *image, const yy_stack_t *stack, uint32_t *index)
+{
+    yy_image_header_t header = {0};
+
+    if (!image || !stack || !stack->data || !stack->len)
+        return YY_ERROR;
+
+    if (!get_image_header(image->data, image->len, &header) || header.len != image->len || image->len > image->reserved)
+        return YY_ERROR;
+
+    if (header.num_added >= header.num_exprs)
+        return YY_ERROR_MEM;
+
+    // upper bounds (pools are encoded at their maximum size, then compacted)
+    uint64_t max_consts = 0;
+    uint64_t max_code = 0;
+    uint64_t max_strs = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+
+        max_code += 2 + MAX_VARINT_BYTES;
+
+        if (token->type == YY_TOKEN_NUMBER || token->type == YY_TOKEN_DATETIME)
+            max_consts++;
+        else if (token->type == YY_TOKEN_STRING || token->type == YY_TOKEN_VARIABLE)
+            max_strs += MAX_VARINT_BYTES + token->str_val.len;
+    }
+
+    uint32_t pos = image->len;
+    uint64_t max_len = sizeof(yy_image_record_t) + max_consts * sizeof(uint64_t) + max_code + max_strs;
+
+    if (image->reserved - pos < max_len)
+        return YY_ERROR_MEM;
+
+    uint8_t *record = image->data + pos;
+    uint8_t *consts = record + sizeof(yy_image_record_t);
+    yy_bytecode_t bytecode = {
+        .code = consts + max_consts * sizeof(uint64_t),
+        .consts = (uint64_t *) consts,
+        .strs = (char *) consts + max_consts * sizeof(uint64_t) + max_code,
+        .code_reserved = (uint32_t) max_code,
+        .consts_reserved = (uint32_t) max_consts,
+        .strs_reserved = (uint32_t) max_strs
+    };
+
+    yy_error_e rc = yy_encode_stack(stack, &bytecode);
+
+    if (rc != YY_OK)
+        return rc;
+
+    yy_image_record_t entry = {
+        .code_len = bytecode.code_len,
+        .num_consts = bytecode.num_consts,
+        .strs_len = bytecode.strs_len
+    };
+    uint8_t *code = consts + entry.num_consts * sizeof(uint64_t);
+    uint32_t len = (uint32_t) IMAGE_ALIGN(sizeof(yy_image_record_t) + entry.num_consts * sizeof(uint64_t) + entry.code_len + entry.strs_len);
+
+    memmove(code, bytecode.code, entry.code_len);
+    memmove(code + entry.code_len, bytecode.strs, entry.strs_len);
+    memset(code + entry.code_len + entry.strs_len, 0x00, len - (uint32_t)(code + entry.code_len + entry.strs_len - record));
+    memcpy(record, &entry, sizeof(entry));
+
+    memcpy(image->data + sizeof(yy_image_header_t) + header.num_added * sizeof(uint32_t), &pos, sizeof(pos));
+
+    if (index)
+        *index = header.num_added;
+
+    header.num_added++;
+    header.len = pos + len;
+    memcpy(image->data, &header, sizeof(header));
+    image->len = header.len;
+
+    return YY_OK;
+}
+
+yy_error_e yy_image_check(const void *data, uint32_t len, uint32_t *num_exprs)
+{
+    yy_image_header_t header = {0};
+
+    if (!data || !num_exprs)
+        return YY_ERROR;
+
+    *num_exprs = 0;
+
+    if (!get_image_header(data, len, &header))
+        return YY_ERROR_VALUE;
+
+    *num_exprs = header.num_added;
+
+    return YY_OK;
+}
+
+yy_token_t yy_eval_image(const void *data, uint32_t index, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *user_data)
+{
+    const uint8_t *ptr = (const uint8_t *) data;
+    yy_image_header_t header = {0};
+    yy_image_record_t entry = {0};
+    uint32_t pos = 0;
+
+    if (!data)
+        return token_error(YY_ERROR);
+
+    // image checked once by yy_image_check(), only bounds are verified
+    memcpy(&header, ptr, sizeof(header));
+
+    if (index >= header.num_added)
+        return token_error(YY_ERROR_REF);
+
+    memcpy(&pos, ptr + sizeof(yy_image_header_t) + index * sizeof(uint32_t), sizeof(pos));
+
+    if (pos % 8 != 0 || pos > header.len || header.len - pos < sizeof(yy_image_record_t))
+        return token_error(YY_ERROR_EVAL);
+
+    memcpy(&entry, ptr + pos, sizeof(entry));
+
+    const uint8_t *consts = ptr + pos + sizeof(yy_image_record_t);
+    uint64_t size = entry.num_consts * (uint64_t) sizeof(uint64_t) + entry.code_len + entry.strs_len;
+
+    if (header.len - pos - sizeof(yy_image_record_t) < size)
+        return token_error(YY_ERROR_EVAL);
+
+    // read-only view (yy_eval_bytecode doesn't modify the bytecode)
+    yy_bytecode_t bytecode = {
+        .code = (uint8_t *)(uintptr_t)(consts + entry.num_consts * sizeof(uint64_t)),
+        .consts = (uint64_t *)(uintptr_t) consts,
+        .strs = (char *)(uintptr_t)(consts + entry.num_consts * sizeof(uint64_t) + entry.code_len),
+        .code_reserved = entry.code_len,
+        .code_len = entry.code_len,
+        .consts_reserved = entry.num_consts,
+        .num_consts = entry.num_consts,
+        .strs_reserved = entry.strs_len,
+        .strs_len = entry.strs_len
+    };
+
+    return yy_eval_bytecode(&bytecode, aux, resolve, user_data);
+}
+
+/*
+ * Native code generation (x86-64, System V ABI).
+ * 
+ * Each value lives in the aux token given by its stack depth, so the 
+ * generated code reads and writes fixed offsets of the aux array (rbx). 
+ * Numbers are processed with SSE2 scalar instructions, bools as bytes. 
+ * Every result writes its value and its type. Variables are resolved 
+ * calling jit_resolve() with the frame (r12). Operands of unknown type 
+ * (variables, temporaries) are checked at runtime.
+ * 
+ * The code starts with the bail-out stub (returns 1), jumped to when 
+ * a check fails; the caller then evaluates the stack with the 
+ * interpreter. The entry point follows the stub.
+ */
+#ifdef USE_JIT
+
+#define MAX_JIT_DEPTH           256
+#define MAX_JIT_JUMPS           256
+#define JIT_BYTES_PER_TOKEN     96
+#define JIT_ENTRY               10
+
+typedef struct yy_jit_frame_t
+{
+    const yy_token_t *tokens;       //!< Compiled stack tokens.
+    yy_token_t (*resolve)(yy_str_t var, void *data);  //!< Variables resolver (can be NULL).
+    void *data;                     //!< Data passed to resolve.
+} yy_jit_frame_t;
+
+typedef struct yy_jit_compiler_t
+{
+    const yy_stack_t *stack;        //!< Compiled stack.
+    uint8_t *code;                  //!< Code buffer.
+    uint32_t reserved;              //!< Size of the code buffer.
+    uint32_t len;                   //!< Code length.
+    uint8_t types[MAX_JIT_DEPTH];   //!< Static type of each value (YY_TOKEN_NULL = known at runtime).
+    uint8_t branches[MAX_JIT_DEPTH]; //!< Types of the pending ifelse then-branches.
+    uint32_t num_branches;          //!< Number of pending ifelse.
+    uint32_t jumps[MAX_JIT_JUMPS][2]; //!< Unresolved jumps (rel32 position, target token).
+    uint32_t num_jumps;             //!< Number of unresolved jumps.
+    uint32_t depth;                 //!< Number of values (temporaries included).
+    uint32_t base;                  //!< Number of temporaries.
+    uint32_t max_depth;             //!< Maximum depth.
+    bool failed;                    //!< Unsupported stack or code buffer exhausted.
+} yy_jit_compiler_t;
+
+// Called from the generated code, returns 1 on blocking error (or no resolver)
+static int jit_resolve(const yy_jit_frame_t *frame, uint32_t pos, yy_token_t *slot)
+{
+    if (!frame->resolve)
+        return 1;
+
+    yy_token_t value = frame->resolve(frame->tokens[pos].variable, frame->data);
+
+    if (value.type == YY_TOKEN_ERROR && is_blocking_error(value.error))
+        return 1;
+
+    *slot = value;
+    return 0;
+}
+
+static void jit_bytes(yy_jit_compiler_t *cc, const void *bytes, uint32_t len)
+{
+    if (cc->reserved - cc->len < len) {
+        cc->failed = true;
+        return;
+    }
+
+    memcpy(cc->code + cc->len, bytes, len);
+    cc->len += len;
+}
+
+#define JIT_EMIT(cc_, ...) do { \
+        const uint8_t bytes_[] = { __VA_ARGS__ }; \
+        jit_bytes(cc_, bytes_, sizeof(bytes_)); \
+    } while (0)
+
+INLINE
+static void jit_u32(yy_jit_compiler_t *cc, uint32_t val)
+{
+    jit_bytes(cc, &val, sizeof(val));   // little-endian
+}
+
+// Instruction with a [rbx + disp32] operand (value at the given depth)
+static void jit_slot(yy_jit_compiler_t *cc, const uint8_t *opcode, uint32_t len, uint8_t reg, uint32_t depth, uint32_t offset)
+{
+    jit_bytes(cc, opcode, len);
+    JIT_EMIT(cc, (uint8_t)(0x80 | (reg << 3) | 3));
+    jit_u32(cc, depth * (uint32_t) sizeof(yy_token_t) + offset);
+}
+
+#define JIT_SLOT(cc_, reg_, depth_, offset_, ...) do { \
+        const uint8_t opcode_[] = { __VA_ARGS__ }; \
+        jit_slot(cc_, opcode_, sizeof(opcode_), reg_, depth_, offset_); \
+    } while (0)
+
+#define JIT_RAX     0
+#define JIT_RCX     1
+#define JIT_RDX     2
+#define JIT_XMM0    0
+#define JIT_XMM1    1
+
+#define jit_load_rax(cc_, depth_, offset_)  JIT_SLOT(cc_, JIT_RAX, depth_, offset_, 0x48, 0x8B)
+#define jit_store_rax(cc_, depth_, offset_) JIT_SLOT(cc_, JIT_RAX, depth_, offset_, 0x48, 0x89)
+#define jit_load_byte(cc_, reg_, depth_)    JIT_SLOT(cc_, reg_, depth_, 0, 0x0F, 0xB6)
+#define jit_load_xmm(cc_, reg_, depth_)     JIT_SLOT(cc_, reg_, depth_, 0, 0xF2, 0x0F, 0x10)
+#define jit_store_xmm0(cc_, depth_)         JIT_SLOT(cc_, JIT_XMM0, depth_, 0, 0xF2, 0x0F, 0x11)
+
+static void jit_set_type(yy_jit_compiler_t *cc, uint32_t depth, yy_token_e type)
+{
+    JIT_SLOT(cc, 0, depth, offsetof(yy_token_t, type), 0xC7);
+    jit_u32(cc, (uint32_t) type);
+    cc->types[depth] = (uint8_t) type;
+}
+
+// Jump (rel32) to the bail-out stub
+static void jit_bail(yy_jit_compiler_t *cc, const uint8_t *opcode, uint32_t len)
+{
+    jit_bytes(cc, opcode, len);
+    jit_u32(cc, (uint32_t)(0 - (int32_t)(cc->len + 4)));
+}
+
+#define JIT_BAIL(cc_, ...) do { \
+        const uint8_t opcode_[] = { __VA_ARGS__ }; \
+        jit_bail(cc_, opcode_, sizeof(opcode_)); \
+    } while (0)
+
+// Jump (rel32) to a token, resolved when the token is reached
+static void jit_jump(yy_jit_compiler_t *cc, const uint8_t *opcode, uint32_t len, uint32_t target)
+{
+    jit_bytes(cc, opcode, len);
+
+    if (cc->num_jumps >= MAX_JIT_JUMPS || target > cc->stack->len) {
+        cc->failed = true;
+        return;
+    }
+
+    cc->jumps[cc->num_jumps][0] = cc->len;
+    cc->jumps[cc->num_jumps][1] = target;
+    cc->num_jumps++;
+
+    jit_u32(cc, 0);
+}
+
+#define JIT_JUMP(cc_, target_, ...) do { \
+        const uint8_t opcode_[] = { __VA_ARGS__ }; \
+        jit_jump(cc_, opcode_, sizeof(opcode_), target_); \
+    } while (0)
+
+static void jit_resolve_jumps(yy_jit_compiler_t *cc, uint32_t target)
+{
+    for (uint32_t i = 0; i < cc->num_jumps; )
+    {
+        if (cc->jumps[i][1] != target) {
+            i++;
+            continue;
+        }
+
+        uint32_t pos = cc->jumps[i][0];
+        uint32_t rel = cc->len - (pos + 4);
+
+        if (cc->failed || pos + 4 > cc->len)
+            return;
+
+        memcpy(cc->code + pos, &rel, sizeof(rel));
+        cc->jumps[i][0] = cc->jumps[cc->num_jumps - 1][0];
+        cc->jumps[i][1] = cc->jumps[cc->num_jumps - 1][1];
+        cc->num_jumps--;
+    }
+}
+
+// Ensures the type of a value (checked at runtime if unknown)
+static void jit_check_type(yy_jit_compiler_t *cc, uint32_t depth, yy_token_e type)
+{
+    if (cc->types[depth] == type)
+        return;
+
+    if (cc->types[depth] != YY_TOKEN_NULL) {
+        cc->failed = true;
+        return;
+    }
+
+    // cmp dword [slot + type], imm8; jne bail
+    JIT_SLOT(cc, 7, depth, offsetof(yy_token_t, type), 0x83);
+    JIT_EMIT(cc, (uint8_t) type);
+    JIT_BAIL(cc, 0x0F, 0x85);
+
+    cc->types[depth] = (uint8_t) type;
+}
+
+// Ensures that a value of unknown type is a number or a bool
+static void jit_check_scalar(yy_jit_compiler_t *cc, uint32_t depth)
+{
+    if (cc->types[depth] != YY_TOKEN_NULL)
+        return;
+
+    // cmp dword [type], NUMBER; je +13; cmp dword [type], BOOL; jne bail
+    JIT_SLOT(cc, 7, depth, offsetof(yy_token_t, type), 0x83);
+    JIT_EMIT(cc, YY_TOKEN_NUMBER, 0x74, 13);
+    JIT_SLOT(cc, 7, depth, offsetof(yy_token_t, type), 0x83);
+    JIT_EMIT(cc, YY_TOKEN_BOOL);
+    JIT_BAIL(cc, 0x0F, 0x85);
+}
+
+static void jit_push(yy_jit_compiler_t *cc)
+{
+    if (cc->depth + 1 >= MAX_JIT_DEPTH) {
+        cc->failed = true;
+        return;
+    }
+
+    cc->depth++;
+    cc->max_depth = MAX(cc->max_depth, cc->depth);
+}
+
+static void jit_copy(yy_jit_compiler_t *cc, uint32_t dst, uint32_t src)
+{
+    jit_load_rax(cc, src, 0);
+    jit_store_rax(cc, dst, 0);
+    jit_load_rax(cc, src, 8);
+    jit_store_rax(cc, dst, 8);
+    cc->types[dst] = cc->types[src];
+}
+
+// x = x op y (numbers), opcode = 0 means comparison with the given cmpsd predicate
+static void jit_numeric(yy_jit_compiler_t *cc, uint8_t opcode, uint8_t predicate, bool swap)
+{
+    uint32_t x = cc->depth - 2;
+    uint32_t y = cc->depth - 1;
+
+    jit_check_type(cc, x, YY_TOKEN_NUMBER);
+    jit_check_type(cc, y, YY_TOKEN_NUMBER);
+    jit_load_xmm(cc, JIT_XMM0, (swap ? y : x));
+    jit_load_xmm(cc, JIT_XMM1, (swap ? x : y));
+
+    if (opcode) {
+        JIT_EMIT(cc, 0xF2, 0x0F, opcode, 0xC1);         // op xmm0, xmm1
+        jit_store_xmm0(cc, x);
+        jit_set_type(cc, x, YY_TOKEN_NUMBER);
+    }
+    else {
+        JIT_EMIT(cc, 0xF2, 0x0F, 0xC2, 0xC1, predicate); // cmpsd xmm0, xmm1, predicate
+        JIT_EMIT(cc, 0x66, 0x48, 0x0F, 0x7E, 0xC0);      // movq rax, xmm0
+        JIT_EMIT(cc, 0x83, 0xE0, 0x01);                  // and eax, 1
+        jit_store_rax(cc, x, 0);
+        jit_set_type(cc, x, YY_TOKEN_BOOL);
+    }
+
+    cc->depth--;
+}
+
+// x = x op y (bools)
+static void jit_logic(yy_jit_compiler_t *cc, uint8_t opcode, uint8_t setcc)
+{
+    uint32_t x = cc->depth - 2;
+    uint32_t y = cc->depth - 1;
+
+    jit_check_type(cc, x, YY_TOKEN_BOOL);
+    jit_check_type(cc, y, YY_TOKEN_BOOL);
+    jit_load_byte(cc, JIT_RAX, x);
+    jit_load_byte(cc, JIT_RCX, y);
+
+    if (opcode) {
+        JIT_EMIT(cc, opcode, 0xC8);                      // and|or eax, ecx
+    }
+    else {
+        JIT_EMIT(cc, 0x39, 0xC8);                        // cmp eax, ecx
+        JIT_EMIT(cc, 0x0F, setcc, 0xC0);                 // sete|setne al
+        JIT_EMIT(cc, 0x0F, 0xB6, 0xC0);                  // movzx eax, al
+    }
+
+    jit_store_rax(cc, x, 0);
+    jit_set_type(cc, x, YY_TOKEN_BOOL);
+    cc->depth--;
+}
+
+static void jit_function(yy_jit_compiler_t *cc, const yy_func_t *func)
+{
+    uint8_t opcode = func->opcode;
+
+    if (opcode == YY_OPCODE_IFELSE)
+    {
+        // branch value already selected by jumps
+        if (cc->depth <= cc->base || !cc->num_branches) {
+            cc->failed = true;
+            return;
+        }
+
+        uint32_t x = cc->depth - 1;
+        uint8_t then_type = cc->branches[--cc->num_branches];
+
+        if (then_type != cc->types[x])
+            cc->types[x] = YY_TOKEN_NULL;
+
+        jit_check_scalar(cc, x);
+        return;
+    }
+
+    if (cc->depth < cc->base + func->num_args) {
+        cc->failed = true;
+        return;
+    }
+
+    switch (opcode)
+    {
+        case YY_OPCODE_ADDITION_OP:     jit_numeric(cc, 0x58, 0, false); break;
+        case YY_OPCODE_SUBTRACTION_OP:  jit_numeric(cc, 0x5C, 0, false); break;
+        case YY_OPCODE_PRODUCT_OP:      jit_numeric(cc, 0x59, 0, false); break;
+        case YY_OPCODE_DIVIDE_OP:       jit_numeric(cc, 0x5E, 0, false); break;
+        case YY_OPCODE_LESS_OP:
+        case YY_OPCODE_LT_NUM:          jit_numeric(cc, 0, 1, false); break;
+        case YY_OPCODE_LESS_EQUALS_OP:
+        case YY_OPCODE_LE_NUM:          jit_numeric(cc, 0, 2, false); break;
+        case YY_OPCODE_GREAT_OP:
+        case YY_OPCODE_GT_NUM:          jit_numeric(cc, 0, 1, true); break;
+        case YY_OPCODE_GREAT_EQUALS_OP:
+        case YY_OPCODE_GE_NUM:          jit_numeric(cc, 0, 2, true); break;
+        case YY_OPCODE_EQ_NUM:          jit_numeric(cc, 0, 0, false); break;
+        case YY_OPCODE_NE_NUM:          jit_numeric(cc, 0, 4, false); break;
+        case YY_OPCODE_EQ_BOOL:         jit_logic(cc, 0, 0x94); break;
+        case YY_OPCODE_NE_BOOL:         jit_logic(cc, 0, 0x95); break;
+        case YY_OPCODE_AND_OP:          jit_logic(cc, 0x21, 0); break;
+        case YY_OPCODE_OR_OP:           jit_logic(cc, 0x09, 0); break;
+
+        case YY_OPCODE_EQUALS_OP:
+        case YY_OPCODE_DISTINCT_OP:
+            if (cc->types[cc->depth - 1] == YY_TOKEN_BOOL || cc->types[cc->depth - 2] == YY_TOKEN_BOOL)
+                jit_logic(cc, 0, (opcode == YY_OPCODE_EQUALS_OP ? 0x94 : 0x95));
+            else
+                jit_numeric(cc, 0, (opcode == YY_OPCODE_EQUALS_OP ? 0 : 4), false);
             break;
-        case YY_SYMBOL_MIN: 
-        case YY_SYMBOL_MAX: 
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_datetime(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_datetime(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+
+        case YY_OPCODE_PLUS_OP:
+            jit_check_type(cc, cc->depth - 1, YY_TOKEN_NUMBER);
             break;
-        case YY_SYMBOL_CLAMP:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_datetime(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_datetime(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_datetime(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+
+        case YY_OPCODE_MINUS_OP:
+            jit_check_type(cc, cc->depth - 1, YY_TOKEN_NUMBER);
+            jit_load_rax(cc, cc->depth - 1, 0);
+            JIT_EMIT(cc, 0x48, 0x0F, 0xBA, 0xF8, 0x3F);      // btc rax, 63
+            jit_store_rax(cc, cc->depth - 1, 0);
             break;
-        case YY_SYMBOL_IFELSE:
-            consume(parser);
-            expect(parser, YY_SYMBOL_PAREN_LEFT);
-            parse_expr_bool(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_datetime(parser);
-            expect(parser, YY_SYMBOL_COMMA);
-            parse_expr_datetime(parser);
-            expect(parser, YY_SYMBOL_PAREN_RIGHT);
+
+        case YY_OPCODE_NOT:
+            jit_check_type(cc, cc->depth - 1, YY_TOKEN_BOOL);
+            jit_load_byte(cc, JIT_RAX, cc->depth - 1);
+            JIT_EMIT(cc, 0x83, 0xF0, 0x01);                  // xor eax, 1
+            jit_store_rax(cc, cc->depth - 1, 0);
             break;
+
         default:
-            parser->error = YY_ERROR_SYNTAX;
+            cc->failed = true;
+            break;
+    }
+}
+
+static void jit_control(yy_jit_compiler_t *cc, uint32_t pos)
+{
+    const yy_token_t *token = &cc->stack->data[pos];
+    uint32_t offset = token->jump.offset;
+
+    switch (token->jump.opcode)
+    {
+        case YY_OPCODE_FRAME:
+            if (pos != 0 || offset >= MAX_JIT_DEPTH) {
+                cc->failed = true;
+                return;
+            }
+            cc->base = cc->depth = cc->max_depth = offset;
+            memset(cc->types, YY_TOKEN_NULL, offset);
+            return;
+
+        case YY_OPCODE_STORE:
+            if (offset >= cc->base || cc->depth <= cc->base) {
+                cc->failed = true;
+                return;
+            }
+            jit_copy(cc, offset, cc->depth - 1);
+            return;
+
+        case YY_OPCODE_JUMP:
+            // end of the then-branch of an ifelse
+            if (cc->depth <= cc->base || cc->num_branches >= MAX_JIT_DEPTH) {
+                cc->failed = true;
+                return;
+            }
+            cc->branches[cc->num_branches++] = cc->types[--cc->depth];
+            JIT_JUMP(cc, pos + offset, 0xE9);
+            return;
+
+        case YY_OPCODE_JUMP_IFELSE:
+            if (cc->depth <= cc->base) {
+                cc->failed = true;
+                return;
+            }
+            jit_check_type(cc, cc->depth - 1, YY_TOKEN_BOOL);
+            jit_load_byte(cc, JIT_RAX, --cc->depth);
+            JIT_EMIT(cc, 0x85, 0xC0);                        // test eax, eax
+            JIT_JUMP(cc, pos + offset, 0x0F, 0x84);          // jz else-branch
+            return;
+
+        case YY_OPCODE_JUMP_AND:
+        case YY_OPCODE_JUMP_OR:
+            if (cc->depth <= cc->base) {
+                cc->failed = true;
+                return;
+            }
+            jit_check_type(cc, cc->depth - 1, YY_TOKEN_BOOL);
+            jit_load_byte(cc, JIT_RAX, cc->depth - 1);
+            JIT_EMIT(cc, 0x85, 0xC0);                        // test eax, eax
+            JIT_JUMP(cc, pos + offset, 0x0F, (token->jump.opcode == YY_OPCODE_JUMP_AND ? 0x84 : 0x85));
+            return;
+
+        default:
+            // superinstructions are not needed
+            if (!is_fused_opcode(token->jump.opcode))
+                cc->failed = true;
+            return;
+    }
+}
+
+static void jit_compile(yy_jit_compiler_t *cc)
+{
+    // bail-out stub: mov eax, 1; pop rbp; pop r12; pop rbx; ret
+    JIT_EMIT(cc, 0xB8, 0x01, 0x00, 0x00, 0x00, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);
+    assert(cc->len == JIT_ENTRY);
+
+    // entry point: push rbx; push r12; push rbp (aligned stack); mov r12, rdi; mov rbx, rsi
+    JIT_EMIT(cc, 0x53, 0x41, 0x54, 0x55, 0x49, 0x89, 0xFC, 0x48, 0x89, 0xF3);
+
+    for (uint32_t i = 0; i < cc->stack->len && !cc->failed; i++)
+    {
+        const yy_token_t *token = &cc->stack->data[i];
+        uint64_t bits = 0;
+
+        jit_resolve_jumps(cc, i);
+
+        switch (token->type)
+        {
+            case YY_TOKEN_NUMBER:
+                jit_push(cc);
+                memcpy(&bits, &token->number_val, sizeof(bits));
+                JIT_EMIT(cc, 0x48, 0xB8);                    // mov rax, imm64
+                jit_bytes(cc, &bits, sizeof(bits));
+                jit_store_rax(cc, cc->depth - 1, 0);
+                jit_set_type(cc, cc->depth - 1, YY_TOKEN_NUMBER);
+                break;
+
+            case YY_TOKEN_BOOL:
+                jit_push(cc);
+                JIT_EMIT(cc, 0xB8);                          // mov eax, imm32
+                jit_u32(cc, (token->bool_val ? 1 : 0));
+                jit_store_rax(cc, cc->depth - 1, 0);
+                jit_set_type(cc, cc->depth - 1, YY_TOKEN_BOOL);
+                break;
+
+            case YY_TOKEN_VARIABLE:
+            {
+                uint64_t addr = (uint64_t)(uintptr_t) jit_resolve;
+
+                jit_push(cc);
+                JIT_SLOT(cc, JIT_RDX, cc->depth - 1, 0, 0x48, 0x8D);   // lea rdx, [slot]
+                JIT_EMIT(cc, 0x4C, 0x89, 0xE7);              // mov rdi, r12
+                JIT_EMIT(cc, 0xBE);                          // mov esi, imm32
+                jit_u32(cc, i);
+                JIT_EMIT(cc, 0x48, 0xB8);                    // mov rax, imm64
+                jit_bytes(cc, &addr, sizeof(addr));
+                JIT_EMIT(cc, 0xFF, 0xD0);                    // call rax
+                JIT_EMIT(cc, 0x85, 0xC0);                    // test eax, eax
+                JIT_BAIL(cc, 0x0F, 0x85);                    // jnz bail
+                cc->types[cc->depth - 1] = YY_TOKEN_NULL;
+                break;
+            }
+
+            case YY_TOKEN_TEMP:
+                if (token->temp >= cc->base) {
+                    cc->failed = true;
+                    break;
+                }
+                jit_push(cc);
+                jit_copy(cc, cc->depth - 1, token->temp);
+                cc->types[cc->depth - 1] = YY_TOKEN_NULL;   // can be stored in a branch
+                break;
+
+            case YY_TOKEN_FUNCTION:
+                jit_function(cc, &token->function);
+                break;
+
+            case YY_TOKEN_JUMP:
+                jit_control(cc, i);
+                break;
+
+            default:
+                cc->failed = true;
+                break;
+        }
+    }
+
+    jit_resolve_jumps(cc, cc->stack->len);
+
+    if (cc->num_jumps || cc->num_branches || cc->depth != cc->base + 1)
+        cc->failed = true;
+    else
+        jit_check_scalar(cc, cc->base);   // strings are returned by the interpreter
+
+    // xor eax, eax; pop rbp; pop r12; pop rbx; ret
+    JIT_EMIT(cc, 0x31, 0xC0, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);
+}
+
+#endif
+
+yy_error_e yy_compile_jit(const yy_stack_t *stack, yy_jit_t *jit, const char *name)
+{
+    if (!stack || !stack->data || !stack->len || !jit)
+        return YY_ERROR;
+
+    memset(jit, 0x00, sizeof(yy_jit_t));
+    jit->stack = stack;
+
+#ifndef USE_JIT
+    UNUSED(name);
+    return YY_ERROR_VALUE;
+#else
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if (page_size <= 0 || stack->len > (UINT32_MAX - 4096) / JIT_BYTES_PER_TOKEN)
+        return YY_ERROR_MEM;
+
+    size_t size = (size_t) JIT_BYTES_PER_TOKEN * stack->len + 64;
+    size = (size + (size_t) page_size - 1) / (size_t) page_size * (size_t) page_size;
+
+    void *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (code == MAP_FAILED)
+        return YY_ERROR_MEM;
+
+    yy_jit_compiler_t cc = {.stack = stack, .code = (uint8_t *) code, .reserved = (uint32_t) size};
+
+    jit_compile(&cc);
+
+    if (cc.failed) {
+        munmap(code, size);
+        return YY_ERROR_VALUE;
+    }
+
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, size);
+        return YY_ERROR_MEM;
+    }
+
+    jit->code = code;
+    jit->size = (uint32_t) size;
+    jit->max_depth = cc.max_depth;
+    jit->result = cc.base;
+
+    // lets perf attribute samples to the generated code
+    if (name)
+    {
+        char path[64] = {0};
+        FILE *file = NULL;
+
+        snprintf(path, sizeof(path), "/tmp/perf-%ld.map", (long) getpid());
+
+        if ((file = fopen(path, "a")) != NULL) {
+            fprintf(file, "%lx %x %s\n", (unsigned long)(uintptr_t) code, cc.len, name);
+            fclose(file);
+        }
+    }
+
+    return YY_OK;
+#endif
+}
+
+yy_token_t yy_eval_jit(const yy_jit_t *jit, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+{
+    if (!jit || !jit->stack)
+        return token_error(YY_ERROR);
+
+#ifdef USE_JIT
+    if (jit->code)
+    {
+        if (!aux || !aux->data)
+            return token_error(YY_ERROR);
+
+        if (aux->reserved < jit->max_depth)
+            return token_error(YY_ERROR_MEM);
+
+        yy_jit_frame_t frame = {.tokens = jit->stack->data, .resolve = resolve, .data = data};
+        int (*func)(yy_jit_frame_t *, yy_token_t *) = (int (*)(yy_jit_frame_t *, yy_token_t *))(uintptr_t)((uint8_t *) jit->code + JIT_ENTRY);
+
+        if (likely(func(&frame, aux->data) == 0)) {
+            aux->len = jit->result + 1;
+            return aux->data[jit->result];
+        }
+    }
+#endif
+
+    // unsupported stack or bail-out (unexpected type, error)
+    return yy_eval_stack(jit->stack, aux, resolve, data);
+}
+
+void yy_free_jit(yy_jit_t *jit)
+{
+    if (!jit)
+        return;
+
+#ifdef USE_JIT
+    if (jit->code)
+        munmap(jit->code, jit->size);
+#endif
+
+    jit->code = NULL;
+    jit->size = 0;
+}
+
+/*
+ * Ahead-of-time code generation.
+ * 
+ * Each stack token becomes a C statement over an array of values 
+ * indexed by the stack depth (same layout than the aux stack), and 
+ * jumps become gotos. Functions are called through call_func() with 
+ * the symbol_to_token entry, so the generated code has the semantics 
+ * of the interpreter and must be compiled including expr.c.
+ */
+
+typedef struct yy_writer_t
+{
+    char *buf;                      //!< Output buffer (NULL = only counts chars).
+    uint32_t reserved;              //!< Size of the output buffer.
+    uint32_t len;                   //!< Number of chars written (terminating nul excluded).
+} yy_writer_t;
+
+static void write_fmt(yy_writer_t *writer, const char *fmt, ...)
+{
+    uint32_t pos = MIN(writer->len, writer->reserved);
+    va_list args;
+
+    va_start(args, fmt);
+    int ret = vsnprintf((writer->buf ? writer->buf + pos : NULL), (writer->buf ? writer->reserved - pos : 0), fmt, args);
+    va_end(args);
+
+    if (ret > 0)
+        writer->len += (uint32_t) ret;
+}
+
+// Writes a C string literal
+static void write_c_str(yy_writer_t *writer, yy_str_t str)
+{
+    write_fmt(writer, "\"");
+
+    for (uint32_t i = 0; i < str.len; i++)
+    {
+        unsigned char c = (unsigned char) str.ptr[i];
+
+        if (c == '"' || c == '\\')
+            write_fmt(writer, "\\%c", c);
+        else if (isprint(c) && c != '?')    // avoids trigraphs
+            write_fmt(writer, "%c", c);
+        else
+            write_fmt(writer, "\\%03o", c);
+    }
+
+    write_fmt(writer, "\"");
+}
+
+static void write_c_number(yy_writer_t *writer, double val)
+{
+    if (isnan(val))
+        write_fmt(writer, "NAN");
+    else if (isinf(val))
+        write_fmt(writer, (val < 0 ? "-INFINITY" : "INFINITY"));
+    else
+        write_fmt(writer, "%a", val);   // exact representation
+}
+
+static const char * get_symbol_name(uint32_t symbol)
+{
+    for (uint32_t i = 0; i < NUM_IDENTIFIERS; i++)
+        if ((uint32_t) yy_identifiers[i].type == symbol)
+            return yy_identifiers[i].str;
+
+    return NULL;
+}
+
+static bool is_jump_target(const yy_stack_t *stack, uint32_t pos)
+{
+    for (uint32_t i = 0; i < pos; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+
+        if (token->type != YY_TOKEN_JUMP || !token->jump.offset || stack->len - i < token->jump.offset)
+            continue;
+
+        switch (token->jump.opcode)
+        {
+            case YY_OPCODE_JUMP_IFELSE:
+            {
+                // non-bool condition jumps to the ifelse token
+                const yy_token_t *jump = &stack->data[i + token->jump.offset - 1];
+
+                if (i + token->jump.offset == pos || i + token->jump.offset - 1 + jump->jump.offset == pos)
+                    return true;
+                break;
+            }
+            case YY_OPCODE_JUMP:
+            case YY_OPCODE_JUMP_AND:
+            case YY_OPCODE_JUMP_OR:
+                if (i + token->jump.offset == pos)
+                    return true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Writes the statements evaluating a stack.
+ * 
+ * @param[in] stack Compiled stack (validated).
+ * @param[in,out] writer Output.
+ * @param[out] max_depth Size of the values array.
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_VALUE if the stack has unsupported tokens (slots),
+ *         YY_ERROR_EVAL if the stack is corrupted.
+ */
+static yy_error_e write_c_stack(const yy_stack_t *stack, yy_writer_t *writer, uint32_t *max_depth)
+{
+    uint32_t depth = 0;
+    uint32_t base = 0;
+
+    *max_depth = 1;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+
+        if (is_jump_target(stack, i))
+            write_fmt(writer, "L%u:\n", i);
+
+        switch (token->type)
+        {
+            case YY_TOKEN_NUMBER:
+                write_fmt(writer, "    v[%u] = token_number(", depth);
+                write_c_number(writer, token->number_val);
+                write_fmt(writer, ");\n");
+                depth++;
+                break;
+
+            case YY_TOKEN_DATETIME:
+                write_fmt(writer, "    v[%u] = token_datetime(%lluULL);\n", depth, (unsigned long long) token->datetime_val);
+                depth++;
+                break;
+
+            case YY_TOKEN_BOOL:
+                write_fmt(writer, "    v[%u] = token_bool(%s);\n", depth, (token->bool_val ? "true" : "false"));
+                depth++;
+                break;
+
+            case YY_TOKEN_STRING:
+                write_fmt(writer, "    v[%u] = token_string(", depth);
+                write_c_str(writer, (token->str_val.ptr ? token->str_val : make_string("", 0)));
+                write_fmt(writer, ", %u);\n", token->str_val.len);
+                depth++;
+                break;
+
+            case YY_TOKEN_ERROR:
+                if (is_blocking_error(token->error))
+                    write_fmt(writer, "    return token_error(YY_ERROR_EVAL);\n");
+                else
+                    write_fmt(writer, "    v[%u] = token_error(%d);\n", depth, (int) token->error);
+                depth++;
+                break;
+
+            case YY_TOKEN_VARIABLE:
+                write_fmt(writer, "    if (!resolve) return token_error(YY_ERROR_REF);\n");
+                write_fmt(writer, "    v[%u] = resolve(make_string(", depth);
+                write_c_str(writer, token->variable);
+                write_fmt(writer, ", %u), data);\n", token->variable.len);
+                write_fmt(writer, "    if (v[%u].type == YY_TOKEN_ERROR && is_blocking_error(v[%u].error)) return v[%u];\n", depth, depth, depth);
+                depth++;
+                break;
+
+            case YY_TOKEN_TEMP:
+                if (token->temp >= base)
+                    return YY_ERROR_EVAL;
+                write_fmt(writer, "    if (v[%u].type == YY_TOKEN_NULL) return token_error(YY_ERROR_EVAL);\n", token->temp);
+                write_fmt(writer, "    v[%u] = v[%u];\n", depth, token->temp);
+                depth++;
+                break;
+
+            case YY_TOKEN_FUNCTION:
+            {
+                const yy_func_t *func = &token->function;
+                uint32_t symbol = find_symbol(func);
+                const char *name = get_symbol_name(symbol);
+
+                if (func->opcode == YY_OPCODE_IFELSE)
+                {
+                    // branch value already selected by jumps
+                    if (depth <= base)
+                        return YY_ERROR_EVAL;
+                    write_fmt(writer, "    if (v[%u].type != YY_TOKEN_NUMBER && v[%u].type != YY_TOKEN_DATETIME && v[%u].type != YY_TOKEN_STRING && v[%u].type != YY_TOKEN_BOOL)\n", depth - 1, depth - 1, depth - 1, depth - 1);
+                    write_fmt(writer, "        v[%u] = token_error(YY_ERROR_VALUE);\n", depth - 1);
+                    break;
+                }
+
+                if (symbol >= YY_SYMBOL_END || depth < base + func->num_args)
+                    return YY_ERROR_EVAL;
+
+                depth -= func->num_args;
+                write_fmt(writer, "    r = call_func(symbol_to_token[%u].function, &v[%u], &ctx);", symbol, depth);
+                if (name)
+                    write_fmt(writer, "   // %s", name);
+                write_fmt(writer, "\n");
+                write_fmt(writer, "    if (r.type == YY_TOKEN_ERROR && is_blocking_error(r.error)) return r;\n");
+                if (func->num_args)
+                    write_fmt(writer, "    free_args(&ctx, &v[%u], %u, &r);\n", depth, func->num_args);
+                write_fmt(writer, "    v[%u] = r;\n", depth);
+                depth++;
+                break;
+            }
+
+            case YY_TOKEN_JUMP:
+            {
+                uint32_t offset = token->jump.offset;
+
+                if (token->jump.opcode != YY_OPCODE_FRAME && token->jump.opcode != YY_OPCODE_STORE && 
+                    !is_fused_opcode(token->jump.opcode) && (!offset || stack->len - i < offset))
+                    return YY_ERROR_EVAL;
+
+                switch (token->jump.opcode)
+                {
+                    case YY_OPCODE_FRAME:
+                        if (i != 0)
+                            return YY_ERROR_EVAL;
+                        base = depth = offset;
+                        write_fmt(writer, "    memset(v, 0x00, sizeof(v));\n");
+                        break;
+
+                    case YY_OPCODE_STORE:
+                        if (offset >= base || depth <= base)
+                            return YY_ERROR_EVAL;
+                        write_fmt(writer, "    v[%u] = v[%u];\n", offset, depth - 1);
+                        break;
+
+                    case YY_OPCODE_JUMP:
+                        // end of the then-branch, the else-branch overwrites the value
+                        if (depth <= base)
+                            return YY_ERROR_EVAL;
+                        write_fmt(writer, "    goto L%u;\n", i + offset);
+                        depth--;
+                        break;
+
+                    case YY_OPCODE_JUMP_IFELSE:
+                    {
+                        const yy_token_t *jump = &stack->data[i + offset - 1];
+
+                        if (depth <= base || jump->type != YY_TOKEN_JUMP || !jump->jump.offset || stack->len - i < offset - 1 + jump->jump.offset)
+                            return YY_ERROR_EVAL;
+
+                        depth--;
+                        write_fmt(writer, "    if (v[%u].type == YY_TOKEN_BOOL) {\n", depth);
+                        write_fmt(writer, "        if (!v[%u].bool_val) goto L%u;\n", depth, i + offset);
+                        write_fmt(writer, "    } else {\n");
+                        write_fmt(writer, "        if (v[%u].type == YY_TOKEN_STRING) free_str(&ctx, &v[%u].str_val);\n", depth, depth);
+                        write_fmt(writer, "        v[%u] = token_error(YY_ERROR_VALUE);\n", depth);
+                        write_fmt(writer, "        goto L%u;\n", i + offset - 1 + jump->jump.offset);
+                        write_fmt(writer, "    }\n");
+                        break;
+                    }
+
+                    case YY_OPCODE_JUMP_AND:
+                    case YY_OPCODE_JUMP_OR:
+                        if (depth <= base)
+                            return YY_ERROR_EVAL;
+                        write_fmt(writer, "    if (v[%u].type == YY_TOKEN_BOOL) {\n", depth - 1);
+                        write_fmt(writer, "        if (%sv[%u].bool_val) goto L%u;\n", (token->jump.opcode == YY_OPCODE_JUMP_AND ? "!" : ""), depth - 1, i + offset);
+                        write_fmt(writer, "    } else {\n");
+                        write_fmt(writer, "        if (v[%u].type == YY_TOKEN_STRING) free_str(&ctx, &v[%u].str_val);\n", depth - 1, depth - 1);
+                        write_fmt(writer, "        v[%u] = token_error(YY_ERROR_VALUE);\n", depth - 1);
+                        write_fmt(writer, "        goto L%u;\n", i + offset);
+                        write_fmt(writer, "    }\n");
+                        break;
+
+                    default:
+                        // superinstructions are not needed
+                        if (!is_fused_opcode(token->jump.opcode))
+                            return YY_ERROR_EVAL;
+                        break;
+                }
+                break;
+            }
+
+            default:
+                return (token->type == YY_TOKEN_SLOT ? YY_ERROR_VALUE : YY_ERROR_EVAL);
+        }
+
+        *max_depth = MAX(*max_depth, depth);
+    }
+
+    if (depth != base + 1)
+        return YY_ERROR_EVAL;
+
+    if (is_jump_target(stack, stack->len))
+        write_fmt(writer, "L%u:\n", stack->len);
+
+    write_fmt(writer, "    return v[%u];\n", base);
+
+    return YY_OK;
+}
+
+static bool is_c_identifier(const char *str)
+{
+    if (!str || !(isalpha((unsigned char) *str) || *str == '_'))
+        return false;
+
+    while (*str && (isalnum((unsigned char) *str) || *str == '_'))
+        str++;
+
+    return (*str == 0);
+}
+
+yy_error_e yy_generate_c(const yy_stack_t *stack, const char *name, char *buf, uint32_t len)
+{
+    if (!stack || !stack->data || !stack->len || !is_c_identifier(name) || !buf || !len)
+        return YY_ERROR;
+
+    yy_writer_t writer = {0};
+    uint32_t max_depth = 0;
+    yy_error_e rc = YY_OK;
+
+    // first pass computes the values array size
+    if ((rc = write_c_stack(stack, &writer, &max_depth)) != YY_OK)
+        return rc;
+
+    writer = (yy_writer_t){.buf = buf, .reserved = len};
+
+    write_fmt(&writer, "static yy_token_t %s(yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)\n", name);
+    write_fmt(&writer, "{\n");
+    write_fmt(&writer, "    yy_eval_ctx_t ctx = {.stack = aux, .tmp_str = (char *) &aux->data[aux->reserved]};\n");
+    write_fmt(&writer, "    yy_token_t v[%u];\n", max_depth);
+    write_fmt(&writer, "    yy_token_t r = {0};\n");
+    write_fmt(&writer, "\n");
+    write_fmt(&writer, "    UNUSED(resolve); UNUSED(data); UNUSED(r); UNUSED(ctx);\n");
+    write_fmt(&writer, "    aux->len = 0;\n");
+    write_fmt(&writer, "\n");
+    write_c_stack(stack, &writer, &max_depth);
+    write_fmt(&writer, "}\n");
+
+    if (writer.len >= len) {
+        buf[0] = 0;
+        return YY_ERROR_MEM;
+    }
+
+    return YY_OK;
+}
+
+yy_error_e yy_load_rules(const char *path, yy_rules_t *rules)
+{
+    if (!path || !rules)
+        return YY_ERROR;
+
+    memset(rules, 0x00, sizeof(yy_rules_t));
+
+#ifndef USE_DLOPEN
+    return YY_ERROR;
+#else
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+    if (!handle)
+        return YY_ERROR_REF;
+
+    const yy_rule_t *table = (const yy_rule_t *) dlsym(handle, "yy_rules");
+    const uint32_t *num_rules = (const uint32_t *) dlsym(handle, "yy_num_rules");
+
+    if (!table || !num_rules) {
+        dlclose(handle);
+        return YY_ERROR_REF;
+    }
+
+    rules->handle = handle;
+    rules->data = table;
+    rules->len = *num_rules;
+
+    return YY_OK;
+#endif
+}
+
+const yy_rule_t * yy_find_rule(const yy_rules_t *rules, const char *name)
+{
+    if (!rules || !rules->data || !name)
+        return NULL;
+
+    for (uint32_t i = 0; i < rules->len; i++)
+        if (rules->data[i].name && strcmp(rules->data[i].name, name) == 0)
+            return &rules->data[i];
+
+    return NULL;
+}
+
+void yy_unload_rules(yy_rules_t *rules)
+{
+    if (!rules)
+        return;
+
+#ifdef USE_DLOPEN
+    if (rules->handle)
+        dlclose(rules->handle);
+#endif
+
+    memset(rules, 0x00, sizeof(yy_rules_t));
+}
+
+yy_error_e yy_bind_stack(yy_stack_t *stack, yy_str_t *names, uint32_t max_names, uint32_t *num_names)
+{
+    if (!stack || !stack->data || !num_names || (max_names && !names))
+        return YY_ERROR;
+
+    uint32_t len = 0;
+
+    // names are assigned before touching the stack
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+        uint32_t j = 0;
+
+        if (token->type != YY_TOKEN_VARIABLE)
+            continue;
+
+        while (j < len && (names[j].len != token->variable.len || strncmp(names[j].ptr, token->variable.ptr, token->variable.len) != 0))
+            j++;
+
+        if (j < len)
+            continue;
+
+        if (len >= max_names)
+            return YY_ERROR_MEM;
+
+        names[len++] = token->variable;
+    }
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        yy_token_t *token = &stack->data[i];
+        uint32_t j = 0;
+
+        if (token->type != YY_TOKEN_VARIABLE)
+            continue;
+
+        while (names[j].len != token->variable.len || strncmp(names[j].ptr, token->variable.ptr, token->variable.len) != 0)
+            j++;
+
+        *token = (yy_token_t){ .slot = j, .type = YY_TOKEN_SLOT };
+    }
+
+    *num_names = len;
+
+    return YY_OK;
+}
+
+#define BATCH_MAX_ROWS 64
+#define BATCH_MAX_DEPTH 64
+
+typedef struct yy_batch_row_t
+{
+    const yy_column_t *columns;     //!< Columns.
+    uint32_t num_columns;           //!< Number of columns.
+    uint32_t row;                   //!< Current row.
+} yy_batch_row_t;
+
+/**
+ * Computes the maximum number of values stored in the aux stack
+ * when the given stack is evaluated (temporaries included).
+ * 
+ * @param[in] stack Stack to check.
+ * @param[out] max_depth Maximum depth.
+ * 
+ * @return true = valid stack, false = corrupted stack.
+ */
+static bool get_stack_depth(const yy_stack_t *stack, uint32_t *max_depth)
+{
+    uint32_t depth = 0;
+    uint32_t base = 0;
+
+    *max_depth = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+
+        if (token->type == YY_TOKEN_JUMP)
+        {
+            switch (token->jump.opcode)
+            {
+                case YY_OPCODE_FRAME:
+                    if (i != 0)
+                        return false;
+                    base = depth = token->jump.offset;
+                    *max_depth = depth;
+                    break;
+                case YY_OPCODE_STORE:
+                    if (token->jump.offset >= base || depth <= base)
+                        return false;
+                    break;
+                default:
+                    break;
+            }
+
+            continue;
+        }
+
+        if (token->type == YY_TOKEN_TEMP && token->temp >= base)
+            return false;
+
+        if (token->type == YY_TOKEN_FUNCTION)
+        {
+            if (depth < base + token->function.num_args)
+                return false;
+
+            depth -= token->function.num_args;
+        }
+
+        depth++;
+        *max_depth = MAX(*max_depth, depth);
+    }
+
+    return (depth == base + 1);
+}
+
+/**
+ * Checks if the evaluation of the stack can allocate temporary strings.
+ * 
+ * @param[in] stack Stack to check.
+ * 
+ * @return true = uses temporary strings, false = otherwise.
+ */
+static bool uses_temp_strings(const yy_stack_t *stack)
+{
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_func_t *func = &stack->data[i].function;
+
+        if (stack->data[i].type != YY_TOKEN_FUNCTION || !func->needs_ctx)
+            continue;
+
+        if ((yy_func_0_x) func->ptr == func_now || (yy_func_2_x) func->ptr == func_random)
+            continue;
+
+        return true;
+    }
+
+    return false;
+}
+
+static const yy_column_t * find_column(const yy_column_t *columns, uint32_t num_columns, yy_str_t name)
+{
+    for (uint32_t i = 0; i < num_columns; i++)
+        if (columns[i].name.len == name.len && strncmp(columns[i].name.ptr, name.ptr, name.len) == 0)
+            return &columns[i];
+
+    return NULL;
+}
+
+// variables are found by name, slots by position
+static const yy_column_t * get_column(const yy_column_t *columns, uint32_t num_columns, const yy_token_t *token)
+{
+    if (token->type == YY_TOKEN_SLOT)
+        return (token->slot < num_columns ? &columns[token->slot] : NULL);
+
+    return find_column(columns, num_columns, token->variable);
+}
+
+static bool has_slots(const yy_stack_t *stack)
+{
+    for (uint32_t i = 0; i < stack->len; i++)
+        if (stack->data[i].type == YY_TOKEN_SLOT)
+            return true;
+
+    return false;
+}
+
+static yy_token_t resolve_batch_row(yy_str_t var, void *data)
+{
+    yy_batch_row_t *batch = (yy_batch_row_t *) data;
+    const yy_column_t *column = find_column(batch->columns, batch->num_columns, var);
+
+    if (!column || !column->values)
+        return token_error(YY_ERROR_REF);
+
+    return column->values[batch->row];
+}
+
+/**
+ * Evaluates the stack row by row.
+ * 
+ * Temporary strings of the results are preserved in the tail of 
+ * the aux memory. Remaining memory is used to evaluate next rows.
+ */
+static yy_error_e eval_batch_by_rows(const yy_stack_t *stack, yy_stack_t *aux, const yy_column_t *columns, uint32_t num_columns, uint32_t num_rows, yy_token_t *results)
+{
+    yy_batch_row_t batch = {.columns = columns, .num_columns = num_columns, .row = 0};
+    yy_stack_t row_aux = *aux;
+    yy_token_t *slots = NULL;
+    uint32_t num_slots = (has_slots(stack) ? num_columns : 0);
+    yy_vars_t vars = {.resolve = resolve_batch_row, .data = &batch, .num_slots = num_slots};
+
+    // slot values of the current row are placed at the head of aux
+    if (num_slots)
+    {
+        if (row_aux.reserved <= num_slots)
+            return YY_ERROR_MEM;
+
+        slots = row_aux.data;
+        vars.slots = slots;
+        row_aux.data += num_slots;
+        row_aux.reserved -= num_slots;
+    }
+
+    for (uint32_t row = 0; row < num_rows; row++)
+    {
+        for (uint32_t j = 0; j < num_slots; j++)
+            slots[j] = (columns[j].values ? columns[j].values[row] : token_error(YY_ERROR_REF));
+
+        batch.row = row;
+        results[row] = eval_stack(stack, &row_aux, &vars);
+
+        if (results[row].type != YY_TOKEN_STRING)
+            continue;
+
+        const char *ptr = results[row].str_val.ptr;
+
+        if (ptr < (char *) row_aux.data || (char *) &row_aux.data[row_aux.reserved] <= ptr)
+            continue;
+
+        // keep result string, tokens after ptr are not reusable
+        row_aux.reserved = (uint32_t) ((ptr - (char *) row_aux.data) / sizeof(yy_token_t));
+    }
+
+    aux->len = 0;
+
+    return YY_OK;
+}
+
+/**
+ * Evaluates a block of rows token by token.
+ * 
+ * Aux memory is used as a matrix, where each stack level holds 
+ * the values of the block rows:
+ * 
+ *   AUX = [level0: row0, row1, ..., rowN][level1: row0, row1, ..., rowN]...
+ * 
+ * Results initialized to YY_TOKEN_NULL. Rows with a blocking error 
+ * are flagged by setting the error in the result.
+ */
+static yy_error_e eval_batch_block(const yy_stack_t *stack, yy_stack_t *aux, const yy_column_t *columns, uint32_t num_columns, uint32_t first_row, uint32_t num_rows, yy_token_t *results)
+{
+    yy_eval_ctx_t ctx = {.stack = aux, .tmp_str = (char *) &aux->data[aux->reserved]};
+    yy_token_t *level = aux->data;
+    uint32_t depth = 0;
+    uint32_t base = 0;      // temporaries are the bottom levels
+
+    for (uint32_t r = 0; r < num_rows; r++)
+        results[r].type = YY_TOKEN_NULL;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+
+        switch (token->type)
+        {
+            case YY_TOKEN_ERROR:
+                if (is_blocking_error(token->error))
+                    return YY_ERROR_EVAL;
+                fallthrough;
+            case YY_TOKEN_BOOL:
+            case YY_TOKEN_NUMBER:
+            case YY_TOKEN_DATETIME:
+            case YY_TOKEN_STRING:
+            {
+                yy_token_t *x = level + (depth++) * num_rows;
+
+                for (uint32_t r = 0; r < num_rows; r++)
+                    x[r] = *token;
+
+                break;
+            }
+            case YY_TOKEN_VARIABLE:
+            case YY_TOKEN_SLOT:
+            {
+                yy_token_t *x = level + (depth++) * num_rows;
+                const yy_column_t *column = get_column(columns, num_columns, token);
+
+                if (!column || !column->values) {
+                    for (uint32_t r = 0; r < num_rows; r++)
+                        x[r] = token_error(YY_ERROR_REF);
+                    break;
+                }
+
+                memcpy(x, column->values + first_row, num_rows * sizeof(yy_token_t));
+
+                for (uint32_t r = 0; r < num_rows; r++)
+                    if (unlikely(x[r].type == YY_TOKEN_ERROR && is_blocking_error(x[r].error)) && results[r].type == YY_TOKEN_NULL)
+                        results[r] = x[r];
+
+                break;
+            }
+            case YY_TOKEN_FUNCTION:
+            {
+                yy_func_t func = token->function;
+
+                if (!func.ptr)
+                    return YY_ERROR_EVAL;
+
+                depth -= func.num_args;
+
+                yy_token_t *x = level + depth * num_rows;
+                yy_token_t *y = x + num_rows;
+                yy_token_t *z = y + num_rows;
+
+                switch (func.num_args + (func.needs_ctx ? 4 : 0))
+                {
+                    case 0: for (uint32_t r = 0; r < num_rows; r++) x[r] = ((yy_func_0) func.ptr)(); break;
+                    case 1: for (uint32_t r = 0; r < num_rows; r++) x[r] = ((yy_func_1) func.ptr)(x[r]); break;
+                    case 2: for (uint32_t r = 0; r < num_rows; r++) x[r] = ((yy_func_2) func.ptr)(x[r], y[r]); break;
+                    case 3: for (uint32_t r = 0; r < num_rows; r++) x[r] = ((yy_func_3) func.ptr)(x[r], y[r], z[r]); break;
+                    case 4: for (uint32_t r = 0; r < num_rows; r++) x[r] = ((yy_func_0_x) func.ptr)(&ctx); break;
+                    case 5: for (uint32_t r = 0; r < num_rows; r++) x[r] = ((yy_func_1_x) func.ptr)(x[r], &ctx); break;
+                    case 6: for (uint32_t r = 0; r < num_rows; r++) x[r] = ((yy_func_2_x) func.ptr)(x[r], y[r], &ctx); break;
+                    case 7: for (uint32_t r = 0; r < num_rows; r++) x[r] = ((yy_func_3_x) func.ptr)(x[r], y[r], z[r], &ctx); break;
+                    default: return YY_ERROR_EVAL;
+                }
+
+                for (uint32_t r = 0; r < num_rows; r++)
+                    if (unlikely(x[r].type == YY_TOKEN_ERROR && is_blocking_error(x[r].error)) && results[r].type == YY_TOKEN_NULL)
+                        results[r] = x[r];
+
+                depth++;
+                break;
+            }
+            case YY_TOKEN_TEMP:
+            {
+                yy_token_t *x = level + (depth++) * num_rows;
+
+                memcpy(x, level + token->temp * num_rows, num_rows * sizeof(yy_token_t));
+                break;
+            }
+            case YY_TOKEN_JUMP:
+                // all operands are evaluated, stores precede loads
+                if (token->jump.opcode == YY_OPCODE_FRAME) {
+                    base = depth = token->jump.offset;
+                    memset(level, 0x00, base * num_rows * sizeof(yy_token_t));
+                }
+                else if (token->jump.opcode == YY_OPCODE_STORE) {
+                    memcpy(level + token->jump.offset * num_rows, level + (depth - 1) * num_rows, num_rows * sizeof(yy_token_t));
+                }
+                break;
+            default:
+                return YY_ERROR_EVAL;
+        }
+    }
+
+    assert(depth == base + 1);
+
+    for (uint32_t r = 0; r < num_rows; r++)
+        if (results[r].type == YY_TOKEN_NULL)
+            results[r] = level[base * num_rows + r];
+
+    return YY_OK;
+}
+
+/*
+ * Numeric kernels used by the batch evaluation.
+ * 
+ * Bool values are stored as doubles (0.0 or 1.0). Each kernel stores the 
+ * result in the first argument. Vectorized code (AVX or SSE2) must give 
+ * the same bits than the scalar functions (func_xxx).
+ */
+
+#define BOOL_VAL(b_)    ((b_) ? 1.0 : 0.0)
+
+#ifdef VEC_LEN
+    #define BATCH_VEC_1(vexpr_) \
+        for (; i + VEC_LEN <= n; i += VEC_LEN) { \
+            yy_vec_t a = vec_load(x + i); \
+            vec_store(x + i, (vexpr_)); \
+        }
+    #define BATCH_VEC_2(vexpr_) \
+        for (; i + VEC_LEN <= n; i += VEC_LEN) { \
+            yy_vec_t a = vec_load(x + i); \
+            yy_vec_t b = vec_load(y + i); \
+            vec_store(x + i, (vexpr_)); \
+        }
+#else
+    #define BATCH_VEC_1(vexpr_)     /**/
+    #define BATCH_VEC_2(vexpr_)     /**/
+#endif
+
+#define BATCH_KERNEL_1(name_, vexpr_, sexpr_) \
+    static void name_(double *x, uint32_t n) \
+    { \
+        uint32_t i = 0; \
+        BATCH_VEC_1(vexpr_) \
+        for (; i < n; i++) { double a = x[i]; x[i] = (sexpr_); } \
+    }
+
+#define BATCH_KERNEL_2(name_, vexpr_, sexpr_) \
+    static void name_(double *x, const double *y, uint32_t n) \
+    { \
+        uint32_t i = 0; \
+        BATCH_VEC_2(vexpr_) \
+        for (; i < n; i++) { double a = x[i], b = y[i]; x[i] = (sexpr_); } \
+    }
+
+#define BATCH_LOOP_1(name_, sexpr_) \
+    static void name_(double *x, uint32_t n) \
+    { \
+        for (uint32_t i = 0; i < n; i++) { double a = x[i]; x[i] = (sexpr_); } \
+    }
+
+#define BATCH_LOOP_2(name_, sexpr_) \
+    static void name_(double *x, const double *y, uint32_t n) \
+    { \
+        for (uint32_t i = 0; i < n; i++) { double a = x[i], b = y[i]; x[i] = (sexpr_); } \
+    }
+
+BATCH_KERNEL_1(batch_minus, vec_xor(a, vec_set1(-0.0)), -a)
+BATCH_KERNEL_1(batch_abs, vec_andnot(vec_set1(-0.0), a), fabs(a))
+BATCH_KERNEL_1(batch_sqrt, vec_sqrt(a), sqrt(a))
+BATCH_KERNEL_1(batch_not, vec_xor(a, vec_set1(1.0)), BOOL_VAL(a == 0.0))
+BATCH_LOOP_1(batch_ceil, ceil(a))
+BATCH_LOOP_1(batch_floor, floor(a))
+BATCH_LOOP_1(batch_trunc, trunc(a))
+BATCH_LOOP_1(batch_sin, sin(a))
+BATCH_LOOP_1(batch_cos, cos(a))
+BATCH_LOOP_1(batch_tan, tan(a))
+BATCH_LOOP_1(batch_exp, exp(a))
+BATCH_LOOP_1(batch_log, log(a))
+BATCH_LOOP_1(batch_isinf, BOOL_VAL(isinf(a)))
+BATCH_LOOP_1(batch_isnan, BOOL_VAL(isnan(a)))
+
+BATCH_KERNEL_2(batch_addition, vec_add(a, b), a + b)
+BATCH_KERNEL_2(batch_subtraction, vec_sub(a, b), a - b)
+BATCH_KERNEL_2(batch_mult, vec_mul(a, b), a * b)
+BATCH_KERNEL_2(batch_div, vec_div(a, b), a / b)
+BATCH_KERNEL_2(batch_lt, vec_and(vec_lt(a, b), vec_set1(1.0)), BOOL_VAL(a < b))
+BATCH_KERNEL_2(batch_le, vec_and(vec_le(a, b), vec_set1(1.0)), BOOL_VAL(a <= b))
+BATCH_KERNEL_2(batch_gt, vec_and(vec_lt(b, a), vec_set1(1.0)), BOOL_VAL(a > b))
+BATCH_KERNEL_2(batch_ge, vec_and(vec_le(b, a), vec_set1(1.0)), BOOL_VAL(a >= b))
+BATCH_KERNEL_2(batch_eq, vec_and(vec_eq(a, b), vec_set1(1.0)), BOOL_VAL(a == b))
+BATCH_KERNEL_2(batch_ne, vec_and(vec_ne(a, b), vec_set1(1.0)), BOOL_VAL(a != b))
+BATCH_KERNEL_2(batch_and, vec_and(a, b), BOOL_VAL(a != 0.0 && b != 0.0))
+BATCH_KERNEL_2(batch_or, vec_or(a, b), BOOL_VAL(a != 0.0 || b != 0.0))
+BATCH_LOOP_2(batch_mod, fmod(a, b))
+BATCH_LOOP_2(batch_pow, pow(a, b))
+BATCH_LOOP_2(batch_powi, (b == trunc(b) && fabs(b) <= MAX_POWI_EXP ? pow_int(a, (int) b) : pow(a, b)))
+
+static void batch_fma(double *x, const double *y, const double *z, uint32_t n, yy_token_t *flags)
+{
+    UNUSED(flags);
+
+    for (uint32_t i = 0; i < n; i++)
+        x[i] = fma(x[i], y[i], z[i]);
+}
+
+/**
+ * min_num() returns the non-NaN argument. Blocks with equal values (ex. -0.0 
+ * and +0.0) are resolved calling min_num() to get the same sign than the scalar path.
+ */
+static void batch_min(double *x, const double *y, uint32_t n)
+{
+    uint32_t i = 0;
+
+#ifdef VEC_LEN
+    for (; i + VEC_LEN <= n; i += VEC_LEN)
+    {
+        yy_vec_t a = vec_load(x + i);
+        yy_vec_t b = vec_load(y + i);
+
+        if (unlikely(vec_movemask(vec_eq(a, b)) != 0)) {
+            for (uint32_t j = i; j < i + VEC_LEN; j++)
+                x[j] = min_num(x[j], y[j]);
+            continue;
+        }
+
+        vec_store(x + i, vec_select(vec_or(vec_lt(a, b), vec_unord(b, b)), a, b));
+    }
+#endif
+
+    for (; i < n; i++)
+        x[i] = min_num(x[i], y[i]);
+}
+
+static void batch_max(double *x, const double *y, uint32_t n)
+{
+    uint32_t i = 0;
+
+#ifdef VEC_LEN
+    for (; i + VEC_LEN <= n; i += VEC_LEN)
+    {
+        yy_vec_t a = vec_load(x + i);
+        yy_vec_t b = vec_load(y + i);
+
+        if (unlikely(vec_movemask(vec_eq(a, b)) != 0)) {
+            for (uint32_t j = i; j < i + VEC_LEN; j++)
+                x[j] = max_num(x[j], y[j]);
+            continue;
+        }
+
+        vec_store(x + i, vec_select(vec_or(vec_lt(b, a), vec_unord(b, b)), a, b));
+    }
+#endif
+
+    for (; i < n; i++)
+        x[i] = max_num(x[i], y[i]);
+}
+
+static void batch_ifelse(double *x, const double *y, const double *z, uint32_t n, yy_token_t *flags)
+{
+    uint32_t i = 0;
+
+    (void) flags;
+
+#ifdef VEC_LEN
+    for (; i + VEC_LEN <= n; i += VEC_LEN)
+    {
+        yy_vec_t cond = vec_ne(vec_load(x + i), vec_set1(0.0));
+        vec_store(x + i, vec_select(cond, vec_load(y + i), vec_load(z + i)));
+    }
+#endif
+
+    for (; i < n; i++)
+        x[i] = (x[i] != 0.0 ? y[i] : z[i]);
+}
+
+/**
+ * Rows with vmin > vmax are flagged (func_clamp returns YY_ERROR_VALUE).
+ */
+static void batch_clamp(double *x, const double *y, const double *z, uint32_t n, yy_token_t *flags)
+{
+    uint32_t i = 0;
+
+#ifdef VEC_LEN
+    for (; i + VEC_LEN <= n; i += VEC_LEN)
+    {
+        yy_vec_t a = vec_load(x + i);
+        yy_vec_t vmin = vec_load(y + i);
+        yy_vec_t vmax = vec_load(z + i);
+        int ko = vec_movemask(vec_lt(vmax, vmin));
+
+        yy_vec_t tmp = vec_select(vec_lt(vmax, a), vmax, a);
+        vec_store(x + i, vec_select(vec_lt(a, vmin), vmin, tmp));
+
+        for (int j = 0; unlikely(ko != 0); j++, ko >>= 1)
+            if (ko & 1)
+                flags[i + j].type = YY_TOKEN_ERROR;
     }
+#endif
+
+    for (; i < n; i++)
+    {
+        if (y[i] > z[i])
+            flags[i].type = YY_TOKEN_ERROR;
+
+        x[i] = CLAMP(x[i], y[i], z[i]);
+    }
+}
+
+typedef void (*yy_batch_1)(double *x, uint32_t n);
+typedef void (*yy_batch_2)(double *x, const double *y, uint32_t n);
+typedef void (*yy_batch_3)(double *x, const double *y, const double *z, uint32_t n, yy_token_t *flags);
+
+typedef enum yy_batch_sig_e {
+    YY_BATCH_N_N,                   //!< number -> number
+    YY_BATCH_N_B,                   //!< number -> bool
+    YY_BATCH_B_B,                   //!< bool -> bool
+    YY_BATCH_NN_N,                  //!< number, number -> number
+    YY_BATCH_NN_B,                  //!< number, number -> bool
+    YY_BATCH_BB_B,                  //!< bool, bool -> bool
+    YY_BATCH_XX_B,                  //!< number, number -> bool | bool, bool -> bool
+    YY_BATCH_NNN_N,                 //!< number, number, number -> number
+    YY_BATCH_BXX_X,                 //!< bool, number, number -> number | bool, bool, bool -> bool
+} yy_batch_sig_e;
+
+typedef struct yy_batch_func_t {
+    void (*func)(void);             //!< Scalar function.
+    void (*kernel)(void);           //!< Batch function.
+    yy_batch_sig_e sig;             //!< Function signature.
+} yy_batch_func_t;
+
+#define make_batch(func_, kernel_, sig_) { (void (*)(void)) func_, (void (*)(void)) kernel_, sig_ }
+
+static const yy_batch_func_t batch_funcs[] =
+{
+    make_batch(func_addition,    batch_addition,    YY_BATCH_NN_N),
+    make_batch(func_subtraction, batch_subtraction, YY_BATCH_NN_N),
+    make_batch(func_mult,        batch_mult,        YY_BATCH_NN_N),
+    make_batch(func_div,         batch_div,         YY_BATCH_NN_N),
+    make_batch(func_mod,         batch_mod,         YY_BATCH_NN_N),
+    make_batch(func_pow,         batch_pow,         YY_BATCH_NN_N),
+    make_batch(func_powi,        batch_powi,        YY_BATCH_NN_N),
+    make_batch(func_min,         batch_min,         YY_BATCH_NN_N),
+    make_batch(func_max,         batch_max,         YY_BATCH_NN_N),
+    make_batch(func_lt,          batch_lt,          YY_BATCH_NN_B),
+    make_batch(func_le,          batch_le,          YY_BATCH_NN_B),
+    make_batch(func_gt,          batch_gt,          YY_BATCH_NN_B),
+    make_batch(func_ge,          batch_ge,          YY_BATCH_NN_B),
+    make_batch(func_eq,          batch_eq,          YY_BATCH_XX_B),
+    make_batch(func_ne,          batch_ne,          YY_BATCH_XX_B),
+    make_batch(func_and,         batch_and,         YY_BATCH_BB_B),
+    make_batch(func_or,          batch_or,          YY_BATCH_BB_B),
+    make_batch(func_clamp,       batch_clamp,       YY_BATCH_NNN_N),
+    make_batch(func_fma,         batch_fma,         YY_BATCH_NNN_N),
+    make_batch(func_ifelse,      batch_ifelse,      YY_BATCH_BXX_X),
+    make_batch(func_minus,       batch_minus,       YY_BATCH_N_N),
+    make_batch(func_ident,       NULL,              YY_BATCH_N_N),
+    make_batch(func_abs,         batch_abs,         YY_BATCH_N_N),
+    make_batch(func_sqrt,        batch_sqrt,        YY_BATCH_N_N),
+    make_batch(func_ceil,        batch_ceil,        YY_BATCH_N_N),
+    make_batch(func_floor,       batch_floor,       YY_BATCH_N_N),
+    make_batch(func_trunc,       batch_trunc,       YY_BATCH_N_N),
+    make_batch(func_sin,         batch_sin,         YY_BATCH_N_N),
+    make_batch(func_cos,         batch_cos,         YY_BATCH_N_N),
+    make_batch(func_tan,         batch_tan,         YY_BATCH_N_N),
+    make_batch(func_exp,         batch_exp,         YY_BATCH_N_N),
+    make_batch(func_log,         batch_log,         YY_BATCH_N_N),
+    make_batch(func_isinf,       batch_isinf,       YY_BATCH_N_B),
+    make_batch(func_isnan,       batch_isnan,       YY_BATCH_N_B),
+    make_batch(func_not,         batch_not,         YY_BATCH_B_B),
+};
+
+static const yy_batch_func_t * find_batch_func(yy_func_t func)
+{
+    for (size_t i = 0; i < sizeof(batch_funcs)/sizeof(batch_funcs[0]); i++)
+        if (batch_funcs[i].func == func.ptr)
+            return &batch_funcs[i];
+
+    return NULL;
 }
 
 /**
- * Parse a datetime expression until an unrecognized symbol is found.
+ * Returns the result type of a batch function.
  * 
- * @param[in] Parser object.
+ * @param[in] sig Function signature.
+ * @param[in] args Arguments types.
+ * 
+ * @return Result type (number or bool), 
+ *         YY_TOKEN_NULL if arguments doesn't match the signature.
  */
-INLINE
-static void parse_expr_datetime(yy_parser_t *parser)
+static yy_token_e get_batch_type(yy_batch_sig_e sig, const yy_token_e *args)
 {
-    if (++(parser->recursion_type) > MAX_RECURSION_TYPE)
-        parser->error = YY_ERROR_EXCD;
+    const yy_token_e N = YY_TOKEN_NUMBER;
+    const yy_token_e B = YY_TOKEN_BOOL;
 
-    parse_term_datetime(parser);
+    switch (sig)
+    {
+        case YY_BATCH_N_N:   return (args[0] == N ? N : YY_TOKEN_NULL);
+        case YY_BATCH_N_B:   return (args[0] == N ? B : YY_TOKEN_NULL);
+        case YY_BATCH_B_B:   return (args[0] == B ? B : YY_TOKEN_NULL);
+        case YY_BATCH_NN_N:  return (args[0] == N && args[1] == N ? N : YY_TOKEN_NULL);
+        case YY_BATCH_NN_B:  return (args[0] == N && args[1] == N ? B : YY_TOKEN_NULL);
+        case YY_BATCH_BB_B:  return (args[0] == B && args[1] == B ? B : YY_TOKEN_NULL);
+        case YY_BATCH_XX_B:  return (args[0] == args[1] ? B : YY_TOKEN_NULL);
+        case YY_BATCH_NNN_N: return (args[0] == N && args[1] == N && args[2] == N ? N : YY_TOKEN_NULL);
+        case YY_BATCH_BXX_X: return (args[0] == B && args[1] == args[2] ? args[1] : YY_TOKEN_NULL);
+        default:             return YY_TOKEN_NULL;
+    }
+}
 
-    assert(parser->recursion_type != 0);
-    parser->recursion_type--;
+/**
+ * Evaluates a block of rows using the numeric kernels.
+ * 
+ * Applies when all values are numbers or bools. Variable types are 
+ * taken from the first row of the block. Rows having a distinct type
+ * (or a flagged value) are evaluated again using the generic path.
+ * 
+ * Aux memory is used as a matrix of doubles (one row-block per level).
+ * 
+ * @return true = block evaluated, false = block not supported.
+ */
+static bool eval_batch_numeric(const yy_stack_t *stack, yy_stack_t *aux, const yy_column_t *columns, uint32_t num_columns, uint32_t first_row, uint32_t num_rows, yy_token_t *results)
+{
+    yy_token_e types[BATCH_MAX_DEPTH];
+    double *level = (double *) aux->data;
+    uint32_t depth = 0;
+    uint32_t base = 0;      // temporaries are the bottom levels
+
+    // check types before touching results
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+
+        switch (token->type)
+        {
+            case YY_TOKEN_BOOL:
+            case YY_TOKEN_NUMBER:
+                if (depth >= BATCH_MAX_DEPTH)
+                    return false;
+                types[depth++] = token->type;
+                break;
+            case YY_TOKEN_VARIABLE:
+            case YY_TOKEN_SLOT:
+            {
+                const yy_column_t *column = get_column(columns, num_columns, token);
+
+                if (depth >= BATCH_MAX_DEPTH || !column || !column->values)
+                    return false;
+
+                yy_token_e type = column->values[first_row].type;
+
+                if (type != YY_TOKEN_NUMBER && type != YY_TOKEN_BOOL)
+                    return false;
+
+                types[depth++] = type;
+                break;
+            }
+            case YY_TOKEN_FUNCTION:
+            {
+                const yy_batch_func_t *batch = find_batch_func(token->function);
+
+                if (!batch || depth < token->function.num_args)
+                    return false;
+
+                depth -= token->function.num_args;
+
+                yy_token_e type = get_batch_type(batch->sig, &types[depth]);
+
+                if (type == YY_TOKEN_NULL)
+                    return false;
+
+                types[depth++] = type;
+                break;
+            }
+            case YY_TOKEN_TEMP:
+                if (depth >= BATCH_MAX_DEPTH || token->temp >= base || types[token->temp] == YY_TOKEN_NULL)
+                    return false;
+                types[depth] = types[token->temp];
+                depth++;
+                break;
+            case YY_TOKEN_JUMP:
+                if (token->jump.opcode == YY_OPCODE_FRAME)
+                {
+                    if (token->jump.offset >= BATCH_MAX_DEPTH)
+                        return false;
+
+                    base = depth = token->jump.offset;
+
+                    for (uint32_t k = 0; k < base; k++)
+                        types[k] = YY_TOKEN_NULL;
+                }
+                else if (token->jump.opcode == YY_OPCODE_STORE)
+                {
+                    if (token->jump.offset >= base || depth <= base)
+                        return false;
+
+                    types[token->jump.offset] = types[depth - 1];
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if (depth != base + 1)
+        return false;
+
+    for (uint32_t r = 0; r < num_rows; r++)
+        results[r].type = YY_TOKEN_NULL;
+
+    depth = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        const yy_token_t *token = &stack->data[i];
+        double *x = level + depth * num_rows;
+
+        switch (token->type)
+        {
+            case YY_TOKEN_BOOL:
+            case YY_TOKEN_NUMBER:
+            {
+                double val = (token->type == YY_TOKEN_BOOL ? BOOL_VAL(token->bool_val) : token->number_val);
+
+                for (uint32_t r = 0; r < num_rows; r++)
+                    x[r] = val;
+
+                depth++;
+                break;
+            }
+            case YY_TOKEN_VARIABLE:
+            case YY_TOKEN_SLOT:
+            {
+                const yy_column_t *column = get_column(columns, num_columns, token);
+
+                if (unlikely(!column))
+                    return false;   // checked above
+
+                const yy_token_t *values = column->values + first_row;
+                yy_token_e type = values[0].type;
+
+                for (uint32_t r = 0; r < num_rows; r++)
+                {
+                    if (unlikely(values[r].type != type))
+                        results[r].type = YY_TOKEN_ERROR;
+
+                    x[r] = (type == YY_TOKEN_BOOL ? BOOL_VAL(values[r].bool_val) : values[r].number_val);
+                }
+
+                depth++;
+                break;
+            }
+            case YY_TOKEN_FUNCTION:
+            {
+                const yy_batch_func_t *batch = find_batch_func(token->function);
+
+                if (unlikely(!batch))
+                    return false;   // checked above
+
+                depth -= token->function.num_args;
+                x = level + depth * num_rows;
+
+                switch (batch->kernel ? token->function.num_args : 0)
+                {
+                    case 1: ((yy_batch_1) batch->kernel)(x, num_rows); break;
+                    case 2: ((yy_batch_2) batch->kernel)(x, x + num_rows, num_rows); break;
+                    case 3: ((yy_batch_3) batch->kernel)(x, x + num_rows, x + 2 * num_rows, num_rows, results); break;
+                    default: break; // identity
+                }
+
+                depth++;
+                break;
+            }
+            case YY_TOKEN_TEMP:
+                memcpy(x, level + token->temp * num_rows, num_rows * sizeof(double));
+                depth++;
+                break;
+            case YY_TOKEN_JUMP:
+                if (token->jump.opcode == YY_OPCODE_FRAME)
+                    depth = base;
+                else if (token->jump.opcode == YY_OPCODE_STORE)
+                    memcpy(level + token->jump.offset * num_rows, x - num_rows, num_rows * sizeof(double));
+                break;
+            default:
+                assert(false);
+                break;
+        }
+    }
+
+    yy_token_e type = types[base];
+    const double *result = level + base * num_rows;
+
+    for (uint32_t r = 0; r < num_rows; r++)
+    {
+        if (results[r].type == YY_TOKEN_ERROR)
+            continue;
+
+        results[r] = (type == YY_TOKEN_BOOL ? token_bool(result[r] != 0.0) : token_number(result[r]));
+    }
+
+    // flagged rows are evaluated using the generic path
+    for (uint32_t r = 0; r < num_rows; r++)
+    {
+        if (results[r].type != YY_TOKEN_ERROR)
+            continue;
+
+        yy_error_e rc = eval_batch_block(stack, aux, columns, num_columns, first_row + r, 1, results + r);
+
+        if (rc != YY_OK)
+            results[r] = token_error(rc);
+    }
+
+    return true;
 }
 
-yy_error_e yy_compile_number(const char *begin, const char *end, yy_stack_t *stack, const char **err)
+yy_error_e yy_eval_stack_batch(const yy_stack_t *stack, yy_stack_t *aux, const yy_column_t *columns, uint32_t num_columns, uint32_t num_rows, yy_token_t *results)
 {
-    if (!begin || !end || begin > end || !stack || !stack->data)
+    if (!stack || !aux || !stack->data || !stack->len || !aux->data || (num_columns && !columns) || (num_rows && !results))
         return YY_ERROR;
 
-    yy_parser_t parser;
+    uint32_t max_depth = 0;
+
+    if (!get_stack_depth(stack, &max_depth))
+        return YY_ERROR_EVAL;
+
+    if (uses_temp_strings(stack))
+        return eval_batch_by_rows(stack, aux, columns, num_columns, num_rows, results);
+
+    uint32_t block_rows = MIN(aux->reserved / max_depth, BATCH_MAX_ROWS);
+
+    if (block_rows == 0)
+        return YY_ERROR_MEM;
+
+    for (uint32_t row = 0; row < num_rows; row += block_rows)
+    {
+        uint32_t len = MIN(block_rows, num_rows - row);
+
+        aux->len = max_depth * len;
+
+        if (eval_batch_numeric(stack, aux, columns, num_columns, row, len, results + row))
+            continue;
+
+        yy_error_e rc = eval_batch_block(stack, aux, columns, num_columns, row, len, results + row);
+
+        if (rc != YY_OK)
+            return rc;
+    }
+
+    aux->len = 0;
+
+    return YY_OK;
+}
+
+yy_token_t yy_eval_number(const char *begin, const char *end, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+{
+    yy_error_e rc = yy_compile_number(begin, end, stack, NULL);
+
+    if (rc != YY_OK)
+        return token_error(rc);
+
+    uint32_t reserved = stack->reserved - stack->len;
+    yy_stack_t aux = {.data = stack->data + stack->len, .reserved = reserved, .len = 0};
+
+    return yy_eval_stack(stack, &aux, resolve, data);
+}
+
+yy_token_t yy_eval_datetime(const char *begin, const char *end, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+{
+    yy_error_e rc = yy_compile_datetime(begin, end, stack, NULL);
+
+    if (rc != YY_OK)
+        return token_error(rc);
+
+    uint32_t reserved = stack->reserved - stack->len;
+    yy_stack_t aux = {.data = stack->data + stack->len, .reserved = reserved, .len = 0};
+
+    return yy_eval_stack(stack, &aux, resolve, data);
+}
+
+yy_token_t yy_eval_string(const char *begin, const char *end, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+{
+    yy_error_e rc = yy_compile_string(begin, end, stack, NULL);
+
+    if (rc != YY_OK)
+        return token_error(rc);
+
+    uint32_t reserved = stack->reserved - stack->len;
+    yy_stack_t aux = {.data = stack->data + stack->len, .reserved = reserved, .len = 0};
+
+    return yy_eval_stack(stack, &aux, resolve, data);
+}
+
+yy_token_t yy_eval_bool(const char *begin, const char *end, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+{
+    yy_error_e rc = yy_compile_bool(begin, end, stack, NULL);
+
+    if (rc != YY_OK)
+        return token_error(rc);
+
+    uint32_t reserved = stack->reserved - stack->len;
+    yy_stack_t aux = {.data = stack->data + stack->len, .reserved = reserved, .len = 0};
+
+    return yy_eval_stack(stack, &aux, resolve, data);
+}
+
+yy_token_t yy_eval(const char *begin, const char *end, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+{
+    yy_error_e rc = yy_compile(begin, end, stack, NULL);
+
+    if (rc != YY_OK)
+        return token_error(rc);
+
+    uint32_t reserved = stack->reserved - stack->len;
+    yy_stack_t aux = {.data = stack->data + stack->len, .reserved = reserved, .len = 0};
+
+    return yy_eval_stack(stack, &aux, resolve, data);
+}
+
+/*
+ * Compiled expressions cache.
+ *
+ * The caller memory is split in shards (array of yy_cache_shard_t),
+ * entries (num_shards x num_entries yy_cache_entry_t), hash indexes
+ * (num_shards x 2 x num_entries positions) and slots (one per entry,
+ * max_tokens tokens followed by max_chars chars). Each slot owns the
+ * compiled stack, the expression text (the key) and the strings
+ * referenced by the stack.
+ *
+ * Each shard has an open addressing index (linear probing, at most half
+ * full) and a doubly linked list of its entries, from the most recently
+ * used to the least recently used (unassigned entries are at the end).
+ * Entries in use by an evaluation are pinned (num_users > 0) and can't
+ * be evicted.
+ */
+
+#define CACHE_NONE          UINT32_MAX
+
+typedef struct yy_cache_entry_t
+{
+    uint64_t hash;                  //!< Hash of the text and type.
+    yy_token_t *tokens;             //!< Compiled stack (slot).
+    char *chars;                    //!< Text followed by the stack strings (slot).
+    uint32_t num_tokens;            //!< Stack length.
+    uint32_t text_len;              //!< Text length.
+    uint32_t num_users;             //!< Evaluations in progress.
+    uint32_t prev;                  //!< Previous entry in the LRU list (more recently used).
+    uint32_t next;                  //!< Next entry in the LRU list (less recently used).
+    yy_error_e rc;                  //!< Compilation result.
+    yy_token_e type;                //!< Requested type.
+    bool used;                      //!< Entry assigned.
+} yy_cache_entry_t;
+
+typedef struct yy_cache_shard_t
+{
+#ifdef USE_THREADS
+    pthread_mutex_t mutex;          //!< Protects the shard entries and counters.
+#endif
+    yy_cache_entry_t *entries;      //!< Shard entries.
+    uint32_t *index;                //!< Hash index (entry positions, CACHE_NONE = empty).
+    uint32_t head;                  //!< Most recently used entry.
+    uint32_t tail;                  //!< Least recently used entry.
+    uint32_t num_used;              //!< Number of assigned entries.
+    uint64_t hits;                  //!< Evaluations using a cached entry.
+    uint64_t misses;                //!< Evaluations compiling the text.
+    uint64_t evictions;             //!< Entries replaced.
+} yy_cache_shard_t;
+
+#define CACHE_ALIGN(n_)     (((n_) + 15U) & ~(size_t) 15U)
+
+INLINE
+static void lock_shard(yy_cache_shard_t *shard)
+{
+#ifdef USE_THREADS
+    pthread_mutex_lock(&shard->mutex);
+#else
+    UNUSED(shard);
+#endif
+}
+
+INLINE
+static void unlock_shard(yy_cache_shard_t *shard)
+{
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&shard->mutex);
+#else
+    UNUSED(shard);
+#endif
+}
+
+// FNV-1a hash
+static uint64_t hash_text(const char *str, uint32_t len, yy_token_e type)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) str[i];
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= (uint64_t) type;
+    hash *= 1099511628211ULL;
+
+    return hash;
+}
+
+// first index position of a hash (shard selected by the low part)
+INLINE
+static uint32_t get_index_home(const yy_cache_t *cache, uint64_t hash)
+{
+    return (uint32_t)((hash / cache->num_shards) % (2 * (uint64_t) cache->num_entries));
+}
+
+static yy_cache_entry_t * find_entry(const yy_cache_t *cache, yy_cache_shard_t *shard, uint64_t hash, const char *str, uint32_t len, yy_token_e type)
+{
+    uint32_t size = 2 * cache->num_entries;
+
+    for (uint32_t pos = get_index_home(cache, hash); shard->index[pos] != CACHE_NONE; pos = (pos + 1) % size)
+    {
+        yy_cache_entry_t *entry = &shard->entries[shard->index[pos]];
+
+        if (entry->hash == hash && entry->type == type && entry->text_len == len && memcmp(entry->chars, str, len) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
 
-    init_parser(&parser, begin, end, stack);
-    parse_expr_number(&parser);
-    finalize(&parser);
+static void index_insert(const yy_cache_t *cache, yy_cache_shard_t *shard, uint32_t idx)
+{
+    uint32_t size = 2 * cache->num_entries;
+    uint32_t pos = get_index_home(cache, shard->entries[idx].hash);
 
-    if (err && parser.error != YY_OK)
-        *err = parser.curr;
+    while (shard->index[pos] != CACHE_NONE)
+        pos = (pos + 1) % size;
 
-    return parser.error;
+    shard->index[pos] = idx;
 }
 
-yy_error_e yy_compile_datetime(const char *begin, const char *end, yy_stack_t *stack, const char **err)
+// backward shift deletion (no tombstones)
+static void index_remove(const yy_cache_t *cache, yy_cache_shard_t *shard, uint32_t idx)
 {
-    if (!begin || !end || begin > end || !stack || !stack->data)
-        return YY_ERROR;
+    uint32_t size = 2 * cache->num_entries;
+    uint32_t pos = get_index_home(cache, shard->entries[idx].hash);
 
-    yy_parser_t parser;
+    while (shard->index[pos] != idx)
+        pos = (pos + 1) % size;
 
-    init_parser(&parser, begin, end, stack);
-    parse_expr_datetime(&parser);
-    finalize(&parser);
+    for (uint32_t next = (pos + 1) % size; shard->index[next] != CACHE_NONE; next = (next + 1) % size)
+    {
+        uint32_t home = get_index_home(cache, shard->entries[shard->index[next]].hash);
 
-    if (err && parser.error != YY_OK)
-        *err = parser.curr;
+        // element can't move before its home position
+        if ((next > pos && (home <= pos || home > next)) || (next < pos && home <= pos && home > next)) {
+            shard->index[pos] = shard->index[next];
+            pos = next;
+        }
+    }
 
-    return parser.error;
+    shard->index[pos] = CACHE_NONE;
 }
 
-yy_error_e yy_compile_string(const char *begin, const char *end, yy_stack_t *stack, const char **err)
+static void lru_unlink(yy_cache_shard_t *shard, uint32_t idx)
 {
-    if (!begin || !end || begin > end || !stack || !stack->data)
-        return YY_ERROR;
-
-    yy_parser_t parser;
-
-    init_parser(&parser, begin, end, stack);
-    parse_expr_string(&parser);
-    finalize(&parser);
+    yy_cache_entry_t *entry = &shard->entries[idx];
 
-    if (err && parser.error != YY_OK)
-        *err = parser.curr;
+    if (entry->prev != CACHE_NONE)
+        shard->entries[entry->prev].next = entry->next;
+    else
+        shard->head = entry->next;
 
-    return parser.error;
+    if (entry->next != CACHE_NONE)
+        shard->entries[entry->next].prev = entry->prev;
+    else
+        shard->tail = entry->prev;
 }
 
-yy_error_e yy_compile_bool(const char *begin, const char *end, yy_stack_t *stack, const char **err)
+static void lru_push_front(yy_cache_shard_t *shard, uint32_t idx)
 {
-    if (!begin || !end || begin > end || !stack || !stack->data)
-        return YY_ERROR;
-
-    yy_parser_t parser;
+    yy_cache_entry_t *entry = &shard->entries[idx];
 
-    init_parser(&parser, begin, end, stack);
-    parse_expr_bool(&parser);
-    finalize(&parser);
+    entry->prev = CACHE_NONE;
+    entry->next = shard->head;
 
-    if (err && parser.error != YY_OK)
-        *err = parser.curr;
+    if (shard->head != CACHE_NONE)
+        shard->entries[shard->head].prev = idx;
+    else
+        shard->tail = idx;
 
-    return parser.error;
+    shard->head = idx;
 }
 
-yy_error_e yy_compile(const char *begin, const char *end, yy_stack_t *stack, const char **err)
+static void lru_push_back(yy_cache_shard_t *shard, uint32_t idx)
 {
-    if (!begin || !end || begin > end || !stack || !stack->data)
-        return YY_ERROR;
+    yy_cache_entry_t *entry = &shard->entries[idx];
 
-    yy_parser_t parser;
+    entry->prev = shard->tail;
+    entry->next = CACHE_NONE;
 
-    init_parser(&parser, begin, end, stack);
-    parse_expr_generic(&parser, true, true);
+    if (shard->tail != CACHE_NONE)
+        shard->entries[shard->tail].next = idx;
+    else
+        shard->head = idx;
 
-    if (err && parser.error != YY_OK)
-        *err = parser.curr;
+    shard->tail = idx;
+}
 
-    return parser.error;
+// least recently used entry not pinned (only pinned entries are skipped)
+static uint32_t find_victim(yy_cache_shard_t *shard)
+{
+    uint32_t idx = shard->tail;
+
+    while (idx != CACHE_NONE && shard->entries[idx].num_users > 0)
+        idx = shard->entries[idx].prev;
+
+    return idx;
 }
 
+// strings not pointing to the text were computed at compile time (end of the stack memory)
 INLINE
-static yy_token_t eval_func(yy_func_t func, yy_eval_ctx_t *ctx)
+static bool is_text_str(const yy_token_t *token, const char *str, uint32_t len)
 {
-    yy_stack_t *stack = ctx->stack;
+    return (str <= token->str_val.ptr && token->str_val.ptr + token->str_val.len <= str + len);
+}
 
-    if (!func.ptr) 
-        return token_error(YY_ERROR_EVAL);
+/**
+ * Checks if a compilation result fits in a slot.
+ * 
+ * A failed compilation only stores the text. A compiled stack also
+ * stores its tokens and the strings computed at compile time.
+ */
+static bool is_entry_fitting(const yy_cache_t *cache, const char *str, uint32_t len, const yy_stack_t *stack, yy_error_e rc)
+{
+    uint64_t num_chars = len;
+
+    if (len > cache->max_chars)
+        return false;
+
+    if (rc != YY_OK)
+        return true;
 
-    switch (func.num_args)
+    if (stack->len > cache->max_tokens)
+        return false;
+
+    for (uint32_t i = 0; i < stack->len; i++)
     {
-        case 0:
-        {
-            if (func.is_not_pure)
-                return ((yy_func_0_x) func.ptr)(ctx);
-            else
-                return ((yy_func_0) func.ptr)();
-        }
+        const yy_token_t *token = &stack->data[i];
 
-        case 1:
-        {
-            yy_token_t *token1 = get(stack, 0);
+        if ((token->type == YY_TOKEN_STRING || token->type == YY_TOKEN_VARIABLE) && token->str_val.ptr && !is_text_str(token, str, len))
+            num_chars += token->str_val.len;
+    }
 
-            if (func.is_not_pure)
-                return ((yy_func_1_x) func.ptr)(*token1, ctx);
-            else
-                return ((yy_func_1) func.ptr)(*token1);
-        }
+    return (num_chars <= cache->max_chars);
+}
 
-        case 2:
-        {
-            yy_token_t *token1 = get(stack, 0);
-            yy_token_t *token2 = get(stack, 1);
+/**
+ * Copies a compiled stack to an entry (the entry owns the text and strings).
+ * The stack must fit in the slot (see is_entry_fitting).
+ */
+static void fill_entry(yy_cache_entry_t *entry, const char *str, uint32_t len, const yy_stack_t *stack)
+{
+    uint32_t num_chars = len;
 
-            if (func.is_not_pure)
-                return ((yy_func_2_x) func.ptr)(*token2, *token1, ctx);
-            else
-                return ((yy_func_2) func.ptr)(*token2, *token1);
-        }
+    memcpy(entry->chars, str, len);
 
-        case 3:
-        {
-            yy_token_t *token1 = get(stack, 0);
-            yy_token_t *token2 = get(stack, 1);
-            yy_token_t *token3 = get(stack, 2);
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        yy_token_t token = stack->data[i];
 
-            if (func.is_not_pure)
-                return ((yy_func_3_x) func.ptr)(*token3, *token2, *token1, ctx);
-            else
-                return ((yy_func_3) func.ptr)(*token3, *token2, *token1);
+        if ((token.type == YY_TOKEN_STRING || token.type == YY_TOKEN_VARIABLE) && token.str_val.ptr)
+        {
+            if (is_text_str(&token, str, len)) {
+                token.str_val.ptr = entry->chars + (token.str_val.ptr - str);
+            }
+            else {
+                memcpy(entry->chars + num_chars, token.str_val.ptr, token.str_val.len);
+                token.str_val.ptr = entry->chars + num_chars;
+                num_chars += token.str_val.len;
+            }
         }
 
-        default:
-            return token_error(YY_ERROR_EVAL);
+        entry->tokens[i] = token;
     }
+
+    entry->num_tokens = stack->len;
+    entry->text_len = len;
 }
 
-yy_token_t yy_eval_stack(const yy_stack_t *stack, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+yy_error_e yy_cache_init(yy_cache_t *cache, void *mem, size_t len, uint32_t num_shards, uint32_t max_tokens, uint32_t max_chars)
 {
-    if (!stack || !aux || !stack->data || !stack->len || !aux->data)
-        return token_error(YY_ERROR);
-
-    yy_eval_ctx_t ctx = {.stack = aux, .tmp_str = (char *) &aux->data[aux->reserved]};
-    yy_token_t tmp = {0};
-
-    aux->len = 0;
+    if (!cache || !mem || !num_shards || !max_tokens)
+        return YY_ERROR;
 
-    for (size_t i = 0; i < stack->len; i++)
-    {
-        switch (stack->data[i].type)
-        {
-            case YY_TOKEN_BOOL:
-            case YY_TOKEN_NUMBER:
-            case YY_TOKEN_DATETIME:
-            case YY_TOKEN_STRING:
-            {
-                if (aux->reserved <= aux->len)
-                    return token_error(YY_ERROR_MEM);
+    memset(cache, 0x00, sizeof(yy_cache_t));
 
-                aux->data[aux->len++] = stack->data[i];
-                break;
-            }
-            case YY_TOKEN_ERROR:
-            {
-                if (is_blocking_error(stack->data[i].error))
-                    return token_error(YY_ERROR_EVAL);
+    uintptr_t begin = CACHE_ALIGN((uintptr_t) mem);
+    uintptr_t end = (uintptr_t) mem + len;
+    size_t shards_size = CACHE_ALIGN(num_shards * sizeof(yy_cache_shard_t));
+    size_t entry_size = CACHE_ALIGN(sizeof(yy_cache_entry_t)) + 2 * sizeof(uint32_t) + max_tokens * sizeof(yy_token_t) + CACHE_ALIGN(max_chars);
 
-                aux->data[aux->len++] = stack->data[i];
-                break;
-            }
-            case YY_TOKEN_VARIABLE:
-            {
-                if (aux->reserved <= aux->len)
-                    return token_error(YY_ERROR_MEM);
+    // 16 = index alignment padding
+    if (end < begin || end - begin < shards_size + 16)
+        return YY_ERROR_MEM;
 
-                if (!resolve)
-                    return token_error(YY_ERROR_REF);
+    size_t num_entries = (end - begin - shards_size - 16) / num_shards / entry_size;
 
-                tmp = resolve(stack->data[i].variable, data);
-                if (tmp.type == YY_TOKEN_ERROR && is_blocking_error(tmp.error))
-                    return tmp;
+    if (num_entries == 0)
+        return YY_ERROR_MEM;
 
-                aux->data[aux->len++] = tmp;
-                break;
-            }
-            case YY_TOKEN_FUNCTION:
-            {
-                tmp = eval_func(stack->data[i].function, &ctx);
-                if (tmp.type == YY_TOKEN_ERROR && is_blocking_error(tmp.error))
-                    return tmp;
+    num_entries = MIN(num_entries, UINT32_MAX / 2 - 1);
 
-                // dealloc temp memory used by arguments
-                for (uint32_t j = 0; j < stack->data[i].function.num_args; j++)
-                {
-                    yy_token_t *arg = get(aux, j);
+    yy_cache_shard_t *shards = (yy_cache_shard_t *) begin;
+    yy_cache_entry_t *entries = (yy_cache_entry_t *)(begin + shards_size);
+    uint32_t *index = (uint32_t *)((uint8_t *) entries + CACHE_ALIGN(num_shards * num_entries * sizeof(yy_cache_entry_t)));
+    uint8_t *slots = (uint8_t *) index + CACHE_ALIGN(num_shards * 2 * num_entries * sizeof(uint32_t));
+    size_t slot_size = max_tokens * sizeof(yy_token_t) + CACHE_ALIGN(max_chars);
 
-                    if (!arg || arg->type != YY_TOKEN_STRING || !is_temp_ptr(&ctx, arg->str_val.ptr))
-                        continue;
+    memset(shards, 0x00, shards_size);
 
-                    if (tmp.type == YY_TOKEN_STRING && is_temp_ptr(&ctx, tmp.str_val.ptr))
-                    {
-                        if (tmp.str_val.ptr == arg->str_val.ptr)
-                            continue;
+    for (uint32_t i = 0; i < num_shards; i++)
+    {
+#ifdef USE_THREADS
+        if (pthread_mutex_init(&shards[i].mutex, NULL) != 0) {
+            while (i-- > 0)
+                pthread_mutex_destroy(&shards[i].mutex);
+            return YY_ERROR;
+        }
+#endif
 
-                        if (tmp.str_val.ptr < arg->str_val.ptr)
-                            tmp.str_val.ptr += arg->str_val.len;
-                    }
+        shards[i].entries = entries + i * num_entries;
+        shards[i].index = index + i * 2 * num_entries;
+        shards[i].head = CACHE_NONE;
+        shards[i].tail = CACHE_NONE;
 
-                    free_str(&ctx, &arg->str_val);
-                }
+        memset(shards[i].index, 0xFF, 2 * num_entries * sizeof(uint32_t));
 
-                if (stack->data[i].function.num_args)
-                    aux->len -= stack->data[i].function.num_args;
-                else if (aux->reserved <= aux->len)
-                    return token_error(YY_ERROR_MEM);
+        for (uint32_t j = 0; j < num_entries; j++)
+        {
+            yy_cache_entry_t *entry = &shards[i].entries[j];
+            uint8_t *slot = slots + (i * num_entries + j) * slot_size;
 
-                aux->data[aux->len++] = tmp;
-                break;
-            }
-            default:
-                return token_error(YY_ERROR_EVAL);
+            memset(entry, 0x00, sizeof(yy_cache_entry_t));
+            entry->tokens = (yy_token_t *) slot;
+            entry->chars = (char *)(slot + max_tokens * sizeof(yy_token_t));
+            lru_push_back(&shards[i], j);
         }
     }
 
-    if (aux->len != 1)
-        return token_error(YY_ERROR_EVAL);
-
-    assert (aux->data[0].type != YY_TOKEN_STRING || 
-            !is_temp_ptr(&ctx, aux->data[0].str_val.ptr) || 
-            (aux->data[0].str_val.ptr == ctx.tmp_str && ctx.tmp_str + aux->data[0].str_val.len == (char *) &aux->data[aux->reserved]));
+    cache->shards = shards;
+    cache->num_shards = num_shards;
+    cache->num_entries = (uint32_t) num_entries;
+    cache->max_tokens = max_tokens;
+    cache->max_chars = max_chars;
 
-    return aux->data[0];
+    return YY_OK;
 }
 
-yy_token_t yy_eval_number(const char *begin, const char *end, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+void yy_cache_destroy(yy_cache_t *cache)
 {
-    yy_error_e rc = yy_compile_number(begin, end, stack, NULL);
+    if (!cache || !cache->shards)
+        return;
 
-    if (rc != YY_OK)
-        return token_error(rc);
+#ifdef USE_THREADS
+    yy_cache_shard_t *shards = (yy_cache_shard_t *) cache->shards;
 
-    uint32_t reserved = stack->reserved - stack->len;
-    yy_stack_t aux = {.data = stack->data + stack->len, .reserved = reserved, .len = 0};
+    for (uint32_t i = 0; i < cache->num_shards; i++)
+        pthread_mutex_destroy(&shards[i].mutex);
+#endif
 
-    return yy_eval_stack(stack, &aux, resolve, data);
+    memset(cache, 0x00, sizeof(yy_cache_t));
 }
 
-yy_token_t yy_eval_datetime(const char *begin, const char *end, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+void yy_cache_stats(yy_cache_t *cache, yy_cache_stats_t *stats)
 {
-    yy_error_e rc = yy_compile_datetime(begin, end, stack, NULL);
+    if (!stats)
+        return;
 
-    if (rc != YY_OK)
-        return token_error(rc);
+    memset(stats, 0x00, sizeof(yy_cache_stats_t));
 
-    uint32_t reserved = stack->reserved - stack->len;
-    yy_stack_t aux = {.data = stack->data + stack->len, .reserved = reserved, .len = 0};
+    if (!cache || !cache->shards)
+        return;
 
-    return yy_eval_stack(stack, &aux, resolve, data);
+    yy_cache_shard_t *shards = (yy_cache_shard_t *) cache->shards;
+
+    for (uint32_t i = 0; i < cache->num_shards; i++)
+    {
+        lock_shard(&shards[i]);
+
+        stats->hits += shards[i].hits;
+        stats->misses += shards[i].misses;
+        stats->evictions += shards[i].evictions;
+        stats->num_entries += shards[i].num_used;
+
+        unlock_shard(&shards[i]);
+    }
 }
 
-yy_token_t yy_eval_string(const char *begin, const char *end, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
+yy_token_t yy_eval_cached(yy_cache_t *cache, const char *begin, const char *end, yy_token_e type, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
 {
-    yy_error_e rc = yy_compile_string(begin, end, stack, NULL);
+    yy_error_e (*compile)(const char *, const char *, yy_stack_t *, const char **) = NULL;
 
-    if (rc != YY_OK)
-        return token_error(rc);
+    switch (type)
+    {
+        case YY_TOKEN_NULL:     compile = yy_compile; break;
+        case YY_TOKEN_NUMBER:   compile = yy_compile_number; break;
+        case YY_TOKEN_DATETIME: compile = yy_compile_datetime; break;
+        case YY_TOKEN_STRING:   compile = yy_compile_string; break;
+        case YY_TOKEN_BOOL:     compile = yy_compile_bool; break;
+        default:                return token_error(YY_ERROR);
+    }
 
-    uint32_t reserved = stack->reserved - stack->len;
-    yy_stack_t aux = {.data = stack->data + stack->len, .reserved = reserved, .len = 0};
+    if (!cache || !cache->shards || !begin || !end || begin > end || end - begin > UINT32_MAX || !stack || !stack->data)
+        return token_error(YY_ERROR);
 
-    return yy_eval_stack(stack, &aux, resolve, data);
-}
+    uint32_t len = (uint32_t)(end - begin);
+    uint64_t hash = hash_text(begin, len, type);
+    yy_cache_shard_t *shard = (yy_cache_shard_t *) cache->shards + (hash % cache->num_shards);
+    yy_cache_entry_t *entry = NULL;
+    yy_token_t ret = {0};
 
-yy_token_t yy_eval_bool(const char *begin, const char *end, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
-{
-    yy_error_e rc = yy_compile_bool(begin, end, stack, NULL);
+    lock_shard(shard);
 
-    if (rc != YY_OK)
-        return token_error(rc);
+    if ((entry = find_entry(cache, shard, hash, begin, len, type)) != NULL) {
+        shard->hits++;
+        entry->num_users++;
+        lru_unlink(shard, (uint32_t)(entry - shard->entries));
+        lru_push_front(shard, (uint32_t)(entry - shard->entries));
+    }
+    else {
+        shard->misses++;
+    }
 
-    uint32_t reserved = stack->reserved - stack->len;
-    yy_stack_t aux = {.data = stack->data + stack->len, .reserved = reserved, .len = 0};
+    unlock_shard(shard);
 
-    return yy_eval_stack(stack, &aux, resolve, data);
-}
+    if (entry)
+    {
+        if (entry->rc != YY_OK) {
+            ret = token_error(entry->rc);
+        }
+        else {
+            yy_stack_t cached = {.data = entry->tokens, .reserved = entry->num_tokens, .len = entry->num_tokens};
+            yy_stack_t aux = {.data = stack->data, .reserved = stack->reserved, .len = 0};
 
-yy_token_t yy_eval(const char *begin, const char *end, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data)
-{
-    yy_error_e rc = yy_compile(begin, end, stack, NULL);
+            ret = yy_eval_stack(&cached, &aux, resolve, data);
+
+            // the entry can be evicted once released
+            if (ret.type == YY_TOKEN_STRING && entry->chars <= ret.str_val.ptr && ret.str_val.ptr < entry->chars + cache->max_chars)
+            {
+                char *ptr = (char *) &stack->data[stack->reserved] - ret.str_val.len;
+
+                if (ret.str_val.len > sizeof(yy_token_t) * (stack->reserved - 1))
+                    ret = token_error(YY_ERROR_MEM);
+                else
+                    ret.str_val.ptr = memmove(ptr, ret.str_val.ptr, ret.str_val.len);
+            }
+        }
+
+        lock_shard(shard);
+        entry->num_users--;
+        unlock_shard(shard);
+
+        return ret;
+    }
+
+    yy_error_e rc = compile(begin, end, stack, NULL);
+
+    // too large expressions are not cached (and don't evict other entries)
+    bool fits = is_entry_fitting(cache, begin, len, stack, rc);
+
+    lock_shard(shard);
+
+    uint32_t idx = CACHE_NONE;
+
+    // not inserted by another thread meanwhile, and some entry can be replaced
+    if (fits && !find_entry(cache, shard, hash, begin, len, type) && (idx = find_victim(shard)) != CACHE_NONE)
+    {
+        entry = &shard->entries[idx];
+
+        if (entry->used) {
+            index_remove(cache, shard, idx);
+            shard->evictions++;
+            shard->num_used--;
+        }
+
+        entry->used = true;
+        entry->hash = hash;
+        entry->type = type;
+        entry->rc = rc;
+        entry->num_tokens = 0;
+        entry->text_len = len;
+
+        if (rc != YY_OK)
+            memcpy(entry->chars, begin, len);
+        else
+            fill_entry(entry, begin, len, stack);
+
+        index_insert(cache, shard, idx);
+        lru_unlink(shard, idx);
+        lru_push_front(shard, idx);
+        shard->num_used++;
+    }
+
+    unlock_shard(shard);
 
     if (rc != YY_OK)
         return token_error(rc);
@@ -2984,8 +10626,6 @@ yy_token_t yy_parse(const char *begin, const char *end)
 // Expr functions implementation.
 // ==================================================
 
-#define UNUSED(x) (void)(x)
-
 // --- Functions returning a datetime
 
 static yy_token_t func_now(yy_eval_ctx_t *ctx)
@@ -3877,6 +11517,50 @@ static yy_token_t func_pow(yy_token_t x, yy_token_t y)
     return token_number(val);
 }
 
+/**
+ * Computes x^n using a multiplication chain (repeated squaring).
+ * Rounding may differ from pow() when |n| > 2.
+ */
+static double pow_int(double x, int n)
+{
+    unsigned int m = (n < 0 ? 0U - (unsigned int) n : (unsigned int) n);
+    double ret = 1.0;
+
+    while (m)
+    {
+        if (m & 1U)
+            ret *= x;
+
+        m >>= 1;
+
+        if (m)
+            x *= x;
+    }
+
+    return (n < 0 ? 1.0 / ret : ret);
+}
+
+// pow() restricted to small integer exponents (see simplify_node())
+static yy_token_t func_powi(yy_token_t x, yy_token_t n)
+{
+    if (x.type != YY_TOKEN_NUMBER || n.type != YY_TOKEN_NUMBER)
+        return token_error(YY_ERROR_VALUE);
+
+    if (n.number_val != trunc(n.number_val) || fabs(n.number_val) > MAX_POWI_EXP)
+        return token_number(pow(x.number_val, n.number_val));
+
+    return token_number(pow_int(x.number_val, (int) n.number_val));
+}
+
+// x * y + z with a single rounding (see simplify_node())
+static yy_token_t func_fma(yy_token_t x, yy_token_t y, yy_token_t z)
+{
+    if (x.type != YY_TOKEN_NUMBER || y.type != YY_TOKEN_NUMBER || z.type != YY_TOKEN_NUMBER)
+        return token_error(YY_ERROR_VALUE);
+
+    return token_number(fma(x.number_val, y.number_val, z.number_val));
+}
+
 // --- Functions returning a boolean
 
 static yy_token_t func_not(yy_token_t x)
@@ -4026,26 +11710,34 @@ static yy_token_t func_ne(yy_token_t x, yy_token_t y)
     return token_error(YY_ERROR_VALUE);
 }
 
+// y is not checked when x decides the result (short-circuit)
 static yy_token_t func_and(yy_token_t x, yy_token_t y)
 {
     if (x.type != YY_TOKEN_BOOL)
         return token_error(YY_ERROR_VALUE);
 
+    if (!x.bool_val)
+        return x;
+
     if (y.type != YY_TOKEN_BOOL)
         return token_error(YY_ERROR_VALUE);
 
-    return token_bool(x.bool_val && y.bool_val);
+    return y;
 }
 
+// y is not checked when x decides the result (short-circuit)
 static yy_token_t func_or(yy_token_t x, yy_token_t y)
 {
     if (x.type != YY_TOKEN_BOOL)
         return token_error(YY_ERROR_VALUE);
 
+    if (x.bool_val)
+        return x;
+
     if (y.type != YY_TOKEN_BOOL)
         return token_error(YY_ERROR_VALUE);
 
-    return token_bool(x.bool_val || y.bool_val);
+    return y;
 }
 
 // --- Functions returning a variable
@@ -4069,7 +11761,7 @@ static yy_token_t func_min(yy_token_t x, yy_token_t y)
 
     if (x.type == YY_TOKEN_NUMBER)
     {
-        double val = fmin(x.number_val, y.number_val);
+        double val = min_num(x.number_val, y.number_val);
         return token_number(val);
     }
 
@@ -4094,7 +11786,7 @@ static yy_token_t func_max(yy_token_t x, yy_token_t y)
 
     if (x.type == YY_TOKEN_NUMBER)
     {
-        double val = fmax(x.number_val, y.number_val);
+        double val = max_num(x.number_val, y.number_val);
         return token_number(val);
     }
 
@@ -4112,18 +11804,18 @@ static yy_token_t func_max(yy_token_t x, yy_token_t y)
     return token_error(YY_ERROR_VALUE);
 }
 
+// untaken branch is not checked (short-circuit)
 static yy_token_t func_ifelse(yy_token_t cond, yy_token_t x, yy_token_t y)
 {
     if (cond.type != YY_TOKEN_BOOL)
         return token_error(YY_ERROR_VALUE);
 
-    if (x.type != y.type)
-        return token_error(YY_ERROR_VALUE);
+    yy_token_t ret = (cond.bool_val ? x : y);
 
-    if (x.type != YY_TOKEN_NUMBER && x.type != YY_TOKEN_DATETIME && x.type != YY_TOKEN_STRING && x.type != YY_TOKEN_BOOL)
+    if (ret.type != YY_TOKEN_NUMBER && ret.type != YY_TOKEN_DATETIME && ret.type != YY_TOKEN_STRING && ret.type != YY_TOKEN_BOOL)
         return token_error(YY_ERROR_VALUE);
 
-    return (cond.bool_val ? x : y);
+    return ret;
 }
 
 static yy_token_t func_clamp(yy_token_t x, yy_token_t vmin, yy_token_t vmax)
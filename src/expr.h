@@ -30,6 +30,7 @@ SOFTWARE.
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #if defined(__GNUC__) || defined(__clang__) || defined(__INTEL_LLVM_COMPILER) 
     #define PACKED     __attribute__((__packed__))
@@ -52,6 +53,9 @@ typedef enum yy_token_e {
     YY_TOKEN_VARIABLE,              //!< Variable.
     YY_TOKEN_FUNCTION,              //!< Function.
     YY_TOKEN_ERROR,                 //!< Evaluation error.
+    YY_TOKEN_SLOT,                  //!< Bound variable (see yy_bind_stack).
+    YY_TOKEN_TEMP,                  //!< Temporary value (compiled stacks only, repeated subexpressions).
+    YY_TOKEN_JUMP,                  //!< Control token (compiled stacks only, jumps and temporaries).
 } yy_token_e;
 
 typedef enum yy_error_e {
@@ -66,6 +70,14 @@ typedef enum yy_error_e {
     YY_ERROR,                       //!< Generic error (ex. given stack is NULL).
 } yy_error_e;
 
+typedef enum yy_optimize_e {
+    YY_OPTIMIZE_REASSOCIATE = 1,    //!< Fold fixed values of sums and products (rounding may change).
+    YY_OPTIMIZE_ALGEBRAIC = 2,      //!< Strength reduction and identities changing rounding or signed zeros (ex: $x^3 -> $x*$x*$x).
+    YY_OPTIMIZE_FMA = 4,            //!< Fuse multiply-add (ex: $x*$y+$z -> fma($x,$y,$z)).
+    YY_OPTIMIZE_FAST_MATH = 7,      //!< All the above (omit it to get strict IEEE results).
+    YY_OPTIMIZE_FOLD_STRINGS = 8,   //!< Fold string functions on literals (ex: upper("abc")), reduces stack->reserved (see yy_optimize_stack).
+} yy_optimize_e;
+
 typedef struct PACKED yy_str_t {
     const char *ptr;                //!< Pointer to data (not NUL-ended).
     uint32_t len;                   //!< String length.
@@ -76,9 +88,16 @@ typedef struct PACKED yy_func_t {
     uint8_t num_args;               //!< Number of arguments.
     uint8_t precedence;             //!< Operator precedence (distinct than 0 means operator).
     uint8_t right_to_left : 1;      //!< Associativity (only for operators).
-    uint8_t is_not_pure : 1;        //!< Result depends not-only on arguments.
+    uint8_t is_not_pure : 1;        //!< Result depends not-only on arguments (ex: random, now).
+    uint8_t needs_ctx : 1;          //!< Requires the eval context (ex: creates temporary strings).
+    uint8_t opcode;                 //!< Evaluation opcode (internal use).
 } yy_func_t;
 
+typedef struct PACKED yy_jump_t {
+    uint32_t offset;                //!< Number of tokens to skip forward (or temporaries index/count).
+    uint8_t opcode;                 //!< Evaluation opcode (internal use).
+} yy_jump_t;
+
 typedef struct yy_token_t {
     union PACKED
     {
@@ -88,6 +107,9 @@ typedef struct yy_token_t {
         yy_str_t str_val;           //!< String value.
         yy_str_t variable;          //!< Variable name.
         yy_func_t function;         //!< Function data.
+        yy_jump_t jump;             //!< Jump data.
+        uint32_t slot;              //!< Bound variable index.
+        uint32_t temp;              //!< Temporary value index.
         yy_error_e error;           //!< Error type.
     };
     yy_token_e type;                //!< Token type (bool, number, etc.).
@@ -99,6 +121,120 @@ typedef struct yy_stack_t {
     uint32_t len;                   //!< Number of tokens in the stack.
 } yy_stack_t;
 
+typedef struct yy_column_t {
+    yy_str_t name;                  //!< Variable name.
+    const yy_token_t *values;       //!< Variable values (one per row).
+} yy_column_t;
+
+typedef struct yy_profile_t {
+    uint32_t *counts;               //!< Short-circuit counters (2 per stack token, initially 0).
+    uint32_t reserved;              //!< Number of allocated counters.
+    uint32_t period;                //!< Evaluations between reorderings (0 = never).
+    uint32_t num_evals;             //!< Evaluations since the last reordering.
+} yy_profile_t;
+
+typedef struct yy_skip_t {
+    uint32_t offset;                //!< Tokens to skip when the token evaluates to an error (0 = none).
+    uint32_t num_values;            //!< Values dropped from the evaluation stack when skipping.
+} yy_skip_t;
+
+typedef struct PACKED yy_instr_t {
+    uint8_t opcode;                 //!< Evaluation opcode (internal use).
+    uint8_t dst;                    //!< Destination register.
+    uint8_t num_args;               //!< Number of operands.
+    uint8_t is_token;               //!< Operand kinds (bit k set = operand k is a token position, otherwise a register).
+    uint32_t args[3];               //!< Operands (register or token position).
+    uint32_t pos;                   //!< Function token position, or target instruction (jumps).
+} yy_instr_t;
+
+typedef struct yy_program_t {
+    yy_instr_t *code;               //!< Instructions list.
+    uint32_t reserved;              //!< Number of allocated instructions.
+    uint32_t len;                   //!< Number of instructions.
+    uint32_t num_regs;              //!< Number of registers (aux tokens required to evaluate).
+    uint32_t result;                //!< Register holding the result.
+    const yy_token_t *tokens;       //!< Compiled stack tokens (constants, variables and functions).
+} yy_program_t;
+
+typedef uint64_t yy_box_t;
+
+typedef struct yy_boxed_t {
+    yy_box_t *data;                 //!< Boxed tokens list.
+    uint32_t reserved;              //!< Numbers of allocated boxes.
+    uint32_t len;                   //!< Number of boxes.
+    const yy_token_t *tokens;       //!< Original tokens (referenced by variables and strings).
+} yy_boxed_t;
+
+typedef struct yy_bytecode_t {
+    uint8_t *code;                  //!< Instructions (1-2 byte opcode followed by a varint operand).
+    uint64_t *consts;               //!< Constants pool (numbers and datetimes).
+    char *strs;                     //!< Strings pool (literals and variable names, prefixed by its varint length).
+    uint32_t code_reserved;         //!< Number of allocated code bytes.
+    uint32_t code_len;              //!< Number of code bytes.
+    uint32_t consts_reserved;       //!< Number of allocated constants.
+    uint32_t num_consts;            //!< Number of constants.
+    uint32_t strs_reserved;         //!< Number of allocated string bytes.
+    uint32_t strs_len;              //!< Number of string bytes.
+} yy_bytecode_t;
+
+typedef struct yy_image_t {
+    uint8_t *data;                  //!< Image bytes (8-byte aligned, allocated by caller).
+    uint32_t reserved;              //!< Number of allocated bytes.
+    uint32_t len;                   //!< Image size (bytes).
+} yy_image_t;
+
+typedef struct yy_jit_t {
+    void *code;                     //!< Native code (NULL = evaluated by the interpreter).
+    uint32_t size;                  //!< Size of the code mapping (bytes).
+    uint32_t max_depth;             //!< Number of aux tokens required to evaluate.
+    uint32_t result;                //!< Aux token holding the result.
+    const yy_stack_t *stack;        //!< Compiled stack (variable names and fallback).
+} yy_jit_t;
+
+typedef struct yy_rule_t {
+    const char *name;               //!< Rule name.
+    yy_token_t (*eval)(yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data); //!< Generated function (see yy_generate_c).
+} yy_rule_t;
+
+typedef struct yy_rules_t {
+    void *handle;                   //!< Shared object handle.
+    const yy_rule_t *data;          //!< Rules list.
+    uint32_t len;                   //!< Number of rules.
+} yy_rules_t;
+
+typedef struct yy_fingerprint_t {
+    uint64_t hi;                    //!< High 64 bits.
+    uint64_t lo;                    //!< Low 64 bits.
+} yy_fingerprint_t;
+
+typedef struct yy_cache_t {
+    void *shards;                   //!< Shards (internal, in the memory given to yy_cache_init).
+    uint32_t num_shards;            //!< Number of shards (each one with its own lock).
+    uint32_t num_entries;           //!< Number of entries per shard.
+    uint32_t max_tokens;            //!< Max length of a cached stack.
+    uint32_t max_chars;             //!< Max length of the text plus strings of a cached stack.
+} yy_cache_t;
+
+typedef struct yy_cache_stats_t {
+    uint64_t hits;                  //!< Evaluations using a cached expression.
+    uint64_t misses;                //!< Evaluations compiling the expression.
+    uint64_t evictions;             //!< Cached expressions replaced by another one.
+    uint32_t num_entries;           //!< Number of cached expressions.
+} yy_cache_stats_t;
+
+typedef struct yy_range_t {
+    yy_token_e type;                //!< Type of the non-error values (YY_TOKEN_NULL = any, YY_TOKEN_ERROR = always an error).
+    double min;                     //!< Lower bound of numbers (bools: 0=false, 1=true).
+    double max;                     //!< Upper bound of numbers (bools: 0=false, 1=true).
+    bool maybe_nan;                 //!< Number can be NaN.
+    bool maybe_error;               //!< Value can be an error.
+} yy_range_t;
+
+typedef struct yy_domain_t {
+    yy_str_t name;                  //!< Variable name.
+    yy_range_t range;               //!< Variable values.
+} yy_domain_t;
+
 /**
  * Evaluate an expression.
  * 
@@ -117,6 +253,66 @@ yy_token_t yy_eval_string(const char *begin, const char *end, yy_stack_t *stack,
 yy_token_t yy_eval_bool(const char *begin, const char *end, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data);
 yy_token_t yy_eval(const char *begin, const char *end, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data);
 
+/**
+ * Initialize a cache of compiled expressions.
+ * 
+ * The cache doesn't allocate memory, it uses the given memory block
+ * (shards, entries, hash indexes and the compiled stacks). The number
+ * of entries per shard is deduced from the memory length. When compiled
+ * with WITH_THREADS (and linked with -pthread) each shard has its own
+ * lock, and the cache can be shared by multiple threads.
+ * 
+ * @param[out] cache Cache to initialize.
+ * @param[in] mem Memory used by the cache (must outlive the cache).
+ * @param[in] len Memory length (in bytes).
+ * @param[in] num_shards Number of shards (> 0).
+ * @param[in] max_tokens Expressions compiled in more tokens are not cached (> 0).
+ * @param[in] max_chars Expressions whose text plus strings exceed this length are not cached.
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_MEM if there is not room for one entry per shard,
+ *         YY_ERROR on invalid arguments.
+ */
+yy_error_e yy_cache_init(yy_cache_t *cache, void *mem, size_t len, uint32_t num_shards, uint32_t max_tokens, uint32_t max_chars);
+
+/**
+ * Release the cache resources (memory is owned by the caller).
+ * 
+ * @param[in] cache Cache to destroy (no evaluations in progress).
+ */
+void yy_cache_destroy(yy_cache_t *cache);
+
+/**
+ * Evaluate an expression reusing the compiled stack when cached.
+ * 
+ * The key is the expression text and the requested type. On miss the
+ * expression is compiled (like yy_eval_xxx) and added to the cache 
+ * replacing the least recently used entry of its shard. Compilation
+ * errors are cached too.
+ * 
+ * String results are stored at the end of the stack memory.
+ * 
+ * @param[in] cache Cache of compiled expressions.
+ * @param[in] begin String to parse.
+ * @param[in] end One char after the string end.
+ * @param[in] type Result type (YY_TOKEN_NULL = any, YY_TOKEN_NUMBER, YY_TOKEN_DATETIME, YY_TOKEN_STRING or YY_TOKEN_BOOL).
+ * @param[in] stack Auxiliar memory used to compile and evaluate.
+ * @param[in] resolve Function used to resolve variables (can be NULL if there are no variables).
+ * @param[in] data Data passed to the 'resolve' function.
+ * 
+ * @return Result as token, 
+ *         on error type=YY_TOKEN_ERROR and error contains the error detail.
+ */
+yy_token_t yy_eval_cached(yy_cache_t *cache, const char *begin, const char *end, yy_token_e type, yy_stack_t *stack, yy_token_t (*resolve)(yy_str_t var, void *data), void *data);
+
+/**
+ * Get the cache counters.
+ * 
+ * @param[in] cache Cache of compiled expressions.
+ * @param[out] stats Aggregated counters of all shards.
+ */
+void yy_cache_stats(yy_cache_t *cache, yy_cache_stats_t *stats);
+
 /**
  * Compile an expression.
  * 
@@ -139,6 +335,101 @@ yy_error_e yy_compile_string(const char *begin, const char *end, yy_stack_t *sta
 yy_error_e yy_compile_bool(const char *begin, const char *end, yy_stack_t *stack, const char **err);
 yy_error_e yy_compile(const char *begin, const char *end, yy_stack_t *stack, const char **err);
 
+/**
+ * Optimize a compiled stack using rewrites that may change the result.
+ * 
+ * Exact rewrites are always done by yy_compile*(). This function 
+ * compiles the stack again applying the requested rewrites too.
+ * Flags = 0 gives the same stack than yy_compile*().
+ * 
+ * With YY_OPTIMIZE_FOLD_STRINGS the strings computed while folding are 
+ * stored at the end of the stack memory and stack->reserved is reduced 
+ * to protect them. Keep the stack memory while the stack is in use, and 
+ * restore stack->reserved before reusing the memory.
+ * 
+ * @param[in,out] stack Compiled stack.
+ * @param[in] flags Optimizations to apply (ORed yy_optimize_e values).
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_MEM if there is not enough room (stack unchanged),
+ *         YY_ERROR_EVAL if the stack is corrupted,
+ *         YY_ERROR on invalid arguments.
+ */
+yy_error_e yy_optimize_stack(yy_stack_t *stack, uint32_t flags);
+
+/**
+ * Specialize a compiled stack against a subset of known variables.
+ * 
+ * Known variables are replaced by their value, and the subexpressions 
+ * becoming fixed are folded (partial evaluation). Variables resolved to 
+ * YY_ERROR_REF (or to a blocking error) are kept and resolved at eval time.
+ * Use it to evaluate many times an expression having parameters fixed 
+ * in advance (ex: per-tenant configuration).
+ * 
+ * Caution, strings on the output stack can point to the input stack and 
+ * to the values returned by resolve. Keep them while output is used.
+ * Compile-time strings are stored at the end of the output memory 
+ * (see yy_compile).
+ * 
+ * @param[in] stack Compiled stack.
+ * @param[out] output Specialized stack (can share memory with stack).
+ * @param[in] resolve Function used to resolve the known variables.
+ * @param[in] data Data passed to the 'resolve' function.
+ * @param[in] flags Optimizations to apply (ORed yy_optimize_e values).
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_MEM if there is not enough room in output,
+ *         YY_ERROR_EVAL if the stack is corrupted,
+ *         YY_ERROR on invalid arguments.
+ */
+yy_error_e yy_partial_eval_stack(const yy_stack_t *stack, yy_stack_t *output, yy_token_t (*resolve)(yy_str_t var, void *data), void *data, uint32_t flags);
+
+/**
+ * Rewrites a compiled stack in canonical form.
+ * 
+ * Equivalent expressions differing in spacing, parentheses, aliases 
+ * (ex: True/true, pow($x,2)/$x^2) or in the operands order of the 
+ * commutative functions (+, *, ==, !=) give the same stack. min() and
+ * max() operands are not sorted (the sign of a zero result depends on
+ * their order).
+ * 
+ * The canonical stack computes the same value than the original one,
+ * except that:
+ *   - the reported error can differ when several operands have an error.
+ *   - variables can be resolved in a different order (resolve callbacks
+ *     having side effects can observe it).
+ * 
+ * Output tokens point to the same strings than the input stack.
+ * Output can be the input stack.
+ * 
+ * @param[in] stack Compiled stack.
+ * @param[out] output Canonical stack.
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_MEM if output has not enough room,
+ *         YY_ERROR_EVAL if the stack is corrupted,
+ *         YY_ERROR on invalid arguments.
+ */
+yy_error_e yy_canonicalize_stack(const yy_stack_t *stack, yy_stack_t *output);
+
+/**
+ * Computes a 128-bit fingerprint of a compiled stack.
+ * 
+ * Tokens are hashed by value (strings and variables by content, functions 
+ * by symbol), so the fingerprint doesn't depend on the memory location and 
+ * it is stable across processes and platforms using the same library version.
+ * Canonicalize the stack before to get equal fingerprints for equivalent 
+ * expressions (see yy_canonicalize_stack).
+ * 
+ * @param[in] stack Compiled stack.
+ * @param[out] fingerprint Stack fingerprint (FNV-1a 128).
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_EVAL if the stack contains unknown tokens,
+ *         YY_ERROR on invalid arguments.
+ */
+yy_error_e yy_fingerprint_stack(const yy_stack_t *stack, yy_fingerprint_t *fingerprint);
+
 /**
  * Evaluate an rpn stack.
  * 
@@ -152,6 +443,504 @@ yy_error_e yy_compile(const char *begin, const char *end, yy_stack_t *stack, con
  */
 yy_token_t yy_eval_stack(const yy_stack_t *stack, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data);
 
+/**
+ * Evaluate an rpn stack resolving each variable once.
+ * 
+ * Resolved values are stored at the head of aux and reused by the 
+ * next occurrences of the same variable. Use it when resolve is 
+ * expensive and variables appear several times in the expression.
+ * 
+ * @param[in] stack Reverse polish notation (rpn) stack.
+ * @param[in] aux Memory used to evaluate the stack (to store intermediate and resolved values).
+ * @param[in] resolve Function used to resolve variables (can be NULL if there are no variables).
+ * @param[in] data Data passed to the 'resolve' function.
+ * 
+ * @return Result as token, 
+ *         on error type=YY_TOKEN_ERROR and error contains the error detail.
+ */
+yy_token_t yy_eval_stack_memo(const yy_stack_t *stack, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data);
+
+/**
+ * Evaluate an rpn stack reordering the operands of && and || chains.
+ * 
+ * Counts how often each operand decides the result (false on &&, true 
+ * on ||). Every profile->period evaluations, the operands of each chain 
+ * are sorted by cost divided by the probability of deciding the result, 
+ * and the counters are reset. The cost is estimated from the operand 
+ * tokens (variables and function calls weigh more than operators).
+ * Use it when conditions are written in business order, not cost order.
+ * 
+ * Caution, results involving errors can change (ex: $u && false 
+ * can become false && $u). Chains containing shared subexpressions 
+ * are not reordered.
+ * 
+ * @param[in,out] stack Compiled stack (reordered periodically).
+ * @param[in] aux Memory used to evaluate the stack (to store intermediate values).
+ * @param[in] resolve Function used to resolve variables (can be NULL if there are no variables).
+ * @param[in] data Data passed to the 'resolve' function.
+ * @param[in,out] profile Counters (at least 2 per stack token).
+ * 
+ * @return Result as token, 
+ *         on error type=YY_TOKEN_ERROR and error contains the error detail.
+ */
+yy_token_t yy_eval_stack_adaptive(yy_stack_t *stack, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data, yy_profile_t *profile);
+
+/**
+ * Compute the fast-fail skips of an rpn stack.
+ * 
+ * For each token, locates the outermost enclosing function that would 
+ * return YY_ERROR_VALUE if the token evaluates to an error. Functions 
+ * observing errors (iserror, str, &&, ||, ifelse) stop the search, as 
+ * do shared subexpressions (temporaries must be stored) and skipped 
+ * functions creating strings (they can return a blocking error).
+ * 
+ * Recompute the skips every time the stack changes.
+ * 
+ * @param[in] stack Compiled stack.
+ * @param[out] skips Skips (one per stack token).
+ * @param[in] len Number of allocated skips.
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_MEM if there are not enough skips,
+ *         YY_ERROR_EVAL if the stack is corrupted.
+ */
+yy_error_e yy_compute_skips(const yy_stack_t *stack, yy_skip_t *skips, uint32_t len);
+
+/**
+ * Evaluate an rpn stack skipping the tokens made useless by an error.
+ * 
+ * When a token evaluates to a non-blocking error (ex. YY_ERROR_REF from 
+ * a missing variable) the evaluation continues after the enclosing 
+ * functions that would only propagate it (see yy_compute_skips). 
+ * Use it when a significant fraction of the data has missing values.
+ * 
+ * Gives the same result than yy_eval_stack(), except that skipped 
+ * variables are not resolved (blocking errors they would return are 
+ * not reported). Functions that can return a blocking error (those 
+ * creating strings, ex: str) are never skipped.
+ * 
+ * @param[in] stack Reverse polish notation (rpn) stack.
+ * @param[in] aux Memory used to evaluate the stack (to store intermediate values).
+ * @param[in] resolve Function used to resolve variables (can be NULL if there are no variables).
+ * @param[in] data Data passed to the 'resolve' function.
+ * @param[in] skips Skips of the stack (see yy_compute_skips).
+ * 
+ * @return Result as token, 
+ *         on error type=YY_TOKEN_ERROR and error contains the error detail.
+ */
+yy_token_t yy_eval_stack_fast_fail(const yy_stack_t *stack, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data, const yy_skip_t *skips);
+
+/**
+ * Bind the variables of an rpn stack to slots.
+ * 
+ * Each distinct variable name is replaced by a slot index (0, 1, 2, ...)
+ * in order of appearance. Bound stacks are evaluated using an array of 
+ * values indexed by slot (see yy_eval_stack_slots), avoiding the name 
+ * lookup on each evaluation.
+ * 
+ * Caution, names point to the str input (like the variables on the stack).
+ * 
+ * @param[in,out] stack Reverse polish notation (rpn) stack.
+ * @param[out] names Variable name of each slot.
+ * @param[in] max_names Number of allocated names.
+ * @param[out] num_names Number of slots.
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_MEM if there are more than max_names variables (stack unchanged).
+ */
+yy_error_e yy_bind_stack(yy_stack_t *stack, yy_str_t *names, uint32_t max_names, uint32_t *num_names);
+
+/**
+ * Evaluate a bound rpn stack.
+ * 
+ * Slots out of range are evaluated as YY_ERROR_REF. Unbound variables 
+ * are evaluated as YY_ERROR_REF.
+ * 
+ * @param[in] stack Reverse polish notation (rpn) stack (see yy_bind_stack).
+ * @param[in] aux Memory used to evaluate the stack (to store intermediate values).
+ * @param[in] slots Variable values indexed by slot (can be NULL if there are no variables).
+ * @param[in] num_slots Number of slots.
+ * 
+ * @return Result as token, 
+ *         on error type=YY_TOKEN_ERROR and error contains the error detail.
+ */
+yy_token_t yy_eval_stack_slots(const yy_stack_t *stack, yy_stack_t *aux, const yy_token_t *slots, uint32_t num_slots);
+
+/**
+ * Compile an rpn stack to register-based bytecode.
+ * 
+ * Each function becomes a three-address instruction reading its operands 
+ * from registers or directly from the stack (constants and variables), 
+ * so intermediate values are not pushed and popped. Registers are 
+ * allocated following the stack depth (at most 256 registers).
+ * Use it on expressions evaluated many times (ex. deep arithmetic).
+ * 
+ * Caution, the program references the stack tokens (the stack must 
+ * remain unchanged while the program is used).
+ * 
+ * @param[in] stack Compiled stack.
+ * @param[out] program Program to fill (code allocated by caller, 
+ *             2 instructions per stack token are always enough).
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_MEM if there are not enough instructions,
+ *         YY_ERROR_EXCD if more than 256 registers are required,
+ *         YY_ERROR_EVAL if the stack is corrupted.
+ */
+yy_error_e yy_compile_program(const yy_stack_t *stack, yy_program_t *program);
+
+/**
+ * Evaluate a register-based program.
+ * 
+ * Gives the same result than yy_eval_stack() on the compiled stack.
+ * 
+ * @param[in] program Program to evaluate (see yy_compile_program).
+ * @param[in] aux Memory used to evaluate the program (registers and 
+ *            intermediate strings, at least program->num_regs tokens).
+ * @param[in] resolve Function used to resolve variables (can be NULL if there are no variables).
+ * @param[in] data Data passed to the 'resolve' function.
+ * 
+ * @return Result as token, 
+ *         on error type=YY_TOKEN_ERROR and error contains the error detail.
+ */
+yy_token_t yy_eval_program(const yy_program_t *program, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data);
+
+/**
+ * Convert an rpn stack to the compact 8-byte format (NaN-boxing).
+ * 
+ * Numbers are stored as doubles, the remaining tokens are encoded in 
+ * the payload of a NaN (bools, datetimes, errors, functions, jumps). 
+ * Variables and strings are stored as handles to the stack tokens.
+ * Use it to halve the memory of large sets of compiled expressions 
+ * and the memory traffic of the evaluation.
+ * 
+ * Caution, boxed tokens reference the stack tokens (the stack must 
+ * remain unchanged while the boxed tokens are used).
+ * 
+ * @param[in] stack Compiled stack.
+ * @param[out] boxed Boxed tokens (data allocated by caller, one box per token).
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_MEM if there are not enough boxes,
+ *         YY_ERROR_VALUE if the stack uses functions creating strings 
+ *         (ex. upper) or datetimes beyond year 10000.
+ */
+yy_error_e yy_box_stack(const yy_stack_t *stack, yy_boxed_t *boxed);
+
+/**
+ * Evaluate boxed tokens.
+ * 
+ * Gives the same result than yy_eval_stack(), excepting intermediate 
+ * datetimes beyond year 10000 (evaluated as YY_ERROR_VALUE).
+ * 
+ * @param[in] boxed Boxed tokens (see yy_box_stack).
+ * @param[in] aux Memory used to evaluate (to store boxed intermediate values).
+ * @param[in] resolve Function used to resolve variables (can be NULL if there are no variables).
+ * @param[in] data Data passed to the 'resolve' function.
+ * 
+ * @return Result as token, 
+ *         on error type=YY_TOKEN_ERROR and error contains the error detail.
+ */
+yy_token_t yy_eval_boxed(const yy_boxed_t *boxed, yy_boxed_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data);
+
+/**
+ * Encode an rpn stack to dense bytecode.
+ * 
+ * Each token becomes an opcode byte (functions add their symbol byte) 
+ * followed by a varint operand. Numbers and datetimes are stored in the 
+ * constants pool, string literals and variable names in the strings 
+ * pool (both deduplicated). The bytecode doesn't reference the stack 
+ * nor the expression text. Use it to hold large sets of compiled 
+ * expressions in memory (typically 5-10x smaller than the stack).
+ * 
+ * @param[in] stack Compiled stack.
+ * @param[out] bytecode Bytecode to fill (code and pools allocated by caller).
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_MEM if there is not enough space (code or pools),
+ *         YY_ERROR_EVAL if the stack is corrupted.
+ */
+yy_error_e yy_encode_stack(const yy_stack_t *stack, yy_bytecode_t *bytecode);
+
+/**
+ * Evaluate dense bytecode.
+ * 
+ * Gives the same result than yy_eval_stack() on the encoded stack.
+ * Result strings can reference the strings pool.
+ * 
+ * @param[in] bytecode Bytecode to evaluate (see yy_encode_stack).
+ * @param[in] aux Memory used to evaluate the bytecode (intermediate values and strings).
+ * @param[in] resolve Function used to resolve variables (can be NULL if there are no variables).
+ * @param[in] data Data passed to the 'resolve' function.
+ * 
+ * @return Result as token, 
+ *         on error type=YY_TOKEN_ERROR and error contains the error detail.
+ */
+yy_token_t yy_eval_bytecode(const yy_bytecode_t *bytecode, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data);
+
+/**
+ * Create an empty image of compiled expressions.
+ * 
+ * An image is a self-contained and relocatable block of bytes (no 
+ * pointers) holding the bytecode of a set of expressions (see 
+ * yy_encode_stack), an index, and a version header. Images are 
+ * evaluated in place, without deserialization: save image->data 
+ * to a file and mmap it (or place it in shared memory) to share 
+ * a compiled rules set between processes and skip parsing at startup.
+ * 
+ * Images are only readable by the same library version on machines 
+ * with the same byte order (see yy_image_check).
+ * 
+ * @param[in,out] image Image (data allocated by caller).
+ * @param[in] num_exprs Number of expressions the image will hold.
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR if invalid arguments (ex. data not 8-byte aligned),
+ *         YY_ERROR_MEM if there is not enough space.
+ */
+yy_error_e yy_image_create(yy_image_t *image, uint32_t num_exprs);
+
+/**
+ * Append a compiled expression to an image.
+ * 
+ * Requires space for the worst case encoding (about 7 bytes per token,
+ * 8 bytes per constant, and the strings length).
+ * 
+ * @param[in,out] image Image (see yy_image_create).
+ * @param[in] stack Compiled stack.
+ * @param[out] index Index of the expression in the image (can be NULL).
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR if invalid arguments,
+ *         YY_ERROR_MEM if there is not enough space or the index is full,
+ *         YY_ERROR_EVAL if the stack is corrupted.
+ */
+yy_error_e yy_image_append(yy_image_t *image, const yy_stack_t *stack, uint32_t *index);
+
+/**
+ * Check that a block of bytes is an image readable by this library.
+ * 
+ * Verifies the header (magic, version, byte order, opcodes). Call it 
+ * once after loading the image and before evaluating its expressions.
+ * 
+ * @param[in] data Image bytes (8-byte aligned).
+ * @param[in] len Number of bytes.
+ * @param[out] num_exprs Number of expressions in the image.
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR if invalid arguments,
+ *         YY_ERROR_VALUE if data is not a valid image (or incompatible).
+ */
+yy_error_e yy_image_check(const void *data, uint32_t len, uint32_t *num_exprs);
+
+/**
+ * Evaluate an expression of an image.
+ * 
+ * Gives the same result than yy_eval_stack() on the appended stack.
+ * Result strings can reference the image.
+ * 
+ * @param[in] data Image bytes (see yy_image_check).
+ * @param[in] index Expression index.
+ * @param[in] aux Memory used to evaluate the expression (intermediate values and strings).
+ * @param[in] resolve Function used to resolve variables (can be NULL if there are no variables).
+ * @param[in] user_data Data passed to the 'resolve' function.
+ * 
+ * @return Result as token, 
+ *         on error type=YY_TOKEN_ERROR and error contains the error detail
+ *         (YY_ERROR_REF if the index is out of range).
+ */
+yy_token_t yy_eval_image(const void *data, uint32_t index, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *user_data);
+
+/**
+ * Compile an rpn stack to native code (x86-64).
+ * 
+ * Supports numeric and boolean expressions: number and bool constants, 
+ * variables, arithmetic (+ - * /), comparisons, logical operators, 
+ * not, and ifelse. Operand types of variables are checked at runtime; 
+ * when a check fails (or a variable is missing) the expression is 
+ * evaluated by the interpreter. Use it on hot expressions evaluated 
+ * many times (the compilation maps memory pages).
+ * 
+ * Only available on x86-64 Linux and FreeBSD (define NO_JIT to disable 
+ * it). Unsupported stacks are evaluated by the interpreter (see yy_eval_jit).
+ * 
+ * The stack must outlive the jit (variable names are read from it).
+ * Release the code calling yy_free_jit().
+ * 
+ * @param[in] stack Compiled stack.
+ * @param[out] jit Compiled code.
+ * @param[in] name Symbol written to /tmp/perf-<pid>.map for profilers (can be NULL).
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR if invalid arguments,
+ *         YY_ERROR_VALUE if the stack or platform is not supported (jit evaluates the stack),
+ *         YY_ERROR_MEM if memory pages can't be mapped (jit evaluates the stack).
+ */
+yy_error_e yy_compile_jit(const yy_stack_t *stack, yy_jit_t *jit, const char *name);
+
+/**
+ * Evaluate a compiled expression (see yy_compile_jit).
+ * 
+ * Gives the same result than yy_eval_stack(). Variables can be resolved 
+ * twice when the native code falls back to the interpreter.
+ * 
+ * @param[in] jit Compiled code.
+ * @param[in] aux Memory used to evaluate the expression (at least jit->max_depth tokens).
+ * @param[in] resolve Function used to resolve variables (can be NULL if there are no variables).
+ * @param[in] data Data passed to the 'resolve' function.
+ * 
+ * @return Result as token, 
+ *         on error type=YY_TOKEN_ERROR and error contains the error detail.
+ */
+yy_token_t yy_eval_jit(const yy_jit_t *jit, yy_stack_t *aux, yy_token_t (*resolve)(yy_str_t var, void *data), void *data);
+
+/**
+ * Release the native code of a compiled expression.
+ * 
+ * @param[in,out] jit Compiled code (evaluated by the interpreter after release).
+ */
+void yy_free_jit(yy_jit_t *jit);
+
+/**
+ * Generate the C code of a compiled expression (ahead-of-time compilation).
+ * 
+ * Writes a straight-line static function evaluating the stack:
+ * 
+ *   static yy_token_t <name>(yy_stack_t *aux, resolve, data)
+ * 
+ * with the semantics of yy_eval_stack() (it calls the same functions). 
+ * The generated code uses the library internals, the translation unit 
+ * must include expr.c (see examples/aot.c). Compile it with -O3 into 
+ * a shared object exporting a rules table (see yy_load_rules) to get 
+ * native performance without executable memory at runtime.
+ * 
+ * @param[in] stack Compiled stack (not bound, see yy_bind_stack).
+ * @param[in] name Function name (C identifier).
+ * @param[out] buf Output buffer (nul-terminated C code).
+ * @param[in] len Size of the output buffer.
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR if invalid arguments,
+ *         YY_ERROR_MEM if the buffer is too small,
+ *         YY_ERROR_VALUE if the stack has bound variables,
+ *         YY_ERROR_EVAL if the stack is corrupted.
+ */
+yy_error_e yy_generate_c(const yy_stack_t *stack, const char *name, char *buf, uint32_t len);
+
+/**
+ * Load a shared object containing generated rules.
+ * 
+ * The shared object exports the symbols:
+ * 
+ *   const yy_rule_t yy_rules[];     // rules table
+ *   const uint32_t yy_num_rules;    // number of rules
+ * 
+ * Each rule is evaluated calling rule->eval(aux, resolve, data), with 
+ * the same arguments than yy_eval_stack(). The shared object must be 
+ * built with the same version of the library.
+ * 
+ * Only available on platforms having dlopen, when compiled with 
+ * WITH_DLOPEN (and linked with -ldl).
+ * 
+ * @param[in] path Shared object path (see dlopen for search rules).
+ * @param[out] rules Loaded rules.
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR if invalid arguments or not supported,
+ *         YY_ERROR_REF if the file can't be loaded or has no rules table.
+ */
+yy_error_e yy_load_rules(const char *path, yy_rules_t *rules);
+
+/**
+ * Search a rule by name.
+ * 
+ * @param[in] rules Loaded rules.
+ * @param[in] name Rule name.
+ * 
+ * @return The rule, or NULL if not found.
+ */
+const yy_rule_t * yy_find_rule(const yy_rules_t *rules, const char *name);
+
+/**
+ * Unload a shared object containing generated rules.
+ * 
+ * @param[in,out] rules Loaded rules (rule pointers become invalid).
+ */
+void yy_unload_rules(yy_rules_t *rules);
+
+/**
+ * Evaluate an rpn stack over a batch of rows.
+ * 
+ * Variable values are read from columns (struct-of-arrays). Each token
+ * is evaluated over a block of rows before moving to the next token.
+ * A variable without column is evaluated as YY_ERROR_REF. Bound variables 
+ * (see yy_bind_stack) read the column located at the slot index.
+ * 
+ * Stacks using temporary strings (ex. upper(), concat) are evaluated
+ * row by row. In this case, string results can point to aux memory.
+ * Otherwise jumps are ignored, and untaken operands are evaluated too.
+ * 
+ * @param[in] stack Reverse polish notation (rpn) stack.
+ * @param[in] aux Memory used to evaluate the stack (to store intermediate values).
+ * @param[in] columns Variable values (can be NULL if there are no variables).
+ * @param[in] num_columns Number of columns.
+ * @param[in] num_rows Number of rows.
+ * @param[out] results Results (one per row). Blocking errors are reported per row.
+ * 
+ * @return YY_OK on success,
+ *         otherwise error (ex. YY_ERROR_MEM if aux can not hold a block of rows).
+ */
+yy_error_e yy_eval_stack_batch(const yy_stack_t *stack, yy_stack_t *aux, const yy_column_t *columns, uint32_t num_columns, uint32_t num_rows, yy_token_t *results);
+
+/**
+ * Evaluate an rpn stack over ranges of values (interval arithmetic).
+ * 
+ * Computes a range containing every result of the stack when each 
+ * variable takes values in its domain. Variables without domain can 
+ * take any value (errors included). Bound variables (see yy_bind_stack) 
+ * use the domain located at the slot index. Bounds of transcendental 
+ * functions are widened by one ulp. Datetimes and strings are unbounded.
+ * 
+ * Example: $age in [0,150] proves that ($age < 200) is always true. 
+ * Use the per-column min/max of a batch as domains to skip the batch 
+ * evaluation when the result is fixed.
+ * 
+ * @param[in] stack Reverse polish notation (rpn) stack.
+ * @param[in] domains Variable domains (can be NULL if there are no domains).
+ * @param[in] num_domains Number of domains.
+ * @param[out] result Range of the result.
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_EXCD if the stack is too deep,
+ *         YY_ERROR_EVAL if the stack is corrupted,
+ *         YY_ERROR on invalid arguments.
+ */
+yy_error_e yy_eval_stack_range(const yy_stack_t *stack, const yy_domain_t *domains, uint32_t num_domains, yy_range_t *result);
+
+/**
+ * Specialize a compiled stack against variable domains.
+ * 
+ * Subexpressions having a fixed value in the given domains are replaced 
+ * by this value, and the stack is compiled again. For example, when $age 
+ * is a number in [0,150], isnan($age) -> false, and $age >= 0 && $x -> $x.
+ * Numbers are replaced when the value is not zero (the sign of zero 
+ * can not be proven).
+ * 
+ * Caution, the result is undefined when a variable takes a value 
+ * out of its domain.
+ * 
+ * @param[in,out] stack Compiled stack.
+ * @param[in] domains Variable domains (can be NULL if there are no domains).
+ * @param[in] num_domains Number of domains.
+ * @param[in] flags Optimizations to apply (ORed yy_optimize_e values).
+ * 
+ * @return YY_OK on success,
+ *         YY_ERROR_MEM if there is not enough room (stack unchanged),
+ *         YY_ERROR_EVAL if the stack is corrupted,
+ *         YY_ERROR on invalid arguments.
+ */
+yy_error_e yy_narrow_stack(yy_stack_t *stack, const yy_domain_t *domains, uint32_t num_domains, uint32_t flags);
+
 /**
  * Parse a single value.
  * 
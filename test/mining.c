@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include "expr.h"
+
+/**
+ * Mine the most frequent token sequences of a set of expressions.
+ *
+ * Compiles all expressions in a csv file (with header) whose first
+ * column is the formula (see performance.c), and reports the sequences
+ * of 2 and 3 tokens sorted by the number of saved dispatches (a fused
+ * sequence of n tokens saves n-1 dispatches). Use it to choose the
+ * superinstructions (see fuse_stack() in expr.c).
+ *
+ * Variables and slots are reported as 'var', temporaries as 'tmp',
+ * jumps are ignored.
+ */
+
+#define MAX_SEQUENCES 4096
+#define MAX_NGRAM 3
+
+typedef struct sequence_t
+{
+    char signature[64];
+    uint32_t len;
+    uint64_t count;
+} sequence_t;
+
+typedef struct func_name_t
+{
+    const char *name;
+    const char *probe;      // expression whose last token is the function
+} func_name_t;
+
+static const func_name_t func_names[] = {
+    {"+", "$a + $b"}, {"-", "$a - $b"}, {"*", "$a * $b"}, {"/", "$a / $b"}, {"%", "$a % $b"}, {"^", "$a ^ $b"},
+    {"<", "$a < $b"}, {"<=", "$a <= $b"}, {">", "$a > $b"}, {">=", "$a >= $b"}, {"==", "$a == $b"}, {"!=", "$a != $b"},
+    {"&&", "$a && $b"}, {"||", "$a || $b"}, {"not", "not($a)"}, {"neg", "-$a"},
+    {"abs", "abs($a)"}, {"sqrt", "sqrt($a)"}, {"exp", "exp($a)"}, {"log", "log($a)"},
+    {"sin", "sin($a)"}, {"cos", "cos($a)"}, {"tan", "tan($a)"}, {"trunc", "trunc($a)"}, {"ceil", "ceil($a)"}, {"floor", "floor($a)"},
+    {"min", "min($a, $b)"}, {"max", "max($a, $b)"}, {"clamp", "clamp($a, $b, $c)"}, {"ifelse", "ifelse($a, $b, $c)"},
+    {"isnan", "isnan($a)"}, {"isinf", "isinf($a)"}, {"iserror", "iserror($a)"},
+    {"length", "length($a)"}, {"upper", "upper($a)"}, {"lower", "lower($a)"}, {"trim", "trim($a)"}, {"str", "str($a)"},
+};
+
+static void (*func_ptrs[sizeof(func_names)/sizeof(func_names[0])])(void);
+
+static sequence_t sequences[MAX_SEQUENCES];
+static uint32_t num_sequences = 0;
+
+static void init_func_ptrs(void)
+{
+    yy_token_t data[16] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+
+    for (size_t i = 0; i < sizeof(func_names)/sizeof(func_names[0]); i++)
+    {
+        const char *str = func_names[i].probe;
+
+        if (yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK && data[stack.len - 1].type == YY_TOKEN_FUNCTION)
+            func_ptrs[i] = data[stack.len - 1].function.ptr;
+    }
+}
+
+static void get_token_name(const yy_token_t *token, char *buf, size_t len)
+{
+    switch (token->type)
+    {
+        case YY_TOKEN_BOOL:     snprintf(buf, len, "bool"); return;
+        case YY_TOKEN_NUMBER:   snprintf(buf, len, "num"); return;
+        case YY_TOKEN_DATETIME: snprintf(buf, len, "date"); return;
+        case YY_TOKEN_STRING:   snprintf(buf, len, "str"); return;
+        case YY_TOKEN_VARIABLE:
+        case YY_TOKEN_SLOT:     snprintf(buf, len, "var"); return;
+        case YY_TOKEN_TEMP:     snprintf(buf, len, "tmp"); return;
+        case YY_TOKEN_ERROR:    snprintf(buf, len, "error"); return;
+        case YY_TOKEN_FUNCTION:
+            for (size_t i = 0; i < sizeof(func_names)/sizeof(func_names[0]); i++) {
+                if (func_ptrs[i] == token->function.ptr) {
+                    snprintf(buf, len, "%s", func_names[i].name);
+                    return;
+                }
+            }
+            snprintf(buf, len, "func/%d", (int) token->function.num_args);
+            return;
+        default:
+            snprintf(buf, len, "?");
+            return;
+    }
+}
+
+static void add_sequence(const yy_token_t **tokens, uint32_t len)
+{
+    char signature[64] = {0};
+    char name[16] = {0};
+
+    for (uint32_t i = 0; i < len; i++) {
+        get_token_name(tokens[i], name, sizeof(name));
+        snprintf(signature + strlen(signature), sizeof(signature) - strlen(signature), "%s%s", (i ? " " : ""), name);
+    }
+
+    for (uint32_t i = 0; i < num_sequences; i++) {
+        if (strcmp(sequences[i].signature, signature) == 0) {
+            sequences[i].count++;
+            return;
+        }
+    }
+
+    if (num_sequences >= MAX_SEQUENCES)
+        return;
+
+    strcpy(sequences[num_sequences].signature, signature);
+    sequences[num_sequences].len = len;
+    sequences[num_sequences].count = 1;
+    num_sequences++;
+}
+
+static void mine_stack(const yy_stack_t *stack)
+{
+    const yy_token_t *window[MAX_NGRAM] = {0};
+    uint32_t num = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+    {
+        if (stack->data[i].type == YY_TOKEN_JUMP)
+            continue;
+
+        if (num == MAX_NGRAM) {
+            memmove(window, window + 1, (MAX_NGRAM - 1) * sizeof(window[0]));
+            num--;
+        }
+
+        window[num++] = &stack->data[i];
+
+        // only sequences ending in a function are worth fusing
+        if (stack->data[i].type != YY_TOKEN_FUNCTION)
+            continue;
+
+        for (uint32_t len = 2; len <= num; len++)
+            add_sequence(window + num - len, len);
+    }
+}
+
+static int cmp_sequences(const void *a, const void *b)
+{
+    const sequence_t *x = (const sequence_t *) a;
+    const sequence_t *y = (const sequence_t *) b;
+    uint64_t saved_x = x->count * (x->len - 1);
+    uint64_t saved_y = y->count * (y->len - 1);
+
+    return (saved_x < saved_y) - (saved_x > saved_y);
+}
+
+int main(int argc, char *argv[])
+{
+    char buffer[16000] = {0};
+    yy_token_t data[1024] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    int num_ok = 0;
+    int num_ko = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "error: no file argument\n");
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *file = fopen(argv[1], "r");
+
+    if (!file) {
+        fprintf(stderr, "error: cannot open file '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    init_func_ptrs();
+
+    // skips first line
+    if (!fgets(buffer, sizeof(buffer), file)) {
+        fclose(file);
+        return EXIT_SUCCESS;
+    }
+
+    while (fgets(buffer, sizeof(buffer), file))
+    {
+        char *ptr = buffer + strlen(buffer);
+
+        while (ptr > buffer && *ptr != ',')
+            --ptr;
+
+        if (ptr > buffer)
+            *ptr = 0;
+
+        if (yy_compile(buffer, buffer + strlen(buffer), &stack, NULL) != YY_OK) {
+            num_ko++;
+            continue;
+        }
+
+        mine_stack(&stack);
+        num_ok++;
+    }
+
+    fclose(file);
+
+    qsort(sequences, num_sequences, sizeof(sequence_t), cmp_sequences);
+
+    printf("expressions = %d (invalid = %d)\n", num_ok, num_ko);
+    printf("%12s  %12s  %s\n", "saved", "count", "sequence");
+
+    for (uint32_t i = 0; i < num_sequences && i < 20; i++)
+        printf("%12lu  %12lu  %s\n", (unsigned long) (sequences[i].count * (sequences[i].len - 1)), (unsigned long) sequences[i].count, sequences[i].signature);
+
+    return EXIT_SUCCESS;
+}
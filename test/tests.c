@@ -491,6 +491,135 @@ void check_eval_ok(const char *str, yy_token_e type)
 
 // ==============
 
+#define BATCH_ROWS 150
+
+typedef struct batch_data_t {
+    const yy_column_t *columns;
+    uint32_t num_columns;
+    uint32_t row;
+} batch_data_t;
+
+yy_token_t resolve_batch(yy_str_t var, void *data)
+{
+    batch_data_t *batch = (batch_data_t *) data;
+
+    for (uint32_t i = 0; i < batch->num_columns; i++)
+        if (batch->columns[i].name.len == var.len && strncmp(batch->columns[i].name.ptr, var.ptr, var.len) == 0)
+            return batch->columns[i].values[batch->row];
+
+    return token_error(YY_ERROR_REF);
+}
+
+bool equals_token(yy_token_t a, yy_token_t b)
+{
+    if (a.type != b.type)
+        return false;
+
+    switch (a.type)
+    {
+        case YY_TOKEN_BOOL: return (a.bool_val == b.bool_val);
+        case YY_TOKEN_NUMBER: return (memcmp(&a.number_val, &b.number_val, sizeof(double)) == 0 || (isnan(a.number_val) && isnan(b.number_val)));
+        case YY_TOKEN_DATETIME: return (a.datetime_val == b.datetime_val);
+        case YY_TOKEN_STRING: return (a.str_val.len == b.str_val.len && memcmp(a.str_val.ptr, b.str_val.ptr, a.str_val.len) == 0);
+        case YY_TOKEN_ERROR: return (a.error == b.error);
+        default: return false;
+    }
+}
+
+void check_eval_batch(const char *str, const yy_column_t *columns, uint32_t num_columns, uint32_t num_rows)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[256] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    yy_token_t data_row[64] = {0};
+    yy_stack_t aux_row = {data_row, sizeof(data_row)/sizeof(data_row[0]), 0};
+    yy_token_t results[BATCH_ROWS] = {0};
+    batch_data_t batch = {columns, num_columns, 0};
+
+    TEST_ASSERT(num_rows <= BATCH_ROWS);
+    TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+    TEST_MSG("Case='%s', error=compilation failed", str);
+
+    TEST_CHECK(yy_eval_stack_batch(&stack, &aux, columns, num_columns, num_rows, results) == YY_OK);
+    TEST_MSG("Case='%s', error=batch evaluation failed", str);
+
+    for (uint32_t row = 0; row < num_rows; row++)
+    {
+        batch.row = row;
+        yy_token_t expected = yy_eval_stack(&stack, &aux_row, resolve_batch, &batch);
+
+        if (!TEST_CHECK(equals_token(results[row], expected))) {
+            TEST_MSG("Case='%s', row=%u", str, row);
+            break;
+        }
+    }
+}
+
+void check_eval_batch_slots(const char *str, const yy_column_t *columns, uint32_t num_columns, uint32_t num_rows)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_bound[64] = {0};
+    yy_stack_t bound = {data_bound, sizeof(data_bound)/sizeof(data_bound[0]), 0};
+    yy_token_t data_aux[256] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    yy_token_t data_row[64] = {0};
+    yy_stack_t aux_row = {data_row, sizeof(data_row)/sizeof(data_row[0]), 0};
+    yy_token_t results[BATCH_ROWS] = {0};
+    yy_column_t slot_columns[8] = {0};
+    yy_str_t names[8] = {0};
+    uint32_t num_names = 0;
+    batch_data_t batch = {columns, num_columns, 0};
+
+    TEST_ASSERT(num_rows <= BATCH_ROWS);
+    TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+    TEST_CHECK(yy_compile(str, str + strlen(str), &bound, NULL) == YY_OK);
+    TEST_CHECK(yy_bind_stack(&bound, names, 8, &num_names) == YY_OK);
+    TEST_MSG("Case='%s', error=bind failed", str);
+
+    // columns ordered by slot
+    for (uint32_t i = 0; i < num_names; i++)
+    {
+        slot_columns[i].name = names[i];
+
+        for (uint32_t j = 0; j < num_columns; j++)
+            if (columns[j].name.len == names[i].len && strncmp(columns[j].name.ptr, names[i].ptr, names[i].len) == 0)
+                slot_columns[i].values = columns[j].values;
+    }
+
+    TEST_CHECK(yy_eval_stack_batch(&bound, &aux, slot_columns, num_names, num_rows, results) == YY_OK);
+    TEST_MSG("Case='%s', error=batch evaluation failed", str);
+
+    for (uint32_t row = 0; row < num_rows; row++)
+    {
+        batch.row = row;
+        yy_token_t expected = yy_eval_stack(&stack, &aux_row, resolve_batch, &batch);
+
+        if (!TEST_CHECK(equals_token(results[row], expected))) {
+            TEST_MSG("Case='%s', row=%u", str, row);
+            break;
+        }
+    }
+}
+
+void check_eval_batch_numeric(const char *str, const yy_column_t *columns, uint32_t num_columns, uint32_t num_rows)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[256] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    yy_token_t results[BATCH_MAX_ROWS] = {0};
+
+    TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+    TEST_MSG("Case='%s', error=compilation failed", str);
+
+    TEST_CHECK(eval_batch_numeric(&stack, &aux, columns, num_columns, 0, MIN(num_rows, BATCH_MAX_ROWS), results));
+    TEST_MSG("Case='%s', error=not evaluated by numeric kernels", str);
+
+    check_eval_batch(str, columns, num_columns, num_rows);
+}
+
 void check_dateadd(const char *str_date, int val, const char *str_part, const char *str_expected)
 {
     yy_token_t date = yy_parse_datetime(str_date, str_date + strlen(str_date));
@@ -1446,7 +1575,7 @@ void test_sizeof(void)
 {
     TEST_CHECK(sizeof(uint64_t) == 8);
     TEST_CHECK(sizeof(yy_str_t) == 12);
-    TEST_CHECK(sizeof(yy_func_t) == 11);
+    TEST_CHECK(sizeof(yy_func_t) == 12);
     TEST_CHECK(sizeof(yy_token_e) <= 4);
     TEST_CHECK(sizeof(yy_token_t) == 16);
     TEST_CHECK(sizeof(yy_symbol_t) == 32);
@@ -2475,8 +2604,13 @@ void test_func_and(void)
     result = func_and(token_error(YY_ERROR_VALUE), token_bool(false));
     TEST_CHECK(result.type == YY_TOKEN_ERROR);
 
-    result = func_and(token_bool(false), token_error(YY_ERROR_VALUE));
+    result = func_and(token_bool(true), token_error(YY_ERROR_VALUE));
     TEST_CHECK(result.type == YY_TOKEN_ERROR);
+
+    // short-circuit (second argument not checked)
+    result = func_and(token_bool(false), token_error(YY_ERROR_VALUE));
+    TEST_CHECK(result.type == YY_TOKEN_BOOL);
+    TEST_CHECK(result.bool_val == false);
 }
 
 void test_func_or(void)
@@ -2504,6 +2638,11 @@ void test_func_or(void)
 
     result = func_or(token_bool(false), token_error(YY_ERROR_VALUE));
     TEST_CHECK(result.type == YY_TOKEN_ERROR);
+
+    // short-circuit (second argument not checked)
+    result = func_or(token_bool(true), token_error(YY_ERROR_VALUE));
+    TEST_CHECK(result.type == YY_TOKEN_BOOL);
+    TEST_CHECK(result.bool_val == true);
 }
 
 void test_func_not(void)
@@ -2947,9 +3086,19 @@ void test_func_ifelse(void)
     result = func_ifelse(token_number(0), token_number(1), token_number(2));
     TEST_CHECK(result.type == YY_TOKEN_ERROR);
 
-    // error case (distinct return types)
+    // distinct return types (untaken branch not checked)
     result = func_ifelse(token_bool(true), token_string("abc", 3), token_number(3));
+    TEST_CHECK(result.type == YY_TOKEN_STRING);
+    TEST_CHECK(str_cmp(result.str_val, make_string("abc", 3)) == 0);
+
+    result = func_ifelse(token_bool(true), token_number(3), token_error(YY_ERROR_VALUE));
+    TEST_CHECK(result.type == YY_TOKEN_NUMBER);
+    TEST_CHECK(result.number_val == 3);
+
+    // error case (taken branch is an error)
+    result = func_ifelse(token_bool(false), token_number(3), token_error(YY_ERROR_REF));
     TEST_CHECK(result.type == YY_TOKEN_ERROR);
+    TEST_CHECK(result.error == YY_ERROR_VALUE);
 
     // error case (unsupported type)
     result = func_ifelse(token_bool(true), token_error(YY_ERROR_VALUE), token_error(YY_ERROR_VALUE));
@@ -3035,6 +3184,2698 @@ void test_funcs(void)
     test_func_variable();
 }
 
+void test_eval_opcodes(void)
+{
+    const yy_token_t values[] = {
+        token_number(0), token_number(-0.0), token_number(1.5), token_number(-2), token_number(NAN), token_number(INFINITY),
+        token_bool(true), token_bool(false),
+        token_datetime(0), token_datetime(1725776766211),
+        token_string("abc", 3), token_string("abd", 3), token_string("", 0),
+        token_error(YY_ERROR_VALUE), token_error(YY_ERROR_REF)
+    };
+    const uint32_t num_values = sizeof(values)/sizeof(values[0]);
+    yy_token_t data[3] = {0};
+    yy_stack_t stack = {data, 0, 0};
+    yy_token_t data_aux[8] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+    for (uint32_t s = 0; s < YY_SYMBOL_END; s++)
+    {
+        yy_token_t func = symbol_to_token[s];
+
+        if (func.type != YY_TOKEN_FUNCTION || func.function.opcode == YY_OPCODE_CALL)
+            continue;
+
+        for (uint32_t i = 0; i < num_values; i++)
+        {
+            for (uint32_t j = 0; j < num_values; j++)
+            {
+                yy_token_t expected = {0};
+
+                if (func.function.num_args == 1) {
+                    data[0] = values[i];
+                    data[1] = func;
+                    stack.len = stack.reserved = 2;
+                    expected = ((yy_func_1) func.function.ptr)(values[i]);
+                }
+                else {
+                    data[0] = values[i];
+                    data[1] = values[j];
+                    data[2] = func;
+                    stack.len = stack.reserved = 3;
+                    expected = ((yy_func_2) func.function.ptr)(values[i], values[j]);
+                }
+
+                yy_token_t result = yy_eval_stack(&stack, &aux, NULL, NULL);
+
+                if (!TEST_CHECK(equals_token(result, expected))) {
+                    TEST_MSG("Case=%s, i=%u, j=%u", symbol_to_str((yy_symbol_e) s), i, j);
+                    return;
+                }
+            }
+        }
+    }
+}
+
+void check_specialization(const char *str, yy_opcode_e expected)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+
+    if (!TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK)) {
+        TEST_MSG("Case='%s', error=compilation failed", str);
+        return;
+    }
+
+    TEST_CHECK(data[stack.len - 1].type == YY_TOKEN_FUNCTION);
+    TEST_CHECK(data[stack.len - 1].function.opcode == expected);
+    TEST_MSG("Case='%s', expected=%d, result=%d", str, (int) expected, (int) data[stack.len - 1].function.opcode);
+}
+
+void test_eval_typed_opcodes(void)
+{
+    const yy_token_t values[] = {
+        token_number(0), token_number(-0.0), token_number(1.5), token_number(-2), token_number(NAN),
+        token_bool(true), token_bool(false),
+        token_datetime(0), token_datetime(1725776766211),
+        token_string("abc", 3), token_string("abd", 3), token_string("", 0),
+        token_error(YY_ERROR_VALUE), token_variable("x", 1)
+    };
+    const uint32_t num_values = sizeof(values)/sizeof(values[0]);
+    yy_token_t data[4] = {0};
+    yy_stack_t stack = {data, 0, 0};
+    yy_token_t data_aux[8] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+    // typed opcodes give the same result than the function
+    for (size_t f = 0; f < sizeof(typed_funcs)/sizeof(typed_funcs[0]); f++)
+    {
+        yy_token_t func = {.type = YY_TOKEN_FUNCTION};
+
+        func.function.ptr = typed_funcs[f].ptr;
+        func.function.opcode = typed_funcs[f].opcode;
+        func.function.num_args = (typed_funcs[f].ptr == (void (*)(void)) func_clamp ? 3 : 2);
+
+        for (uint32_t i = 0; i < num_values * num_values * (func.function.num_args == 3 ? num_values : 1); i++)
+        {
+            yy_token_t x = values[i % num_values];
+            yy_token_t y = values[(i / num_values) % num_values];
+            yy_token_t z = values[(i / num_values / num_values) % num_values];
+            yy_token_t expected = {0};
+
+            if (x.type == YY_TOKEN_VARIABLE || y.type == YY_TOKEN_VARIABLE || z.type == YY_TOKEN_VARIABLE)
+                continue;
+
+            data[0] = x;
+            data[1] = y;
+
+            if (func.function.num_args == 3) {
+                data[2] = z;
+                data[3] = func;
+                stack.len = stack.reserved = 4;
+                expected = func_clamp(x, y, z);
+            }
+            else {
+                data[2] = func;
+                stack.len = stack.reserved = 3;
+                expected = ((yy_func_2) func.function.ptr)(x, y);
+            }
+
+            yy_token_t result = yy_eval_stack(&stack, &aux, NULL, NULL);
+
+            if (!TEST_CHECK(equals_token(result, expected))) {
+                TEST_MSG("Case=%d, i=%u", (int) typed_funcs[f].opcode, i);
+                return;
+            }
+        }
+    }
+
+    // compiler assigns typed opcodes
+    check_specialization("$x < 3", YY_OPCODE_LT_NUM);
+    check_specialization("abs($x) >= $y", YY_OPCODE_GE_NUM);
+    check_specialization("$x == $y", YY_OPCODE_EQUALS_OP);
+    check_specialization("\"abc\" < $p", YY_OPCODE_LT_STR);
+    check_specialization("upper($p) != $q", YY_OPCODE_NE_STR);
+    check_specialization("true == $m", YY_OPCODE_EQ_BOOL);
+    check_specialization("now() >= $d", YY_OPCODE_GE_DATETIME);
+    check_specialization("min($x, 3)", YY_OPCODE_MIN_NUM);
+    check_specialization("max($d, now())", YY_OPCODE_MAX_DATETIME);
+    check_specialization("min(\"abc\", $p)", YY_OPCODE_CALL);
+    check_specialization("clamp($x, 0, $y)", YY_OPCODE_CLAMP_NUM);
+    check_specialization("clamp($d, $d, $d)", YY_OPCODE_CALL);
+    check_specialization("ifelse($m, $x, 1) > 2", YY_OPCODE_GT_NUM);
+
+    // variables with unexpected types
+    check_eval_bool_ok("$x < 3", true);
+    check_eval_number_ko("min($p, 3)", YY_ERROR_VALUE);
+    check_eval_bool_ok("iserror($p < 3)", true);
+    check_eval_bool_ok("iserror(\"abc\" < $x)", true);
+    check_eval_bool_ok("upper($p) > \"BOA\"", true);
+    check_eval_ok("clamp($d, \"2024-01-01\", \"2023-01-01\")", YY_TOKEN_ERROR);
+}
+
+uint32_t count_jumps(const yy_stack_t *stack)
+{
+    uint32_t ret = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+        ret += (stack->data[i].type == YY_TOKEN_JUMP);
+
+    return ret;
+}
+
+void check_jumps(const char *str, uint32_t expected_jumps)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+    if (!TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK)) {
+        TEST_MSG("Case='%s', error=compilation failed", str);
+        return;
+    }
+
+    TEST_CHECK(count_jumps(&stack) == expected_jumps);
+    TEST_MSG("Case='%s', expected=%u, result=%u", str, expected_jumps, count_jumps(&stack));
+
+    yy_token_t expected = yy_eval_stack(&stack, &aux, resolve, NULL);
+
+    // same result ignoring jumps
+    yy_token_t data2[64] = {0};
+    yy_stack_t stack2 = {data2, sizeof(data2)/sizeof(data2[0]), 0};
+
+    for (uint32_t i = 0; i < stack.len; i++)
+    {
+        if (data[i].type == YY_TOKEN_JUMP)
+            continue;
+
+        data2[stack2.len] = data[i];
+
+        if (data[i].type == YY_TOKEN_FUNCTION && data[i].function.opcode == YY_OPCODE_IFELSE)
+            data2[stack2.len].function.opcode = YY_OPCODE_CALL;
+
+        stack2.len++;
+    }
+
+    yy_token_t result = yy_eval_stack(&stack2, &aux, resolve, NULL);
+
+    TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=distinct results", str);
+}
+
+void test_eval_jumps(void)
+{
+    // jumps are added only when there is something to skip
+    check_jumps("ifelse($m, $x, 2)", 2);
+    check_jumps("ifelse($m, 1, 2)", 0);
+    check_jumps("ifelse(true, 1, 2)", 0);
+    check_jumps("$m && $n", 1);
+    check_jumps("$m || true", 0);
+    check_jumps("ifelse($m && $n, ifelse($n || $m, $x, 2), 3)", 6);
+    check_jumps("ifelse($m, upper($p), \"\") == \"BOB\"", 2);
+
+    // untaken branches are not evaluated ($u is a blocking error)
+    check_eval_number_ok("ifelse($m, 1, $u)", 1);
+    check_eval_number_ok("ifelse($n, $u, 2)", 2);
+    check_eval_bool_ok("$n && $u", false);
+    check_eval_bool_ok("$m || $u", true);
+    check_eval_bool_ok("$n && $u || $m", true);
+    check_eval_string_ok("ifelse($n, replace($u, \"a\", \"b\"), lower($p))", "bob");
+    check_eval_ok("$m && $u", YY_TOKEN_ERROR);
+    check_eval_number_ko("ifelse($n, 1, $u)", YY_ERROR_SYNTAX);
+
+    // nested
+    check_eval_number_ok("ifelse($m && $n, ifelse($n || $m, 1, 2), 3)", 3);
+    check_eval_number_ok("ifelse($m || $n, ifelse($n || $m, 1, 2), 3)", 1);
+    check_eval_number_ok("ifelse($m, ifelse($n, 1, 2), ifelse($m, 3, 4)) + 10", 12);
+    check_eval_string_ok("ifelse($m, upper($p), \"\") + \"!\"", "BOB!");
+    check_eval_string_ok("ifelse($n, upper($p), lower($q)) + upper($s)", "johnLOREM IPSUM");
+
+    // non-bool condition
+    check_eval_number_ko("ifelse($x, 1, 2)", YY_ERROR_VALUE);
+    check_eval_bool_ok("iserror($x && $m)", true);
+    check_eval_bool_ok("iserror($p || $m)", true);
+    check_eval_bool_ok("iserror($m && $x)", true);
+    check_eval_bool_ok("iserror($n || $x)", true);
+
+    // branches with distinct types
+    check_eval_number_ok("ifelse($m, $x, $p)", 0.5);
+    check_eval_ok("ifelse($n, $x, $p)", YY_TOKEN_STRING);
+
+    // zero-argument functions
+    check_jumps("ifelse($m, now(), $d)", 2);
+    check_eval_bool_ok("ifelse($n, now(), $d) == $d", true);
+    check_eval_bool_ok("ifelse($m, now(), $d) > $d", true);
+}
+
+void check_eval_slots(const char *str, uint32_t expected_slots)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_bound[64] = {0};
+    yy_stack_t bound = {data_bound, sizeof(data_bound)/sizeof(data_bound[0]), 0};
+    yy_token_t data_aux[256] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    yy_str_t names[8] = {0};
+    yy_token_t slots[8] = {0};
+    uint32_t num_names = 0;
+
+    TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+    TEST_CHECK(yy_compile(str, str + strlen(str), &bound, NULL) == YY_OK);
+    TEST_MSG("Case='%s', error=compilation failed", str);
+
+    TEST_CHECK(yy_bind_stack(&bound, names, 8, &num_names) == YY_OK);
+    TEST_CHECK(num_names == expected_slots);
+    TEST_MSG("Case='%s', expected=%u, result=%u", str, expected_slots, num_names);
+
+    for (uint32_t i = 0; i < bound.len; i++)
+        TEST_CHECK(data_bound[i].type != YY_TOKEN_VARIABLE);
+
+    for (uint32_t i = 0; i < num_names; i++)
+        slots[i] = resolve(names[i], NULL);
+
+    yy_token_t expected = yy_eval_stack(&stack, &aux, resolve, NULL);
+    yy_token_t result = yy_eval_stack_slots(&bound, &aux, slots, num_names);
+
+    TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=distinct results", str);
+}
+
+void test_eval_slots(void)
+{
+    check_eval_slots("1 + 2", 0);
+    check_eval_slots("$x", 1);
+    check_eval_slots("$x * $x - 2 * $x + $y", 2);
+    check_eval_slots("${x} + $x", 1);
+    check_eval_slots("ifelse($m, $p, $q) + upper($s)", 4);
+    check_eval_slots("now() < $d || $m && not($n)", 3);
+    check_eval_slots("$x + $v", 2);
+    check_eval_slots("$x + $w", 2);
+    check_eval_slots("ifelse($m, 1, $u)", 2);
+
+    const char *str = "$x + $y * $z";
+    yy_token_t data[16] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[16] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    yy_str_t names[3] = {0};
+    uint32_t num_names = 0;
+    yy_token_t result = {0};
+
+    TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+
+    // not enough names (stack unchanged)
+    TEST_CHECK(yy_bind_stack(&stack, names, 2, &num_names) == YY_ERROR_MEM);
+    TEST_CHECK(data[0].type == YY_TOKEN_VARIABLE);
+    TEST_CHECK(yy_bind_stack(NULL, names, 3, &num_names) == YY_ERROR);
+    TEST_CHECK(yy_bind_stack(&stack, NULL, 3, &num_names) == YY_ERROR);
+
+    // slots assigned in order of appearance
+    TEST_CHECK(yy_bind_stack(&stack, names, 3, &num_names) == YY_OK);
+    TEST_CHECK(num_names == 3);
+    TEST_CHECK(names[0].len == 1 && names[0].ptr[0] == 'x');
+    TEST_CHECK(names[1].len == 1 && names[1].ptr[0] == 'y');
+    TEST_CHECK(names[2].len == 1 && names[2].ptr[0] == 'z');
+    TEST_CHECK(data[0].type == YY_TOKEN_SLOT && data[0].slot == 0);
+
+    // rebinding a bound stack does nothing
+    TEST_CHECK(yy_bind_stack(&stack, names, 3, &num_names) == YY_OK);
+    TEST_CHECK(num_names == 0);
+
+    yy_token_t slots[3] = {token_number(1), token_number(2), token_number(3)};
+
+    result = yy_eval_stack_slots(&stack, &aux, slots, 3);
+    TEST_CHECK(result.type == YY_TOKEN_NUMBER && result.number_val == 7);
+
+    // missing slots
+    result = yy_eval_stack_slots(&stack, &aux, slots, 2);
+    TEST_CHECK(result.type == YY_TOKEN_ERROR);
+
+    result = yy_eval_stack_slots(&stack, &aux, NULL, 0);
+    TEST_CHECK(result.type == YY_TOKEN_ERROR);
+
+    result = yy_eval_stack(&stack, &aux, resolve, NULL);
+    TEST_CHECK(result.type == YY_TOKEN_ERROR);
+
+    // blocking error
+    slots[1] = token_error(YY_ERROR_CREF);
+    result = yy_eval_stack_slots(&stack, &aux, slots, 3);
+    TEST_CHECK(result.type == YY_TOKEN_ERROR && result.error == YY_ERROR_CREF);
+}
+
+yy_token_t resolve_counting(yy_str_t var, void *data)
+{
+    (*(int *) data)++;
+    return resolve(var, NULL);
+}
+
+void check_eval_memo(const char *str, int expected_calls)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[256] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    int num_calls = 0;
+
+    TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+    TEST_MSG("Case='%s', error=compilation failed", str);
+
+    yy_token_t expected = yy_eval_stack(&stack, &aux, resolve, NULL);
+    yy_token_t result = yy_eval_stack_memo(&stack, &aux, resolve_counting, &num_calls);
+
+    TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=distinct results", str);
+
+    TEST_CHECK(num_calls == expected_calls);
+    TEST_MSG("Case='%s', expected=%d, result=%d", str, expected_calls, num_calls);
+}
+
+void test_eval_memo(void)
+{
+    check_eval_memo("1 + 2", 0);
+    check_eval_memo("$x", 1);
+    check_eval_memo("$x * $x - 2 * $x + 1", 1);
+    check_eval_memo("ifelse($y > 100, $y * 0.9, $y)", 1);
+    check_eval_memo("ifelse($m, $p, $q) + $p", 2);
+    check_eval_memo("${x} + $x + $y + ${y}", 2);
+    check_eval_memo("upper($s) + lower($s) + $p", 2);
+    check_eval_memo("$x + $v + $x + $v", 2);
+    check_eval_memo("$x + $unknown + $unknown", 2);
+
+    // blocking errors abort the evaluation
+    check_eval_memo("$x + $w + $w", 2);
+
+    // small aux memory (values not memoized)
+    {
+        const char *str = "$x + $x";
+        yy_token_t data[16] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[3] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+        int num_calls = 0;
+
+        TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+
+        yy_token_t result = yy_eval_stack_memo(&stack, &aux, resolve_counting, &num_calls);
+        TEST_CHECK(result.type == YY_TOKEN_NUMBER && result.number_val == 1);
+        TEST_CHECK(num_calls == 2);
+
+        TEST_CHECK(yy_eval_stack_memo(NULL, &aux, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_stack_memo(&stack, NULL, resolve, NULL).type == YY_TOKEN_ERROR);
+    }
+}
+
+bool equals_stack(const yy_stack_t *stack1, const yy_stack_t *stack2)
+{
+    if (stack1->len != stack2->len)
+        return false;
+
+    for (uint32_t i = 0; i < stack1->len; i++)
+    {
+        const yy_token_t *token1 = &stack1->data[i];
+        const yy_token_t *token2 = &stack2->data[i];
+
+        if (token1->type == YY_TOKEN_JUMP) {
+            if (token2->type != YY_TOKEN_JUMP || token1->jump.opcode != token2->jump.opcode || token1->jump.offset != token2->jump.offset)
+                return false;
+        }
+        else if (token1->type == YY_TOKEN_TEMP) {
+            if (token2->type != YY_TOKEN_TEMP || token1->temp != token2->temp)
+                return false;
+        }
+        else if (!is_same_token(token1, token2)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void check_reassociate(const char *str, uint32_t flags, const char *expected_str)
+{
+    yy_token_t data1[64] = {0};
+    yy_stack_t stack1 = {data1, sizeof(data1)/sizeof(data1[0]), 0};
+    yy_token_t data2[64] = {0};
+    yy_stack_t stack2 = {data2, sizeof(data2)/sizeof(data2[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+    if (!TEST_CHECK(yy_compile(str, str + strlen(str), &stack1, NULL) == YY_OK)) {
+        TEST_MSG("Case='%s', error=compilation failed", str);
+        return;
+    }
+
+    if (flags && !TEST_CHECK(yy_optimize_stack(&stack1, flags) == YY_OK)) {
+        TEST_MSG("Case='%s', error=optimization failed", str);
+        return;
+    }
+
+    TEST_ASSERT(yy_compile(expected_str, expected_str + strlen(expected_str), &stack2, NULL) == YY_OK);
+
+    TEST_CHECK(equals_stack(&stack1, &stack2));
+    TEST_MSG("Case='%s', expected='%s', len=%u, expected_len=%u", str, expected_str, stack1.len, stack2.len);
+
+    yy_token_t result = yy_eval_stack(&stack1, &aux, resolve, NULL);
+    yy_token_t expected = yy_eval_stack(&stack2, &aux, resolve, NULL);
+
+    TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=distinct results", str);
+}
+
+void test_reassociate(void)
+{
+    // min and max
+    check_reassociate("min(min($x, 3), 1)", 0, "min($x, 1)");
+    check_reassociate("max(2, max($x, 5))", 0, "max($x, 5)");
+    check_reassociate("min(1, $x)", 0, "min($x, 1)");
+    check_reassociate("min(min($x, 3), min($y, 1))", 0, "min(min($x, $y), 1)");
+    check_reassociate("max(max($x, 3), $y)", 0, "max(max($x, $y), 3)");
+    check_reassociate("max($x, max($y, 3))", 0, "max(max($x, $y), 3)");
+    check_reassociate("min(max($x, 3), 1)", 0, "min(max($x, 3), 1)");
+    check_reassociate("max(-0, $a)", 0, "max(-0, $a)");
+    check_reassociate("min(0, $a)", 0, "min(0, $a)");
+    check_reassociate("max(max($a, -0), $x)", 0, "max(max($a, -0), $x)");
+    check_reassociate("min(min($a, 0), min($x, 1))", 0, "min(min($a, 0), min($x, 1))");
+
+    // sign of a zero result is kept
+    {
+        const char *str = "max(-0, $a)";
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[64] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+        yy_token_t (* volatile max_ptr)(yy_token_t, yy_token_t) = func_max;     // not inlined
+        yy_token_t expected = max_ptr(token_number(-0.0), token_number(0.0));
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        yy_token_t result = yy_eval_stack(&stack, &aux, resolve, NULL);
+        TEST_CHECK(result.type == YY_TOKEN_NUMBER && result.number_val == 0);
+        TEST_CHECK(signbit(result.number_val) == signbit(expected.number_val));
+    }
+
+    // sums and products are opt-in
+    check_reassociate("$x + 1 + 2 + 3", 0, "$x + 1 + 2 + 3");
+    check_reassociate("$x + 1 + 2 + 3", YY_OPTIMIZE_REASSOCIATE, "$x + 6");
+    check_reassociate("1 + $x + 3", YY_OPTIMIZE_REASSOCIATE, "$x + 4");
+    check_reassociate("2 * $x * 3 * $y", YY_OPTIMIZE_REASSOCIATE, "$x * $y * 6");
+    check_reassociate("($x + 1) + ($y + 2)", YY_OPTIMIZE_REASSOCIATE, "$x + $y + 3");
+    check_reassociate("$x + 1 + 2 - 3", YY_OPTIMIZE_REASSOCIATE, "$x + 3 - 3");
+    check_reassociate("$x * 2 + 3 * $y * 4", YY_OPTIMIZE_REASSOCIATE, "$x * 2 + $y * 12");
+    check_reassociate("$x + 1 + $p + 2", YY_OPTIMIZE_REASSOCIATE, "$x + $p + 3");
+    check_reassociate("min($x + 1 + 2, 3)", YY_OPTIMIZE_REASSOCIATE, "min($x + 3, 3)");
+
+    // logical operators (evaluation order preserved)
+    check_reassociate("$m && true && $n", 0, "$m && $n");
+    check_reassociate("$m || false || $n", 0, "$m || $n");
+    check_reassociate("true && $m && $n", 0, "$m && $n");
+    check_reassociate("true && $m", 0, "true && $m");
+    check_reassociate("$m && true", 0, "$m && true");
+    check_reassociate("true && ($x > 1)", 0, "$x > 1");
+    check_reassociate("($x > 1) || false", 0, "$x > 1");
+    check_reassociate("false && $m", 0, "false");
+    check_reassociate("true || $m", 0, "true");
+    check_reassociate("$m && false", 0, "$m && false");
+    check_reassociate("$m && (true && $n)", 0, "$m && (true && $n)");
+    check_reassociate("($m || false) && $n", 0, "$m && $n");
+
+    // compiled stacks (shared subexpressions and jumps)
+    check_reassociate("sqrt($x*$x + 1) + ifelse($m, sqrt($x*$x + 1), 0) + 1 + 2", YY_OPTIMIZE_REASSOCIATE, 
+                      "sqrt($x*$x + 1) + ifelse($m, sqrt($x*$x + 1), 0) + 3");
+
+    // not enough memory
+    {
+        const char *str = "sqrt($x*$x + 1) + sqrt($x*$x + 1) + 1 + 2";
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+
+        TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+
+        uint32_t len = stack.len;
+        stack.reserved = stack.len;
+
+        TEST_CHECK(yy_optimize_stack(&stack, YY_OPTIMIZE_REASSOCIATE) == YY_ERROR_MEM);
+        TEST_CHECK(stack.len == len);
+        TEST_CHECK(yy_optimize_stack(NULL, 0) == YY_ERROR);
+    }
+}
+
+uint32_t count_temps(const yy_stack_t *stack)
+{
+    uint32_t ret = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+        ret += (stack->data[i].type == YY_TOKEN_TEMP);
+
+    return ret;
+}
+
+void check_eval_cse(const char *str, uint32_t expected_temps, int expected_calls, yy_token_t expected)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    int num_calls = 0;
+
+    if (!TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK)) {
+        TEST_MSG("Case='%s', error=compilation failed", str);
+        return;
+    }
+
+    uint32_t num_temps = (data[0].type == YY_TOKEN_JUMP && data[0].jump.opcode == YY_OPCODE_FRAME ? data[0].jump.offset : 0);
+
+    TEST_CHECK(num_temps == expected_temps);
+    TEST_MSG("Case='%s', expected=%u, result=%u", str, expected_temps, num_temps);
+
+    TEST_CHECK(count_temps(&stack) >= num_temps);
+    TEST_MSG("Case='%s', error=unused temporaries", str);
+
+    yy_token_t result = yy_eval_stack(&stack, &aux, resolve_counting, &num_calls);
+
+    if (expected.type == YY_TOKEN_NUMBER)
+        TEST_CHECK(result.type == YY_TOKEN_NUMBER && fabs(result.number_val - expected.number_val) < 1e-12);
+    else
+        TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=unexpected result", str);
+
+    TEST_CHECK(num_calls == expected_calls);
+    TEST_MSG("Case='%s', expected=%d, result=%d", str, expected_calls, num_calls);
+}
+
+void test_eval_cse(void)
+{
+    const double x = 0.5;
+    const double y = M_PI;
+
+    check_eval_cse("$x * $y + 1", 0, 2, token_number(x * y + 1));
+    check_eval_cse("sqrt($x*$x + $y*$y) / sqrt($x*$x + $y*$y + 1)", 1, 4, token_number(sqrt(x*x + y*y) / sqrt(x*x + y*y + 1)));
+    check_eval_cse("($x*$y + 1) * ($x*$y + 1) + $x*$y", 2, 2, token_number((x*y + 1) * (x*y + 1) + x*y));
+    check_eval_cse("abs($x - 1) + abs($x - 1) + abs($x - 1)", 1, 1, token_number(1.5));
+    check_eval_cse("$x*$y + ifelse($m, $x*$y, 0)", 1, 3, token_number(2*x*y));
+    check_eval_cse("ifelse($m, ($x+1)*($x+1), 0)", 1, 2, token_number(2.25));
+    check_eval_cse("($x + 1 > 1) && $m && ($x + 1 > 1)", 1, 2, token_bool(true));
+
+    // first occurrence not always evaluated
+    check_eval_cse("ifelse($m, $x*$y, 0) + $x*$y", 0, 5, token_number(2*x*y));
+    check_eval_cse("ifelse($n, $x*$y, 1) + ifelse($n, $x*$y, 2)", 0, 2, token_number(3));
+    check_eval_cse("$n && ($x + 1 > 1) || ($x + 1 > 1)", 0, 2, token_bool(true));
+
+    // impure functions are not shared
+    check_eval_cse("upper($p) == upper($p)", 0, 2, token_bool(true));
+    check_eval_cse("length(trim($s)) + length(trim($s))", 0, 2, token_number(22));
+
+    // distinct subtrees
+    check_eval_cse("($x + 1) * ($x + 1.0000001)", 0, 2, token_number((x + 1) * (x + 1.0000001)));
+    check_eval_cse("($x + 0) * (0 + $x)", 0, 2, token_number(x * x));
+
+    // bound variables
+    {
+        const char *str = "sqrt($a*$a + $b*$b) / sqrt($a*$a + $b*$b + 1)";
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[64] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+        yy_str_t names[4] = {0};
+        uint32_t num_names = 0;
+        yy_token_t slots[2] = {token_number(3), token_number(4)};
+
+        TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_bind_stack(&stack, names, 4, &num_names) == YY_OK);
+        TEST_CHECK(num_names == 2);
+
+        yy_token_t result = yy_eval_stack_slots(&stack, &aux, slots, 2);
+        TEST_CHECK(result.type == YY_TOKEN_NUMBER && fabs(result.number_val - 5.0 / sqrt(26.0)) < 1e-12);
+    }
+
+    // corrupted stacks
+    {
+        yy_token_t data_aux[8] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+        yy_token_t data1[] = { token_jump(YY_OPCODE_FRAME, 1), token_temp(0) };
+        yy_token_t data2[] = { token_jump(YY_OPCODE_FRAME, 1), token_number(1), token_jump(YY_OPCODE_STORE, 1), token_temp(1) };
+        yy_token_t data3[] = { token_number(1), token_jump(YY_OPCODE_FRAME, 1) };
+        yy_token_t data4[] = { token_jump(YY_OPCODE_FRAME, 9), token_number(1) };
+        yy_stack_t stack1 = {data1, 2, 2};
+        yy_stack_t stack2 = {data2, 4, 4};
+        yy_stack_t stack3 = {data3, 2, 2};
+        yy_stack_t stack4 = {data4, 2, 2};
+
+        TEST_CHECK(yy_eval_stack(&stack1, &aux, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_stack(&stack2, &aux, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_stack(&stack3, &aux, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_stack(&stack4, &aux, resolve, NULL).type == YY_TOKEN_ERROR);
+    }
+}
+
+void check_fold(const char *str, uint32_t flags, uint32_t expected_len, yy_token_t expected)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+    if (!TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK)) {
+        TEST_MSG("Case='%s', error=compilation failed", str);
+        return;
+    }
+
+    TEST_CHECK(stack.reserved == sizeof(data)/sizeof(data[0]));
+
+    if (flags && !TEST_CHECK(yy_optimize_stack(&stack, flags) == YY_OK)) {
+        TEST_MSG("Case='%s', error=optimization failed", str);
+        return;
+    }
+
+    TEST_CHECK(stack.len == expected_len);
+    TEST_MSG("Case='%s', expected=%u, result=%u", str, expected_len, stack.len);
+
+    yy_token_t result = yy_eval_stack(&stack, &aux, resolve, NULL);
+
+    TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=unexpected result", str);
+}
+
+uint32_t count_funcs(const yy_stack_t *stack, yy_token_t (*ptr)())
+{
+    uint32_t num = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+        if (stack->data[i].type == YY_TOKEN_FUNCTION && stack->data[i].function.ptr == (void (*)(void)) ptr)
+            num++;
+
+    return num;
+}
+
+// stack length excluding superinstructions (see fuse_stack())
+uint32_t get_unfused_len(const yy_stack_t *stack)
+{
+    uint32_t len = 0;
+
+    for (uint32_t i = 0; i < stack->len; i++)
+        len += !is_fused_token(&stack->data[i]);
+
+    return len;
+}
+
+void check_simplify(const char *str, uint32_t flags, uint32_t expected_len, yy_token_t expected)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+    if (!TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK)) {
+        TEST_MSG("Case='%s', error=compilation failed", str);
+        return;
+    }
+
+    if (flags && !TEST_CHECK(yy_optimize_stack(&stack, flags) == YY_OK)) {
+        TEST_MSG("Case='%s', error=optimization failed", str);
+        return;
+    }
+
+    TEST_CHECK(get_unfused_len(&stack) == expected_len);
+    TEST_MSG("Case='%s', flags=%u, expected=%u, result=%u", str, flags, expected_len, get_unfused_len(&stack));
+
+    yy_token_t result = yy_eval_stack(&stack, &aux, resolve, NULL);
+
+    if (expected.type == YY_TOKEN_NUMBER)
+        TEST_CHECK(result.type == YY_TOKEN_NUMBER && fabs(result.number_val - expected.number_val) < 1e-12);
+    else
+        TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', flags=%u, error=unexpected result", str, flags);
+}
+
+void test_simplify_algebra(void)
+{
+    const double x = 0.5;
+    const double y = M_PI;
+    const double z = 1.0/3.0;
+    const uint32_t A = YY_OPTIMIZE_ALGEBRAIC;
+    const uint32_t F = YY_OPTIMIZE_FMA;
+
+    // exact rewrites (always done)
+    check_simplify("$x * 1", 0, 2, token_number(x));
+    check_simplify("1 * ($x + $y)", 0, 3, token_number(x + y));
+    check_simplify("$x / 1", 0, 2, token_number(x));
+    check_simplify("$x / 4", 0, 3, token_number(x / 4));
+    check_simplify("$x / 3", 0, 3, token_number(x / 3));
+    check_simplify("$x - 0", 0, 2, token_number(x));
+    check_simplify("-0 + $x", 0, 2, token_number(x));
+    check_simplify("-(-$x)", 0, 2, token_number(x));
+    check_simplify("-(-($x * $y))", 0, 3, token_number(x * y));
+    check_simplify("$x + (-$y)", 0, 3, token_number(x - y));
+    check_simplify("$x - (-$y)", 0, 3, token_number(x + y));
+    check_simplify("$x ^ 1", 0, 2, token_number(x));
+    check_simplify("$x + 0", 0, 3, token_number(x));
+    check_simplify("$x ^ 2", 0, 3, token_number(x * x));
+    check_simplify("$x * $y + $z", 0, 5, token_number(x * y + z));
+
+    // errors are preserved
+    check_simplify("$p * 1", 0, 2, token_error(YY_ERROR_VALUE));
+    check_simplify("-(-$p)", 0, 2, token_error(YY_ERROR_VALUE));
+    check_simplify("$p / 2", 0, 3, token_error(YY_ERROR_VALUE));
+
+    // rewrites changing rounding or signed zeros
+    check_simplify("$x + 0", A, 2, token_number(x));
+    check_simplify("0 + $x", A, 2, token_number(x));
+    check_simplify("$x ^ 2", A, 3, token_number(x * x));
+    check_simplify("pow($y, 3)", A, 3, token_number(y * y * y));
+    check_simplify("$y ^ (-2)", A, 3, token_number(1 / (y * y)));
+    check_simplify("$y ^ 9", A, 3, token_number(pow(y, 9)));
+    check_simplify("$y ^ 2.5", A, 3, token_number(pow(y, 2.5)));
+    check_simplify("($x + $y) ^ 2", A, 7, token_number((x + y) * (x + y)));
+    check_simplify("$p ^ 3", A, 3, token_error(YY_ERROR_VALUE));
+
+    // fused multiply-add
+    check_simplify("$x * $y + $z", F, 4, token_number(fma(x, y, z)));
+    check_simplify("$z + $x * $y", F, 4, token_number(fma(x, y, z)));
+    check_simplify("$x * $y - $z", F, 5, token_number(fma(x, y, -z)));
+    check_simplify("$x * $y + $z * $x", F, 6, token_number(fma(x, y, z * x)));
+    check_simplify("$x * $y + $z", A, 5, token_number(x * y + z));
+
+    // function tokens
+    {
+        const char *str = "pow($r, 2) * 100 / 8 + $r ^ 3";
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(count_funcs(&stack, func_div) == 0);
+        TEST_CHECK(count_funcs(&stack, func_pow) == 2);
+
+        TEST_ASSERT(yy_optimize_stack(&stack, YY_OPTIMIZE_FAST_MATH) == YY_OK);
+        TEST_CHECK(count_funcs(&stack, func_pow) == 0);
+        TEST_CHECK(count_funcs(&stack, func_powi) == 2);
+        TEST_CHECK(count_funcs(&stack, func_fma) == 1);
+    }
+
+    // numeric kernels
+    {
+        const char *str = "$x ^ 3 + $x * $y";
+        const double values[] = {0.0, -0.0, 1.0, -1.0, 0.5, 2.5, -3.75, 7.0, 1e300, INFINITY, NAN, M_PI};
+        const uint32_t num_rows = sizeof(values)/sizeof(values[0]);
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[256] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+        yy_token_t xs[sizeof(values)/sizeof(values[0])] = {0};
+        yy_token_t ys[sizeof(values)/sizeof(values[0])] = {0};
+        yy_token_t results[sizeof(values)/sizeof(values[0])] = {0};
+
+        for (uint32_t i = 0; i < num_rows; i++) {
+            xs[i] = token_number(values[i]);
+            ys[i] = token_number(values[num_rows - 1 - i]);
+        }
+
+        yy_column_t columns[] = { { {"x", 1}, xs }, { {"y", 1}, ys } };
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_ASSERT(yy_optimize_stack(&stack, YY_OPTIMIZE_FAST_MATH) == YY_OK);
+        TEST_CHECK(eval_batch_numeric(&stack, &aux, columns, 2, 0, num_rows, results));
+
+        for (uint32_t i = 0; i < num_rows; i++) {
+            double a = values[i];
+            double b = values[num_rows - 1 - i];
+            double expected = fma(a, b, a * a * a);
+            TEST_CHECK(results[i].type == YY_TOKEN_NUMBER);
+            TEST_CHECK(memcmp(&results[i].number_val, &expected, sizeof(double)) == 0 || (isnan(expected) && isnan(results[i].number_val)));
+            TEST_MSG("row=%u, expected=%g, result=%g", i, expected, results[i].number_val);
+        }
+    }
+}
+
+// resolves a subset of the variables
+yy_token_t resolve_known(yy_str_t var, void *data)
+{
+    UNUSED(data);
+
+    if (var.len == 1 && strchr("abmnpuvd", var.ptr[0]))
+        return resolve(var, NULL);
+
+    return token_error(YY_ERROR_REF);
+}
+
+void check_partial_eval(const char *str, const char *expected_str)
+{
+    yy_token_t data1[64] = {0};
+    yy_stack_t stack1 = {data1, sizeof(data1)/sizeof(data1[0]), 0};
+    yy_token_t data2[64] = {0};
+    yy_stack_t stack2 = {data2, sizeof(data2)/sizeof(data2[0]), 0};
+    yy_token_t data3[64] = {0};
+    yy_stack_t stack3 = {data3, sizeof(data3)/sizeof(data3[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+    if (!TEST_CHECK(yy_compile(str, str + strlen(str), &stack1, NULL) == YY_OK)) {
+        TEST_MSG("Case='%s', error=compilation failed", str);
+        return;
+    }
+
+    if (!TEST_CHECK(yy_partial_eval_stack(&stack1, &stack2, resolve_known, NULL, 0) == YY_OK)) {
+        TEST_MSG("Case='%s', error=partial evaluation failed", str);
+        return;
+    }
+
+    TEST_ASSERT(yy_compile(expected_str, expected_str + strlen(expected_str), &stack3, NULL) == YY_OK);
+
+    TEST_CHECK(equals_stack(&stack2, &stack3));
+    TEST_MSG("Case='%s', expected='%s', len=%u, expected_len=%u", str, expected_str, stack2.len, stack3.len);
+
+    yy_token_t result = yy_eval_stack(&stack2, &aux, resolve, NULL);
+    yy_token_t expected = yy_eval_stack(&stack1, &aux, resolve, NULL);
+
+    TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=distinct results", str);
+}
+
+void test_partial_eval(void)
+{
+    check_partial_eval("$b * $x + $a", "1 * $x + 0");
+    check_partial_eval("$x * ($b + 1) - $a", "$x * 2 - 0");
+    check_partial_eval("$b + $b * 2", "3");
+    check_partial_eval("$x + $y", "$x + $y");
+    check_partial_eval("$m && $x > 0", "$x > 0");
+    check_partial_eval("$n && $x > 0", "false");
+    check_partial_eval("$x > 0 || $n", "$x > 0");
+    check_partial_eval("upper($p) + \"!\"", "upper(\"Bob\") + \"!\"");
+    check_partial_eval("\"Hi \" + lower($p)", "\"Hi \" + lower(\"Bob\")");
+    check_partial_eval("datepart($d, \"year\") + $x", "2024 + $x");
+    check_partial_eval("$u + $b", "$u + 1");
+    check_partial_eval("min(min($x, $b), $a)", "min(min($x, 1), 0)");
+    check_partial_eval("max(max($x, $b), $b)", "max($x, 1)");
+    check_partial_eval("($b + $x) * ($b + $x)", "(1 + $x) * (1 + $x)");
+    check_partial_eval("ifelse($m, $x * $y, $y) + $b", "$x * $y + 1");
+
+    // created strings folded on request
+    {
+        const char *str = "upper($p) + \"!\"";
+        yy_token_t data1[64] = {0};
+        yy_stack_t stack1 = {data1, sizeof(data1)/sizeof(data1[0]), 0};
+        yy_token_t data2[64] = {0};
+        yy_stack_t stack2 = {data2, sizeof(data2)/sizeof(data2[0]), 0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack1, NULL) == YY_OK);
+        TEST_CHECK(yy_partial_eval_stack(&stack1, &stack2, resolve_known, NULL, YY_OPTIMIZE_FOLD_STRINGS) == YY_OK);
+        TEST_CHECK(stack2.len == 1 && equals_token(data2[0], token_string("BOB!", 4)));
+        TEST_CHECK(stack2.reserved < sizeof(data2)/sizeof(data2[0]));
+    }
+
+    // in place
+    {
+        const char *str = "sqrt($b*$b + $x*$x) / $b";
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[64] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_partial_eval_stack(&stack, &stack, resolve_known, NULL, 0) == YY_OK);
+        TEST_CHECK(get_unfused_len(&stack) == 6);
+
+        yy_token_t result = yy_eval_stack(&stack, &aux, resolve, NULL);
+        TEST_CHECK(result.type == YY_TOKEN_NUMBER && fabs(result.number_val - sqrt(1.25)) < 1e-12);
+    }
+
+    // invalid arguments
+    {
+        yy_token_t data1[] = { token_variable("x", 1), token_variable("b", 1), symbol_to_token[YY_SYMBOL_ADDITION_OP] };
+        yy_stack_t stack1 = {data1, 3, 3};
+        yy_token_t data2[2] = {0};
+        yy_stack_t stack2 = {data2, 2, 0};
+
+        TEST_CHECK(yy_partial_eval_stack(NULL, &stack2, resolve_known, NULL, 0) == YY_ERROR);
+        TEST_CHECK(yy_partial_eval_stack(&stack1, NULL, resolve_known, NULL, 0) == YY_ERROR);
+        TEST_CHECK(yy_partial_eval_stack(&stack1, &stack2, NULL, NULL, 0) == YY_ERROR);
+        TEST_CHECK(yy_partial_eval_stack(&stack1, &stack2, resolve_known, NULL, 0) == YY_ERROR_MEM);
+    }
+}
+
+void test_prune_branches(void)
+{
+    const double x = 0.5;
+    const double y = M_PI;
+
+    check_simplify("ifelse(true, $x * 2, $y)", 0, 3, token_number(x * 2));
+    check_simplify("ifelse(false, $x, $y + 1)", 0, 3, token_number(y + 1));
+    check_simplify("ifelse(1 < 2, upper($p), $q)", 0, 2, token_string("BOB", 3));
+    check_simplify("ifelse(true, 2, $x) + 1", 0, 1, token_number(3));
+    check_simplify("ifelse(false, ifelse($m, 1, 2), ifelse(true, $y * 2, 0)) * 3", 0, 5, token_number(y * 6));
+
+    // taken branch can return an error distinct than YY_ERROR_VALUE
+    check_simplify("ifelse(true, $x, $y * 2 + 1)", 0, 6, token_number(x));
+    check_simplify("ifelse(false, $y * 2 + 1, $x)", 0, 6, token_number(x));
+    check_simplify("ifelse(true, $k, $y * 2)", 0, 6, token_error(YY_ERROR_VALUE));
+    check_simplify("ifelse(true, $w, $y * 2)", 0, 6, token_error(YY_ERROR_CREF));
+    check_simplify("ifelse(true, $x, 1)", 0, 6, token_number(x));
+
+    // absorbing values of && and ||
+    check_simplify("false && $x > 1", 0, 1, token_bool(false));
+    check_simplify("true || $x > 1", 0, 1, token_bool(true));
+    check_simplify("ifelse(false && $m, $x, $y * 2)", 0, 3, token_number(y * 2));
+
+    // conditions known after partial evaluation
+    check_partial_eval("ifelse($m, $x * 2, $y)", "$x * 2");
+    check_partial_eval("ifelse($n, $x, $y + $b)", "$y + 1");
+    check_partial_eval("ifelse($m && $b > 0, \"on\", $q)", "\"on\"");
+    check_partial_eval("ifelse($n || $a > 0, $x, $y * 2) + $b", "$y * 2 + 1");
+    check_partial_eval("$n && $x > 0 || $y > 1", "$y > 1");
+
+    // condition is not a bool
+    {
+        const char *str = "ifelse($b, $x, $y) + 1";
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_partial_eval_stack(&stack, &stack, resolve_known, NULL, 0) == YY_OK);
+        TEST_CHECK(stack.len == 3);
+        TEST_CHECK(data[0].type == YY_TOKEN_ERROR && data[0].error == YY_ERROR_VALUE);
+    }
+}
+
+void check_canonical(const char *str1, const char *str2, bool same)
+{
+    const char *strs[2] = {str1, str2};
+    yy_token_t data[2][64];
+    yy_token_t canonical[2][64];
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    yy_stack_t stacks[2] = {0};
+    yy_fingerprint_t fingerprints[2] = {0};
+
+    memset(data, 0x00, sizeof(data));
+    memset(canonical, 0x00, sizeof(canonical));
+
+    for (int i = 0; i < 2; i++)
+    {
+        yy_stack_t stack = {data[i], 64, 0};
+
+        stacks[i] = (yy_stack_t){canonical[i], 64, 0};
+
+        TEST_ASSERT(yy_compile(strs[i], strs[i] + strlen(strs[i]), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_canonicalize_stack(&stack, &stacks[i]) == YY_OK);
+        TEST_MSG("Case='%s', error=canonicalization failed", strs[i]);
+        TEST_CHECK(yy_fingerprint_stack(&stacks[i], &fingerprints[i]) == YY_OK);
+
+        yy_token_t expected = yy_eval_stack(&stack, &aux, resolve, NULL);
+        yy_token_t result = yy_eval_stack(&stacks[i], &aux, resolve, NULL);
+
+        TEST_CHECK(equals_token(result, expected));
+        TEST_MSG("Case='%s', error=distinct results", strs[i]);
+    }
+
+    TEST_CHECK(equals_stack(&stacks[0], &stacks[1]) == same);
+    TEST_CHECK((fingerprints[0].hi == fingerprints[1].hi && fingerprints[0].lo == fingerprints[1].lo) == same);
+    TEST_MSG("Case='%s' vs '%s', error=unexpected fingerprint", str1, str2);
+}
+
+void test_canonicalize(void)
+{
+    check_canonical("$x * $y + 1", "  1 + (($y) * ($x)) ", true);
+    check_canonical("$m && True", "$m && true", true);
+    check_canonical("pow($x, 2) + $c", "$c + $x^2", true);
+    check_canonical("min($x, $y) == max($z, $a)", "max($z, $a) == min($x, $y)", true);
+    check_canonical("min($x, $y)", "min($y, $x)", false);
+    check_canonical("max(-0, $a)", "max($a, -0)", false);
+    check_canonical("$p != $q", "$q != $p", true);
+    check_canonical("$x * $y + $y * $x", "$y * $x * 2", false);
+    check_canonical("ifelse($m, $x + $y, $c * $a)", "ifelse($m, $y + $x, $a * $c)", true);
+    check_canonical("$x * $y + $y * $x > 1", "$y * $x + $x * $y > 1", true);
+    check_canonical("$x - $y", "$y - $x", false);
+    check_canonical("$x / 2", "2 / $x", false);
+    check_canonical("upper($p) + $q", "$q + upper($p)", false);
+    check_canonical("$m && $n", "$n && $m", false);
+    check_canonical("$v && false", "false && $v", false);
+    check_canonical("$x + $y + $z", "$z + ($y + $x)", true);
+    check_canonical("$x + $y + $z", "$x + ($y + $z)", false);
+
+    // fingerprint doesn't depend on the memory location
+    {
+        char text[64] = {0};
+        const char *str = "upper($p) + \"abc\" + $q";
+        yy_token_t data1[64] = {0};
+        yy_stack_t stack1 = {data1, sizeof(data1)/sizeof(data1[0]), 0};
+        yy_token_t data2[64] = {0};
+        yy_stack_t stack2 = {data2, sizeof(data2)/sizeof(data2[0]), 0};
+        yy_fingerprint_t fingerprint1 = {0};
+        yy_fingerprint_t fingerprint2 = {0};
+
+        strcpy(text, str);
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack1, NULL) == YY_OK);
+        TEST_ASSERT(yy_compile(text, text + strlen(text), &stack2, NULL) == YY_OK);
+        TEST_CHECK(yy_fingerprint_stack(&stack1, &fingerprint1) == YY_OK);
+        TEST_CHECK(yy_fingerprint_stack(&stack2, &fingerprint2) == YY_OK);
+        TEST_CHECK(fingerprint1.hi == fingerprint2.hi && fingerprint1.lo == fingerprint2.lo);
+
+        // in-place
+        TEST_CHECK(yy_canonicalize_stack(&stack2, &stack2) == YY_OK);
+        TEST_CHECK(equals_stack(&stack1, &stack2));
+    }
+
+    // invalid arguments
+    {
+        const char *str = "$y * $x";
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data2[2] = {0};
+        yy_stack_t output = {data2, sizeof(data2)/sizeof(data2[0]), 0};
+        yy_stack_t empty = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_fingerprint_t fingerprint = {0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_canonicalize_stack(NULL, &output) == YY_ERROR);
+        TEST_CHECK(yy_canonicalize_stack(&stack, NULL) == YY_ERROR);
+        TEST_CHECK(yy_canonicalize_stack(&empty, &output) == YY_ERROR);
+        TEST_CHECK(yy_canonicalize_stack(&stack, &output) == YY_ERROR_MEM);
+        TEST_CHECK(yy_fingerprint_stack(NULL, &fingerprint) == YY_ERROR);
+        TEST_CHECK(yy_fingerprint_stack(&stack, NULL) == YY_ERROR);
+
+        // empty stack has the FNV-1a offset basis
+        TEST_CHECK(yy_fingerprint_stack(&empty, &fingerprint) == YY_OK);
+        TEST_CHECK(fingerprint.hi == 0x6C62272E07BB0142ULL && fingerprint.lo == 0x62B821756295C58DULL);
+    }
+
+    // FNV-1a 128 test vector
+    {
+        yy_fingerprint_t hash = {.hi = 0x6C62272E07BB0142ULL, .lo = 0x62B821756295C58DULL};
+
+        hash_bytes(&hash, "foobar", 6);
+        TEST_CHECK(hash.hi == 0x343E1662793C64BFULL && hash.lo == 0x6F0D3597BA446F18ULL);
+    }
+}
+
+// domains contain the values returned by resolve()
+const yy_domain_t test_domains[] = {
+    { {"a", 1}, {YY_TOKEN_NUMBER, 0, 150, false, false} },
+    { {"b", 1}, {YY_TOKEN_NUMBER, 1, 1, false, false} },
+    { {"c", 1}, {YY_TOKEN_NUMBER, 0, 5, false, false} },
+    { {"m", 1}, {YY_TOKEN_BOOL, 0, 1, false, false} },
+    { {"x", 1}, {YY_TOKEN_NUMBER, -1, 1, false, false} },
+    { {"z", 1}, {YY_TOKEN_NUMBER, 0, 1, true, false} },
+};
+
+void check_range(const char *str, yy_token_e type, double min, double max, bool maybe_nan, bool maybe_error)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    uint32_t num_domains = sizeof(test_domains)/sizeof(test_domains[0]);
+    yy_range_t range = {0};
+
+    if (!TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK)) {
+        TEST_MSG("Case='%s', error=compilation failed", str);
+        return;
+    }
+
+    TEST_ASSERT(yy_eval_stack_range(&stack, test_domains, num_domains, &range) == YY_OK);
+
+    TEST_CHECK(range.type == type && range.maybe_nan == maybe_nan && range.maybe_error == maybe_error);
+    TEST_MSG("Case='%s', type=%d, maybe_nan=%d, maybe_error=%d", str, (int) range.type, range.maybe_nan, range.maybe_error);
+
+    if (type == YY_TOKEN_NUMBER || type == YY_TOKEN_BOOL) {
+        TEST_CHECK(range.min == min && range.max == max);
+        TEST_MSG("Case='%s', min=%g, max=%g, expected_min=%g, expected_max=%g", str, range.min, range.max, min, max);
+    }
+
+    // result is in range
+    yy_token_t result = yy_eval_stack(&stack, &aux, resolve, NULL);
+
+    if (result.type == YY_TOKEN_ERROR)
+        TEST_CHECK(range.maybe_error);
+    else if (result.type == YY_TOKEN_NUMBER && isnan(result.number_val))
+        TEST_CHECK(range.maybe_nan);
+    else if (result.type == YY_TOKEN_NUMBER)
+        TEST_CHECK(range.min <= result.number_val && result.number_val <= range.max);
+    else if (result.type == YY_TOKEN_BOOL)
+        TEST_CHECK(range.min <= result.bool_val && result.bool_val <= range.max);
+
+    TEST_MSG("Case='%s', error=result out of range", str);
+}
+
+void test_eval_range(void)
+{
+    // always true or false
+    check_range("$a < 200", YY_TOKEN_BOOL, 1, 1, false, false);
+    check_range("$a > 150", YY_TOKEN_BOOL, 0, 0, false, false);
+    check_range("$a >= 18", YY_TOKEN_BOOL, 0, 1, false, false);
+    check_range("$a >= 0 && $x <= 1", YY_TOKEN_BOOL, 1, 1, false, false);
+    check_range("$a > 200 && $w", YY_TOKEN_BOOL, 0, 0, false, false);
+    check_range("$a > 10 && $w", YY_TOKEN_BOOL, 0, 1, false, true);
+    check_range("$a < 0 || $x != 5", YY_TOKEN_BOOL, 1, 1, false, false);
+    check_range("not($m) || $m", YY_TOKEN_BOOL, 0, 1, false, false);
+    check_range("$a * 2 + 1 > 301", YY_TOKEN_BOOL, 0, 0, false, false);
+    check_range("$z < 2", YY_TOKEN_BOOL, 0, 1, false, false);
+    check_range("$c == 7", YY_TOKEN_BOOL, 0, 0, false, false);
+    check_range("$b == 1", YY_TOKEN_BOOL, 1, 1, false, false);
+
+    // numbers
+    check_range("$a * 2 + 1", YY_TOKEN_NUMBER, 1, 301, false, false);
+    check_range("$x * $c - $b", YY_TOKEN_NUMBER, -6, 4, false, false);
+    check_range("$a / ($x + 2)", YY_TOKEN_NUMBER, 0, 150, false, false);
+    check_range("$a / $x", YY_TOKEN_NUMBER, -INFINITY, INFINITY, true, false);
+    check_range("-abs($x) + $b", YY_TOKEN_NUMBER, 0, 1, false, false);
+    check_range("sqrt($c) * 0 + floor($x + 0.5)", YY_TOKEN_NUMBER, -1, 1, false, false);
+    check_range("sqrt($x)", YY_TOKEN_NUMBER, 0, 1, true, false);
+    check_range("sin($a) + cos($x)", YY_TOKEN_NUMBER, -2, 2, false, false);
+    check_range("$a % 7", YY_TOKEN_NUMBER, 0, 7, false, false);
+    check_range("min($a, 100) + max($x, 0)", YY_TOKEN_NUMBER, 0, 101, false, false);
+    check_range("clamp($a, 10, 20)", YY_TOKEN_NUMBER, 10, 20, false, false);
+    check_range("max($z, 0.5)", YY_TOKEN_NUMBER, 0.5, 1, false, false);
+    check_range("$z + $b", YY_TOKEN_NUMBER, 1, 2, true, false);
+    check_range("ifelse($a > 200, $w, $x)", YY_TOKEN_NUMBER, -1, 1, false, false);
+    check_range("ifelse($m, $x, $c)", YY_TOKEN_NUMBER, -1, 5, false, false);
+    check_range("($a + 1) * ($a + 1) > 0", YY_TOKEN_BOOL, 1, 1, false, false);
+
+    // transcendental functions are widened
+    {
+        const char *str = "$c ^ 2 + exp($x)";
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_range_t range = {0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_ASSERT(yy_eval_stack_range(&stack, test_domains, sizeof(test_domains)/sizeof(test_domains[0]), &range) == YY_OK);
+        TEST_CHECK(range.type == YY_TOKEN_NUMBER && !range.maybe_nan && !range.maybe_error);
+        TEST_CHECK(range.min < exp(-1) && range.min > exp(-1) - 1e-12);
+        TEST_CHECK(range.max > 25 + exp(1) && range.max < 25 + exp(1) + 1e-12);
+    }
+
+    // nan and inf checks
+    check_range("isnan($a)", YY_TOKEN_BOOL, 0, 0, false, false);
+    check_range("isnan($z)", YY_TOKEN_BOOL, 0, 1, false, false);
+    check_range("isinf($a * $x)", YY_TOKEN_BOOL, 0, 0, false, false);
+    check_range("isinf(1 / $x)", YY_TOKEN_BOOL, 0, 1, false, false);
+
+    // errors and unknown variables
+    check_range("iserror($a)", YY_TOKEN_BOOL, 0, 0, false, false);
+    check_range("iserror($v)", YY_TOKEN_BOOL, 0, 1, false, true);
+    check_range("$y + 1", YY_TOKEN_NUMBER, -INFINITY, INFINITY, true, true);
+    check_range("$y", YY_TOKEN_NULL, 0, 0, true, true);
+    check_range("$a + $m", YY_TOKEN_ERROR, 0, 0, false, true);
+    check_range("upper($p)", YY_TOKEN_STRING, 0, 0, false, true);
+
+    // bound stack
+    {
+        const char *str = "$x * 10 < $a + 11";
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_str_t names[4] = {0};
+        uint32_t num_names = 0;
+        yy_domain_t domains[2] = { test_domains[4], test_domains[0] };
+        yy_range_t range = {0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_ASSERT(yy_bind_stack(&stack, names, 4, &num_names) == YY_OK);
+        TEST_CHECK(yy_eval_stack_range(&stack, domains, 2, &range) == YY_OK);
+        TEST_CHECK(range.type == YY_TOKEN_BOOL && range.min == 1 && range.max == 1 && !range.maybe_error);
+        TEST_CHECK(yy_eval_stack_range(&stack, domains, 1, &range) == YY_OK);
+        TEST_CHECK(range.type == YY_TOKEN_BOOL && range.min == 0 && range.max == 1 && range.maybe_error);
+    }
+
+    // invalid arguments
+    {
+        yy_token_t data[] = { token_variable("x", 1), symbol_to_token[YY_SYMBOL_ADDITION_OP] };
+        yy_stack_t stack = {data, 2, 2};
+        yy_range_t range = {0};
+
+        TEST_CHECK(yy_eval_stack_range(NULL, NULL, 0, &range) == YY_ERROR);
+        TEST_CHECK(yy_eval_stack_range(&stack, NULL, 1, &range) == YY_ERROR);
+        TEST_CHECK(yy_eval_stack_range(&stack, NULL, 0, NULL) == YY_ERROR);
+        TEST_CHECK(yy_eval_stack_range(&stack, NULL, 0, &range) == YY_ERROR_EVAL);
+    }
+}
+
+void check_narrow(const char *str, const char *expected_str)
+{
+    yy_token_t data1[64] = {0};
+    yy_stack_t stack1 = {data1, sizeof(data1)/sizeof(data1[0]), 0};
+    yy_token_t data2[64] = {0};
+    yy_stack_t stack2 = {data2, sizeof(data2)/sizeof(data2[0]), 0};
+    yy_token_t data3[64] = {0};
+    yy_stack_t stack3 = {data3, sizeof(data3)/sizeof(data3[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+    TEST_ASSERT(yy_compile(str, str + strlen(str), &stack1, NULL) == YY_OK);
+    TEST_ASSERT(yy_compile(str, str + strlen(str), &stack2, NULL) == YY_OK);
+
+    if (!TEST_CHECK(yy_narrow_stack(&stack2, test_domains, sizeof(test_domains)/sizeof(test_domains[0]), 0) == YY_OK)) {
+        TEST_MSG("Case='%s', error=narrowing failed", str);
+        return;
+    }
+
+    TEST_ASSERT(yy_compile(expected_str, expected_str + strlen(expected_str), &stack3, NULL) == YY_OK);
+
+    TEST_CHECK(equals_stack(&stack2, &stack3));
+    TEST_MSG("Case='%s', expected='%s', len=%u, expected_len=%u", str, expected_str, stack2.len, stack3.len);
+
+    yy_token_t result = yy_eval_stack(&stack2, &aux, resolve, NULL);
+    yy_token_t expected = yy_eval_stack(&stack1, &aux, resolve, NULL);
+
+    TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=distinct results", str);
+}
+
+yy_token_t resolve_dates(yy_str_t var, void *data)
+{
+    UNUSED(data);
+
+    if (var.len == 1 && var.ptr[0] == 'd')
+        return token_datetime(1724457600000);   // 2024-08-24
+
+    if (var.len == 1 && var.ptr[0] == 'e')
+        return token_datetime(951782400000);    // 2000-02-29
+
+    return token_error(YY_ERROR_REF);
+}
+
+void test_narrow(void)
+{
+    check_narrow("isnan($a) || $y > 1", "$y > 1");
+    check_narrow("$a >= 0 && $y > 1", "$y > 1");
+    check_narrow("$a < 200", "true");
+    check_narrow("ifelse($a > 200, $y, $x + 1)", "$x + 1");
+    check_narrow("ifelse(isinf($x), 0, $y / $x)", "$y / $x");
+    check_narrow("ifelse(isnan($z), 0, $z)", "ifelse(isnan($z), 0, $z)");
+    check_narrow("$b * $y", "1 * $y");
+    check_narrow("$x * 0 + $y", "$x * 0 + $y");
+    check_narrow("$c + 1 < 10 && $m", "true && $m");
+    check_narrow("$y > 1", "$y > 1");
+    check_narrow("iserror(clamp(5, 2 / $x, 3))", "iserror(clamp(5, 2 / $x, 3))");
+
+    // datetime clamp bounds are unknown (vmin > vmax is an error)
+    {
+        const char *str = "iserror(clamp($d, $d, $e))";
+        yy_domain_t domains[] = {
+            { {"d", 1}, {YY_TOKEN_DATETIME, 0, 0, false, false} },
+            { {"e", 1}, {YY_TOKEN_DATETIME, 0, 0, false, false} },
+        };
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[64] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(equals_token(yy_eval_stack(&stack, &aux, resolve_dates, NULL), token_bool(true)));
+        TEST_CHECK(yy_narrow_stack(&stack, domains, 2, 0) == YY_OK);
+        TEST_CHECK(equals_token(yy_eval_stack(&stack, &aux, resolve_dates, NULL), token_bool(true)));
+    }
+
+    // division by a zero range reaches both infinities (-1 * $a is -0)
+    {
+        const char *str = "1 / (-1 * $a) < 0";
+        yy_domain_t domains[] = { { {"a", 1}, {YY_TOKEN_NUMBER, 0, 0, false, false} } };
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[64] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(equals_token(yy_eval_stack(&stack, &aux, resolve, NULL), token_bool(true)));
+        TEST_CHECK(yy_narrow_stack(&stack, domains, 1, 0) == YY_OK);
+        TEST_CHECK(equals_token(yy_eval_stack(&stack, &aux, resolve, NULL), token_bool(true)));
+    }
+
+    // invalid arguments
+    {
+        yy_token_t data[] = { token_variable("x", 1), token_variable("b", 1), symbol_to_token[YY_SYMBOL_ADDITION_OP] };
+        yy_stack_t stack = {data, 3, 3};
+
+        TEST_CHECK(yy_narrow_stack(NULL, test_domains, 1, 0) == YY_ERROR);
+        TEST_CHECK(yy_narrow_stack(&stack, NULL, 1, 0) == YY_ERROR);
+        TEST_CHECK(yy_narrow_stack(&stack, NULL, 0, 0) == YY_OK);
+    }
+}
+
+void check_adaptive(const char *str, const char *expected_str)
+{
+    yy_token_t data1[64] = {0};
+    yy_stack_t stack1 = {data1, sizeof(data1)/sizeof(data1[0]), 0};
+    yy_token_t data2[64] = {0};
+    yy_stack_t stack2 = {data2, sizeof(data2)/sizeof(data2[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    uint32_t counts[128] = {0};
+    yy_profile_t profile = {counts, sizeof(counts)/sizeof(counts[0]), 4, 0};
+
+    TEST_ASSERT(yy_compile(str, str + strlen(str), &stack1, NULL) == YY_OK);
+    TEST_ASSERT(yy_compile(expected_str, expected_str + strlen(expected_str), &stack2, NULL) == YY_OK);
+
+    yy_token_t expected = yy_eval_stack(&stack1, &aux, resolve, NULL);
+
+    for (int i = 0; i < 8; i++)
+    {
+        yy_token_t result = yy_eval_stack_adaptive(&stack1, &aux, resolve, NULL, &profile);
+
+        if (!TEST_CHECK(equals_token(result, expected))) {
+            TEST_MSG("Case='%s', iter=%d, error=distinct results", str, i);
+            return;
+        }
+    }
+
+    TEST_CHECK(equals_stack(&stack1, &stack2));
+    TEST_MSG("Case='%s', expected='%s'", str, expected_str);
+}
+
+void test_eval_adaptive(void)
+{
+    check_adaptive("$y > 1 && $x > 1", "$x > 1 && $y > 1");
+    check_adaptive("$x > 1 || $y > 1", "$y > 1 || $x > 1");
+    check_adaptive("$y > 1 && $z < 1 && $x > 1", "$x > 1 && $y > 1 && $z < 1");
+    check_adaptive("$z > 1 || $y > 1 || $x < 1", "$y > 1 || $x < 1 || $z > 1");
+    check_adaptive("upper($p) == \"BOB\" || $x < 1", "$x < 1 || upper($p) == \"BOB\"");
+    check_adaptive("($y > 1 || $x > 1) && ($z > 1 && $b > 0)", "($z > 1 && $b > 0) && ($y > 1 || $x > 1)");
+    check_adaptive("$x > 1 && $y > 1", "$x > 1 && $y > 1");
+    check_adaptive("$x * $y < 5 && $x * $y > 5", "$x * $y < 5 && $x * $y > 5");
+    check_adaptive("$a + 1", "$a + 1");
+
+    // period = 0 (never reordered)
+    {
+        const char *str = "$y > 1 && $x > 1";
+        yy_token_t data[32] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[32] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+        uint32_t counts[64] = {0};
+        yy_profile_t profile = {counts, 64, 0, 0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+
+        for (int i = 0; i < 8; i++)
+            TEST_CHECK(yy_eval_stack_adaptive(&stack, &aux, resolve, NULL, &profile).type == YY_TOKEN_BOOL);
+
+        TEST_CHECK(data[0].type == YY_TOKEN_JUMP && data[0].jump.opcode == YY_OPCODE_FUSED_GT);
+        TEST_CHECK(data[1].type == YY_TOKEN_VARIABLE && data[1].variable.ptr[0] == 'y');
+        TEST_CHECK(counts[0] == 0 && profile.num_evals == 0);
+    }
+
+    // invalid arguments
+    {
+        yy_token_t data[] = { token_variable("x", 1), token_variable("y", 1), symbol_to_token[YY_SYMBOL_ADDITION_OP] };
+        yy_stack_t stack = {data, 3, 3};
+        yy_token_t data_aux[8] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+        uint32_t counts[6] = {0};
+        yy_profile_t profile = {counts, 6, 1, 0};
+        yy_profile_t small = {counts, 5, 1, 0};
+
+        TEST_CHECK(yy_eval_stack_adaptive(NULL, &aux, resolve, NULL, &profile).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_stack_adaptive(&stack, &aux, resolve, NULL, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_stack_adaptive(&stack, &aux, resolve, NULL, &small).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_stack_adaptive(&stack, &aux, resolve, NULL, &profile).type == YY_TOKEN_NUMBER);
+    }
+}
+
+void check_fused(const char *str, uint32_t expected_fused, yy_token_t expected)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+    if (!TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK)) {
+        TEST_MSG("Case='%s', error=compilation failed", str);
+        return;
+    }
+
+    TEST_CHECK(stack.len - get_unfused_len(&stack) == expected_fused);
+    TEST_MSG("Case='%s', expected=%u, result=%u", str, expected_fused, stack.len - get_unfused_len(&stack));
+
+    yy_token_t result = yy_eval_stack(&stack, &aux, resolve, NULL);
+
+    if (expected.type == YY_TOKEN_NUMBER)
+        TEST_CHECK(result.type == YY_TOKEN_NUMBER && fabs(result.number_val - expected.number_val) < 1e-12);
+    else
+        TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=unexpected result", str);
+}
+
+void test_fuse_stack(void)
+{
+    check_fused("$x < 1", 1, token_bool(true));
+    check_fused("1 <= $x", 1, token_bool(false));
+    check_fused("$x * $y", 1, token_number(0.5 * M_PI));
+    check_fused("$x * $y + $z", 1, token_number(0.5 * M_PI + 1.0/3.0));
+    check_fused("$x - 1 == $z / 2", 2, token_bool(false));
+    check_fused("$y != 3 && $x >= 1", 2, token_bool(false));
+    check_fused("$x > 1 || $y > 3", 2, token_bool(true));
+    check_fused("ifelse($m, $x + 1, $y - 1)", 2, token_number(1.5));
+    check_fused("ifelse($n, $x + 1, $y - 1)", 2, token_number(M_PI - 1));
+    check_fused("ifelse($x > 1, $x + 1, $y - 1) * 2", 3, token_number(2 * (M_PI - 1)));
+    check_fused("$x * $y + $x * $y", 1, token_number(M_PI));
+    check_fused("$d == $d", 1, token_bool(true));
+    check_fused("$m == $n", 1, token_bool(false));
+    check_fused("$p + 1", 1, token_error(YY_ERROR_VALUE));
+    check_fused("$v * 2", 1, token_error(YY_ERROR_VALUE));
+    check_fused("$u + 1", 1, token_error(YY_ERROR_SYNTAX));
+    check_fused("$q != $p", 1, token_bool(true));
+    check_fused("ifelse($m, $p, \"\") == upper($q)", 0, token_bool(false));
+    check_fused("1 + 2", 0, token_number(3));
+
+    // bound variables
+    {
+        const char *str = "$x * $y < 2";
+        yy_token_t data[16] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[16] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+        yy_str_t names[2] = {0};
+        uint32_t num_names = 0;
+        yy_token_t slots[2] = { token_number(0.5), token_number(M_PI) };
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(data[0].type == YY_TOKEN_JUMP && data[0].jump.opcode == YY_OPCODE_FUSED_MUL);
+        TEST_ASSERT(yy_bind_stack(&stack, names, 2, &num_names) == YY_OK);
+        TEST_CHECK(equals_token(yy_eval_stack_slots(&stack, &aux, slots, num_names), token_bool(true)));
+        TEST_CHECK(equals_token(yy_eval_stack_slots(&stack, &aux, slots, 1), token_error(YY_ERROR_VALUE)));
+    }
+
+    // stack full (not fused)
+    {
+        yy_token_t data[] = { token_variable("x", 1), token_variable("y", 1), symbol_to_token[YY_SYMBOL_PRODUCT_OP] };
+        yy_stack_t stack = {data, 3, 3};
+
+        fuse_stack(&stack);
+        TEST_CHECK(stack.len == 3 && data[0].type == YY_TOKEN_VARIABLE);
+    }
+
+    // not enough memory
+    {
+        const char *str = "$x * $y";
+        yy_token_t data[8] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[1] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(equals_token(yy_eval_stack(&stack, &aux, resolve, NULL), token_error(YY_ERROR_MEM)));
+    }
+}
+
+void check_program(const char *str, uint32_t expected_len)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    yy_instr_t code[128] = {0};
+    yy_program_t program = {code, sizeof(code)/sizeof(code[0]), 0, 0, 0, NULL};
+
+    TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+
+    if (!TEST_CHECK(yy_compile_program(&stack, &program) == YY_OK)) {
+        TEST_MSG("Case='%s', error=program compilation failed", str);
+        return;
+    }
+
+    if (expected_len) {
+        TEST_CHECK(program.len == expected_len);
+        TEST_MSG("Case='%s', expected=%u, len=%u", str, expected_len, program.len);
+    }
+
+    yy_token_t expected = yy_eval_stack(&stack, &aux, resolve, NULL);
+    yy_token_t result = yy_eval_program(&program, &aux, resolve, NULL);
+
+    TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=distinct results", str);
+}
+
+void test_eval_program(void)
+{
+    check_program("$x * 2 + $y * 3", 3);
+    check_program("($x + 1) * ($y - 2) / ($z + 3)", 5);
+    check_program("$x", 1);
+    check_program("1", 1);
+    check_program("-$x", 1);
+    check_program("sqrt($x * $x + $y * $y)", 4);
+    check_program("$x < 1 && $y > 3", 0);
+    check_program("$x > 1 || $y > 3", 0);
+    check_program("$m && $n", 0);
+    check_program("$p && $m", 0);
+    check_program("$m || $p", 0);
+    check_program("ifelse($m, $x + 1, $y - 1)", 0);
+    check_program("ifelse($n, $x + 1, $y - 1)", 0);
+    check_program("ifelse($p, $x + 1, $y - 1)", 0);
+    check_program("ifelse($m, 1, $u)", 0);
+    check_program("ifelse($x > 1, ifelse($m, $x, $z), ifelse($n, 2, $y)) * 2", 0);
+    check_program("$a + ifelse($m, $b, $c) + $x", 0);
+    check_program("$x * $y + $x * $y", 0);
+    check_program("max($x * $y, $z) + min($a, $b)", 0);
+    check_program("1 / max(-0, $a)", 0);
+    check_program("1 / max($a, -0)", 0);
+    check_program("1 / min(-0, $a) < 1 / min($a, -0)", 0);
+
+    // equal numbers (+0 and -0) return the first operand in all evaluators
+    TEST_CHECK(signbit(func_max(token_number(-0.0), token_number(0.0)).number_val));
+    TEST_CHECK(!signbit(func_max(token_number(0.0), token_number(-0.0)).number_val));
+    TEST_CHECK(signbit(func_min(token_number(-0.0), token_number(0.0)).number_val));
+    TEST_CHECK(!signbit(func_min(token_number(0.0), token_number(-0.0)).number_val));
+    check_program("clamp($y, $a, $b)", 0);
+    check_program("upper($p) + \" \" + lower($q)", 0);
+    check_program("length(trim(\"  \" + $p + \"  \")) * 2", 0);
+    check_program("$q != $p && length($s) > 5", 0);
+    check_program("datepart($d, \"year\") + $x", 0);
+    check_program("$u + $w", 0);
+    check_program("$w + sqrt($u)", 0);
+    check_program("$v * 2", 0);
+    check_program("$k + 1", 0);
+    check_program("$m == $n", 0);
+
+    // invalid arguments
+    {
+        const char *str = "$x * $y + $z";
+        yy_token_t data[16] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[16] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+        yy_instr_t code[8] = {0};
+        yy_program_t program = {code, 1, 0, 0, 0, NULL};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_compile_program(NULL, &program) == YY_ERROR);
+        TEST_CHECK(yy_compile_program(&stack, NULL) == YY_ERROR);
+        TEST_CHECK(yy_compile_program(&stack, &program) == YY_ERROR_MEM);
+
+        program.reserved = 8;
+        TEST_CHECK(yy_compile_program(&stack, &program) == YY_OK);
+        TEST_CHECK(yy_eval_program(NULL, &aux, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_program(&program, NULL, resolve, NULL).type == YY_TOKEN_ERROR);
+
+        aux.reserved = program.num_regs - 1;
+        TEST_CHECK(equals_token(yy_eval_program(&program, &aux, resolve, NULL), token_error(YY_ERROR_MEM)));
+
+        aux.reserved = sizeof(data_aux)/sizeof(data_aux[0]);
+        TEST_CHECK(equals_token(yy_eval_program(&program, &aux, NULL, NULL), token_error(YY_ERROR_REF)));
+    }
+
+    // corrupted stack
+    {
+        yy_token_t data[] = { token_variable("x", 1), symbol_to_token[YY_SYMBOL_ADDITION_OP] };
+        yy_stack_t stack = {data, 2, 2};
+        yy_instr_t code[8] = {0};
+        yy_program_t program = {code, 8, 0, 0, 0, NULL};
+
+        TEST_CHECK(yy_compile_program(&stack, &program) == YY_ERROR_EVAL);
+    }
+}
+
+void check_boxed(const char *str)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    yy_box_t boxes[64] = {0};
+    yy_boxed_t boxed = {boxes, sizeof(boxes)/sizeof(boxes[0]), 0, NULL};
+    yy_box_t boxes_aux[64] = {0};
+    yy_boxed_t boxed_aux = {boxes_aux, sizeof(boxes_aux)/sizeof(boxes_aux[0]), 0, NULL};
+
+    TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+
+    if (!TEST_CHECK(yy_box_stack(&stack, &boxed) == YY_OK)) {
+        TEST_MSG("Case='%s', error=boxing failed", str);
+        return;
+    }
+
+    TEST_CHECK(boxed.len == stack.len);
+
+    yy_token_t expected = yy_eval_stack(&stack, &aux, resolve, NULL);
+    yy_token_t result = yy_eval_boxed(&boxed, &boxed_aux, resolve, NULL);
+
+    TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=distinct results", str);
+}
+
+void test_eval_boxed(void)
+{
+    TEST_CHECK(sizeof(yy_box_t) == 8);
+
+    check_boxed("$x * 2 + $y * 3");
+    check_boxed("($x + 1) * ($y - 2) / ($z + 3)");
+    check_boxed("$x");
+    check_boxed("1");
+    check_boxed("-$x");
+    check_boxed("sqrt($x * $x + $y * $y)");
+    check_boxed("sqrt(-1) + $x");
+    check_boxed("$x / $a");
+    check_boxed("$x < 1 && $y > 3");
+    check_boxed("$x > 1 || $y > 3");
+    check_boxed("not($m) || $n");
+    check_boxed("$p && $m");
+    check_boxed("$m || $p");
+    check_boxed("ifelse($m, $x + 1, $y - 1)");
+    check_boxed("ifelse($n, $x + 1, $y - 1)");
+    check_boxed("ifelse($p, $x + 1, $y - 1)");
+    check_boxed("ifelse($m, 1, $u)");
+    check_boxed("ifelse($x > 1, ifelse($m, $x, $z), ifelse($n, 2, $y)) * 2");
+    check_boxed("$x * $y + $x * $y");
+    check_boxed("max($x * $y, $z) + min($a, $b)");
+    check_boxed("clamp($y, $a, $b)");
+    check_boxed("$q != $p && length($s) > 5");
+    check_boxed("ifelse($m, $p, \"abc\")");
+    check_boxed("datepart($d, \"year\") + $x");
+    check_boxed("$d + 1000");
+    check_boxed("$u + $w");
+    check_boxed("$w + sqrt($u)");
+    check_boxed("$v * 2");
+    check_boxed("$k + 1");
+    check_boxed("$m == $n");
+
+    // not boxable
+    {
+        const char *str = "upper($p)";
+        yy_token_t data[16] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_box_t boxes[16] = {0};
+        yy_boxed_t boxed = {boxes, sizeof(boxes)/sizeof(boxes[0]), 0, NULL};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_box_stack(&stack, &boxed) == YY_ERROR_VALUE);
+    }
+
+    // invalid arguments
+    {
+        const char *str = "$x * $y + $z";
+        yy_token_t data[16] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_box_t boxes[16] = {0};
+        yy_boxed_t boxed = {boxes, 2, 0, NULL};
+        yy_box_t boxes_aux[16] = {0};
+        yy_boxed_t boxed_aux = {boxes_aux, sizeof(boxes_aux)/sizeof(boxes_aux[0]), 0, NULL};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_box_stack(NULL, &boxed) == YY_ERROR);
+        TEST_CHECK(yy_box_stack(&stack, NULL) == YY_ERROR);
+        TEST_CHECK(yy_box_stack(&stack, &boxed) == YY_ERROR_MEM);
+
+        boxed.reserved = sizeof(boxes)/sizeof(boxes[0]);
+        TEST_CHECK(yy_box_stack(&stack, &boxed) == YY_OK);
+        TEST_CHECK(yy_eval_boxed(NULL, &boxed_aux, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_boxed(&boxed, NULL, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(equals_token(yy_eval_boxed(&boxed, &boxed_aux, NULL, NULL), token_error(YY_ERROR_REF)));
+
+        boxed_aux.reserved = 1;
+        TEST_CHECK(equals_token(yy_eval_boxed(&boxed, &boxed_aux, resolve, NULL), token_error(YY_ERROR_MEM)));
+    }
+}
+
+#ifdef USE_THREADS
+typedef struct cache_job_t
+{
+    yy_cache_t *cache;
+    int num_errors;
+} cache_job_t;
+
+static void * run_cache_job(void *arg)
+{
+    cache_job_t *job = (cache_job_t *) arg;
+    const char *exprs[] = { "$x * 2 + $y", "upper($p) + $q", "$x < $y && $m", "1 +" };
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+
+    for (int i = 0; i < 1000; i++)
+    {
+        const char *str = exprs[i % 4];
+        yy_token_t result = yy_eval_cached(job->cache, str, str + strlen(str), YY_TOKEN_NULL, &stack, resolve, NULL);
+
+        switch (i % 4) {
+            case 0: job->num_errors += !equals_token(result, token_number(0.5 * 2 + M_PI)); break;
+            case 1: job->num_errors += !equals_token(result, token_string("BOBJohn", 7)); break;
+            case 2: job->num_errors += !equals_token(result, token_bool(true)); break;
+            default: job->num_errors += !equals_token(result, token_error(YY_ERROR_SYNTAX)); break;
+        }
+    }
+
+    return NULL;
+}
+#endif
+
+void test_eval_cached(void)
+{
+    const char *exprs[] = {
+        "$x * 2 + $y * 3",
+        "ifelse($m, $x + 1, $y - 1)",
+        "$x < 1 && $y > 3",
+        "upper($p) + \" \" + lower($q)",
+        "length(trim(\"  \" + $p + \"  \")) * 2.5",
+        "upper(\"abc\") + $p",
+        "datepart($d, \"year\") + $x",
+        "$k + 1",
+        "1 + ",
+    };
+    const uint32_t num_exprs = sizeof(exprs)/sizeof(exprs[0]);
+    uint64_t mem[4096] = {0};
+    yy_cache_t cache = {0};
+    yy_cache_stats_t stats = {0};
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    char text[256] = {0};
+    char expected[256] = {0};
+
+    TEST_ASSERT(yy_cache_init(&cache, mem, sizeof(mem), 4, 32, 128) == YY_OK);
+    TEST_CHECK(cache.num_shards == 4);
+    TEST_CHECK(cache.num_entries > 2);
+
+    for (int k = 0; k < 2; k++)
+    {
+        for (uint32_t i = 0; i < num_exprs; i++)
+        {
+            const char *str = exprs[i];
+            yy_token_t result = yy_eval(str, str + strlen(str), &aux, resolve, NULL);
+
+            if (result.type == YY_TOKEN_STRING) {
+                memcpy(expected, result.str_val.ptr, result.str_val.len);
+                result.str_val.ptr = expected;
+            }
+
+            // the text can be discarded after the call
+            strcpy(text, str);
+            yy_token_t cached = yy_eval_cached(&cache, text, text + strlen(text), YY_TOKEN_NULL, &stack, resolve, NULL);
+            memset(text, 'x', strlen(text));
+
+            TEST_CHECK(equals_token(cached, result));
+            TEST_MSG("Case='%s', iteration=%d, error=distinct results", str, k);
+        }
+    }
+
+    yy_cache_stats(&cache, &stats);
+    TEST_CHECK(stats.misses == num_exprs);
+    TEST_CHECK(stats.hits == num_exprs);
+    TEST_CHECK(stats.evictions == 0);
+    TEST_CHECK(stats.num_entries == num_exprs);
+
+    // requested type is part of the key
+    {
+        const char *str = "$x * 2 + $y * 3";
+
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str, str + strlen(str), YY_TOKEN_NUMBER, &stack, resolve, NULL), token_number(0.5 * 2 + M_PI * 3)));
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str, str + strlen(str), YY_TOKEN_STRING, &stack, resolve, NULL), token_error(YY_ERROR_SYNTAX)));
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str, str + strlen(str), YY_TOKEN_STRING, &stack, resolve, NULL), token_error(YY_ERROR_SYNTAX)));
+
+        yy_cache_stats(&cache, &stats);
+        TEST_CHECK(stats.misses == num_exprs + 2);
+        TEST_CHECK(stats.hits == num_exprs + 1);
+    }
+
+    // not cached (too long)
+    {
+        const char *str = "$x + $x + $x + $x + $x + $x + $x + $x + $x + $x + $x + $x + $x + $x + $x + $x + $x";
+
+        for (int i = 0; i < 2; i++)
+            TEST_CHECK(equals_token(yy_eval_cached(&cache, str, str + strlen(str), YY_TOKEN_NULL, &stack, resolve, NULL), token_number(0.5 * 17)));
+
+        yy_cache_stats(&cache, &stats);
+        TEST_CHECK(stats.misses == num_exprs + 4);
+        TEST_CHECK(stats.num_entries == num_exprs + 2);
+    }
+
+    // eviction (one shard with 2 entries)
+    {
+        const char *str1 = "$x + 1";
+        const char *str2 = "$x + 2";
+        const char *str3 = "$x + 3";
+
+        size_t len = 16 + CACHE_ALIGN(sizeof(yy_cache_shard_t)) + 16 + 2 * (CACHE_ALIGN(sizeof(yy_cache_entry_t)) + 2 * sizeof(uint32_t) + 8 * sizeof(yy_token_t) + 32);
+
+        yy_cache_destroy(&cache);
+        TEST_ASSERT(yy_cache_init(&cache, mem, len, 1, 8, 32) == YY_OK);
+        TEST_CHECK(cache.num_entries == 2);
+
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str1, str1 + strlen(str1), YY_TOKEN_NULL, &stack, resolve, NULL), token_number(1.5)));
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str2, str2 + strlen(str2), YY_TOKEN_NULL, &stack, resolve, NULL), token_number(2.5)));
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str1, str1 + strlen(str1), YY_TOKEN_NULL, &stack, resolve, NULL), token_number(1.5)));
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str3, str3 + strlen(str3), YY_TOKEN_NULL, &stack, resolve, NULL), token_number(3.5)));
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str1, str1 + strlen(str1), YY_TOKEN_NULL, &stack, resolve, NULL), token_number(1.5)));
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str2, str2 + strlen(str2), YY_TOKEN_NULL, &stack, resolve, NULL), token_number(2.5)));
+
+        yy_cache_stats(&cache, &stats);
+        TEST_CHECK(stats.hits == 2);
+        TEST_CHECK(stats.misses == 4);
+        TEST_CHECK(stats.evictions == 2);
+        TEST_CHECK(stats.num_entries == 2);
+
+        // too large expressions don't evict entries
+        const char *large[] = {
+            "$x + $x + $x + $x + $x",                       // too many tokens
+            "$x +                                 1",       // too many chars
+            "$x +                                 +",       // too many chars (compilation error)
+        };
+
+        for (uint32_t i = 0; i < sizeof(large)/sizeof(large[0]); i++)
+            yy_eval_cached(&cache, large[i], large[i] + strlen(large[i]), YY_TOKEN_NULL, &stack, resolve, NULL);
+
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str1, str1 + strlen(str1), YY_TOKEN_NULL, &stack, resolve, NULL), token_number(1.5)));
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str2, str2 + strlen(str2), YY_TOKEN_NULL, &stack, resolve, NULL), token_number(2.5)));
+
+        yy_cache_stats(&cache, &stats);
+        TEST_CHECK(stats.hits == 4);
+        TEST_CHECK(stats.misses == 7);
+        TEST_CHECK(stats.evictions == 2);
+        TEST_CHECK(stats.num_entries == 2);
+    }
+
+    // hash index stays consistent with many evictions (one shard with 8 entries)
+    {
+        char text[32] = {0};
+        size_t len = 16 + CACHE_ALIGN(sizeof(yy_cache_shard_t)) + 16 + 8 * (CACHE_ALIGN(sizeof(yy_cache_entry_t)) + 2 * sizeof(uint32_t) + 8 * sizeof(yy_token_t) + 32);
+
+        yy_cache_destroy(&cache);
+        TEST_ASSERT(yy_cache_init(&cache, mem, len, 1, 8, 32) == YY_OK);
+        TEST_CHECK(cache.num_entries == 8);
+
+        for (int i = 0; i < 500; i++)
+        {
+            int k = (i * 7 + i / 13) % 23;
+
+            snprintf(text, sizeof(text), "$a + %d", k);
+            TEST_CHECK(equals_token(yy_eval_cached(&cache, text, text + strlen(text), YY_TOKEN_NULL, &stack, resolve, NULL), token_number(k)));
+            TEST_MSG("Case='%s'", text);
+        }
+
+        yy_cache_shard_t *shard = (yy_cache_shard_t *) cache.shards;
+        uint32_t num_indexed = 0;
+
+        for (uint32_t i = 0; i < 2 * cache.num_entries; i++)
+            num_indexed += (shard->index[i] != CACHE_NONE);
+
+        yy_cache_stats(&cache, &stats);
+        TEST_CHECK(stats.hits + stats.misses == 500);
+        TEST_CHECK(stats.evictions == stats.misses - 8);
+        TEST_CHECK(stats.num_entries == 8);
+        TEST_CHECK(num_indexed == 8);
+
+        for (uint32_t i = 0; i < cache.num_entries; i++) {
+            yy_cache_entry_t *entry = &shard->entries[i];
+            TEST_CHECK(find_entry(&cache, shard, entry->hash, entry->chars, entry->text_len, entry->type) == entry);
+        }
+    }
+
+    // string result outlives the entry
+    {
+        const char *str = "upper(\"abc\") + $p";
+
+        stack.reserved = 8;
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str, str + strlen(str), YY_TOKEN_NULL, &stack, resolve, NULL), token_string("ABCBob", 6)));
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str, str + strlen(str), YY_TOKEN_NULL, &stack, resolve, NULL), token_string("ABCBob", 6)));
+        TEST_CHECK(stack.reserved == 8);
+
+        str = "ifelse($m, \"yes\", \"no\")";
+        TEST_CHECK(equals_token(yy_eval_cached(&cache, str, str + strlen(str), YY_TOKEN_NULL, &stack, resolve, NULL), token_string("yes", 3)));
+        yy_token_t result = yy_eval_cached(&cache, str, str + strlen(str), YY_TOKEN_NULL, &stack, resolve, NULL);
+        TEST_CHECK(equals_token(result, token_string("yes", 3)));
+        TEST_CHECK(result.str_val.ptr == (char *) &data[8] - 3);
+        stack.reserved = sizeof(data)/sizeof(data[0]);
+    }
+
+#ifdef USE_THREADS
+    // concurrent access
+    {
+        pthread_t threads[4];
+        cache_job_t jobs[4] = {0};
+
+        yy_cache_destroy(&cache);
+        TEST_ASSERT(yy_cache_init(&cache, mem, sizeof(mem), 2, 32, 128) == YY_OK);
+
+        for (int i = 0; i < 4; i++) {
+            jobs[i].cache = &cache;
+            TEST_ASSERT(pthread_create(&threads[i], NULL, run_cache_job, &jobs[i]) == 0);
+        }
+
+        for (int i = 0; i < 4; i++) {
+            pthread_join(threads[i], NULL);
+            TEST_CHECK(jobs[i].num_errors == 0);
+        }
+
+        yy_cache_stats(&cache, &stats);
+        TEST_CHECK(stats.hits + stats.misses == 4000);
+        TEST_CHECK(stats.num_entries == 4);
+    }
+#endif
+
+    // invalid arguments
+    {
+        const char *str = "$x + 1";
+        yy_cache_t cache2 = {0};
+
+        TEST_CHECK(yy_cache_init(NULL, mem, sizeof(mem), 1, 32, 64) == YY_ERROR);
+        TEST_CHECK(yy_cache_init(&cache2, NULL, sizeof(mem), 1, 32, 64) == YY_ERROR);
+        TEST_CHECK(yy_cache_init(&cache2, mem, sizeof(mem), 0, 32, 64) == YY_ERROR);
+        TEST_CHECK(yy_cache_init(&cache2, mem, sizeof(mem), 1, 0, 64) == YY_ERROR);
+        TEST_CHECK(yy_cache_init(&cache2, mem, 100, 1, 32, 64) == YY_ERROR_MEM);
+
+        TEST_CHECK(yy_eval_cached(NULL, str, str + strlen(str), YY_TOKEN_NULL, &stack, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_cached(&cache2, str, str + strlen(str), YY_TOKEN_NULL, &stack, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_cached(&cache, NULL, str + strlen(str), YY_TOKEN_NULL, &stack, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_cached(&cache, str, str + strlen(str), YY_TOKEN_ERROR, &stack, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_cached(&cache, str, str + strlen(str), YY_TOKEN_NULL, NULL, resolve, NULL).type == YY_TOKEN_ERROR);
+
+        yy_cache_stats(NULL, &stats);
+        yy_cache_stats(&cache2, &stats);
+        TEST_CHECK(stats.hits == 0 && stats.num_entries == 0);
+        yy_cache_destroy(NULL);
+        yy_cache_destroy(&cache2);
+    }
+
+    yy_cache_destroy(&cache);
+    TEST_CHECK(cache.shards == NULL);
+}
+
+void test_eval_image(void)
+{
+    const char *exprs[] = {
+        "$x * 2 + $y * 3",
+        "ifelse($m, $x + 1, $y - 1)",
+        "$x < 1 && $y > 3",
+        "upper($p) + \" \" + lower($q)",
+        "length(trim(\"  \" + $p + \"  \")) * 2.5",
+        "$x * $y + $x * $y",
+        "datepart($d, \"year\") + $x",
+        "$k + 1",
+        "$u + $w",
+        "1 / max(-0, $a)",
+        "1 / min($a, -0)",
+    };
+    const uint32_t num_exprs = sizeof(exprs)/sizeof(exprs[0]);
+    uint64_t buffer[1024] = {0};
+    uint64_t copy[1024] = {0};
+    yy_image_t image = {(uint8_t *) buffer, sizeof(buffer), 0};
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    yy_token_t expected[16] = {0};
+    char text[256] = {0};
+    uint32_t index = 0;
+    uint32_t num = 0;
+
+    TEST_ASSERT(yy_image_create(&image, num_exprs) == YY_OK);
+
+    for (uint32_t i = 0; i < num_exprs; i++)
+    {
+        strcpy(text, exprs[i]);
+        stack.reserved = sizeof(data)/sizeof(data[0]);
+        TEST_ASSERT(yy_compile(text, text + strlen(text), &stack, NULL) == YY_OK);
+
+        expected[i] = yy_eval_stack(&stack, &aux, resolve, NULL);
+
+        if (expected[i].type == YY_TOKEN_STRING)
+            expected[i] = token_error(YY_ERROR);    // string in aux, compared below
+
+        TEST_CHECK(yy_image_append(&image, &stack, &index) == YY_OK);
+        TEST_CHECK(index == i);
+        TEST_CHECK(image.len % 8 == 0);
+
+        // image doesn't reference the expression text
+        memset(text, 'x', strlen(text));
+    }
+
+    TEST_CHECK(yy_image_append(&image, &stack, &index) == YY_ERROR_MEM);
+
+    // relocated (ex. written to a file and mapped)
+    memcpy(copy, buffer, image.len);
+    memset(buffer, 0x00, sizeof(buffer));
+
+    TEST_CHECK(yy_image_check(copy, image.len, &num) == YY_OK);
+    TEST_CHECK(num == num_exprs);
+
+    for (uint32_t i = 0; i < num_exprs; i++)
+    {
+        yy_token_t result = yy_eval_image(copy, i, &aux, resolve, NULL);
+
+        if (expected[i].type == YY_TOKEN_ERROR && expected[i].error == YY_ERROR) {
+            TEST_CHECK(result.type == YY_TOKEN_STRING);
+            continue;
+        }
+
+        TEST_CHECK(equals_token(result, expected[i]));
+        TEST_MSG("Case='%s', error=distinct results", exprs[i]);
+    }
+
+    TEST_CHECK(equals_token(yy_eval_image(copy, 3, &aux, resolve, NULL), token_string("BOB john", 8)));
+    TEST_CHECK(equals_token(yy_eval_image(copy, num_exprs, &aux, resolve, NULL), token_error(YY_ERROR_REF)));
+
+    // partially filled image
+    {
+        const char *str = "$x * 2 + $y";
+        uint64_t small[64] = {0};
+        yy_image_t image2 = {(uint8_t *) small, 40, 0};
+
+        stack.reserved = sizeof(data)/sizeof(data[0]);
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_image_create(&image2, 4) == YY_OK);
+        TEST_CHECK(yy_image_append(&image2, &stack, NULL) == YY_ERROR_MEM);
+
+        image2.reserved = sizeof(small);
+        TEST_CHECK(yy_image_append(&image2, &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_image_check(small, image2.len, &num) == YY_OK);
+        TEST_CHECK(num == 1);
+        TEST_CHECK(equals_token(yy_eval_image(small, 0, &aux, resolve, NULL), token_number(0.5 * 2 + M_PI)));
+        TEST_CHECK(equals_token(yy_eval_image(small, 1, &aux, resolve, NULL), token_error(YY_ERROR_REF)));
+    }
+
+    // invalid images
+    {
+        yy_image_t image3 = {(uint8_t *) buffer, 16, 0};
+        uint64_t tmp[1024] = {0};
+
+        TEST_CHECK(yy_image_create(NULL, 1) == YY_ERROR);
+        TEST_CHECK(yy_image_create(&image3, 1) == YY_ERROR_MEM);
+        image3.data = (uint8_t *) buffer + 1;
+        image3.reserved = 1024;
+        TEST_CHECK(yy_image_create(&image3, 1) == YY_ERROR);
+        TEST_CHECK(yy_image_append(&image3, &stack, NULL) == YY_ERROR);
+        TEST_CHECK(yy_image_append(NULL, &stack, NULL) == YY_ERROR);
+
+        TEST_CHECK(yy_image_check(NULL, image.len, &num) == YY_ERROR);
+        TEST_CHECK(yy_image_check(copy, image.len, NULL) == YY_ERROR);
+        TEST_CHECK(yy_image_check(copy, image.len - 8, &num) == YY_ERROR_VALUE);
+        TEST_CHECK(yy_image_check((uint8_t *) copy + 4, image.len - 4, &num) == YY_ERROR_VALUE);
+        TEST_CHECK(yy_image_check(buffer, image.len, &num) == YY_ERROR_VALUE);
+        TEST_CHECK(num == 0);
+
+        memcpy(tmp, copy, image.len);
+        ((uint8_t *) tmp)[0] = 'X';
+        TEST_CHECK(yy_image_check(tmp, image.len, &num) == YY_ERROR_VALUE);
+
+        memcpy(tmp, copy, image.len);
+        ((uint8_t *) tmp)[4]++;     // version
+        TEST_CHECK(yy_image_check(tmp, image.len, &num) == YY_ERROR_VALUE);
+
+        TEST_CHECK(yy_eval_image(NULL, 0, &aux, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_image(copy, 0, NULL, resolve, NULL).type == YY_TOKEN_ERROR);
+    }
+}
+
+void check_jit(const char *str, bool native)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    yy_jit_t jit = {0};
+
+    TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+
+#ifdef USE_JIT
+    TEST_CHECK(yy_compile_jit(&stack, &jit, NULL) == (native ? YY_OK : YY_ERROR_VALUE));
+    TEST_MSG("Case='%s', error=unexpected compilation result", str);
+    TEST_CHECK((jit.code != NULL) == native);
+#else
+    UNUSED(native);
+    TEST_CHECK(yy_compile_jit(&stack, &jit, NULL) == YY_ERROR_VALUE);
+#endif
+
+    yy_token_t expected = yy_eval_stack(&stack, &aux, resolve, NULL);
+
+    for (int i = 0; i < 2; i++) {
+        TEST_CHECK(equals_token(yy_eval_jit(&jit, &aux, resolve, NULL), expected));
+        TEST_MSG("Case='%s', error=distinct results", str);
+    }
+
+    yy_free_jit(&jit);
+    TEST_CHECK(jit.code == NULL);
+    TEST_CHECK(equals_token(yy_eval_jit(&jit, &aux, resolve, NULL), expected));
+}
+
+void test_eval_jit(void)
+{
+    check_jit("1 + 2 * $x", true);
+    check_jit("$x * 2 + $y * 3", true);
+    check_jit("($x + 1) * ($y - 2) / ($z + 1)", true);
+    check_jit("$x", true);
+    check_jit("-$x", true);
+    check_jit("+$x", true);
+    check_jit("$x / $a", true);
+    check_jit("$a / $a", true);
+    check_jit("$x < 1 && $y > 3", true);
+    check_jit("$x > 1 || $y >= 3", true);
+    check_jit("$x <= $z || $y == 3 || $a != $b", true);
+    check_jit("$m && $n", true);
+    check_jit("$m || $n", true);
+    check_jit("not($m) || $n", true);
+    check_jit("$m == $n", true);
+    check_jit("$m != $n", true);
+    check_jit("($x > 1) == $n", true);
+    check_jit("ifelse($m, $x + 1, $y - 1)", true);
+    check_jit("ifelse($n, $x + 1, $y - 1)", true);
+    check_jit("ifelse($x > 1, ifelse($m, $x, $z), ifelse($n, 2, $y)) * 2", true);
+    check_jit("ifelse($m, $n, $x)", true);
+    check_jit("$a + ifelse($m, $b, $c) + $x", true);
+    check_jit("$x * $y + $x * $y", true);
+    check_jit("ifelse($m, $x * $y, 1) + $x * $y", true);
+
+    // bail-out to the interpreter
+    check_jit("$p", true);
+    check_jit("$p + 1", true);
+    check_jit("$x + $m", true);
+    check_jit("$u + 1", true);
+    check_jit("$v * 2", true);
+    check_jit("$k + 1", true);
+    check_jit("$p && $m", true);
+    check_jit("ifelse($m, $p, $x)", true);
+
+    // unsupported stacks
+    check_jit("upper($p)", false);
+    check_jit("sqrt($x * $x + $y * $y)", false);
+    check_jit("$x + length($p)", false);
+    check_jit("datepart($d, \"year\") + $x", false);
+
+    // invalid arguments
+    {
+        const char *str = "$x * 2 + $y";
+        yy_token_t data[16] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[16] = {0};
+        yy_stack_t aux = {data_aux, 1, 0};
+        yy_jit_t jit = {0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_compile_jit(NULL, &jit, NULL) == YY_ERROR);
+        TEST_CHECK(yy_compile_jit(&stack, NULL, NULL) == YY_ERROR);
+        TEST_CHECK(yy_eval_jit(NULL, &aux, resolve, NULL).type == YY_TOKEN_ERROR);
+
+#ifdef USE_JIT
+        TEST_CHECK(yy_compile_jit(&stack, &jit, NULL) == YY_OK);
+        TEST_CHECK(jit.max_depth == 2);
+        TEST_CHECK(yy_eval_jit(&jit, NULL, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(equals_token(yy_eval_jit(&jit, &aux, resolve, NULL), token_error(YY_ERROR_MEM)));
+
+        aux.reserved = sizeof(data_aux)/sizeof(data_aux[0]);
+        TEST_CHECK(equals_token(yy_eval_jit(&jit, &aux, resolve, NULL), token_number(0.5 * 2 + M_PI)));
+
+        // evaluated natively (no fallback resolving variables again)
+        int num_calls = 0;
+        TEST_CHECK(equals_token(yy_eval_jit(&jit, &aux, resolve_counting, &num_calls), token_number(0.5 * 2 + M_PI)));
+        TEST_CHECK(num_calls == 2);
+        TEST_CHECK(equals_token(yy_eval_jit(&jit, &aux, NULL, NULL), token_error(YY_ERROR_REF)));
+        yy_free_jit(&jit);
+#endif
+    }
+}
+
+void check_generate_c(const char *str, const char *expected)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    char code[4096] = {0};
+
+    TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+    TEST_CHECK(yy_generate_c(&stack, "rule", code, sizeof(code)) == YY_OK);
+    TEST_MSG("Case='%s', error=generation failed", str);
+    TEST_CHECK(strncmp(code, "static yy_token_t rule(", 23) == 0);
+    TEST_CHECK(strstr(code, expected) != NULL);
+    TEST_MSG("Case='%s', expected='%s', code=\n%s", str, expected, code);
+}
+
+void test_generate_c(void)
+{
+    check_generate_c("1", "    return v[0];\n");
+    check_generate_c("-0.5", "token_number(-0x1p-1)");
+    check_generate_c("$x * 2", "resolve(make_string(\"x\", 1), data)");
+    check_generate_c("$x / 0 < 1", "token_number(0x0p+0)");
+    check_generate_c("sqrt($x)", "   // sqrt\n");
+    check_generate_c("\"a\\\"b\" + $p", "token_string(\"a\\\\\\\"b\", 4)");
+    check_generate_c("\"a\\tb?\" + $p", "token_string(\"a\\\\tb\\077\", 5)");
+    check_generate_c("$m && $n", "if (!v[0].bool_val) goto L4;\n");
+    check_generate_c("$m || $n", "if (v[0].bool_val) goto L4;\n");
+    check_generate_c("ifelse($m, $x, $y)", "    goto L5;\nL4:\n");
+    check_generate_c("$x * $y + $x * $y", "memset(v, 0x00, sizeof(v));\n");
+
+    // invalid arguments
+    {
+        const char *str = "$x * 2 + $y";
+        yy_token_t data[16] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_str_t names[4] = {0};
+        uint32_t num_names = 0;
+        char code[4096] = {0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_generate_c(NULL, "rule", code, sizeof(code)) == YY_ERROR);
+        TEST_CHECK(yy_generate_c(&stack, NULL, code, sizeof(code)) == YY_ERROR);
+        TEST_CHECK(yy_generate_c(&stack, "1rule", code, sizeof(code)) == YY_ERROR);
+        TEST_CHECK(yy_generate_c(&stack, "my-rule", code, sizeof(code)) == YY_ERROR);
+        TEST_CHECK(yy_generate_c(&stack, "rule", NULL, sizeof(code)) == YY_ERROR);
+        TEST_CHECK(yy_generate_c(&stack, "rule", code, 16) == YY_ERROR_MEM);
+        TEST_CHECK(code[0] == 0);
+        TEST_CHECK(yy_generate_c(&stack, "_rule_1", code, sizeof(code)) == YY_OK);
+        TEST_CHECK(code[strlen(code) - 2] == '}');
+
+        TEST_ASSERT(yy_bind_stack(&stack, names, 4, &num_names) == YY_OK);
+        TEST_CHECK(yy_generate_c(&stack, "rule", code, sizeof(code)) == YY_ERROR_VALUE);
+    }
+
+    // rules loading (see examples/aot.c and 'make rules')
+    {
+        yy_rules_t rules = {0};
+
+        TEST_CHECK(yy_load_rules(NULL, &rules) == YY_ERROR);
+        TEST_CHECK(yy_load_rules("librules.so", NULL) == YY_ERROR);
+#ifdef USE_DLOPEN
+        TEST_CHECK(yy_load_rules("/nonexistent/librules.so", &rules) == YY_ERROR_REF);
+#endif
+        TEST_CHECK(rules.handle == NULL && rules.data == NULL && rules.len == 0);
+        TEST_CHECK(yy_find_rule(&rules, "total") == NULL);
+        TEST_CHECK(yy_find_rule(NULL, "total") == NULL);
+        yy_unload_rules(&rules);
+        yy_unload_rules(NULL);
+    }
+}
+
+void check_bytecode(const char *str)
+{
+    char text[256] = {0};
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    uint8_t code[256] = {0};
+    uint64_t consts[16] = {0};
+    char strs[128] = {0};
+    yy_bytecode_t bytecode = {code, consts, strs, sizeof(code), 0, sizeof(consts)/sizeof(consts[0]), 0, sizeof(strs), 0};
+
+    TEST_ASSERT(strlen(str) < sizeof(text));
+    strcpy(text, str);
+
+    TEST_ASSERT(yy_compile(text, text + strlen(text), &stack, NULL) == YY_OK);
+
+    if (!TEST_CHECK(yy_encode_stack(&stack, &bytecode) == YY_OK)) {
+        TEST_MSG("Case='%s', error=encoding failed", str);
+        return;
+    }
+
+    TEST_CHECK(bytecode.code_len < stack.len * sizeof(yy_token_t) / 4);
+    TEST_MSG("Case='%s', tokens=%u, bytes=%u", str, stack.len, bytecode.code_len);
+
+    yy_token_t expected = yy_eval_stack(&stack, &aux, resolve, NULL);
+
+    if (expected.type == YY_TOKEN_STRING) {
+        TEST_CHECK(equals_token(yy_eval_bytecode(&bytecode, &aux, resolve, NULL), expected));
+        TEST_MSG("Case='%s', error=distinct results", str);
+        return;
+    }
+
+    // bytecode doesn't reference the expression text
+    memset(text, 'x', strlen(text));
+
+    yy_token_t result = yy_eval_bytecode(&bytecode, &aux, resolve, NULL);
+
+    TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=distinct results", str);
+}
+
+void test_eval_bytecode(void)
+{
+    check_bytecode("$x * 2 + $y * 3");
+    check_bytecode("($x + 1) * ($y - 2) / ($z + 1)");
+    check_bytecode("$x");
+    check_bytecode("1");
+    check_bytecode("-$x");
+    check_bytecode("sqrt($x * $x + $y * $y)");
+    check_bytecode("1 / max(-0, $a)");
+    check_bytecode("1 / max($a, -0)");
+    check_bytecode("1 / min(-0, $a) < 1 / min($a, -0)");
+    check_bytecode("$x < 1 && $y > 3");
+    check_bytecode("$x > 1 || $y > 3");
+    check_bytecode("$m && $n");
+    check_bytecode("$p && $m");
+    check_bytecode("$m || $p");
+    check_bytecode("ifelse($m, $x + 1, $y - 1)");
+    check_bytecode("ifelse($n, $x + 1, $y - 1)");
+    check_bytecode("ifelse($p, $x + 1, $y - 1)");
+    check_bytecode("ifelse($m, 1, $u)");
+    check_bytecode("ifelse($x > 1, ifelse($m, $x, $z), ifelse($n, 2, $y)) * 2");
+    check_bytecode("$a + ifelse($m, $b, $c) + $x");
+    check_bytecode("$x * $y + $x * $y");
+    check_bytecode("max($x * $y, $z) + min($a, $b)");
+    check_bytecode("clamp($y, $a, $b)");
+    check_bytecode("upper($p) + \" \" + lower($q)");
+    check_bytecode("length(trim(\"  \" + $p + \"  \")) * 2");
+    check_bytecode("$q != $p && length($s) > 5");
+    check_bytecode("ifelse($m, $p, \"abc\") + \"abc\"");
+    check_bytecode("datepart($d, \"year\") + $x");
+    check_bytecode("$u + $w");
+    check_bytecode("$w + sqrt($u)");
+    check_bytecode("$v * 2");
+    check_bytecode("$k + 1");
+    check_bytecode("$m == $n");
+
+    // pools are deduplicated
+    {
+        const char *str = "$x * 2.5 + length(ifelse($m, \"abc\", $p) + \"abc\") * 2.5";
+        yy_token_t data[64] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        uint8_t code[256] = {0};
+        uint64_t consts[16] = {0};
+        char strs[128] = {0};
+        yy_bytecode_t bytecode = {code, consts, strs, sizeof(code), 0, sizeof(consts)/sizeof(consts[0]), 0, sizeof(strs), 0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_encode_stack(&stack, &bytecode) == YY_OK);
+        TEST_CHECK(bytecode.num_consts == 1);
+        TEST_CHECK(bytecode.strs_len == (1 + 1) * 3 + (1 + 3));
+    }
+
+    // invalid arguments
+    {
+        const char *str = "$x * 2 + length(\"abc\")";
+        yy_token_t data[16] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[16] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+        uint8_t code[64] = {0};
+        uint64_t consts[4] = {0};
+        char strs[16] = {0};
+        yy_bytecode_t bytecode = {code, consts, strs, 2, 0, 0, 0, 2, 0};
+
+        TEST_ASSERT(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_encode_stack(NULL, &bytecode) == YY_ERROR);
+        TEST_CHECK(yy_encode_stack(&stack, NULL) == YY_ERROR);
+        TEST_CHECK(yy_encode_stack(&stack, &bytecode) == YY_ERROR_MEM);
+
+        bytecode.code_reserved = sizeof(code);
+        TEST_CHECK(yy_encode_stack(&stack, &bytecode) == YY_ERROR_MEM);
+
+        bytecode.strs_reserved = sizeof(strs);
+        TEST_CHECK(yy_encode_stack(&stack, &bytecode) == YY_ERROR_MEM);
+
+        bytecode.consts_reserved = sizeof(consts)/sizeof(consts[0]);
+        TEST_CHECK(yy_encode_stack(&stack, &bytecode) == YY_OK);
+        TEST_CHECK(yy_eval_bytecode(NULL, &aux, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(yy_eval_bytecode(&bytecode, NULL, resolve, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(equals_token(yy_eval_bytecode(&bytecode, &aux, NULL, NULL), token_error(YY_ERROR_REF)));
+
+        aux.reserved = 1;
+        TEST_CHECK(equals_token(yy_eval_bytecode(&bytecode, &aux, resolve, NULL), token_error(YY_ERROR_MEM)));
+
+        // truncated bytecode
+        aux.reserved = sizeof(data_aux)/sizeof(data_aux[0]);
+        bytecode.code_len--;
+        TEST_CHECK(equals_token(yy_eval_bytecode(&bytecode, &aux, resolve, NULL), token_error(YY_ERROR_EVAL)));
+    }
+}
+
+void check_fast_fail(const char *str, int expected_calls)
+{
+    yy_token_t data[64] = {0};
+    yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+    yy_token_t data_aux[64] = {0};
+    yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+    yy_skip_t skips[64] = {0};
+    int num_calls = 0;
+
+    if (!TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK)) {
+        TEST_MSG("Case='%s', error=compilation failed", str);
+        return;
+    }
+
+    TEST_ASSERT(yy_compute_skips(&stack, skips, sizeof(skips)/sizeof(skips[0])) == YY_OK);
+
+    yy_token_t expected = yy_eval_stack(&stack, &aux, resolve, NULL);
+    yy_token_t result = yy_eval_stack_fast_fail(&stack, &aux, resolve_counting, &num_calls, skips);
+
+    TEST_CHECK(equals_token(result, expected));
+    TEST_MSG("Case='%s', error=distinct results", str);
+
+    TEST_CHECK(num_calls == expected_calls);
+    TEST_MSG("Case='%s', expected=%d, result=%d", str, expected_calls, num_calls);
+}
+
+void test_eval_fast_fail(void)
+{
+    check_fast_fail("$x * $y + $z", 3);
+    check_fast_fail("$k", 1);
+    check_fast_fail("$k + $x * $y", 1);
+    check_fast_fail("sqrt($k * $x + $y * $z) / ($a + $b)", 2);
+    check_fast_fail("$k * 2 > 1 || $m", 1);
+    check_fast_fail("$x < 1 && $k * 2 > $x", 2);
+    check_fast_fail("iserror(2 * $k + $x) && $m", 2);
+    check_fast_fail("ifelse($m, $k + $x, 2) * $y", 4);
+    check_fast_fail("ifelse($k > $x, 1, 2) * $y", 2);
+    check_fast_fail("str(2 * $k + $x)", 1);
+    check_fast_fail("length(upper($p) + $k + lower($q))", 3);
+    check_fast_fail("length(lower($q) + str(2 * $k + $x))", 2);
+    check_fast_fail("$x * $y + $x * $y + $k", 3);
+    check_fast_fail("($k + $x * $y) * ($x * $y)", 3);
+    check_fast_fail("$p * 2 + $x", 1);
+    check_fast_fail("$v + $x", 2);
+    check_fast_fail("$x + $w", 2);
+    check_fast_fail("$k + $w", 2);
+    check_fast_fail("$k + str($v)", 2);
+    check_fast_fail("$k + length(str($m))", 2);
+
+    // skips
+    {
+        yy_token_t data[] = { token_variable("k", 1), token_variable("x", 1), symbol_to_token[YY_SYMBOL_ADDITION_OP], 
+                              token_variable("y", 1), symbol_to_token[YY_SYMBOL_PRODUCT_OP] };
+        yy_stack_t stack = {data, 5, 5};
+        yy_skip_t skips[5] = {0};
+
+        TEST_CHECK(yy_compute_skips(NULL, skips, 5) == YY_ERROR);
+        TEST_CHECK(yy_compute_skips(&stack, NULL, 5) == YY_ERROR);
+        TEST_CHECK(yy_compute_skips(&stack, skips, 4) == YY_ERROR_MEM);
+        TEST_CHECK(yy_compute_skips(&stack, skips, 5) == YY_OK);
+        TEST_CHECK(skips[0].offset == 5 && skips[0].num_values == 0);
+        TEST_CHECK(skips[1].offset == 4 && skips[1].num_values == 1);
+        TEST_CHECK(skips[2].offset == 3 && skips[2].num_values == 0);
+        TEST_CHECK(skips[3].offset == 2 && skips[3].num_values == 1);
+        TEST_CHECK(skips[4].offset == 0);
+
+        yy_token_t data_aux[8] = {0};
+        yy_stack_t aux = {data_aux, 8, 0};
+
+        TEST_CHECK(yy_eval_stack_fast_fail(&stack, &aux, resolve, NULL, NULL).type == YY_TOKEN_ERROR);
+        TEST_CHECK(equals_token(yy_eval_stack_fast_fail(&stack, &aux, resolve, NULL, skips), token_error(YY_ERROR_VALUE)));
+    }
+}
+
+void test_fold_strings(void)
+{
+    const uint32_t F = YY_OPTIMIZE_FOLD_STRINGS;
+
+    // created strings are only folded on request
+    check_fold("upper(\"abc\")", 0, 2, token_string("ABC", 3));
+    check_fold("\"a\\tb\" + \"c\"", 0, 4, token_string("a\tbc", 4));
+    check_fold("length(\"abc\") * 2", 0, 1, token_number(6));
+    check_fold("substr(\"lorem ipsum\", 6, 5) == \"ipsum\"", 0, 1, token_bool(true));
+
+    check_fold("upper(\"abc\")", F, 1, token_string("ABC", 3));
+    check_fold("upper(trim(\"  ab  \")) + lower(\"XyZ\")", F, 1, token_string("ABxyz", 5));
+    check_fold("\"a\\tb\" + \"c\"", F, 1, token_string("a\tbc", 4));
+    check_fold("length(upper(\"abc\")) * 2", F, 1, token_number(6));
+    check_fold("substr(replace(\"lorem ipsum\", \"ipsum\", \"dolor\"), 6, 5) == \"dolor\"", F, 1, token_bool(true));
+    check_fold("str(1) + str(true)", F, 1, token_string("1true", 5));
+    check_fold("\"Hi \" + upper($p)", F, 4, token_string("Hi BOB", 6));
+    check_fold("upper($p) + lower(\"XY\")", F, 4, token_string("BOBxy", 5));
+    check_fold("length(str(now())) > 0", F, 5, token_bool(true));
+
+    // pool is located at the end of the stack memory
+    {
+        const char *str = "upper(\"abc\") + trim(\"  def  \")";
+        yy_token_t data[8] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+
+        TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(stack.reserved == 8);
+        TEST_CHECK(yy_optimize_stack(&stack, F) == YY_OK);
+        TEST_CHECK(stack.len == 1);
+        TEST_CHECK(stack.reserved < 8);
+        TEST_CHECK(data[0].type == YY_TOKEN_STRING);
+        TEST_CHECK(data[0].str_val.ptr >= (char *)(data + stack.reserved));
+        TEST_CHECK(data[0].str_val.len == 6 && strncmp(data[0].str_val.ptr, "ABCdef", 6) == 0);
+    }
+
+    // not enough memory, evaluated at runtime
+    {
+        const char *str = "upper(\"abcdefghijklmnopqrstuvwxyz\")";
+        yy_token_t data[3] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[8] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+
+        TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_optimize_stack(&stack, F) == YY_OK);
+        TEST_CHECK(stack.len == 2);
+        TEST_CHECK(stack.reserved == 3);
+        TEST_CHECK(equals_token(yy_eval_stack(&stack, &aux, resolve, NULL), token_string("ABCDEFGHIJKLMNOPQRSTUVWXYZ", 26)));
+    }
+
+    // stack capacity is kept (including compilation errors)
+    {
+        const char *strs[] = { "upper(\"abc\") + \"def\"", "upper(\"abc\") + " };
+        yy_token_t data[16] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+
+        for (int i = 0; i < 4; i++) {
+            const char *str = strs[i % 2];
+            yy_token_t result = yy_eval_string(str, str + strlen(str), &stack, resolve, NULL);
+            TEST_CHECK(equals_token(result, (i % 2 ? token_error(YY_ERROR_SYNTAX) : token_string("ABCdef", 6))));
+            TEST_CHECK(stack.reserved == 16);
+        }
+    }
+}
+
+void test_eval_batch(void)
+{
+    yy_token_t x[BATCH_ROWS] = {0};
+    yy_token_t y[BATCH_ROWS] = {0};
+    yy_token_t d[BATCH_ROWS] = {0};
+    yy_token_t m[BATCH_ROWS] = {0};
+    yy_token_t s[BATCH_ROWS] = {0};
+    yy_token_t w[BATCH_ROWS] = {0};
+    const char *names[] = {"Bob", "John", "lorem ipsum", ""};
+
+    for (uint32_t i = 0; i < BATCH_ROWS; i++)
+    {
+        x[i] = token_number((double) i / 4.0 - 10.0);
+        y[i] = (i % 7 == 0 ? token_error(YY_ERROR_VALUE) : token_number((double) (i % 13)));
+        d[i] = token_datetime(1725776766211 + i * 3600000ULL);
+        m[i] = token_bool(i % 3 == 0);
+        s[i] = token_string(names[i % 4], (uint32_t) strlen(names[i % 4]));
+        w[i] = (i % 11 == 0 ? token_error(YY_ERROR_CREF) : token_number(i));
+    }
+
+    yy_column_t columns[] = {
+        { {"x", 1}, x },
+        { {"y", 1}, y },
+        { {"d", 1}, d },
+        { {"m", 1}, m },
+        { {"s", 1}, s },
+        { {"w", 1}, w },
+    };
+    uint32_t num_columns = sizeof(columns)/sizeof(columns[0]);
+
+    check_eval_batch("1 + 2", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("$x", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("$x * $x - 2 * $x + 1", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("$x / $y", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("sqrt($x) + abs($y)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("clamp($x, -$y, $y) ^ 2 % 5", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("min($x, $y) < max($x, 3) && not($m)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("ifelse($m, $x, $y)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("ifelse($x < 0, \"neg\", $s)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("iserror($y) || $m", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("dateadd($d, $x, \"day\") > $d", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("datepart($d, \"hour\") + length($s)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("find(\"o\", $s, 0) + $x", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("\"C\" > $s || \"lorem ipsum\" == $s", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("$x + $w", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("$x + $unknown", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("upper($s) + \"-\" + str($x)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("trim(\"  \" + $s + \"  \")", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("length(lower($s)) + $w", columns, num_columns, 20);
+    check_eval_batch("$x * 2", columns, num_columns, 0);
+    check_eval_batch("$x * 2", columns, num_columns, 1);
+    check_eval_batch("abs($x - 1) + ifelse($m, abs($x - 1), $y * 2) + $y * 2", columns, num_columns, BATCH_ROWS);
+    check_eval_batch("length($s + \"!\") * datepart($d, \"hour\") - datepart($d, \"hour\")", columns, num_columns, BATCH_ROWS);
+
+    // bound variables
+    check_eval_batch_slots("$x * $x - 2 * $x + $y", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_slots("ifelse($x < 0, \"neg\", $s)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_slots("$x + $unknown", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_slots("upper($s) + \"-\" + str($x)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_slots("length(lower($s)) + $w", columns, num_columns, 20);
+
+    // string results point to the aux memory
+    {
+        const char *str = "upper($s)";
+        yy_token_t data[16] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[64] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+        yy_token_t results[8] = {0};
+
+        TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_eval_stack_batch(&stack, &aux, columns, num_columns, 8, results) == YY_OK);
+
+        for (uint32_t i = 0; i < 8; i++) {
+            TEST_CHECK(results[i].type == YY_TOKEN_STRING);
+            TEST_CHECK(results[i].str_val.len == s[i].str_val.len);
+            TEST_CHECK(strncasecmp(results[i].str_val.ptr, s[i].str_val.ptr, s[i].str_val.len) == 0);
+        }
+    }
+
+    // not enough memory
+    {
+        const char *str = "$x + ($x + ($x + 1))";
+        yy_token_t data[16] = {0};
+        yy_stack_t stack = {data, sizeof(data)/sizeof(data[0]), 0};
+        yy_token_t data_aux[2] = {0};
+        yy_stack_t aux = {data_aux, sizeof(data_aux)/sizeof(data_aux[0]), 0};
+        yy_token_t results[8] = {0};
+
+        TEST_CHECK(yy_compile(str, str + strlen(str), &stack, NULL) == YY_OK);
+        TEST_CHECK(yy_eval_stack_batch(&stack, &aux, columns, num_columns, 8, results) == YY_ERROR_MEM);
+        TEST_CHECK(yy_eval_stack_batch(NULL, &aux, columns, num_columns, 8, results) == YY_ERROR);
+        TEST_CHECK(yy_eval_stack_batch(&stack, NULL, columns, num_columns, 8, results) == YY_ERROR);
+    }
+}
+
+void test_eval_batch_numeric(void)
+{
+    const double values[] = {0.0, -0.0, 1.0, -1.0, 0.5, 2.5, -3.75, 7.0, 1e300, -1e-300, 
+                             INFINITY, -INFINITY, NAN, -NAN, 3.0, 100.0, M_PI};
+    const uint32_t num_values = sizeof(values)/sizeof(values[0]);
+    yy_token_t x[BATCH_ROWS] = {0};
+    yy_token_t y[BATCH_ROWS] = {0};
+    yy_token_t z[BATCH_ROWS] = {0};
+    yy_token_t m[BATCH_ROWS] = {0};
+
+    for (uint32_t i = 0; i < BATCH_ROWS; i++)
+    {
+        x[i] = token_number(values[i % num_values]);
+        y[i] = token_number(values[(i / num_values + 3 * i) % num_values]);
+        z[i] = token_number(values[(7 * i + 5) % num_values]);
+        m[i] = token_bool(i % 3 != 1);
+
+        // non-numeric values are evaluated by the generic path
+        if (i % 23 == 11) y[i] = token_error(YY_ERROR_VALUE);
+        if (i % 29 == 13) z[i] = token_string("Bob", 3);
+        if (i % 31 == 17) m[i] = token_number(1);
+        if (i % 37 == 19) x[i] = token_error(YY_ERROR_CREF);
+    }
+
+    yy_column_t columns[] = {
+        { {"x", 1}, x },
+        { {"y", 1}, y },
+        { {"z", 1}, z },
+        { {"m", 1}, m },
+    };
+    uint32_t num_columns = sizeof(columns)/sizeof(columns[0]);
+
+    // cases from test_eval_number_ok() and test_eval_bool_ok() using variables
+    check_eval_batch_numeric("$x+$y", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("$x+$y-$z", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("$x*$y/$z", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("-$x+1", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("+$x", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("-($x+($y*3)/4)-$z", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("(min($x,$y)-max($y,$z))*3", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("min($x,$y) + max($x,$y)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("-$x%$y + $x^$z - (pow($y,3))", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("abs(-$x) + sqrt($y)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("sqrt(exp((($x * (-4332.4091)) / ($y - 275715300.8411))))", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("log($x / $y * exp(0)) + sin($z) - cos($x) * tan($y)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("ceil($x) + floor($y) - trunc($z)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("clamp($x, $y, $z)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("clamp($x, -5, 5)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("ifelse($x < $y && $m, $z, $x)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("ifelse(clamp($x, $y, $z) > 0, 1, 2)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("$x < $y || not($x < $y) && $y != $z", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("$x <= $y == ($y >= $z)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("$x == $y || $x > $z", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("($x*$y + 1) / ($x*$y + 2) - ifelse($m, $x*$y + 1, $z)", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("isinf($x) || isnan($y) != $m", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("ifelse($m, $m, not($m))", columns, num_columns, BATCH_ROWS);
+    check_eval_batch_numeric("$x * 2 + 1", columns, num_columns, 3);
+    check_eval_batch_numeric("$x * 2 + 1", columns, num_columns, 1);
+}
+
 void test_recursion(void)
 {
     yy_token_t data[1024] = {0};
@@ -3104,6 +5945,32 @@ TEST_LIST = {
     { "yy_eval_ok",                   test_eval_ok },
     { "yy_eval_ko",                   test_eval_ko },
     { "yy_funcs",                     test_funcs },
+    { "yy_eval_opcodes",              test_eval_opcodes },
+    { "yy_eval_typed_opcodes",        test_eval_typed_opcodes },
+    { "yy_eval_jumps",                test_eval_jumps },
+    { "yy_eval_stack_slots",          test_eval_slots },
+    { "yy_eval_stack_memo",           test_eval_memo },
+    { "yy_eval_cse",                  test_eval_cse },
+    { "yy_optimize_stack",            test_reassociate },
+    { "yy_optimize_stack_algebraic",  test_simplify_algebra },
+    { "fold_strings",                 test_fold_strings },
+    { "yy_partial_eval_stack",        test_partial_eval },
+    { "yy_canonicalize_stack",        test_canonicalize },
+    { "prune_branches",               test_prune_branches },
+    { "yy_eval_stack_range",          test_eval_range },
+    { "yy_narrow_stack",              test_narrow },
+    { "yy_eval_stack_adaptive",       test_eval_adaptive },
+    { "yy_eval_stack_fast_fail",      test_eval_fast_fail },
+    { "fuse_stack",                   test_fuse_stack },
+    { "yy_eval_program",              test_eval_program },
+    { "yy_eval_boxed",                test_eval_boxed },
+    { "yy_eval_bytecode",             test_eval_bytecode },
+    { "yy_eval_cached",               test_eval_cached },
+    { "yy_eval_image",                test_eval_image },
+    { "yy_eval_jit",                  test_eval_jit },
+    { "yy_generate_c",                test_generate_c },
+    { "yy_eval_stack_batch",          test_eval_batch },
+    { "yy_eval_stack_batch_numeric",  test_eval_batch_numeric },
     { "recursion",                    test_recursion },
     { NULL, NULL }
 };